@@ -0,0 +1,101 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs slow jobs (writing files, ...) one after another on a single background
+// thread, in the order they were queued. The thread is started with the first
+// job. Jobs must own everything they use; the destructor waits for all queued
+// jobs to finish.
+class BackgroundWriter
+{
+public:
+  using Job = std::function<void()>;
+
+  BackgroundWriter() = default;
+
+  ~BackgroundWriter()
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    if (thread.joinable())
+      thread.join();
+  }
+
+  BackgroundWriter(const BackgroundWriter&) = delete;
+  BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+  void enqueue(Job job)
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      jobs.push_back(std::move(job));
+      if (!thread.joinable())
+        thread = std::thread([this] { work(); });
+    }
+    changed.notify_all();
+  }
+
+  // Blocks until every job queued so far has finished:
+  void flush()
+  {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    changed.wait(lock, [this] { return jobs.empty() && !busy; });
+  }
+
+private:
+  void work()
+  {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    while (true) {
+      changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+        return; // stopping, and everything has been written
+
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      busy = true;
+      lock.unlock();
+      job();
+      lock.lock();
+      busy = false;
+      changed.notify_all();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<Job> jobs;
+  bool busy = false;
+  bool stopping = false;
+  std::thread thread;
+};
@@ -0,0 +1,161 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "Biquad.h"
+#include <array>
+#include <cmath>
+#include <complex>
+
+namespace {
+// Unnormalised { b0, b1, b2, a0, a1, a2 }. Templated so that the same formulas
+// can be evaluated with complex parameters for complex-step differentiation:
+template<typename T>
+std::array<T, 6> rbj_coefficients(BiquadType type,
+                                  T frequency,
+                                  T q,
+                                  T gainDb,
+                                  double fs)
+{
+  const auto A = std::pow(T(10), gainDb / 40.0);
+  const auto w0 = 2 * M_PI * frequency / fs;
+  const auto cosw0 = std::cos(w0);
+  const auto alpha = std::sin(w0) / (2.0 * q);
+  const auto sqrtAalpha2 = 2.0 * std::sqrt(A) * alpha;
+
+  switch (type) {
+    case BiquadType::peak:
+      return { 1.0 + alpha * A,         -2.0 * cosw0, 1.0 - alpha * A,
+               1.0 + alpha / A,         -2.0 * cosw0, 1.0 - alpha / A };
+    case BiquadType::lowShelf:
+      return { A * ((A + 1.0) - (A - 1.0) * cosw0 + sqrtAalpha2),
+               2.0 * A * ((A - 1.0) - (A + 1.0) * cosw0),
+               A * ((A + 1.0) - (A - 1.0) * cosw0 - sqrtAalpha2),
+               (A + 1.0) + (A - 1.0) * cosw0 + sqrtAalpha2,
+               -2.0 * ((A - 1.0) + (A + 1.0) * cosw0),
+               (A + 1.0) + (A - 1.0) * cosw0 - sqrtAalpha2 };
+    case BiquadType::highShelf:
+    default:
+      return { A * ((A + 1.0) + (A - 1.0) * cosw0 + sqrtAalpha2),
+               -2.0 * A * ((A - 1.0) + (A + 1.0) * cosw0),
+               A * ((A + 1.0) + (A - 1.0) * cosw0 - sqrtAalpha2),
+               (A + 1.0) - (A - 1.0) * cosw0 + sqrtAalpha2,
+               2.0 * ((A - 1.0) - (A + 1.0) * cosw0),
+               (A + 1.0) - (A - 1.0) * cosw0 - sqrtAalpha2 };
+  }
+}
+} // namespace
+
+Biquad make_biquad(const BiquadParameters& parameters, double fs)
+{
+  const auto c = rbj_coefficients(parameters.type,
+                                  parameters.frequency,
+                                  parameters.q,
+                                  parameters.gainDb,
+                                  fs);
+  return { float(c[0] / c[3]),
+           float(c[1] / c[3]),
+           float(c[2] / c[3]),
+           float(c[4] / c[3]),
+           float(c[5] / c[3]) };
+}
+
+void biquad_magnitude_db_with_gradient(
+  const BiquadParameters& parameters,
+  const std::vector<double>& frequencies,
+  double fs,
+  std::vector<double>& db,
+  std::vector<std::array<double, 3>>& gradient)
+{
+  using Complex = std::complex<double>;
+
+  // The coefficients' derivatives with respect to log2(frequency), log2(q)
+  // and gainDb don't depend on the evaluation frequency, so they are computed
+  // once by complex-step differentiation (exact to machine precision):
+  constexpr auto h = 1e-30;
+  const auto x = std::array<double, 3>{ std::log2(parameters.frequency),
+                                        std::log2(parameters.q),
+                                        parameters.gainDb };
+  auto dc = std::array<std::array<double, 6>, 3>();
+  auto c = std::array<double, 6>();
+  for (size_t p = 0; p < 3; ++p) {
+    auto xc = std::array<Complex, 3>{ x[0], x[1], x[2] };
+    xc[p] += Complex(0, h);
+    const auto cc = rbj_coefficients(parameters.type,
+                                     std::pow(Complex(2), xc[0]),
+                                     std::pow(Complex(2), xc[1]),
+                                     xc[2],
+                                     fs);
+    for (size_t i = 0; i < 6; ++i) {
+      c[i] = cc[i].real();
+      dc[p][i] = cc[i].imag() / h;
+    }
+  }
+
+  // dB = 20 log10|B(z)| - 20 log10|A(z)|, and d/dc_i log|P(z)| equals
+  // Re(z^-i / P(z)) for every polynomial coefficient c_i:
+  constexpr auto k = 20 / M_LN10;
+  db.resize(frequencies.size());
+  gradient.resize(frequencies.size());
+  for (size_t n = 0; n < frequencies.size(); ++n) {
+    const auto z1 = std::polar(1.0, -2 * M_PI * frequencies[n] / fs);
+    const auto z2 = z1 * z1;
+    const auto B = c[0] + c[1] * z1 + c[2] * z2;
+    const auto A = c[3] + c[4] * z1 + c[5] * z2;
+    const auto normB = std::norm(B);
+    const auto normA = std::norm(A);
+    db[n] = 0.5 * k * std::log(normB / normA);
+
+    const auto invB = k * std::conj(B) / normB;
+    const auto invA = -k * std::conj(A) / normA;
+    const auto dB = std::array<double, 6>{
+      invB.real(), (z1 * invB).real(), (z2 * invB).real(),
+      invA.real(), (z1 * invA).real(), (z2 * invA).real()
+    };
+    for (size_t p = 0; p < 3; ++p) {
+      gradient[n][p] = 0;
+      for (size_t i = 0; i < 6; ++i)
+        gradient[n][p] += dB[i] * dc[p][i];
+    }
+  }
+}
+
+double biquad_magnitude_db(const Biquad& biquad, double f, double fs)
+{
+  const auto z1 = std::polar(1.0, -2 * M_PI * f / fs); // z^-1
+  const auto z2 = z1 * z1;
+  const auto numerator = double(biquad.b0) + double(biquad.b1) * z1 +
+                         double(biquad.b2) * z2;
+  const auto denominator =
+    1.0 + double(biquad.a1) * z1 + double(biquad.a2) * z2;
+  return 20 * std::log10(std::abs(numerator / denominator));
+}
+
+double cascade_magnitude_db(const std::vector<Biquad>& cascade,
+                            double f,
+                            double fs)
+{
+  auto db = 0.0;
+  for (const auto& biquad : cascade)
+    db += biquad_magnitude_db(biquad, f, fs);
+  return db;
+}
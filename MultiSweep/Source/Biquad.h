@@ -0,0 +1,71 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+// Normalised (a0 = 1) second-order section, in the same coefficient order as
+// juce::dsp::IIR::Coefficients: { b0, b1, b2, a1, a2 }.
+struct Biquad
+{
+  float b0 = 1;
+  float b1 = 0;
+  float b2 = 0;
+  float a1 = 0;
+  float a2 = 0;
+};
+
+enum class BiquadType
+{
+  peak,
+  lowShelf,
+  highShelf
+};
+
+struct BiquadParameters
+{
+  BiquadType type = BiquadType::peak;
+  double frequency = 1000;
+  double q = 0.707;
+  double gainDb = 0;
+};
+
+// Audio EQ Cookbook (R. Bristow-Johnson) designs:
+Biquad make_biquad(const BiquadParameters& parameters, double fs);
+
+// Magnitude response of a single section / a cascade at frequency f:
+double biquad_magnitude_db(const Biquad& biquad, double f, double fs);
+double cascade_magnitude_db(const std::vector<Biquad>& cascade,
+                            double f,
+                            double fs);
+
+// Magnitude response of one section at all given frequencies, together with
+// its analytic gradient with respect to { log2(frequency), log2(q), gainDb }:
+void biquad_magnitude_db_with_gradient(
+  const BiquadParameters& parameters,
+  const std::vector<double>& frequencies,
+  double fs,
+  std::vector<double>& db,
+  std::vector<std::array<double, 3>>& gradient);
@@ -0,0 +1,632 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+#include "BackgroundWriter.h"
+#include "Biquad.h"
+#include "FractionalDelay.h"
+#include "SpscRing.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Room correction of many outputs fed from one input: every output channel is
+// delayed (fractional, see FractionalDelay), scaled and equalised (a cascade
+// of up to maxBands biquads) in one pass. Channels are processed in groups of
+// four SIMD lanes, and up to batchGroups groups at once: their delayed and
+// scaled input is written lane-interleaved into one block that stays in cache
+// for all EQ bands, and the result is written to the outputs once. Filtering
+// the groups of a batch side by side keeps several independent recursions in
+// flight, instead of waiting for the result of each sample.
+//
+// The configuration of all channels is published as one immutable snapshot,
+// so the audio thread never sees a mix of old and new settings (read-copy-
+// update). Changes of delay and gain are ramped. When the EQ of a channel
+// changes, the old and the new filters of its group run in parallel and are
+// crossfaded, the new ones starting from the states of the old ones; other
+// groups keep running undisturbed. The audio thread hands snapshots it no
+// longer uses back through an SpscRing, and they are freed on a background
+// thread, so the audio thread never allocates or frees memory.
+class CorrectionChain
+{
+public:
+  static constexpr size_t lanes = FractionalDelay::lanes;
+  static constexpr size_t maxBands = 20;
+  static constexpr size_t batchGroups = 4;
+
+  struct Channel
+  {
+    float delay = 0; // in samples, limited to the maximum given to prepare()
+    float gain = 1;
+    std::vector<Biquad> equalizer; // bands beyond maxBands are ignored
+  };
+
+  // Per output channel, channels without settings are muted:
+  using Settings = std::vector<std::optional<Channel>>;
+
+  CorrectionChain() = default;
+  CorrectionChain(const CorrectionChain&) = delete;
+  CorrectionChain& operator=(const CorrectionChain&) = delete;
+
+  ~CorrectionChain()
+  {
+    releaser.flush();
+    releaseRetired();
+    delete pending.load();
+    delete current;
+  }
+
+  // Allocates everything, must not be called concurrently with process():
+  void prepare(int newNumChannels, int maxBlockSize, float maxDelayInSamples)
+  {
+    numChannels = size_t(newNumChannels);
+    maxDelay = std::max(0.0f, maxDelayInSamples);
+    length = FractionalDelay::historyLength(maxDelay, maxBlockSize);
+    mask = length - 1;
+    history.assign(length + interpLength, 0.0f);
+    writeIndex = 0;
+
+    blockSize = size_t(maxBlockSize);
+    groups.assign((numChannels + lanes - 1) / lanes, Group{});
+    interleaved.assign(blockSize * stride, 0.0f);
+    fading.assign(blockSize * stride, 0.0f);
+    ramps.assign(numChannels, Ramp{});
+    fadeRemaining = 0;
+
+    // The settings in use (or ones published since) are applied again, without
+    // ramps or crossfade:
+    if (current != nullptr)
+      applySettings(*current, nullptr, false);
+    pullSettings(false);
+  }
+
+  void reset() noexcept
+  {
+    std::fill(history.begin(), history.end(), 0.0f);
+    for (auto& group : groups)
+      for (auto* cascade : { &group.active, &group.previous })
+        for (size_t band = 0; band < maxBands; ++band)
+          cascade->z1[band] = cascade->z2[band] = Lanes::expand(0);
+  }
+
+  // Publishes a new configuration of all channels. Lock-free towards the
+  // audio thread, but there must only be one thread publishing at a time:
+  void setSettings(Settings settings)
+  {
+    published = settings;
+    const auto* skipped = pending.exchange(new Settings(std::move(settings)),
+                                           std::memory_order_acq_rel);
+
+    // Frees the snapshots the audio thread has retired so far, and the one it
+    // didn't pick up before it was replaced:
+    releaser.enqueue([this, skipped] {
+      delete skipped;
+      releaseRetired();
+    });
+  }
+
+  // Publishes a change of a single channel, from the publishing thread like
+  // setSettings(). Only the group of the channel is crossfaded:
+  void setChannel(size_t channel, std::optional<Channel> setting)
+  {
+    auto settings = published;
+    if (settings.size() <= channel)
+      settings.resize(channel + 1);
+    settings[channel] = std::move(setting);
+    setSettings(std::move(settings));
+  }
+
+  // The last published configuration, from the publishing thread only:
+  const Settings& getSettings() const { return published; }
+
+  // Length of the linear ramps to a new delay and gain, 0 jumps immediately:
+  void setRampLength(int numSamples) { rampLength = std::max(0, numSamples); }
+
+  // Length of the crossfade from the old to the new EQ, 0 switches at once:
+  void setCrossfadeLength(int numSamples)
+  {
+    crossfadeLength = std::max(0, numSamples);
+  }
+
+  static constexpr int getLatency() { return FractionalDelay::getLatency(); }
+
+  // The input may be one of the outputs:
+  void process(const float* input,
+               float* const* outputs,
+               int numOutputs,
+               int numSamples) noexcept
+  {
+    assert(size_t(numSamples) <= blockSize);
+    const auto count = size_t(std::clamp(numSamples, 0, int(blockSize)));
+    const auto channelCount =
+      std::min(size_t(std::max(0, numOutputs)), numChannels);
+    if (count == 0)
+      return;
+
+    pullSettings(true);
+
+    const auto first = std::min(count, length - writeIndex);
+    auto* const line = history.data();
+    std::copy(input, input + first, line + writeIndex);
+    std::copy(input + first, input + count, line);
+    std::copy(line, line + interpLength, line + length);
+
+    const auto groupCount = (channelCount + lanes - 1) / lanes;
+    for (size_t firstGroup = 0; firstGroup < groupCount;
+         firstGroup += batchGroups) {
+      const auto batchSize = std::min(batchGroups, groupCount - firstGroup);
+      for (size_t g = 0; g < batchSize; ++g) {
+        const auto firstChannel = (firstGroup + g) * lanes;
+        delayAndScale(firstChannel,
+                      std::min(lanes, channelCount - firstChannel),
+                      g,
+                      count);
+      }
+
+      equalizeAndCrossfade(firstGroup, batchSize, count);
+
+      for (size_t g = 0; g < batchSize; ++g) {
+        const auto firstChannel = (firstGroup + g) * lanes;
+        const auto groupLanes = std::min(lanes, channelCount - firstChannel);
+        for (size_t lane = 0; lane < groupLanes; ++lane) {
+          auto* output = outputs[firstChannel + lane];
+          const auto* source = interleaved.data() + g * lanes + lane;
+          for (size_t i = 0; i < count; ++i)
+            output[i] = source[i * stride];
+        }
+      }
+    }
+
+    writeIndex = (writeIndex + count) & mask;
+    fadeRemaining -= std::min(fadeRemaining, int(count));
+  }
+
+private:
+  // The four channels of a group in the lanes of one register, with the same
+  // arithmetic for the vector and scalar versions:
+  struct Lanes
+  {
+#ifdef MULTISWEEP_SSE2
+    __m128 value;
+
+    static Lanes expand(float x) noexcept { return { _mm_set1_ps(x) }; }
+    static Lanes load(const float* data) noexcept
+    {
+      return { _mm_loadu_ps(data) };
+    }
+    void store(float* data) const noexcept { _mm_storeu_ps(data, value); }
+
+    Lanes operator+(Lanes other) const noexcept
+    {
+      return { _mm_add_ps(value, other.value) };
+    }
+    Lanes operator-(Lanes other) const noexcept
+    {
+      return { _mm_sub_ps(value, other.value) };
+    }
+    Lanes operator*(Lanes other) const noexcept
+    {
+      return { _mm_mul_ps(value, other.value) };
+    }
+#else
+    std::array<float, lanes> value;
+
+    static Lanes expand(float x) noexcept { return { { x, x, x, x } }; }
+    static Lanes load(const float* data) noexcept
+    {
+      return { { data[0], data[1], data[2], data[3] } };
+    }
+    void store(float* data) const noexcept
+    {
+      std::copy(value.cbegin(), value.cend(), data);
+    }
+
+    Lanes operator+(Lanes other) const noexcept
+    {
+      return apply(other, [](float a, float b) { return a + b; });
+    }
+    Lanes operator-(Lanes other) const noexcept
+    {
+      return apply(other, [](float a, float b) { return a - b; });
+    }
+    Lanes operator*(Lanes other) const noexcept
+    {
+      return apply(other, [](float a, float b) { return a * b; });
+    }
+
+    template <typename Operation>
+    Lanes apply(Lanes other, Operation operation) const noexcept
+    {
+      auto result = Lanes{};
+      for (size_t lane = 0; lane < lanes; ++lane)
+        result.value[lane] = operation(value[lane], other.value[lane]);
+      return result;
+    }
+#endif
+
+    void set(size_t lane, float x) noexcept
+    {
+      float values[lanes];
+      store(values);
+      values[lane] = x;
+      *this = load(values);
+    }
+  };
+
+  struct Ramp
+  {
+    float delay = 0;
+    float gain = 1;
+    float targetDelay = 0;
+    float targetGain = 1;
+    float delayIncrement = 0;
+    float gainIncrement = 0;
+    int remaining = 0;
+
+    void advance() noexcept
+    {
+      if (remaining == 0)
+        return;
+      if (--remaining == 0) {
+        delay = targetDelay;
+        gain = targetGain;
+      } else {
+        delay += delayIncrement;
+        gain += gainIncrement;
+      }
+    }
+  };
+
+  struct Cascade
+  {
+    Cascade()
+    {
+      for (size_t band = 0; band < maxBands; ++band) {
+        b0[band] = Lanes::expand(1);
+        b1[band] = b2[band] = a1[band] = a2[band] = Lanes::expand(0);
+        z1[band] = z2[band] = Lanes::expand(0);
+      }
+    }
+
+    std::array<Lanes, maxBands> b0, b1, b2, a1, a2;
+    std::array<Lanes, maxBands> z1, z2;
+    size_t numBands = 0; // highest number of bands of all lanes
+  };
+
+  struct Group
+  {
+    Cascade active;
+    Cascade previous; // fading out after a change
+    bool fading = false; // if the current crossfade includes this group
+  };
+
+  // Floats per sample of the interleaved blocks, four lanes per group:
+  static constexpr size_t stride = batchGroups * lanes;
+
+  // Reads the delayed input of every lane into the position of a group in the
+  // interleaved block:
+  void delayAndScale(size_t firstChannel,
+                     size_t numLanes,
+                     size_t position,
+                     size_t count) noexcept
+  {
+    // Unused lanes read with zero weights and gain:
+    FractionalDelay::Taps taps[lanes];
+    alignas(16) float gains[lanes];
+    auto ramping = false;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      const auto& ramp = ramps[firstChannel + (lane < numLanes ? lane : 0)];
+      taps[lane] = FractionalDelay::locate(ramp.delay);
+      gains[lane] = lane < numLanes ? ramp.gain : 0.0f;
+      ramping = ramping || (lane < numLanes && ramp.remaining > 0);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      if (ramping)
+        for (size_t lane = 0; lane < numLanes; ++lane) {
+          auto& ramp = ramps[firstChannel + lane];
+          ramp.advance();
+          taps[lane] = FractionalDelay::locate(ramp.delay);
+          gains[lane] = ramp.gain;
+        }
+
+      const auto sample = writeIndex + i + length;
+      auto* destination = interleaved.data() + i * stride + position * lanes;
+#ifdef MULTISWEEP_SSE2
+      // See FractionalDelay::processGroup():
+      __m128 products[lanes];
+      for (size_t lane = 0; lane < lanes; ++lane)
+        products[lane] = _mm_mul_ps(
+          _mm_loadu_ps(taps[lane].weights),
+          _mm_loadu_ps(&history[(sample - taps[lane].back) & mask]));
+      _MM_TRANSPOSE4_PS(products[0], products[1], products[2], products[3]);
+      const auto sum = _mm_add_ps(_mm_add_ps(products[0], products[1]),
+                                  _mm_add_ps(products[2], products[3]));
+      _mm_storeu_ps(destination, _mm_mul_ps(sum, _mm_load_ps(gains)));
+#else
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        const auto* x = &history[(sample - taps[lane].back) & mask];
+        const auto* w = taps[lane].weights;
+        destination[lane] =
+          gains[lane] * (w[0] * x[0] + w[1] * x[1] + w[2] * x[2] + w[3] * x[3]);
+      }
+#endif
+    }
+  }
+
+  void equalizeAndCrossfade(size_t first,
+                            size_t batchSize,
+                            size_t count) noexcept
+  {
+    Cascade* active[batchGroups];
+    for (size_t g = 0; g < batchSize; ++g)
+      active[g] = &groups[first + g].active;
+
+    // The old filters run for the whole block, so their output is continuous
+    // if the crossfade ends within it:
+    const auto fadeCount = size_t(std::min(fadeRemaining, int(count)));
+    for (size_t g = 0; g < batchSize && fadeCount > 0; ++g) {
+      auto& group = groups[first + g];
+      if (!group.fading)
+        continue;
+      for (size_t i = 0; i < count; ++i)
+        Lanes::load(&interleaved[i * stride + g * lanes])
+          .store(&fading[i * stride + g * lanes]);
+      auto* previous = &group.previous;
+      equalize<1>(&previous, fading.data() + g * lanes, count);
+    }
+
+    switch (batchSize) {
+      case 1: equalize<1>(active, interleaved.data(), count); break;
+      case 2: equalize<2>(active, interleaved.data(), count); break;
+      case 3: equalize<3>(active, interleaved.data(), count); break;
+      default: equalize<4>(active, interleaved.data(), count); break;
+    }
+
+    const auto step = 1.0f / float(std::max(crossfadeLength, 1));
+    for (size_t g = 0; g < batchSize && fadeCount > 0; ++g) {
+      if (!groups[first + g].fading)
+        continue;
+      auto position = float(crossfadeLength - fadeRemaining) * step;
+      for (size_t i = 0; i < fadeCount; ++i) {
+        position += step;
+        auto* mixed = &interleaved[i * stride + g * lanes];
+        const auto fadeIn = Lanes::expand(position);
+        const auto faded = Lanes::load(&fading[i * stride + g * lanes]);
+        const auto filtered = Lanes::load(mixed);
+        (faded + fadeIn * (filtered - faded)).store(mixed);
+      }
+    }
+  }
+
+  // Band by band over the whole block, so coefficients and states stay in
+  // registers (transposed direct form II). The cascades of numCascades groups
+  // in consecutive positions of the block are run side by side, unrolled so
+  // their states aren't kept in memory:
+  template <size_t numCascades>
+  static void equalize(Cascade* const* cascades,
+                       float* block,
+                       size_t count) noexcept
+  {
+    equalize(cascades, block, count, std::make_index_sequence<numCascades>());
+  }
+
+  template <size_t... c>
+  static void equalize(Cascade* const* cascades,
+                       float* block,
+                       size_t count,
+                       std::index_sequence<c...>) noexcept
+  {
+    constexpr auto numCascades = sizeof...(c);
+    auto numBands = size_t(0);
+    for (size_t cascade = 0; cascade < numCascades; ++cascade)
+      numBands = std::max(numBands, cascades[cascade]->numBands);
+
+    for (size_t band = 0; band < numBands; ++band) {
+      const Lanes b0[] = { cascades[c]->b0[band]... };
+      const Lanes b1[] = { cascades[c]->b1[band]... };
+      const Lanes b2[] = { cascades[c]->b2[band]... };
+      const Lanes a1[] = { cascades[c]->a1[band]... };
+      const Lanes a2[] = { cascades[c]->a2[band]... };
+      Lanes z1[] = { cascades[c]->z1[band]... };
+      Lanes z2[] = { cascades[c]->z2[band]... };
+
+      const auto step = [&](float* samples, size_t cascade) noexcept {
+        const auto x = Lanes::load(samples);
+        const auto y = b0[cascade] * x + z1[cascade];
+        z1[cascade] = b1[cascade] * x - a1[cascade] * y + z2[cascade];
+        z2[cascade] = b2[cascade] * x - a2[cascade] * y;
+        y.store(samples);
+      };
+      for (size_t i = 0; i < count; ++i)
+        (step(block + i * stride + c * lanes, c), ...);
+
+      ((cascades[c]->z1[band] = z1[c]), ...);
+      ((cascades[c]->z2[band] = z2[c]), ...);
+    }
+  }
+
+  // Adopts a new snapshot, if there is one. Only one change is crossfaded at a
+  // time, and the old snapshot must fit into the ring of retired ones:
+  void pullSettings(bool smoothly) noexcept
+  {
+    if (fadeRemaining > 0 || retired.getFreeSpace() == 0)
+      return;
+    const auto* next = pending.exchange(nullptr, std::memory_order_acq_rel);
+    if (next == nullptr)
+      return;
+
+    const auto* previous = current;
+    if (previous != nullptr) {
+      const auto region = retired.prepareWrite(1);
+      retired.channel(0)[region.start1] = previous;
+      retired.finishWrite(1);
+    }
+    current = next;
+    applySettings(*current, previous, smoothly);
+  }
+
+  // Only the EQs of groups with a changed channel are set again (and
+  // crossfaded), all of them without previous settings:
+  void applySettings(const Settings& settings,
+                     const Settings* previous,
+                     bool smoothly) noexcept
+  {
+    const auto crossfade = smoothly && crossfadeLength > 0;
+    auto anyFading = false;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      auto& group = groups[g];
+      auto changed = previous == nullptr;
+      for (size_t lane = 0; lane < lanes && !changed; ++lane) {
+        const auto channel = g * lanes + lane;
+        changed = channel < numChannels &&
+                  !sameEqualizer(getChannel(settings, channel),
+                                 getChannel(*previous, channel));
+      }
+
+      group.fading = crossfade && changed;
+      anyFading = anyFading || group.fading;
+      if (!changed)
+        continue;
+      if (group.fading)
+        group.previous = group.active;
+      group.active.numBands = 0;
+      for (size_t lane = 0; lane < lanes; ++lane)
+        if (g * lanes + lane < numChannels)
+          applyEqualizer(g * lanes + lane,
+                         getChannel(settings, g * lanes + lane).equalizer);
+    }
+
+    for (size_t channel = 0; channel < numChannels; ++channel)
+      applyRamp(ramps[channel], getChannel(settings, channel), smoothly);
+    fadeRemaining = anyFading ? crossfadeLength : 0;
+  }
+
+  // Channels without settings are muted:
+  static const Channel& getChannel(const Settings& settings,
+                                   size_t channel) noexcept
+  {
+    static const auto muted = Channel{ 0.0f, 0.0f, {} };
+    return channel < settings.size() && settings[channel] ? *settings[channel]
+                                                          : muted;
+  }
+
+  static bool sameEqualizer(const Channel& first,
+                            const Channel& second) noexcept
+  {
+    const auto count = std::min(first.equalizer.size(), maxBands);
+    if (count != std::min(second.equalizer.size(), maxBands))
+      return false;
+    for (size_t band = 0; band < count; ++band) {
+      const auto& a = first.equalizer[band];
+      const auto& b = second.equalizer[band];
+      if (a.b0 != b.b0 || a.b1 != b.b1 || a.b2 != b.b2 || a.a1 != b.a1 ||
+          a.a2 != b.a2)
+        return false;
+    }
+    return true;
+  }
+
+  // On the background thread, the only one reading from retired:
+  void releaseRetired()
+  {
+    const auto region = retired.prepareRead(retired.getCapacity());
+    const auto* snapshots = retired.channel(0);
+    for (size_t i = 0; i < region.size1; ++i)
+      delete snapshots[region.start1 + i];
+    for (size_t i = 0; i < region.size2; ++i)
+      delete snapshots[region.start2 + i];
+    retired.finishRead(region.size());
+  }
+
+  // A channel whose delay and gain didn't change keeps its ramp (if any), so
+  // it isn't interpolated anew while other channels are updated:
+  void applyRamp(Ramp& ramp, const Channel& setting, bool smoothly) noexcept
+  {
+    const auto targetDelay = std::clamp(setting.delay, 0.0f, maxDelay);
+    if (smoothly && targetDelay == ramp.targetDelay &&
+        setting.gain == ramp.targetGain)
+      return;
+
+    ramp.targetDelay = targetDelay;
+    ramp.targetGain = setting.gain;
+    if (!smoothly || rampLength == 0) {
+      ramp.delay = ramp.targetDelay;
+      ramp.gain = ramp.targetGain;
+      ramp.remaining = 0;
+      return;
+    }
+
+    ramp.delayIncrement = (ramp.targetDelay - ramp.delay) / float(rampLength);
+    ramp.gainIncrement = (ramp.targetGain - ramp.gain) / float(rampLength);
+    ramp.remaining = rampLength;
+  }
+
+  void applyEqualizer(size_t channel,
+                      const std::vector<Biquad>& equalizer) noexcept
+  {
+    auto& group = groups[channel / lanes].active;
+    const auto lane = channel % lanes;
+    const auto count = std::min(equalizer.size(), maxBands);
+
+    // Unused bands are set to identity, so the lanes of one group can have
+    // different numbers of bands. The states are kept:
+    for (size_t band = 0; band < maxBands; ++band) {
+      const auto biquad = band < count ? equalizer[band] : Biquad();
+      group.b0[band].set(lane, biquad.b0);
+      group.b1[band].set(lane, biquad.b1);
+      group.b2[band].set(lane, biquad.b2);
+      group.a1[band].set(lane, biquad.a1);
+      group.a2[band].set(lane, biquad.a2);
+    }
+    group.numBands = std::max(group.numBands, count);
+  }
+
+  size_t numChannels = 0;
+  float maxDelay = 0;
+  int rampLength = 2048;
+
+  size_t length = 0; // of the circular input history, a power of two
+  size_t mask = 0;
+  size_t writeIndex = 0;
+  std::vector<float> history; // followed by interpLength samples
+
+  size_t blockSize = 0;
+  std::vector<Group> groups;
+  std::vector<float> interleaved; // one block of a batch, lane-interleaved
+  std::vector<Ramp> ramps;        // per channel
+
+  int crossfadeLength = 1024;
+  int fadeRemaining = 0;
+  std::vector<float> fading; // the block through the previous filters
+
+  Settings published; // publishing thread only
+  std::atomic<const Settings*> pending{ nullptr };
+  const Settings* current = nullptr; // audio thread only
+  SpscRing<const Settings*> retired{ 1, 16 };
+  BackgroundWriter releaser; // last, so it stops before the rest goes
+};
@@ -0,0 +1,464 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "DataFiles.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Sample data is written and read in host byte order, all supported platforms
+// are little endian. Header fields are written byte by byte.
+
+namespace {
+using File = std::unique_ptr<std::FILE, int (*)(std::FILE*)>;
+
+File open_for_writing(const std::string& path)
+{
+  return File(std::fopen(path.c_str(), "wb"), std::fclose);
+}
+
+void append_le(std::string& out, uint64_t value, size_t numBytes)
+{
+  for (size_t i = 0; i < numBytes; ++i)
+    out.push_back(char((value >> (8 * i)) & 0xff));
+}
+
+uint64_t read_le(const char* in, size_t numBytes)
+{
+  auto value = uint64_t(0);
+  for (size_t i = 0; i < numBytes; ++i)
+    value |= uint64_t(uint8_t(in[i])) << (8 * i);
+  return value;
+}
+
+size_t max_length(const Channels& channels)
+{
+  auto length = size_t(0);
+  for (const auto& channel : channels)
+    length = std::max(length, channel.size());
+  return length;
+}
+
+// Writes numFrames frames of the channels interleaved, a few thousand at a
+// time:
+bool write_interleaved(std::FILE* file,
+                       const Channels& channels,
+                       size_t numFrames)
+{
+  constexpr auto framesPerChunk = size_t(4096);
+  auto chunk = std::vector<float>(framesPerChunk * channels.size());
+  for (size_t start = 0; start < numFrames; start += framesPerChunk) {
+    const auto count = std::min(framesPerChunk, numFrames - start);
+    for (size_t c = 0; c < channels.size(); ++c) {
+      const auto& channel = channels[c];
+      for (size_t i = 0; i < count; ++i)
+        chunk[i * channels.size() + c] =
+          start + i < channel.size() ? channel[start + i] : 0.0f;
+    }
+    const auto numSamples = count * channels.size();
+    if (std::fwrite(chunk.data(), sizeof(float), numSamples, file) !=
+        numSamples)
+      return false;
+  }
+  return true;
+}
+
+// KSDATAFORMAT_SUBTYPE_IEEE_FLOAT:
+constexpr unsigned char floatSubtype[16] = { 0x03, 0x00, 0x00, 0x00,
+                                             0x00, 0x00, 0x10, 0x00,
+                                             0x80, 0x00, 0x00, 0xaa,
+                                             0x00, 0x38, 0x9b, 0x71 };
+constexpr uint16_t formatFloat = 3;
+constexpr uint16_t formatExtensible = 0xfffe;
+} // namespace
+
+// =============================================================================
+
+bool write_wav(const std::string& path,
+               const Channels& channels,
+               double sampleRate)
+{
+  const auto numChannels = uint64_t(channels.size());
+  const auto numFrames = uint64_t(max_length(channels));
+  const auto dataBytes = numFrames * numChannels * 4;
+  if (numChannels == 0 || numChannels > 0xffff || dataBytes > 0xffffff00)
+    return false;
+
+  // WAVE_FORMAT_EXTENSIBLE with a float subtype, which is what readers expect
+  // for more than two channels. The header is 80 bytes, so the samples are
+  // aligned when the file is mapped:
+  auto header = std::string("RIFF");
+  append_le(header, 72 + dataBytes, 4);
+  header += "WAVEfmt ";
+  append_le(header, 40, 4);
+  append_le(header, formatExtensible, 2);
+  append_le(header, numChannels, 2);
+  append_le(header, uint64_t(std::lround(sampleRate)), 4);
+  append_le(header, uint64_t(std::lround(sampleRate)) * numChannels * 4, 4);
+  append_le(header, numChannels * 4, 2); // block align
+  append_le(header, 32, 2);              // bits per sample
+  append_le(header, 22, 2);              // extension size
+  append_le(header, 32, 2);              // valid bits per sample
+  append_le(header, 0, 4);               // channel mask: unassigned
+  header.append(reinterpret_cast<const char*>(floatSubtype), 16);
+  header += "fact";
+  append_le(header, 4, 4);
+  append_le(header, numFrames, 4);
+  header += "data";
+  append_le(header, dataBytes, 4);
+
+  const auto file = open_for_writing(path);
+  return file &&
+         std::fwrite(header.data(), 1, header.size(), file.get()) ==
+           header.size() &&
+         write_interleaved(file.get(), channels, numFrames);
+}
+
+bool write_npy(const std::string& path,
+               const float* data,
+               const std::vector<size_t>& shape)
+{
+  auto numValues = size_t(1);
+  auto shapeString = std::string("(");
+  for (size_t i = 0; i < shape.size(); ++i) {
+    numValues *= shape[i];
+    shapeString += (i > 0 ? ", " : "") + std::to_string(shape[i]);
+  }
+  shapeString += shape.size() == 1 ? ",)" : ")"; // a tuple, not a number
+
+  // Format version 1.0; magic, version and header length take 10 bytes and
+  // the header is padded with spaces so the data starts at a multiple of 64:
+  auto dictionary = "{'descr': '<f4', 'fortran_order': False, 'shape': " +
+                    shapeString + ", }";
+  const auto paddedLength = (10 + dictionary.size() + 1 + 63) / 64 * 64 - 10;
+  dictionary.resize(paddedLength - 1, ' ');
+  dictionary += '\n';
+  if (dictionary.size() > 0xffff)
+    return false;
+
+  auto header = std::string("\x93NUMPY\x01\x00", 8);
+  append_le(header, dictionary.size(), 2);
+  header += dictionary;
+
+  const auto file = open_for_writing(path);
+  return file &&
+         std::fwrite(header.data(), 1, header.size(), file.get()) ==
+           header.size() &&
+         std::fwrite(data, sizeof(float), numValues, file.get()) == numValues;
+}
+
+bool write_npy(const std::string& path, const Channels& channels)
+{
+  const auto numFrames = max_length(channels);
+  if (std::all_of(channels.cbegin(), channels.cend(), [&](const auto& c) {
+        return c.size() == numFrames;
+      })) {
+    auto data = std::vector<float>();
+    data.reserve(channels.size() * numFrames);
+    for (const auto& channel : channels)
+      data.insert(data.end(), channel.cbegin(), channel.cend());
+    return write_npy(path, data.data(), { channels.size(), numFrames });
+  }
+
+  auto padded = channels;
+  for (auto& channel : padded)
+    channel.resize(numFrames);
+  return write_npy(path, padded);
+}
+
+bool write_csv(const std::string& path,
+               const std::vector<std::string>& header,
+               const Channels& columns,
+               int precision)
+{
+  const auto file = open_for_writing(path);
+  if (!file)
+    return false;
+
+  auto text = std::string();
+  for (size_t i = 0; i < header.size(); ++i)
+    text += (i > 0 ? "," : "") + header[i];
+  if (!header.empty())
+    text += '\n';
+
+  // Rows are formatted into one buffer that is flushed every few kilobytes:
+  constexpr auto flushSize = size_t(1) << 16;
+  const auto numRows = max_length(columns);
+  char number[32];
+  for (size_t row = 0; row < numRows; ++row) {
+    for (size_t c = 0; c < columns.size(); ++c) {
+      if (c > 0)
+        text += ',';
+      if (row < columns[c].size())
+        text.append(number, format_float(number, columns[c][row], precision));
+    }
+    text += '\n';
+
+    if (text.size() >= flushSize) {
+      if (std::fwrite(text.data(), 1, text.size(), file.get()) != text.size())
+        return false;
+      text.clear();
+    }
+  }
+  return std::fwrite(text.data(), 1, text.size(), file.get()) == text.size();
+}
+
+size_t format_float(char* out, float value, int precision)
+{
+  static constexpr double powers[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                       1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16 };
+  precision = std::clamp(precision, 1, 9);
+
+  auto* p = out;
+  if (std::isnan(value)) {
+    std::memcpy(p, "nan", 3);
+    return 3;
+  }
+  if (std::signbit(value))
+    *p++ = '-';
+  auto x = std::abs(double(value));
+  if (std::isinf(x)) {
+    std::memcpy(p, "inf", 3);
+    return size_t(p - out) + 3;
+  }
+  if (x == 0) {
+    *p++ = '0';
+    return size_t(p - out);
+  }
+
+  // Decimal exponent, limited to the range where %g uses fixed notation:
+  auto exponent = 0;
+  if (x >= 1)
+    while (exponent < precision && x >= powers[exponent + 1])
+      ++exponent;
+  else
+    while (exponent > -5 && x < 1 / powers[-exponent])
+      --exponent;
+
+  auto decimals = precision - 1 - exponent;
+  auto scaled = uint64_t(0);
+  if (exponent > -5 && exponent < precision) {
+    scaled = uint64_t(std::llround(x * powers[decimals]));
+    if (scaled >= uint64_t(powers[precision])) { // rounded up, e.g. 9.9999999
+      ++exponent;
+      --decimals;
+      scaled = uint64_t(std::llround(x * powers[std::max(0, decimals)]));
+    }
+  }
+  if (exponent <= -5 || exponent >= precision || decimals < 0) {
+    const auto written =
+      std::snprintf(p, size_t(32 - (p - out)), "%.*g", precision, x);
+    return size_t(p - out) + size_t(std::max(0, written));
+  }
+
+  const auto divisor = uint64_t(powers[decimals]);
+  auto integer = scaled / divisor;
+  auto fraction = scaled % divisor;
+
+  char digits[20];
+  auto numDigits = 0;
+  do {
+    digits[numDigits++] = char('0' + integer % 10);
+    integer /= 10;
+  } while (integer > 0);
+  while (numDigits > 0)
+    *p++ = digits[--numDigits];
+
+  if (fraction > 0) {
+    while (fraction % 10 == 0) { // trailing zeros are dropped
+      fraction /= 10;
+      --decimals;
+    }
+    *p++ = '.';
+    for (auto i = decimals - 1; i >= 0; --i) {
+      p[i] = char('0' + fraction % 10);
+      fraction /= 10;
+    }
+    p += decimals;
+  }
+  return size_t(p - out);
+}
+
+// =============================================================================
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+  const auto file = CreateFileA(path.c_str(),
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                nullptr,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+
+  auto size = LARGE_INTEGER{};
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (handle != nullptr) {
+      bytes = static_cast<const char*>(
+        MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0));
+      numBytes = bytes != nullptr ? size_t(size.QuadPart) : 0;
+    }
+  }
+  CloseHandle(file); // the mapping keeps the file open
+#else
+  const auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    auto* mapping =
+      mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      bytes = static_cast<const char*>(mapping);
+      numBytes = size_t(info.st_size);
+    }
+  }
+  close(fd); // the mapping keeps the file open
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+  if (bytes != nullptr)
+    UnmapViewOfFile(bytes);
+  if (handle != nullptr)
+    CloseHandle(handle);
+#else
+  if (bytes != nullptr)
+    munmap(const_cast<char*>(bytes), numBytes);
+#endif
+}
+
+// =============================================================================
+
+bool read_npy(const MappedFile& file, NpyView& view)
+{
+  const auto* bytes = file.data();
+  const auto size = file.size();
+  if (size < 10 || std::memcmp(bytes, "\x93NUMPY", 6) != 0)
+    return false;
+
+  // Version 1 has a 16 bit header length, versions 2 and 3 a 32 bit one:
+  const auto lengthBytes = bytes[6] == 1 ? size_t(2) : size_t(4);
+  if (size < 8 + lengthBytes)
+    return false;
+  const auto headerLength = size_t(read_le(bytes + 8, lengthBytes));
+  const auto dataOffset = 8 + lengthBytes + headerLength;
+  if (dataOffset > size || dataOffset % alignof(float) != 0)
+    return false;
+
+  const auto header = std::string(bytes + 8 + lengthBytes, headerLength);
+  if (header.find("'<f4'") == std::string::npos ||
+      header.find("'fortran_order': False") == std::string::npos)
+    return false;
+
+  const auto shapeBegin = header.find('(', header.find("'shape'"));
+  const auto shapeEnd = header.find(')', shapeBegin);
+  if (shapeBegin == std::string::npos || shapeEnd == std::string::npos)
+    return false;
+
+  view.shape.clear();
+  auto numValues = size_t(1);
+  auto dimension = size_t(0);
+  auto hasDigits = false;
+  for (auto i = shapeBegin + 1; i <= shapeEnd; ++i) {
+    const auto c = header[i];
+    if (c >= '0' && c <= '9') {
+      dimension = dimension * 10 + size_t(c - '0');
+      hasDigits = true;
+    } else if (hasDigits) {
+      view.shape.push_back(dimension);
+      numValues *= dimension;
+      dimension = 0;
+      hasDigits = false;
+    }
+  }
+
+  if ((size - dataOffset) / sizeof(float) < numValues)
+    return false;
+  view.data = reinterpret_cast<const float*>(bytes + dataOffset);
+  return true;
+}
+
+bool read_wav(const MappedFile& file, WavView& view)
+{
+  const auto* bytes = file.data();
+  const auto size = file.size();
+  if (size < 12 || std::memcmp(bytes, "RIFF", 4) != 0 ||
+      std::memcmp(bytes + 8, "WAVE", 4) != 0)
+    return false;
+
+  auto isFloat = false;
+  for (size_t offset = 12; offset + 8 <= size;) {
+    const auto* chunk = bytes + offset;
+    const auto chunkSize = size_t(read_le(chunk + 4, 4));
+    const auto available = std::min(chunkSize, size - offset - 8);
+
+    if (std::memcmp(chunk, "fmt ", 4) == 0 && available >= 16) {
+      const auto format = read_le(chunk + 8, 2);
+      view.numChannels = size_t(read_le(chunk + 10, 2));
+      view.sampleRate = double(read_le(chunk + 12, 4));
+      const auto bitsPerSample = read_le(chunk + 22, 2);
+      isFloat = bitsPerSample == 32 &&
+                (format == formatFloat ||
+                 (format == formatExtensible && available >= 40 &&
+                  std::memcmp(chunk + 32, floatSubtype, 16) == 0));
+    } else if (std::memcmp(chunk, "data", 4) == 0) {
+      if (!isFloat || view.numChannels == 0)
+        return false;
+      view.data = chunk + 8;
+      view.numFrames = available / (4 * view.numChannels);
+      return true;
+    }
+    offset += 8 + chunkSize + (chunkSize & 1); // chunks are word aligned
+  }
+  return false;
+}
+
+void WavView::copyChannel(size_t channel, float* output) const
+{
+  const auto stride = numChannels * sizeof(float);
+  const auto* sample = data + channel * sizeof(float);
+  for (size_t i = 0; i < numFrames; ++i, sample += stride)
+    std::memcpy(output + i, sample, sizeof(float));
+}
@@ -0,0 +1,99 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Reading and writing of float32 data files: multichannel WAV (IEEE float),
+// NumPy .npy (little endian '<f4', C order) and CSV. Writers return false if
+// the file could not be written.
+using Channels = std::vector<std::vector<float>>;
+
+// Channels of equal length, written interleaved. Shorter channels are padded
+// with zeros:
+bool write_wav(const std::string& path, const Channels&, double sampleRate);
+
+// Row-major array with the given shape; product(shape) floats are read:
+bool write_npy(const std::string& path,
+               const float* data,
+               const std::vector<size_t>& shape);
+// Shape (channels, samples), shorter channels padded with zeros:
+bool write_npy(const std::string& path, const Channels&);
+
+// One column per entry of columns, one row per sample:
+bool write_csv(const std::string& path,
+               const std::vector<std::string>& header,
+               const Channels& columns,
+               int precision = 7);
+
+// Shortest decimal representation with up to precision significant digits,
+// like printf("%.<precision>g") but several times faster for the common range
+// of values. Writes at most 32 characters (no terminating zero) and returns
+// the number of characters written:
+size_t format_float(char* out, float value, int precision = 7);
+
+// Read-only memory mapping of a whole file. Empty if the file could not be
+// opened (or is empty).
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool isOpen() const { return bytes != nullptr; }
+  const char* data() const { return bytes; }
+  size_t size() const { return numBytes; }
+
+private:
+  const char* bytes = nullptr;
+  size_t numBytes = 0;
+  void* handle = nullptr; // file mapping object on Windows
+};
+
+// Views into a MappedFile, valid as long as the mapping is:
+struct NpyView
+{
+  const float* data = nullptr; // row-major
+  std::vector<size_t> shape;
+};
+
+struct WavView
+{
+  const char* data = nullptr; // interleaved float32, not necessarily aligned
+  size_t numChannels = 0;
+  size_t numFrames = 0;
+  double sampleRate = 0;
+
+  // Deinterleaves one channel (numFrames samples) into output:
+  void copyChannel(size_t channel, float* output) const;
+};
+
+// Only float32 data as written above is accepted:
+bool read_npy(const MappedFile&, NpyView&);
+bool read_wav(const MappedFile&, WavView&);
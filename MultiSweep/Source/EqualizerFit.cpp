@@ -0,0 +1,274 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#include "EqualizerFit.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+struct FitProblem
+{
+  const EqualizerFitSettings& settings;
+  std::vector<double> frequencies; // in-band only
+  std::vector<double> desiredDb;   // response the EQ should have
+};
+
+void clamp_band(BiquadParameters& band, const EqualizerFitSettings& settings)
+{
+  band.frequency =
+    std::clamp(band.frequency, settings.lowerFreq, settings.upperFreq);
+  band.q = std::clamp(band.q, settings.minQ, settings.maxQ);
+  band.gainDb =
+    std::clamp(band.gainDb, -settings.maxCutDb, settings.maxBoostDb);
+}
+
+// Sum of squared errors between the EQ and the desired response. If jacobian
+// is given, it is filled row-major (one row per frequency, three columns per
+// band: log2(frequency), log2(q), gainDb):
+double evaluate(const std::vector<BiquadParameters>& bands,
+                const FitProblem& problem,
+                std::vector<double>& residual,
+                std::vector<double>* jacobian)
+{
+  const auto numPoints = problem.frequencies.size();
+  const auto numParameters = 3 * bands.size();
+  residual.assign(numPoints, 0);
+  if (jacobian)
+    jacobian->assign(numPoints * numParameters, 0);
+
+  auto db = std::vector<double>();
+  auto gradient = std::vector<std::array<double, 3>>();
+  for (size_t b = 0; b < bands.size(); ++b) {
+    biquad_magnitude_db_with_gradient(
+      bands[b], problem.frequencies, problem.settings.fs, db, gradient);
+    for (size_t n = 0; n < numPoints; ++n) {
+      residual[n] += db[n];
+      if (jacobian)
+        std::copy(gradient[n].cbegin(),
+                  gradient[n].cend(),
+                  jacobian->begin() + long(n * numParameters + 3 * b));
+    }
+  }
+
+  auto cost = 0.0;
+  for (size_t n = 0; n < numPoints; ++n) {
+    residual[n] -= problem.desiredDb[n];
+    cost += residual[n] * residual[n];
+  }
+  return cost;
+}
+
+// Gaussian elimination with partial pivoting, solves A x = b in place (the
+// solution ends up in b):
+bool solve(std::vector<double>& A, std::vector<double>& b)
+{
+  const auto n = b.size();
+  for (size_t col = 0; col < n; ++col) {
+    auto pivot = col;
+    for (auto row = col + 1; row < n; ++row)
+      if (std::abs(A[row * n + col]) > std::abs(A[pivot * n + col]))
+        pivot = row;
+    if (std::abs(A[pivot * n + col]) < 1e-300)
+      return false;
+    if (pivot != col) {
+      for (size_t i = 0; i < n; ++i)
+        std::swap(A[col * n + i], A[pivot * n + i]);
+      std::swap(b[col], b[pivot]);
+    }
+    for (auto row = col + 1; row < n; ++row) {
+      const auto factor = A[row * n + col] / A[col * n + col];
+      for (auto i = col; i < n; ++i)
+        A[row * n + i] -= factor * A[col * n + i];
+      b[row] -= factor * b[col];
+    }
+  }
+  for (auto col = n; col-- > 0;) {
+    for (auto i = col + 1; i < n; ++i)
+      b[col] -= A[col * n + i] * b[i];
+    b[col] /= A[col * n + col];
+  }
+  return true;
+}
+
+std::vector<BiquadParameters> initial_bands(const FitProblem& problem)
+{
+  const auto& settings = problem.settings;
+  auto bands = std::vector<BiquadParameters>();
+
+  // Shelves start flat, their gain is found by the optimizer:
+  if (settings.useShelves && settings.numBands >= 2) {
+    bands.push_back(
+      { BiquadType::lowShelf, settings.lowerFreq * 4, 0.707, 0 });
+    bands.push_back(
+      { BiquadType::highShelf, settings.upperFreq / 4, 0.707, 0 });
+  }
+
+  // Peaks are placed one by one at the largest remaining error:
+  auto residual = std::vector<double>();
+  while (bands.size() < settings.numBands) {
+    evaluate(bands, problem, residual, nullptr);
+    const auto worst = size_t(std::distance(
+      residual.cbegin(),
+      std::max_element(
+        residual.cbegin(), residual.cend(), [](auto a, auto b) {
+          return std::abs(a) < std::abs(b);
+        })));
+
+    auto band = BiquadParameters{ BiquadType::peak,
+                                  problem.frequencies[worst],
+                                  2.0,
+                                  -residual[worst] };
+    clamp_band(band, settings);
+    bands.push_back(band);
+  }
+
+  for (auto& band : bands)
+    clamp_band(band, settings);
+  return bands;
+}
+
+std::vector<BiquadParameters> apply_step(std::vector<BiquadParameters> bands,
+                                         const std::vector<double>& step,
+                                         const EqualizerFitSettings& settings)
+{
+  for (size_t b = 0; b < bands.size(); ++b) {
+    bands[b].frequency *= std::exp2(step[3 * b]);
+    bands[b].q *= std::exp2(step[3 * b + 1]);
+    bands[b].gainDb += step[3 * b + 2];
+    clamp_band(bands[b], settings);
+  }
+  return bands;
+}
+} // namespace
+
+EqualizerFitResult fit_equalizer(const std::vector<float>& measuredDb,
+                                 const std::vector<float>& frequencies,
+                                 const std::vector<TargetPoint>& target,
+                                 const EqualizerFitSettings& settings)
+{
+  auto problem = FitProblem{ settings, {}, {} };
+  for (size_t n = 0; n < std::min(measuredDb.size(), frequencies.size()); ++n)
+    if (frequencies[n] >= settings.lowerFreq &&
+        frequencies[n] <= settings.upperFreq) {
+      problem.frequencies.push_back(frequencies[n]);
+      problem.desiredDb.push_back(target_db(target, frequencies[n]) -
+                                  measuredDb[n]);
+    }
+
+  auto result = EqualizerFitResult{};
+  if (problem.frequencies.empty() || settings.numBands == 0)
+    return result;
+
+  // Remove the broadband offset:
+  const auto offset = std::accumulate(problem.desiredDb.cbegin(),
+                                      problem.desiredDb.cend(),
+                                      0.0) /
+                      double(problem.desiredDb.size());
+  for (auto& db : problem.desiredDb)
+    db -= offset;
+
+  auto bands = initial_bands(problem);
+
+  // Levenberg-Marquardt: (J'J + lambda diag(J'J)) step = -J'r
+  const auto numPoints = problem.frequencies.size();
+  const auto numParameters = 3 * bands.size();
+  auto residual = std::vector<double>();
+  auto jacobian = std::vector<double>();
+  auto normal = std::vector<double>(numParameters * numParameters);
+  auto gradient = std::vector<double>(numParameters);
+  auto lambda = 1e-2;
+  auto cost = evaluate(bands, problem, residual, &jacobian);
+
+  for (size_t iteration = 0; iteration < settings.maxIterations; ++iteration) {
+    std::fill(normal.begin(), normal.end(), 0);
+    std::fill(gradient.begin(), gradient.end(), 0);
+    for (size_t n = 0; n < numPoints; ++n) {
+      const auto* row = &jacobian[n * numParameters];
+      for (size_t i = 0; i < numParameters; ++i) {
+        gradient[i] += row[i] * residual[n];
+        for (auto j = i; j < numParameters; ++j)
+          normal[i * numParameters + j] += row[i] * row[j];
+      }
+    }
+    for (size_t i = 0; i < numParameters; ++i)
+      for (size_t j = 0; j < i; ++j)
+        normal[i * numParameters + j] = normal[j * numParameters + i];
+
+    auto accepted = false;
+    auto candidateResidual = std::vector<double>();
+    for (int attempt = 0; attempt < 10 && !accepted; ++attempt) {
+      auto A = normal;
+      for (size_t i = 0; i < numParameters; ++i)
+        A[i * numParameters + i] +=
+          lambda * (normal[i * numParameters + i] + 1e-6);
+      auto step = gradient;
+      for (auto& x : step)
+        x = -x;
+      if (!solve(A, step)) {
+        lambda *= 4;
+        continue;
+      }
+
+      const auto candidate = apply_step(bands, step, settings);
+      const auto candidateCost =
+        evaluate(candidate, problem, candidateResidual, nullptr);
+      if (candidateCost < cost) {
+        accepted = true;
+        const auto improvement = (cost - candidateCost) / cost;
+        bands = candidate;
+        cost = evaluate(bands, problem, residual, &jacobian);
+        lambda = std::max(lambda / 3, 1e-9);
+        if (improvement < 1e-6)
+          iteration = settings.maxIterations; // converged
+      } else {
+        lambda *= 4;
+      }
+    }
+    if (!accepted)
+      break;
+  }
+
+  result.bands = bands;
+  for (const auto& band : bands)
+    result.coefficients.push_back(make_biquad(band, settings.fs));
+  result.rmsErrorDb = std::sqrt(cost / double(numPoints));
+  return result;
+}
+
+std::vector<EqualizerFitResult> fit_equalizers(
+  const std::vector<std::vector<float>>& measuredDb,
+  const std::vector<float>& frequencies,
+  const std::vector<TargetPoint>& target,
+  const EqualizerFitSettings& settings,
+  unsigned numThreads)
+{
+  auto results = std::vector<EqualizerFitResult>(measuredDb.size());
+  parallel_for(
+    measuredDb.size(),
+    [&](size_t i) {
+      results[i] = fit_equalizer(measuredDb[i], frequencies, target, settings);
+    },
+    numThreads);
+  return results;
+}
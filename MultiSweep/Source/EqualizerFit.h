@@ -0,0 +1,74 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include "Biquad.h"
+#include "FilterDesign.h"
+#include <vector>
+
+struct EqualizerFitSettings
+{
+  double fs = 48000;
+  size_t numBands = 16;
+
+  // Frequency range that is fitted (and where bands may be placed):
+  double lowerFreq = 20;
+  double upperFreq = 20e3;
+
+  // Use the first and last band as low and high shelf:
+  bool useShelves = true;
+
+  double maxBoostDb = 6;
+  double maxCutDb = 18;
+  double minQ = 0.3;
+  double maxQ = 10;
+
+  size_t maxIterations = 100;
+};
+
+struct EqualizerFitResult
+{
+  std::vector<BiquadParameters> bands;
+  std::vector<Biquad> coefficients; // ready for CorrectionChain
+  double rmsErrorDb = 0;            // remaining in-band error
+};
+
+// Fits a cascade of peak/shelf filters so that measuredDb + EQ follows the
+// target (up to a broadband offset, which is not the EQ's job). measuredDb is
+// evaluated at the given frequencies, e.g. the log-spaced grid from
+// dft_log_bins(). Bands are placed greedily at the largest remaining error and
+// then refined jointly with Levenberg-Marquardt, using analytic gradients of
+// the biquad magnitude responses.
+EqualizerFitResult fit_equalizer(const std::vector<float>& measuredDb,
+                                 const std::vector<float>& frequencies,
+                                 const std::vector<TargetPoint>& target,
+                                 const EqualizerFitSettings& settings);
+
+// Fits all channels in parallel:
+std::vector<EqualizerFitResult> fit_equalizers(
+  const std::vector<std::vector<float>>& measuredDb,
+  const std::vector<float>& frequencies,
+  const std::vector<TargetPoint>& target,
+  const EqualizerFitSettings& settings,
+  unsigned numThreads = 0);
@@ -0,0 +1,320 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "FilterBank.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <utility>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MULTISWEEP_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MULTISWEEP_SSE2 1
+#endif
+
+namespace {
+constexpr auto sectionsPerBand = size_t(3);
+
+double bands_per_octave(BandResolution resolution)
+{
+  return resolution == BandResolution::octave ? 1 : 3;
+}
+
+// Band edges are the center times G^(+-1 / 2b), with G = 10^(3/10):
+double band_edge_ratio(BandResolution resolution)
+{
+  return std::pow(10.0, 0.3 / (2 * bands_per_octave(resolution)));
+}
+
+// Neighbouring bands in the lanes of one register, with the same arithmetic
+// for the vector and scalar versions:
+#if defined(MULTISWEEP_AVX)
+using Lanes = __m256d;
+constexpr auto laneWidth = size_t(4);
+Lanes load(const double* data) { return _mm256_loadu_pd(data); }
+void store(double* data, Lanes value) { _mm256_storeu_pd(data, value); }
+Lanes broadcast(double value) { return _mm256_set1_pd(value); }
+Lanes add(Lanes a, Lanes b) { return _mm256_add_pd(a, b); }
+Lanes subtract(Lanes a, Lanes b) { return _mm256_sub_pd(a, b); }
+Lanes multiply(Lanes a, Lanes b) { return _mm256_mul_pd(a, b); }
+#elif defined(MULTISWEEP_SSE2)
+using Lanes = __m128d;
+constexpr auto laneWidth = size_t(2);
+Lanes load(const double* data) { return _mm_loadu_pd(data); }
+void store(double* data, Lanes value) { _mm_storeu_pd(data, value); }
+Lanes broadcast(double value) { return _mm_set1_pd(value); }
+Lanes add(Lanes a, Lanes b) { return _mm_add_pd(a, b); }
+Lanes subtract(Lanes a, Lanes b) { return _mm_sub_pd(a, b); }
+Lanes multiply(Lanes a, Lanes b) { return _mm_mul_pd(a, b); }
+#else
+using Lanes = double;
+constexpr auto laneWidth = size_t(1);
+Lanes load(const double* data) { return *data; }
+void store(double* data, Lanes value) { *data = value; }
+Lanes broadcast(double value) { return value; }
+Lanes add(Lanes a, Lanes b) { return a + b; }
+Lanes subtract(Lanes a, Lanes b) { return a - b; }
+Lanes multiply(Lanes a, Lanes b) { return a * b; }
+#endif
+
+// A group spans several registers, so their independent recursions hide each
+// other's latency:
+constexpr auto registersPerGroup = size_t(2);
+constexpr auto bandsPerGroup = laneWidth * registersPerGroup;
+constexpr auto blockSize = size_t(256);
+constexpr auto coefficientsPerSection = size_t(3); // gain, -a1, -a2
+constexpr auto statesPerSection = size_t(2);
+
+// All sections of one group over a block of lane-interleaved samples, in
+// place (transposed direct form II). With broadcastInput, the input of every
+// lane is the same sample of input instead. The index sequence enumerates
+// section * registersPerGroup + register, which unrolls everything so states
+// stay in registers, and the sections' independent recursions overlap:
+template<bool broadcastInput, size_t... j>
+void filter_group(const double* coefficients,
+                  double* states,
+                  const float* input,
+                  double* block,
+                  size_t numSamples,
+                  std::index_sequence<j...>)
+{
+  constexpr auto c = coefficientsPerSection * bandsPerGroup;
+  constexpr auto z = statesPerSection * bandsPerGroup;
+  constexpr auto R = registersPerGroup;
+  const Lanes gain[] = { load(coefficients + j / R * c + j % R * laneWidth)... };
+  const Lanes a1[] = { load(coefficients + j / R * c + bandsPerGroup +
+                            j % R * laneWidth)... };
+  const Lanes a2[] = { load(coefficients + j / R * c + 2 * bandsPerGroup +
+                            j % R * laneWidth)... };
+  Lanes z1[] = { load(states + j / R * z + j % R * laneWidth)... };
+  Lanes z2[] = { load(states + j / R * z + bandsPerGroup +
+                      j % R * laneWidth)... };
+
+  for (size_t i = 0; i < numSamples; ++i) {
+    auto* samples = block + i * bandsPerGroup;
+    Lanes values[R];
+    const auto step = [&](size_t k) {
+      const auto lanes = k % R * laneWidth;
+      if (k < R) {
+        if constexpr (broadcastInput)
+          values[k] = broadcast(double(input[i]));
+        else
+          values[k] = load(samples + lanes);
+      }
+      const auto x = multiply(gain[k], values[k % R]);
+      const auto y = add(x, z1[k]);
+      z1[k] = add(z2[k], multiply(a1[k], y));
+      z2[k] = subtract(multiply(a2[k], y), x);
+      values[k % R] = y;
+      if (k >= R * (sectionsPerBand - 1))
+        store(samples + lanes, y);
+    };
+    (step(j), ...);
+  }
+
+  (store(states + j / R * z + j % R * laneWidth, z1[j]), ...);
+  (store(states + j / R * z + bandsPerGroup + j % R * laneWidth, z2[j]), ...);
+}
+
+template<bool broadcastInput>
+void filter_group(const double* coefficients,
+                  double* states,
+                  const float* input,
+                  double* block,
+                  size_t numSamples)
+{
+  filter_group<broadcastInput>(
+    coefficients,
+    states,
+    input,
+    block,
+    numSamples,
+    std::make_index_sequence<sectionsPerBand * registersPerGroup>());
+}
+} // namespace
+
+std::vector<double> band_center_frequencies(
+  const FilterBankSettings& settings,
+  double fs)
+{
+  const auto bandsPerOctave = bands_per_octave(settings.resolution);
+  const auto edge = band_edge_ratio(settings.resolution);
+
+  // Index x counts bands from 1 kHz: fm = 1000 * G^(x / b). The tolerance
+  // keeps nominal limits like 20 Hz (19.95 Hz exact) inside the range:
+  const auto toIndex = [&](double frequency) {
+    return std::log10(frequency / 1000) / 0.3 * bandsPerOctave;
+  };
+  auto centers = std::vector<double>();
+  for (auto x = int(std::ceil(toIndex(settings.lowestFrequency) - 0.1));
+       x <= int(std::floor(toIndex(settings.highestFrequency) + 0.1));
+       ++x) {
+    const auto center = 1000 * std::pow(10.0, 0.3 * x / bandsPerOctave);
+    if (center * edge < fs / 2)
+      centers.push_back(center);
+  }
+  return centers;
+}
+
+std::array<BandPassSection, 3> design_band_pass(double centerFrequency,
+                                                BandResolution resolution,
+                                                double fs)
+{
+  // Prewarped band edges, analog center and bandwidth:
+  const auto edge = band_edge_ratio(resolution);
+  const auto warp = [fs](double f) { return 2 * fs * std::tan(M_PI * f / fs); };
+  const auto lower = warp(centerFrequency / edge);
+  const auto upper = warp(std::min(centerFrequency * edge, 0.49 * fs));
+  const auto center = std::sqrt(lower * upper);
+  const auto bandwidth = upper - lower;
+
+  // Every pole p of the third-order Butterworth low pass becomes the two roots
+  // of s^2 - p B s + w0^2 (low pass to band pass transform). Of the six band
+  // pass poles, the three with positive imaginary part define the sections:
+  using Complex = std::complex<double>;
+  auto poles = std::vector<Complex>();
+  for (int k = 0; k < 3; ++k) {
+    const auto p = std::polar(1.0, M_PI * (2 * k + 4) / 6);
+    const auto root = std::sqrt(p * p * bandwidth * bandwidth -
+                                4 * center * center);
+    for (const auto pole : { (p * bandwidth + root) / 2.0,
+                             (p * bandwidth - root) / 2.0 })
+      if (pole.imag() > 0)
+        poles.push_back(pole);
+  }
+
+  auto sections = std::array<BandPassSection, 3>();
+  const auto z = std::polar(1.0, 2 * M_PI * centerFrequency / fs);
+  auto response = Complex(1);
+  for (size_t s = 0; s < sections.size(); ++s) {
+    const auto pole = (2 * fs + poles[s]) / (2 * fs - poles[s]); // bilinear
+    sections[s] = { 1, -2 * pole.real(), std::norm(pole) };
+    response *= (1.0 - 1.0 / (z * z)) /
+                (1.0 + sections[s].a1 / z + sections[s].a2 / (z * z));
+  }
+
+  // Unity gain at the center frequency, spread evenly over the sections:
+  const auto gain = std::cbrt(1 / std::abs(response));
+  for (auto& section : sections)
+    section.gain = gain;
+  return sections;
+}
+
+FilterBank::FilterBank(const FilterBankSettings& settings, double fs)
+  : centers(band_center_frequencies(settings, fs))
+  , numGroups((centers.size() + bandsPerGroup - 1) / bandsPerGroup)
+  , coefficients(numGroups * sectionsPerBand * coefficientsPerSection *
+                 bandsPerGroup)
+  , states(numGroups * sectionsPerBand * statesPerSection * bandsPerGroup)
+  , block(blockSize * bandsPerGroup)
+{
+  for (size_t band = 0; band < centers.size(); ++band) {
+    const auto sections =
+      design_band_pass(centers[band], settings.resolution, fs);
+    const auto group = band / bandsPerGroup;
+    const auto lane = band % bandsPerGroup;
+    for (size_t s = 0; s < sectionsPerBand; ++s) {
+      auto* c = coefficients.data() +
+                ((group * sectionsPerBand + s) * coefficientsPerSection) *
+                  bandsPerGroup;
+      c[lane] = sections[s].gain;
+      c[bandsPerGroup + lane] = -sections[s].a1;
+      c[2 * bandsPerGroup + lane] = -sections[s].a2;
+    }
+  }
+}
+
+void FilterBank::reset()
+{
+  std::fill(states.begin(), states.end(), 0.0);
+}
+
+void FilterBank::process(const float* input,
+                         float* const* outputs,
+                         size_t numSamples)
+{
+  for (size_t group = 0; group < numGroups; ++group)
+    processGroup(group, input, outputs, numSamples, false);
+}
+
+void FilterBank::processZeroPhase(const float* input,
+                                  float* const* outputs,
+                                  size_t numSamples)
+{
+  // Group by group, so the backward pass finds the forward pass's output
+  // still in the cache:
+  const auto groupStates = sectionsPerBand * statesPerSection * bandsPerGroup;
+  for (size_t group = 0; group < numGroups; ++group) {
+    const auto first = states.begin() + long(group * groupStates);
+    std::fill(first, first + long(groupStates), 0.0);
+    processGroup(group, input, outputs, numSamples, false);
+    std::fill(first, first + long(groupStates), 0.0);
+    processGroup(group, nullptr, outputs, numSamples, true);
+    std::fill(first, first + long(groupStates), 0.0);
+  }
+}
+
+void FilterBank::processGroup(size_t group,
+                              const float* input,
+                              float* const* outputs,
+                              size_t numSamples,
+                              bool backwards)
+{
+  const auto firstBand = group * bandsPerGroup;
+  const auto numLanes = std::min(bandsPerGroup, centers.size() - firstBand);
+  const auto* c = coefficients.data() + group * sectionsPerBand *
+                                         coefficientsPerSection * bandsPerGroup;
+  auto* z =
+    states.data() + group * sectionsPerBand * statesPerSection * bandsPerGroup;
+
+  for (size_t start = 0; start < numSamples; start += blockSize) {
+    const auto count = std::min(blockSize, numSamples - start);
+
+    // Backwards, every lane filters (the time-reversed) output of the forward
+    // pass of its own band, block by block from the end:
+    const auto offset = backwards ? numSamples - start - count : start;
+    if (backwards) {
+      for (size_t lane = 0; lane < numLanes; ++lane) {
+        const auto* band = outputs[firstBand + lane] + offset + count - 1;
+        for (size_t i = 0; i < count; ++i)
+          block[i * bandsPerGroup + lane] = double(*(band - i));
+      }
+      filter_group<false>(c, z, nullptr, block.data(), count);
+    } else {
+      filter_group<true>(c, z, input + start, block.data(), count);
+    }
+
+    for (size_t lane = 0; lane < numLanes; ++lane) {
+      auto* band = outputs[firstBand + lane] + offset;
+      if (backwards)
+        for (size_t i = 0; i < count; ++i)
+          band[count - 1 - i] = float(block[i * bandsPerGroup + lane]);
+      else
+        for (size_t i = 0; i < count; ++i)
+          band[i] = float(block[i * bandsPerGroup + lane]);
+    }
+  }
+}
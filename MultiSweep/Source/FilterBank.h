@@ -0,0 +1,111 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Fractional-octave (octave or third-octave) filter bank after IEC 61260-1,
+// for band-wise analysis of IRs and captures: every band is a sixth-order
+// Butterworth band pass between the band edges, as three second-order
+// sections.
+
+enum class BandResolution
+{
+  octave,
+  thirdOctave
+};
+
+struct FilterBankSettings
+{
+  BandResolution resolution = BandResolution::thirdOctave;
+
+  // Nominal band centers in this range (and with their upper band edge below
+  // Nyquist) are used:
+  double lowestFrequency = 20;
+  double highestFrequency = 20e3;
+};
+
+// Exact (base-10) band centers:
+std::vector<double> band_center_frequencies(const FilterBankSettings&,
+                                            double fs);
+
+// The sections of one band pass, with the numerator gain * (1 - z^-2) and
+// unity gain at the center frequency:
+struct BandPassSection
+{
+  double gain;
+  double a1;
+  double a2;
+};
+std::array<BandPassSection, 3> design_band_pass(double centerFrequency,
+                                                BandResolution,
+                                                double fs);
+
+// Filters one signal through all bands at once. Neighbouring bands share the
+// lanes of SIMD registers (AVX or SSE2, in double precision, which the poles
+// of the narrow low bands need), and each group of bands runs through all of
+// its sections over blocks of samples with the filter states held in
+// registers. All memory is allocated by the constructor.
+class FilterBank
+{
+public:
+  FilterBank(const FilterBankSettings&, double fs);
+
+  size_t getNumBands() const { return centers.size(); }
+  const std::vector<double>& getCenterFrequencies() const { return centers; }
+
+  // Clears the filter states:
+  void reset();
+
+  // Causal filtering, continuing from the previous call. outputs[band] must
+  // have room for numSamples, and may not alias input:
+  void process(const float* input, float* const* outputs, size_t numSamples);
+
+  // Zero-phase filtering of a whole signal: every band is filtered forwards
+  // and then backwards (from a cleared state each time), which squares its
+  // magnitude response (so the band edges are at -6 dB) and cancels its
+  // phase. Nothing is delayed, so band energies line up with the broadband
+  // signal in time. Leaves the states cleared:
+  void processZeroPhase(const float* input,
+                        float* const* outputs,
+                        size_t numSamples);
+
+private:
+  void processGroup(size_t group,
+                    const float* input,
+                    float* const* outputs,
+                    size_t numSamples,
+                    bool backwards);
+
+  std::vector<double> centers;
+  size_t numGroups;
+
+  // Per group and section, in lane order: gain, -a1, -a2 and the states z1,
+  // z2. Lanes without a band have zero coefficients:
+  std::vector<double> coefficients;
+  std::vector<double> states;
+  std::vector<double> block; // one block of one group, lane-interleaved
+};
@@ -0,0 +1,219 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "FilterDesign.h"
+#include "MinimumPhase.h"
+#include "ParallelFor.h"
+#include "fft.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <numeric>
+
+namespace {
+float regularization(const FilterDesignSettings& settings, float frequency)
+{
+  // Distance outside of the band in octaves (negative inside the band):
+  const auto below = frequency > 0
+                       ? std::log2(settings.lowerFreq / frequency)
+                       : settings.transitionOctaves;
+  const auto above = std::log2(frequency / settings.upperFreq);
+  const auto distance = std::max(below, above);
+
+  if (distance <= 0)
+    return settings.inBandRegularization;
+  if (distance >= settings.transitionOctaves)
+    return settings.outOfBandRegularization;
+
+  // Raised-cosine transition, interpolated on a logarithmic scale:
+  const auto x =
+    0.5f - 0.5f * std::cos(float(M_PI) * distance / settings.transitionOctaves);
+  return settings.inBandRegularization *
+         std::pow(settings.outOfBandRegularization /
+                    settings.inBandRegularization,
+                  x);
+}
+
+float fade_gain(size_t i, size_t fadeLength)
+{
+  return float(0.5 - 0.5 * std::cos(M_PI * double(i) / double(fadeLength)));
+}
+
+void apply_fades(std::vector<float>& coefficients,
+                 size_t fadeInLength,
+                 size_t fadeOutLength)
+{
+  fadeInLength = std::min(fadeInLength, coefficients.size() / 2);
+  fadeOutLength = std::min(fadeOutLength, coefficients.size() / 2);
+  for (size_t i = 0; i < fadeInLength; ++i)
+    coefficients[i] *= fade_gain(i, fadeInLength);
+  for (size_t i = 0; i < fadeOutLength; ++i)
+    coefficients[coefficients.size() - 1 - i] *= fade_gain(i, fadeOutLength);
+}
+} // namespace
+
+float target_db(const std::vector<TargetPoint>& target, float frequency)
+{
+  if (target.empty())
+    return 0;
+  if (frequency <= target.front().frequency)
+    return target.front().db;
+  if (frequency >= target.back().frequency)
+    return target.back().db;
+
+  const auto upper = std::upper_bound(
+    target.cbegin(), target.cend(), frequency, [](auto f, const auto& point) {
+      return f < point.frequency;
+    });
+  const auto lower = upper - 1;
+  const auto x = std::log(frequency / lower->frequency) /
+                 std::log(upper->frequency / lower->frequency);
+  return lower->db + x * (upper->db - lower->db);
+}
+
+namespace {
+// minimumPhase is only used (and must have an FFT size of 2 * numTaps) if
+// settings.minimumPhase is set:
+FilterDesignResult design(const std::vector<float>& ir,
+                          const FilterDesignSettings& settings,
+                          MinimumPhase* minimumPhase)
+{
+  const auto startTime = std::chrono::steady_clock::now();
+
+  // The inverse is computed at twice the filter length, so that most of its
+  // circular wrap-around ends up in the part that gets truncated:
+  const auto fftSize = 2 * settings.numTaps;
+  auto input = RealVector(
+    ir.cbegin(), ir.cbegin() + long(std::min(ir.size(), fftSize)));
+  input.resize(fftSize, 0);
+  const auto H = dft(input);
+
+  const auto binWidth = settings.fs / double(fftSize);
+  const auto frequency = [binWidth](size_t k) { return float(k * binWidth); };
+
+  auto power = RealVector(H.size());
+  std::transform(H.cbegin(), H.cend(), power.begin(), [](auto x) {
+    return std::norm(x);
+  });
+  if (settings.smoothing.type != SmoothingType::none) {
+    auto frequencies = std::vector<float>(H.size());
+    for (size_t k = 0; k < H.size(); ++k)
+      frequencies[k] = frequency(k);
+    auto smoother = SpectrumSmoother(
+      settings.fs, fftSize, std::move(frequencies), settings.smoothing);
+    power = smoother.power(power);
+  }
+
+  // Regularization is relative to the in-band level, so the result does not
+  // depend on the absolute level of the measurement:
+  auto inBandPower = 0.0;
+  auto numInBandBins = size_t(0);
+  for (size_t k = 0; k < H.size(); ++k)
+    if (frequency(k) >= settings.lowerFreq &&
+        frequency(k) <= settings.upperFreq) {
+      inBandPower += power[k];
+      ++numInBandBins;
+    }
+  const auto meanPower = numInBandBins > 0 ? inBandPower / numInBandBins : 1.0;
+
+  // Kirkeby inversion C = T H* / (|H|^2 + beta), with the modeling delay
+  // applied as a linear phase term:
+  const auto delay = settings.minimumPhase
+                       ? 0.0
+                       : double(settings.modelingDelay) * settings.numTaps;
+  auto C = ComplexVector(H.size());
+  for (size_t k = 0; k < H.size(); ++k) {
+    const auto f = frequency(k);
+    const auto beta = regularization(settings, f) * meanPower;
+    const auto target = std::pow(10.0, target_db(settings.target, f) / 20);
+    const auto phase = -2 * M_PI * double(k) * delay / double(fftSize);
+    // |H| conj(H) / |H| = conj(H), but with the (smoothed) magnitude:
+    const auto magnitude = std::sqrt(power[k]);
+    const auto inversePhase = std::abs(H[k]) > 0
+                                ? std::conj(H[k]) / std::abs(H[k])
+                                : ComplexType(1);
+    C[k] = target * magnitude * inversePhase / (power[k] + beta) *
+           std::polar(1.0, phase);
+  }
+
+  auto result = FilterDesignResult{};
+  if (settings.minimumPhase) {
+    // Only the magnitude of the inverse is kept:
+    auto magnitude = RealVector(C.size());
+    std::transform(C.cbegin(), C.cend(), magnitude.begin(), [](auto x) {
+      return std::abs(x);
+    });
+    result.coefficients =
+      minimumPhase->fromMagnitude(magnitude, settings.numTaps);
+  } else {
+    const auto impulseResponse = idft(C);
+    result.coefficients = std::vector<float>(
+      impulseResponse.cbegin(),
+      impulseResponse.cbegin() + long(settings.numTaps));
+  }
+
+  // The fade-in must not reach the main tap:
+  const auto fadeLength = size_t(settings.fadeLength * float(settings.numTaps));
+  apply_fades(result.coefficients,
+              std::min(fadeLength, size_t(delay / 2)),
+              fadeLength);
+
+  const auto endTime = std::chrono::steady_clock::now();
+  result.designTimeMs =
+    std::chrono::duration<double, std::milli>(endTime - startTime).count();
+  return result;
+}
+
+} // namespace
+
+FilterDesignResult design_correction_filter(
+  const std::vector<float>& ir,
+  const FilterDesignSettings& settings)
+{
+  auto minimumPhase = settings.minimumPhase
+                        ? std::make_unique<MinimumPhase>(2 * settings.numTaps)
+                        : nullptr;
+  return design(ir, settings, minimumPhase.get());
+}
+
+std::vector<FilterDesignResult> design_correction_filters(
+  const std::vector<std::vector<float>>& irs,
+  const FilterDesignSettings& settings,
+  unsigned numThreads)
+{
+  numThreads = resolve_num_threads(numThreads, irs.size());
+  auto workspaces = std::vector<std::unique_ptr<MinimumPhase>>(numThreads);
+
+  auto results = std::vector<FilterDesignResult>(irs.size());
+  parallel_for_with_worker(
+    irs.size(),
+    [&](size_t i, unsigned worker) {
+      if (settings.minimumPhase && !workspaces[worker])
+        workspaces[worker] =
+          std::make_unique<MinimumPhase>(2 * settings.numTaps);
+      results[i] = design(irs[i], settings, workspaces[worker].get());
+    },
+    numThreads);
+  return results;
+}
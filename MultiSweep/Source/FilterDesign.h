@@ -0,0 +1,89 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include "Smoothing.h"
+#include <cstddef>
+#include <vector>
+
+struct TargetPoint
+{
+  float frequency;
+  float db;
+};
+
+struct FilterDesignSettings
+{
+  double fs = 48000;
+  size_t numTaps = 32768;
+
+  // Target response, interpolated linearly over log frequency. Flat if empty:
+  std::vector<TargetPoint> target;
+
+  // Kirkeby regularization, relative to the mean in-band power of the
+  // measured response. Inside [lowerFreq, upperFreq] the (small) in-band
+  // value is used, outside the (large) out-of-band value, with a smooth
+  // transition of transitionOctaves in between:
+  float lowerFreq = 20;
+  float upperFreq = 20e3f;
+  float inBandRegularization = 1e-3f;
+  float outOfBandRegularization = 1.0f;
+  float transitionOctaves = 1.0f / 3;
+
+  // Smoothing of the measured power response before inversion. Only the
+  // magnitude is smoothed, the phase of the measurement is kept:
+  Smoothing smoothing;
+
+  // Delay of the main tap, relative to the number of taps. Centering it leaves
+  // room for the pre-ringing of the inverted (mixed-phase) response:
+  float modelingDelay = 0.5f;
+
+  // Only keep the magnitude of the inverse and make it minimum phase. This
+  // ignores modelingDelay and allows for much shorter filters at runtime:
+  bool minimumPhase = false;
+
+  // Length of the raised-cosine fades applied to both ends of the filter,
+  // relative to the number of taps:
+  float fadeLength = 0.1f;
+};
+
+struct FilterDesignResult
+{
+  std::vector<float> coefficients;
+  double designTimeMs = 0;
+};
+
+// Designs a correction FIR for an IR that starts at the system's zero-delay
+// point (e.g. the output of computeIR() from getIROffset() onwards):
+FilterDesignResult design_correction_filter(const std::vector<float>& ir,
+                                            const FilterDesignSettings&);
+
+// Designs filters for all channels in parallel:
+std::vector<FilterDesignResult> design_correction_filters(
+  const std::vector<std::vector<float>>& irs,
+  const FilterDesignSettings& settings,
+  unsigned numThreads = 0);
+
+// Evaluates the target curve in dB at the given frequency:
+float target_db(const std::vector<TargetPoint>& target, float frequency);
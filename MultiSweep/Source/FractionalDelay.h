@@ -0,0 +1,272 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MULTISWEEP_SSE2 1
+#endif
+#include <interpLagrangeWeights.h>
+
+// Multichannel fractional delay for sub-sample alignment of many outputs,
+// with third-order Lagrange interpolation from the bundled 129-entry weight
+// table. Channels are processed in groups of four: the four taps of each
+// channel are read with one (SSE) load and weighted in one multiplication,
+// and transposing the four products leaves the outputs of all four channels
+// in one register.
+//
+// Delays are published lock-free and ramped linearly to their new value
+// within setRampLength() samples, so changing them doesn't click. The
+// interpolator needs one sample of look-ahead, so every channel is delayed by
+// one sample more than requested (see getLatency()).
+class FractionalDelay
+{
+public:
+  static constexpr size_t lanes = 4;
+
+  FractionalDelay() = default;
+  FractionalDelay(const FractionalDelay&) = delete;
+  FractionalDelay& operator=(const FractionalDelay&) = delete;
+
+  // Allocates everything, must not be called concurrently with process():
+  void prepare(int newNumChannels, int maxBlockSize, float maxDelayInSamples)
+  {
+    // Delays that were published before are kept as long as the number of
+    // channels stays the same:
+    if (!targets || numChannels != size_t(newNumChannels)) {
+      targets.reset(new std::atomic<float>[size_t(newNumChannels)]);
+      for (int channel = 0; channel < newNumChannels; ++channel)
+        targets[size_t(channel)].store(0.0f, std::memory_order_relaxed);
+    }
+
+    numChannels = size_t(newNumChannels);
+    maxDelay = std::max(0.0f, maxDelayInSamples);
+    blockSize = size_t(maxBlockSize);
+    length = historyLength(maxDelay, maxBlockSize);
+    mask = length - 1;
+    history.assign(numChannels * stride(), 0.0f);
+    writeIndex = 0;
+
+    delays.assign(numChannels, 0.0f);
+    rampTargets.assign(numChannels, 0.0f);
+    increments.assign(numChannels, 0.0f);
+    rampRemaining.assign(numChannels, 0);
+  }
+
+  void reset() noexcept
+  {
+    std::fill(history.begin(), history.end(), 0.0f);
+  }
+
+  // Lock-free, can be called from any thread while processing. Delays are
+  // limited to the maximum given to prepare():
+  void setDelay(int channel, float delayInSamples)
+  {
+    assert(channel >= 0 && size_t(channel) < numChannels);
+    if (channel < 0 || size_t(channel) >= numChannels)
+      return;
+    targets[size_t(channel)].store(std::clamp(delayInSamples, 0.0f, maxDelay),
+                                   std::memory_order_relaxed);
+  }
+
+  // Length of the linear ramp to a new delay, 0 jumps immediately:
+  void setRampLength(int numSamples) { rampLength = std::max(0, numSamples); }
+
+  static constexpr int getLatency() { return 1; }
+
+  // Samples of circular history needed for delays up to maxDelayInSamples, a
+  // power of two, also used by CorrectionChain:
+  static size_t historyLength(float maxDelayInSamples, int maxBlockSize)
+  {
+    const auto needed = size_t(std::ceil(maxDelayInSamples)) +
+                        size_t(maxBlockSize) + interpLength;
+    auto length = size_t(1);
+    while (length < needed)
+      length *= 2;
+    return length;
+  }
+
+  // Where the taps of a delay start (counted back from the current sample)
+  // and how they are weighted, also used by CorrectionChain:
+  struct Taps
+  {
+    size_t back;
+    float weights[interpLength];
+  };
+
+  static Taps locate(float delay) noexcept
+  {
+    // The output at t - (delay + latency) is interpolated between the taps
+    // around it, the second of which lies at or before that point:
+    const auto total = delay + float(getLatency());
+    const auto whole = std::ceil(total);
+    const auto position = (whole - total) * float(interpMult);
+    const auto index = std::min(int(position), interpMult - 1);
+
+    auto taps = Taps{};
+    taps.back = size_t(whole) + interpOffset;
+    getInterpolatedLagrangeWeights(
+      index, position - float(index), taps.weights);
+    return taps;
+  }
+
+  // In place:
+  void process(float* const* channels,
+               int numChannelsToProcess,
+               int numSamples) noexcept
+  {
+    assert(size_t(numSamples) <= blockSize);
+    const auto count = size_t(std::clamp(numSamples, 0, int(blockSize)));
+    const auto channelCount =
+      std::min(size_t(std::max(0, numChannelsToProcess)), numChannels);
+    if (count == 0)
+      return;
+
+    pullDelayUpdates();
+
+    // The whole block goes into the history first, so it can be processed in
+    // place. The first samples are repeated behind the end, so the taps of
+    // one output can always be read in one piece:
+    for (size_t channel = 0; channel < channelCount; ++channel) {
+      auto* line = history.data() + channel * stride();
+      const auto first = std::min(count, length - writeIndex);
+      std::copy(
+        channels[channel], channels[channel] + first, line + writeIndex);
+      std::copy(channels[channel] + first, channels[channel] + count, line);
+      std::copy(line, line + interpLength, line + length);
+    }
+
+    for (size_t firstChannel = 0; firstChannel < channelCount;
+         firstChannel += lanes)
+      processGroup(channels,
+                   firstChannel,
+                   std::min(lanes, channelCount - firstChannel),
+                   count);
+
+    writeIndex = (writeIndex + count) & mask;
+  }
+
+private:
+  void pullDelayUpdates() noexcept
+  {
+    for (size_t channel = 0; channel < numChannels; ++channel) {
+      const auto target = targets[channel].load(std::memory_order_relaxed);
+      if (target == rampTargets[channel])
+        continue;
+
+      rampTargets[channel] = target;
+      if (rampLength == 0) {
+        delays[channel] = target;
+        rampRemaining[channel] = 0;
+      } else {
+        increments[channel] = (target - delays[channel]) / float(rampLength);
+        rampRemaining[channel] = rampLength;
+      }
+    }
+  }
+
+  void processGroup(float* const* channels,
+                    size_t firstChannel,
+                    size_t numLanes,
+                    size_t count) noexcept
+  {
+    // Unused lanes read the first channel with zero weights:
+    const float* lines[lanes];
+    Taps taps[lanes];
+    auto ramping = false;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+      const auto channel = firstChannel + (lane < numLanes ? lane : 0);
+      lines[lane] = history.data() + channel * stride();
+      taps[lane] = locate(delays[channel]);
+      if (lane >= numLanes)
+        std::fill(taps[lane].weights, taps[lane].weights + interpLength, 0.0f);
+      else
+        ramping = ramping || rampRemaining[channel] > 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      // While ramping, the taps move with every sample:
+      if (ramping)
+        for (size_t lane = 0; lane < numLanes; ++lane)
+          taps[lane] = locate(advanceRamp(firstChannel + lane));
+
+      const auto current = writeIndex + i + length;
+#ifdef MULTISWEEP_SSE2
+      __m128 products[lanes];
+      for (size_t lane = 0; lane < lanes; ++lane)
+        products[lane] = _mm_mul_ps(
+          _mm_loadu_ps(taps[lane].weights),
+          _mm_loadu_ps(lines[lane] + ((current - taps[lane].back) & mask)));
+      _MM_TRANSPOSE4_PS(products[0], products[1], products[2], products[3]);
+      float outputs[lanes];
+      _mm_storeu_ps(outputs,
+                    _mm_add_ps(_mm_add_ps(products[0], products[1]),
+                               _mm_add_ps(products[2], products[3])));
+#else
+      float outputs[lanes];
+      for (size_t lane = 0; lane < lanes; ++lane) {
+        const auto* x = lines[lane] + ((current - taps[lane].back) & mask);
+        const auto* w = taps[lane].weights;
+        outputs[lane] = w[0] * x[0] + w[1] * x[1] + w[2] * x[2] + w[3] * x[3];
+      }
+#endif
+      for (size_t lane = 0; lane < numLanes; ++lane)
+        channels[firstChannel + lane][i] = outputs[lane];
+    }
+  }
+
+  float advanceRamp(size_t channel) noexcept
+  {
+    if (rampRemaining[channel] > 0) {
+      --rampRemaining[channel];
+      delays[channel] = rampRemaining[channel] == 0
+                          ? rampTargets[channel]
+                          : delays[channel] + increments[channel];
+    }
+    return delays[channel];
+  }
+
+  size_t stride() const { return length + interpLength; }
+
+  size_t numChannels = 0;
+  size_t blockSize = 0;
+  float maxDelay = 0;
+  int rampLength = 2048;
+
+  size_t length = 0; // of the circular history, a power of two
+  size_t mask = 0;
+  size_t writeIndex = 0;
+  std::vector<float> history; // per channel, followed by interpLength samples
+
+  std::unique_ptr<std::atomic<float>[]> targets;
+  std::vector<float> delays;      // audio thread only
+  std::vector<float> rampTargets; // audio thread only
+  std::vector<float> increments;  // audio thread only
+  std::vector<int> rampRemaining; // audio thread only
+};
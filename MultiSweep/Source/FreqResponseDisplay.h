@@ -21,6 +21,7 @@
  */
 
 #pragma once
+#include "RealTimeAnalyzer.h"
 #include "SweepComponentProcessor.h"
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_audio_utils/juce_audio_utils.h>
@@ -36,7 +37,23 @@ public:
   {
     sweep.addChangeListener(this);
   }
-  ~FreqResponseDisplay() override { sweep.removeChangeListener(this); }
+  ~FreqResponseDisplay() override
+  {
+    sweep.removeChangeListener(this);
+    setAnalyzer(nullptr);
+  }
+
+  // Shows the live spectrum or transfer function of this analyzer (if any)
+  // while it is enabled:
+  void setAnalyzer(RealTimeAnalyzer* newAnalyzer)
+  {
+    if (analyzer != nullptr)
+      analyzer->removeChangeListener(this);
+    analyzer = newAnalyzer;
+    if (analyzer != nullptr)
+      analyzer->addChangeListener(this);
+    repaint();
+  }
 
   void paint(juce::Graphics& g) override
   {
@@ -47,7 +64,8 @@ public:
     const auto graph = area.reduced(margin);
     const auto xAxis = dft_log_bins(size_t(graph.getWidth()), 20.0, 20e3);
 
-    const auto curve = sweep.getFrequencyResponse(uint(graph.getWidth()));
+    updateSweepCurves(graph.getWidth());
+    const auto& curve = sweepCurves.magnitude;
 
     auto yAxis = std::vector<float>(size_t(graph.getHeight()));
     std::iota(yAxis.begin(), yAxis.end(), 0);
@@ -145,7 +163,11 @@ public:
     g.setColour(lookAndFeel.ClSeperator);
     g.drawRect(graph);
 
-    if (curve.size() == 0) {
+    const auto analyzing = analyzer != nullptr && analyzer->isEnabled();
+    const auto live = analyzing ? analyzer->getSpectrum() : nullptr;
+    const auto transfer = analyzing ? analyzer->getTransferFunction() : nullptr;
+
+    if (curve.size() == 0 && !live && !transfer) {
       g.setColour(juce::Colours::white);
       g.setOpacity(0.4f);
       g.fillRect(graph);
@@ -155,17 +177,143 @@ public:
       g.drawText("No Sweep Recorded", graph, juce::Justification::centred);
     }
 
+    g.setColour(lookAndFeel.ClText);
+    g.setFont(lookAndFeel.robotoMedium);
+    g.drawText(
+      sweepCurves.truncation, graph.reduced(8), juce::Justification::topLeft);
+    g.drawText(sweepCurves.acoustics,
+               graph.reduced(8).withTrimmedTop(18),
+               juce::Justification::topLeft);
+
+    // The live spectrum is drawn relative to its mean level (in dBFS), so its
+    // shape can be compared to the measured responses:
+    auto livePath = juce::Path();
+    if (live && !live->levels.empty()) {
+      const auto mean =
+        std::accumulate(live->levels.cbegin(), live->levels.cend(), 0.0f) /
+        float(live->levels.size());
+      for (size_t i = 0; i < live->levels.size(); ++i) {
+        const auto x =
+          graph.getX() + findPixelForFrequency(live->frequencies[i]);
+        const auto y =
+          graph.getBottom() - findPixelForDb(live->levels[i] - mean);
+        if (i == 0)
+          livePath.startNewSubPath(x, y);
+        else
+          livePath.lineTo(x, y);
+      }
+
+      g.setColour(lookAndFeel.ClText);
+      g.setFont(lookAndFeel.robotoMedium);
+      g.drawText("RTA: mean " + juce::String(mean, 1) + " dBFS, " +
+                   juce::String(live->numFrames) + " averages",
+                 graph.reduced(8),
+                 juce::Justification::topRight);
+    }
+
+    // The transfer function is left out where the coherence is too low for
+    // its magnitude to mean anything (noise, reverberation, ...):
+    if (transfer) {
+      auto drawing = false;
+      for (size_t i = 0; i < transfer->magnitudeDb.size(); ++i) {
+        if (transfer->coherence[i] < minCoherence) {
+          drawing = false;
+          continue;
+        }
+        const auto x =
+          graph.getX() + findPixelForFrequency(transfer->frequencies[i]);
+        const auto y =
+          graph.getBottom() - findPixelForDb(transfer->magnitudeDb[i]);
+        if (drawing)
+          livePath.lineTo(x, y);
+        else
+          livePath.startNewSubPath(x, y);
+        drawing = true;
+      }
+
+      const auto status =
+        transfer->delay
+          ? "delay " +
+              juce::String(1000.0 * double(*transfer->delay) /
+                             sweep.getMeasurementSampleRate(),
+                           2) +
+              " ms, " + juce::String(transfer->numFrames) + " averages"
+          : juce::String("searching for the delay");
+      g.setColour(lookAndFeel.ClText);
+      g.setFont(lookAndFeel.robotoMedium);
+      g.drawText("Transfer function: " + status,
+                 graph.reduced(8),
+                 juce::Justification::topRight);
+    }
+
     g.reduceClipRegion(graph.reduced(1)); // reduce by stroke width
     g.setColour(juce::Colours::red);
     g.strokePath(path, juce::PathStrokeType(2.0f));
+    g.setColour(juce::Colours::yellow);
+    g.strokePath(livePath, juce::PathStrokeType(1.5f));
   }
 
 private:
   void changeListenerCallback(juce::ChangeBroadcaster*) override { repaint(); }
 
+  // The measured response and its annotations only change with the
+  // measurement (or the display width), not with every repaint of the live
+  // analyzer:
+  struct SweepCurves
+  {
+    int revision = -1;
+    int width = 0;
+    std::vector<float> magnitude; // empty if nothing has been measured
+    juce::String truncation;
+    juce::String acoustics;
+  };
+
+  void updateSweepCurves(int width)
+  {
+    if (sweepCurves.revision == sweep.getRevision() &&
+        sweepCurves.width == width)
+      return;
+
+    sweepCurves = {};
+    sweepCurves.revision = sweep.getRevision();
+    sweepCurves.width = width;
+    sweepCurves.magnitude = sweep.getFrequencyResponse(uint(width));
+    if (sweepCurves.magnitude.empty())
+      return; // nothing measured (yet)
+
+    const auto truncation = sweep.getTruncation();
+    if (truncation && truncation->found) {
+      const auto ms =
+        1000.0 * double(truncation->point) / sweep.getMeasurementSampleRate();
+      sweepCurves.truncation =
+        "IR truncated at noise floor after " + juce::String(ms, 0) +
+        " ms, discarded " + juce::String(truncation->discardedEnergyDb, 1) +
+        " dB";
+    }
+
+    // Room-acoustic parameters of the 1 kHz third-octave band:
+    const auto acoustics = sweep.getRoomAcoustics();
+    const auto band = std::find_if(
+      acoustics.cbegin(), acoustics.cend(), [](const auto& parameters) {
+        return std::abs(parameters.frequency - 1000) < 1;
+      });
+    const auto format = [](double value, const juce::String& unit) {
+      return std::isnan(value) ? juce::String("-")
+                               : juce::String(value, 2) + unit;
+    };
+    if (band != acoustics.cend())
+      sweepCurves.acoustics =
+        "1 kHz: T30 " + format(band->t30, " s") + ", EDT " +
+        format(band->edt, " s") + ", C80 " + format(band->c80, " dB") +
+        ", D50 " + format(band->d50, "");
+  }
+
 private:
   LaF lookAndFeel;
   SweepComponentProcessor& sweep;
+  RealTimeAnalyzer* analyzer = nullptr;
+  SweepCurves sweepCurves;
+  static constexpr float minCoherence = 0.5f;
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FreqResponseDisplay)
 };
@@ -59,6 +59,14 @@ public:
   virtual std::vector<float> computeIR(
     const std::vector<float>& signalResponse) const = 0;
 
+  // Index of the sample in computeIR()'s output that corresponds to a system
+  // delay of zero samples:
+  virtual size_t getIROffset() const = 0;
+
+  Frequency getSampleRate() const { return fs; }
+  Duration getDuration() const { return duration; }
+  FreqRange getRange() const { return range; }
+
 protected:
   inline double t(size_t i) const { return i / fs; }
 
@@ -0,0 +1,167 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "Latency.h"
+#include "fft.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <sstream>
+
+namespace {
+// Vertex of the parabola through three equally spaced points, relative to the
+// middle one (in the range [-0.5, 0.5] for a proper maximum):
+double parabolic_offset(double a, double b, double c)
+{
+  const auto denominator = a - 2 * b + c;
+  if (denominator == 0)
+    return 0;
+  return std::clamp(0.5 * (a - c) / denominator, -0.5, 0.5);
+}
+
+template<typename T>
+double refine_peak(const std::vector<T>& x, size_t index)
+{
+  if (index == 0 || index + 1 >= x.size())
+    return double(index);
+  return index + parabolic_offset(std::abs(x[index - 1]),
+                                  std::abs(x[index]),
+                                  std::abs(x[index + 1]));
+}
+} // namespace
+
+size_t find_peak_index(const std::vector<float>& ir)
+{
+  assert(!ir.empty());
+  const auto absLess = [](float a, float b) {
+    return std::abs(a) < std::abs(b);
+  };
+  return size_t(std::distance(
+    ir.cbegin(), std::max_element(ir.cbegin(), ir.cend(), absLess)));
+}
+
+double find_peak_parabolic(const std::vector<float>& ir)
+{
+  return refine_peak(ir, find_peak_index(ir));
+}
+
+double find_peak_upsampled(const std::vector<float>& ir, size_t factor)
+{
+  // Only a short segment around the peak is band-limited interpolated, so the
+  // cost is independent of the IR length:
+  constexpr size_t halfWidth = 32;
+  const auto peak = find_peak_index(ir);
+  const auto start = peak > halfWidth ? peak - halfWidth : 0;
+  const auto end = std::min(ir.size(), start + 2 * halfWidth);
+
+  RealVector segment(ir.cbegin() + long(start), ir.cbegin() + long(end));
+  segment.resize(2 * halfWidth, 0);
+
+  // Zero-padding in the frequency domain is ideal (sinc) interpolation. The
+  // Nyquist bin is split between the positive and negative half so that the
+  // interpolated signal stays real:
+  auto spectrum = dft(segment);
+  spectrum.back() *= 0.5;
+  spectrum.resize(halfWidth * factor + 1, 0);
+  const auto upsampled = idft(spectrum);
+
+  const auto absLess = [](auto a, auto b) { return std::abs(a) < std::abs(b); };
+  const auto index = size_t(std::distance(
+    upsampled.cbegin(),
+    std::max_element(upsampled.cbegin(), upsampled.cend(), absLess)));
+
+  return double(start) + refine_peak(upsampled, index) / double(factor);
+}
+
+double find_onset(const std::vector<float>& ir, float thresholdDb)
+{
+  const auto peak = find_peak_index(ir);
+  const auto threshold = std::abs(ir[peak]) * std::pow(10.0f, thresholdDb / 20);
+
+  size_t i = 0;
+  while (i < peak && std::abs(ir[i]) < threshold)
+    ++i;
+  if (i == 0)
+    return 0;
+
+  // Linear interpolation of the threshold crossing:
+  const auto a = std::abs(ir[i - 1]);
+  const auto b = std::abs(ir[i]);
+  return double(i - 1) + (b > a ? double(threshold - a) / double(b - a) : 1.0);
+}
+
+ArrivalTime estimate_arrival(const std::vector<float>& ir,
+                             size_t upsamplingFactor)
+{
+  if (ir.empty())
+    return {};
+
+  return { upsamplingFactor > 1 ? find_peak_upsampled(ir, upsamplingFactor)
+                                : find_peak_parabolic(ir),
+           find_onset(ir) };
+}
+
+double estimate_time_of_flight(const std::vector<float>& ir,
+                               const std::vector<float>& loopbackIR)
+{
+  return estimate_arrival(ir).peak - estimate_arrival(loopbackIR).peak;
+}
+
+std::vector<double> delay_compensation(const std::vector<double>& arrivals)
+{
+  if (arrivals.empty())
+    return {};
+
+  const auto latest = *std::max_element(arrivals.cbegin(), arrivals.cend());
+  auto delays = std::vector<double>(arrivals.size());
+  std::transform(arrivals.cbegin(),
+                 arrivals.cend(),
+                 delays.begin(),
+                 [latest](auto x) { return latest - x; });
+  return delays;
+}
+
+std::string RoundTripLatencyCache::makeKey(const std::string& deviceName,
+                                           double sampleRate,
+                                           int blockSize)
+{
+  auto key = std::stringstream{};
+  key << deviceName << "@" << sampleRate << "/" << blockSize;
+  return key.str();
+}
+
+void RoundTripLatencyCache::store(const std::string& key,
+                                  double latencyInSamples)
+{
+  latencies[key] = latencyInSamples;
+}
+
+std::optional<double> RoundTripLatencyCache::lookup(
+  const std::string& key) const
+{
+  const auto it = latencies.find(key);
+  if (it == latencies.cend())
+    return std::nullopt;
+  return it->second;
+}
@@ -0,0 +1,73 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// All positions are in (fractional) samples relative to the start of the IR
+// vector that was passed in.
+
+size_t find_peak_index(const std::vector<float>& ir);
+double find_peak_parabolic(const std::vector<float>& ir);
+double find_peak_upsampled(const std::vector<float>& ir, size_t factor = 16);
+double find_onset(const std::vector<float>& ir, float thresholdDb = -20.0f);
+
+struct ArrivalTime
+{
+  double peak = 0;  // position of the absolute maximum
+  double onset = 0; // first crossing of the onset threshold before the peak
+};
+
+ArrivalTime estimate_arrival(const std::vector<float>& ir,
+                             size_t upsamplingFactor = 16);
+
+// Time of flight of a measured IR relative to the IR of an electrical
+// loopback, which removes the interface latency from the result:
+double estimate_time_of_flight(const std::vector<float>& ir,
+                               const std::vector<float>& loopbackIR);
+
+// Turns per-channel arrival times into per-channel delays that align all
+// channels to the one that arrives last:
+std::vector<double> delay_compensation(const std::vector<double>& arrivals);
+
+// Round-trip latencies in samples, measured via loopback and cached per device
+// configuration so that later measurements without loopback can still be
+// corrected:
+class RoundTripLatencyCache
+{
+public:
+  static std::string makeKey(const std::string& deviceName,
+                             double sampleRate,
+                             int blockSize);
+
+  void store(const std::string& key, double latencyInSamples);
+  std::optional<double> lookup(const std::string& key) const;
+  void clear() { latencies.clear(); }
+
+private:
+  std::map<std::string, double> latencies;
+};
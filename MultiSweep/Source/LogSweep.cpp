@@ -68,3 +68,10 @@ std::vector<float> LogSweep::computeIR(
 {
   return convolve(signalResponse, generateInverse());
 }
+
+size_t LogSweep::getIROffset() const
+{
+  // The inverse sweep is time-reversed, so the deconvolved IR starts at the
+  // last sample of the inverse sweep:
+  return numSamples - 1;
+}
@@ -36,6 +36,7 @@ public:
   std::vector<float> generateInverse() const;
   std::vector<float> computeIR(
     const std::vector<float>& signalResponse) const override;
+  size_t getIROffset() const override;
 
 private:
   double k;
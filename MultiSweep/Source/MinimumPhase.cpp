@@ -0,0 +1,112 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "MinimumPhase.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <memory>
+
+MinimumPhase::MinimumPhase(size_t fftSize)
+  : plan(fftSize)
+  , buffer(fftSize)
+  , spectrum(fftSize / 2 + 1)
+{}
+
+std::vector<float> MinimumPhase::fromMagnitude(const RealVector& magnitude,
+                                               size_t numTaps)
+{
+  assert(magnitude.size() == spectrum.size());
+  const auto size = plan.size();
+
+  // Zeros in the magnitude response would end up as -inf in the cepstrum, so
+  // the magnitude is limited to 200 dB below its maximum:
+  const auto peak = *std::max_element(magnitude.cbegin(), magnitude.cend());
+  const auto floor = std::max(peak * 1e-10, 1e-300);
+  for (size_t k = 0; k < spectrum.size(); ++k)
+    spectrum[k] = std::log(std::max(magnitude[k], floor));
+
+  // Real cepstrum -> fold the anti-causal part onto the causal part:
+  buffer = plan.inverse(spectrum);
+  for (size_t n = 1; n < size / 2; ++n)
+    buffer[n] *= 2;
+  std::fill(buffer.begin() + long(size / 2) + 1, buffer.end(), 0);
+
+  const auto& foldedSpectrum = plan.forward(buffer);
+  std::transform(foldedSpectrum.cbegin(),
+                 foldedSpectrum.cend(),
+                 spectrum.begin(),
+                 [](auto x) { return std::exp(x); });
+
+  const auto& output = plan.inverse(spectrum);
+  numTaps = std::min(numTaps, size);
+  return std::vector<float>(output.cbegin(), output.cbegin() + long(numTaps));
+}
+
+std::vector<float> MinimumPhase::fromImpulseResponse(
+  const std::vector<float>& ir,
+  size_t numTaps)
+{
+  const auto length = std::min(ir.size(), plan.size());
+  std::copy(ir.cbegin(), ir.cbegin() + long(length), buffer.begin());
+
+  const auto& irSpectrum = plan.forward(buffer.data(), length);
+  auto magnitude = RealVector(irSpectrum.size());
+  std::transform(irSpectrum.cbegin(),
+                 irSpectrum.cend(),
+                 magnitude.begin(),
+                 [](auto x) { return std::abs(x); });
+  return fromMagnitude(magnitude, numTaps);
+}
+
+std::vector<std::vector<float>> minimum_phase_filters(
+  const std::vector<std::vector<float>>& irs,
+  size_t numTaps,
+  size_t fftSize,
+  unsigned numThreads)
+{
+  if (fftSize == 0) {
+    auto longest = numTaps;
+    for (const auto& ir : irs)
+      longest = std::max(longest, ir.size());
+    fftSize = 2;
+    while (fftSize < 4 * longest)
+      fftSize *= 2;
+  }
+
+  numThreads = resolve_num_threads(numThreads, irs.size());
+  auto workspaces = std::vector<std::unique_ptr<MinimumPhase>>(numThreads);
+
+  auto output = std::vector<std::vector<float>>(irs.size());
+  parallel_for_with_worker(
+    irs.size(),
+    [&](size_t i, unsigned worker) {
+      // Each worker only ever touches its own workspace:
+      if (!workspaces[worker])
+        workspaces[worker] = std::make_unique<MinimumPhase>(fftSize);
+      output[i] = workspaces[worker]->fromImpulseResponse(irs[i], numTaps);
+    },
+    numThreads);
+  return output;
+}
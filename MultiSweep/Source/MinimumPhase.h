@@ -0,0 +1,61 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include "fft.h"
+#include <vector>
+
+// Homomorphic (real cepstrum) minimum-phase transform. The FFT size should be
+// a few times longer than the filters to keep cepstral aliasing low. Plans and
+// buffers are allocated once, so one instance can process many filters (but
+// only on one thread at a time).
+class MinimumPhase
+{
+public:
+  explicit MinimumPhase(size_t fftSize);
+
+  size_t getFFTSize() const { return plan.size(); }
+
+  // Linear magnitude with getFFTSize() / 2 + 1 bins, e.g. a smoothed response
+  // or the magnitude of a designed filter:
+  std::vector<float> fromMagnitude(const RealVector& magnitude, size_t numTaps);
+
+  // Minimum-phase filter with the same magnitude response as ir:
+  std::vector<float> fromImpulseResponse(const std::vector<float>& ir,
+                                         size_t numTaps);
+
+private:
+  FFTPlan plan;
+  RealVector buffer;
+  ComplexVector spectrum;
+};
+
+// Converts all filters in parallel, reusing one MinimumPhase instance per
+// worker thread. If fftSize is 0, it is chosen as the next power of two of at
+// least four times the longest filter.
+std::vector<std::vector<float>> minimum_phase_filters(
+  const std::vector<std::vector<float>>& irs,
+  size_t numTaps,
+  size_t fftSize = 0,
+  unsigned numThreads = 0);
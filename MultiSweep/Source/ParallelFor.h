@@ -0,0 +1,69 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline unsigned resolve_num_threads(unsigned numThreads, size_t count)
+{
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  return unsigned(std::max(size_t(1), std::min(size_t(numThreads), count)));
+}
+
+// Calls function(i, worker) for every i in [0, count) on up to numThreads
+// threads (0 = one per hardware thread). worker is in [0, numThreads) and can
+// be used to index per-thread scratch space (FFT plans, buffers, ...).
+// Indices are handed out one at a time from a shared counter, so channels with
+// uneven workloads balance themselves.
+template<typename Function>
+void parallel_for_with_worker(size_t count,
+                              Function function,
+                              unsigned numThreads = 0)
+{
+  numThreads = resolve_num_threads(numThreads, count);
+
+  std::atomic<size_t> nextIndex{ 0 };
+  const auto worker = [&](unsigned workerIndex) {
+    for (auto i = nextIndex++; i < count; i = nextIndex++)
+      function(i, workerIndex);
+  };
+
+  auto threads = std::vector<std::thread>();
+  for (unsigned i = 1; i < numThreads; ++i)
+    threads.emplace_back(worker, i);
+  worker(0); // the calling thread does its share of the work as well
+  for (auto& thread : threads)
+    thread.join();
+}
+
+template<typename Function>
+void parallel_for(size_t count, Function function, unsigned numThreads = 0)
+{
+  parallel_for_with_worker(
+    count, [&](size_t i, unsigned) { function(i); }, numThreads);
+}
@@ -0,0 +1,86 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#include "PartitionedConvolver.h"
+#include "SpectralKernels.h"
+#include <algorithm>
+
+PartitionedConvolver::PartitionedConvolver(const std::vector<float>& ir,
+                                           size_t _blockSize)
+  : blockSize(_blockSize)
+  , numPartitions(std::max(size_t(1), (ir.size() + blockSize - 1) / blockSize))
+  , plan(2 * blockSize)
+  , partitions(numPartitions)
+  , history(numPartitions, ComplexVector(blockSize + 1))
+  , silentBlocks(numPartitions)
+  , window(2 * blockSize)
+  , accumulator(blockSize + 1)
+{
+  // Each partition is zero-padded to twice the block size, so the circular
+  // convolution of the last two input blocks is linear in its second half:
+  for (size_t p = 0; p < numPartitions; ++p) {
+    const auto begin = std::min(ir.size(), p * blockSize);
+    const auto end = std::min(ir.size(), begin + blockSize);
+    const auto segment = RealVector(ir.cbegin() + long(begin),
+                                    ir.cbegin() + long(end));
+    partitions[p] = plan.forward(segment);
+  }
+}
+
+void PartitionedConvolver::reset()
+{
+  for (auto& spectrum : history)
+    std::fill(spectrum.begin(), spectrum.end(), ComplexType(0));
+  std::fill(window.begin(), window.end(), 0);
+  silentBlocks = numPartitions;
+}
+
+void PartitionedConvolver::processAdding(const float* input, float* output)
+{
+  const auto silent =
+    std::all_of(input, input + blockSize, [](float x) { return x == 0; });
+  silentBlocks = silent ? silentBlocks + 1 : 0;
+  if (silentBlocks > numPartitions)
+    return; // everything in history is zero already
+
+  current = (current + 1) % numPartitions;
+  std::copy(window.cbegin() + long(blockSize), window.cend(), window.begin());
+  std::copy(input, input + blockSize, window.begin() + long(blockSize));
+  if (silentBlocks > 1) // the window is all zeros
+    std::fill(history[current].begin(), history[current].end(), ComplexType(0));
+  else
+    history[current] = plan.forward(window);
+
+  std::fill(accumulator.begin(), accumulator.end(), ComplexType(0));
+  for (size_t p = 0; p < numPartitions; ++p) {
+    const auto& spectrum =
+      history[(current + numPartitions - p) % numPartitions];
+    complex_multiply_accumulate(spectrum.data(),
+                                partitions[p].data(),
+                                accumulator.data(),
+                                accumulator.size());
+  }
+
+  const auto& result = plan.inverse(accumulator);
+  for (size_t i = 0; i < blockSize; ++i)
+    output[i] += float(result[blockSize + i]);
+}
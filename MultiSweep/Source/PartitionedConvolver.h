@@ -0,0 +1,54 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#pragma once
+
+#include "fft.h"
+#include <vector>
+
+// Uniformly partitioned overlap-save convolution with a fixed block size, for
+// long IRs processed block by block (e.g. a simulated room). Output block n
+// already contains the response to input block n, i.e. there is no added
+// latency. Not thread-safe.
+class PartitionedConvolver
+{
+public:
+  PartitionedConvolver(const std::vector<float>& ir, size_t blockSize);
+
+  size_t getBlockSize() const { return blockSize; }
+  void reset();
+
+  // Convolves exactly getBlockSize() samples and adds the result to output.
+  // Silent input is cheap once the tail of earlier input has decayed:
+  void processAdding(const float* input, float* output);
+
+private:
+  size_t blockSize;
+  size_t numPartitions;
+  FFTPlan plan;
+  std::vector<ComplexVector> partitions;
+  std::vector<ComplexVector> history; // input spectra, newest at current
+  size_t current = 0;
+  size_t silentBlocks;
+  RealVector window; // the last two input blocks
+  ComplexVector accumulator;
+};
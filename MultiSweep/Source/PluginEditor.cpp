@@ -46,8 +46,41 @@ MultiSweepAudioProcessorEditor::MultiSweepAudioProcessorEditor(
     "outputChannelsSetting",
     *title.getOutputWidgetPtr()->getChannelsCbPointer());
 
+  sweepEditor.setAnalyzer(p.analyzer);
   addAndMakeVisible(sweepEditor);
 
+  addAndMakeVisible(correctionButton);
+  correctionButton.setButtonText("Correction");
+  correctionAttachment = std::make_unique<ButtonAttachment>(
+    valueTreeState, "correctionEnabled", correctionButton);
+
+  addAndMakeVisible(programInputSelector);
+  for (int channel = 1; channel <= 10; ++channel)
+    programInputSelector.addItem("Program: In " + String(channel), channel);
+  programInputAttachment = std::make_unique<ComboBoxAttachment>(
+    valueTreeState, "programInput", programInputSelector);
+
+  // Towards a flat target, for all measured channels:
+  addAndMakeVisible(fitEqualizerButton);
+  fitEqualizerButton.setButtonText("Fit EQ");
+  fitEqualizerButton.onClick = [this] {
+    fitEqualizerButton.setEnabled(false);
+    audioProcessor.fitCorrectionEQ(
+      {}, {}, [editor = SafePointer<MultiSweepAudioProcessorEditor>(this)](
+                const auto&) {
+        if (editor != nullptr)
+          editor->fitEqualizerButton.setEnabled(true);
+      });
+  };
+
+  // Session files are kept until they are deleted here, see
+  // SweepComponentProcessor::deleteSessions():
+  addAndMakeVisible(deleteSessionsButton);
+  deleteSessionsButton.setButtonText("Delete Sessions...");
+  deleteSessionsButton.onClick = [this] {
+    audioProcessor.sweep.deleteSessions();
+  };
+
   startTimer(20); // --> timerCallback()
 }
 
@@ -65,6 +98,15 @@ void MultiSweepAudioProcessorEditor::resized()
 {
   Rectangle<int> area = getLocalBounds();
   drawHeaderFooter(area);
+
+  auto correctionRow = area.removeFromBottom(25);
+  area.removeFromBottom(5);
+  correctionButton.setBounds(correctionRow.removeFromLeft(120));
+  deleteSessionsButton.setBounds(correctionRow.removeFromLeft(120));
+  fitEqualizerButton.setBounds(correctionRow.removeFromRight(100));
+  correctionRow.removeFromRight(10);
+  programInputSelector.setBounds(correctionRow.removeFromRight(150));
+
   sweepEditor.setBounds(area);
 }
 
@@ -65,6 +65,15 @@ private:
 
   SweepComponentEditor sweepEditor;
 
+  // Room correction of the program input:
+  ToggleButton correctionButton;
+  std::unique_ptr<ButtonAttachment> correctionAttachment;
+  ComboBox programInputSelector;
+  std::unique_ptr<ComboBoxAttachment> programInputAttachment;
+  TextButton fitEqualizerButton;
+
+  TextButton deleteSessionsButton;
+
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultiSweepAudioProcessorEditor)
 };
 
@@ -33,6 +33,16 @@ MultiSweepAudioProcessor::MultiSweepAudioProcessor()
   outputChannelsSetting =
     parameters.getRawParameterValue("outputChannelsSetting");
   parameters.addParameterListener("outputChannelsSetting", this);
+  correctionEnabled = parameters.getRawParameterValue("correctionEnabled");
+  programInput = parameters.getRawParameterValue("programInput");
+
+  // A plug-in can't see the audio interface, so the round-trip latency is
+  // cached per wrapper and host (and sample rate and block size):
+  sweep.setDeviceName(String(getWrapperTypeDescription(wrapperType)) + " in " +
+                      PluginHostType().getHostDescription());
+
+  // Keeps all measured outputs time-aligned in the correction:
+  sweep.onTimeOfFlight = [this] { applyDelayCompensation(); };
 
   // param1 = parameters.getRawParameterValue("param1");
   // parameters.addParameterListener("param1", this);
@@ -50,6 +60,10 @@ void MultiSweepAudioProcessor::prepareToPlay(double sampleRate,
   ignoreUnused(sampleRate, samplesPerBlock);
 
   sweep.prepareToPlay(sampleRate, samplesPerBlock);
+  correction.prepare(numberOfOutputChannels,
+                     samplesPerBlock,
+                     float(maxAlignmentDelay * sampleRate));
+  analyzer.prepare(sampleRate, samplesPerBlock);
 }
 
 void MultiSweepAudioProcessor::releaseResources()
@@ -79,9 +93,91 @@ void MultiSweepAudioProcessor::processBlock(AudioSampleBuffer& buffer,
   for (int i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
     buffer.clear(i, 0, buffer.getNumSamples());
 
+  const auto numSamples = buffer.getNumSamples();
+  const auto correcting =
+    *correctionEnabled >= 0.5f && !sweep.isSweepActive();
+  const auto programChannel = jlimit(
+    0, jmax(0, totalNumInputChannels - 1), int(*programInput) - 1);
+
+  if (analyzer.isEnabled() && !sweep.isSweepActive()) {
+    // The input is queued before the noise (if any) replaces it:
+    const auto noiseChannel = analyzer.getNoiseChannel();
+    const auto referenceChannel = analyzer.getReferenceChannel();
+    analyzer.process(
+      buffer.getReadPointer(0),
+      referenceChannel > 0 && referenceChannel < totalNumInputChannels
+        ? buffer.getReadPointer(referenceChannel)
+        : nullptr,
+      noiseChannel >= 0
+        ? buffer.getWritePointer(correcting ? programChannel : 0)
+        : nullptr,
+      numSamples);
+
+    if (!correcting) {
+      if (noiseChannel > 0 && noiseChannel < buffer.getNumChannels())
+        buffer.copyFrom(noiseChannel, 0, buffer, 0, 0, numSamples);
+      for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        if (channel != noiseChannel)
+          buffer.clear(channel, 0, numSamples);
+      return;
+    }
+  }
+
+  if (correcting) {
+    correction.process(
+      buffer.getReadPointer(programChannel),
+      buffer.getArrayOfWritePointers(),
+      jmin(totalNumOutputChannels, buffer.getNumChannels()),
+      numSamples);
+    return;
+  }
+
   sweep.processBlock(buffer, midi);
 }
 
+void MultiSweepAudioProcessor::fitCorrectionEQ(
+  const EqualizerFitSettings& settings,
+  const std::vector<TargetPoint>& target,
+  SweepComponentProcessor::EqualizerFitCallback onFinished)
+{
+  auto fitSettings = settings;
+  fitSettings.numBands = std::min(settings.numBands, CorrectionChain::maxBands);
+
+  sweep.fitEqualizersAsync(
+    fitSettings,
+    target,
+    [this, onFinished = std::move(onFinished)](const auto& equalizers) {
+      auto correctionSettings = correction.getSettings();
+      correctionSettings.resize(numberOfOutputChannels);
+      for (const auto& [channel, equalizer] : equalizers)
+        if (channel < numberOfOutputChannels) {
+          auto& setting = correctionSettings[size_t(channel)];
+          if (!setting)
+            setting.emplace();
+          setting->equalizer = equalizer.coefficients;
+        }
+      correction.setSettings(std::move(correctionSettings));
+      if (onFinished)
+        onFinished(equalizers);
+    });
+}
+
+void MultiSweepAudioProcessor::applyDelayCompensation()
+{
+  const auto delays = sweep.getDelayCompensation();
+  const auto sampleRate = getSampleRate();
+  auto correctionSettings = correction.getSettings();
+  correctionSettings.resize(numberOfOutputChannels);
+  for (const auto channel : sweep.getMeasuredChannels())
+    if (size_t(channel) < delays.size() && channel < numberOfOutputChannels) {
+      auto& setting = correctionSettings[size_t(channel)];
+      if (!setting)
+        setting.emplace();
+      setting->delay = float(delays[size_t(channel)] * sampleRate);
+    }
+  correction.setSettings(std::move(correctionSettings));
+}
+
 AudioProcessorEditor* MultiSweepAudioProcessor::createEditor()
 {
   return new MultiSweepAudioProcessorEditor(*this, parameters);
@@ -94,6 +190,15 @@ void MultiSweepAudioProcessor::getStateInformation(MemoryBlock& destData)
   auto oscConfig = state.getOrCreateChildWithName("OSCConfig", nullptr);
   oscConfig.copyPropertiesFrom(oscParameterInterface.getConfig(), nullptr);
 
+  // Measurements are too large for the plugin state. They go to a session
+  // file, and the state only remembers where it is:
+  const auto sessionFile =
+    sweep.saveSession(SweepComponentProcessor::getSessionDirectory());
+  if (sessionFile != File())
+    state.setProperty("SessionFile", sessionFile.getFullPathName(), nullptr);
+  else
+    state.removeProperty("SessionFile", nullptr);
+
   std::unique_ptr<XmlElement> xml(state.createXml());
   copyXmlToBinary(*xml, destData);
 }
@@ -118,6 +223,13 @@ void MultiSweepAudioProcessor::setStateInformation(const void* data,
       auto oscConfig = parameters.state.getChildWithName("OSCConfig");
       if (oscConfig.isValid())
         oscParameterInterface.setConfig(oscConfig);
+
+      // Only the chunk headers are read, see SessionStore.h. A state without
+      // a session clears the measurements:
+      const auto path = parameters.state.getProperty("SessionFile").toString();
+      sweep.restoreSession(path.isNotEmpty() && File::isAbsolutePath(path)
+                             ? File(path)
+                             : File());
     }
 }
 
@@ -152,6 +264,24 @@ MultiSweepAudioProcessor::createParameterLayout()
     [](float value) { return value < 0.5f ? "Auto" : String(value); },
     nullptr));
 
+  params.push_back(OSCParameterInterface::createParameterTheOldWay(
+    "correctionEnabled",
+    "Room correction",
+    "",
+    NormalisableRange<float>(0.0f, 1.0f, 1.0f),
+    0.0f,
+    [](float value) { return value < 0.5f ? "Off" : "On"; },
+    nullptr));
+
+  params.push_back(OSCParameterInterface::createParameterTheOldWay(
+    "programInput",
+    "Program input channel",
+    "",
+    NormalisableRange<float>(1.0f, 10.0f, 1.0f),
+    2.0f,
+    [](float value) { return String(int(value)); },
+    nullptr));
+
   params.push_back(OSCParameterInterface::createParameterTheOldWay(
     "param1",
     "Parameter 1",
@@ -21,6 +21,8 @@
  */
 
 #pragma once
+#include "CorrectionChain.h"
+#include "RealTimeAnalyzer.h"
 #include "SweepComponentProcessor.h"
 #include <AudioProcessorBase.h>
 #define ProcessorClass MultiSweepAudioProcessor
@@ -63,8 +65,37 @@ public:
 
   SweepComponentProcessor sweep;
 
+  // Room correction of the program input (the "programInput" parameter),
+  // distributed to all outputs while "correctionEnabled" is on and no sweep is
+  // running: per output a delay for sub-sample time alignment, a gain and a
+  // parametric EQ. Outputs that haven't been measured stay silent.
+  CorrectionChain correction;
+  static constexpr double maxAlignmentDelay = 0.1; // seconds
+
+  // Fits an EQ to every measured channel on a background thread and loads it
+  // into the correction when done. onFinished then gets the results, both on
+  // the message thread:
+  void fitCorrectionEQ(
+    const EqualizerFitSettings& settings,
+    const std::vector<TargetPoint>& target,
+    SweepComponentProcessor::EqualizerFitCallback onFinished = {});
+
+  // Loads the delays that align the arrivals of all measured channels (see
+  // SweepComponentProcessor::estimateTimeOfFlight()) into the correction,
+  // after every measurement:
+  void applyDelayCompensation();
+
+  // Live spectrum or transfer function of the input while enabled and no
+  // sweep is running. Its pink noise replaces the program input of the
+  // correction (to all outputs) when that is enabled, and goes to the
+  // analyzer's noise channel only otherwise. The reference channel is one of
+  // the other inputs.
+  RealTimeAnalyzer analyzer;
+
 private:
   std::atomic<float>* outputChannelsSetting;
+  std::atomic<float>* correctionEnabled;
+  std::atomic<float>* programInput;
   // std::atomic<float>* param1;
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultiSweepAudioProcessor)
@@ -0,0 +1,347 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+
+#pragma once
+#include "Smoothing.h"
+#include "SpectrumAnalyzer.h"
+#include "SpscRing.h"
+#include "TransferFunctionAnalyzer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <juce_events/juce_events.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Live analysis of the mic input, optionally with pink noise as excitation:
+// either its averaged spectrum (RTA) or its transfer function relative to a
+// reference, e.g. the console feed during a show or the played noise. The
+// audio thread only copies: the input and the reference go through one
+// lock-free ring to the analysis thread, and the noise comes back pre-
+// generated through another. The analysis thread runs SpectrumAnalyzer or
+// TransferFunctionAnalyzer, smooths the result onto a log-spaced grid and
+// publishes it at display rate, with a change message for the display. All
+// buffers are sized in prepare() (or on the analysis thread).
+class RealTimeAnalyzer : public juce::ChangeBroadcaster
+{
+public:
+  enum class Mode
+  {
+    spectrum,        // band levels of the input
+    transferFunction // input relative to the reference
+  };
+
+  struct Settings
+  {
+    Mode mode = Mode::spectrum;
+    SpectrumAnalyzerSettings analysis; // spectrum mode
+    TransferFunctionSettings transfer; // transferFunction mode
+    Smoothing smoothing{ SmoothingType::fractionalOctave, 3 };
+    size_t numBands = 512;   // log-spaced from 20 Hz to 20 kHz
+    double displayRate = 30; // spectra per second
+  };
+
+  struct Spectrum
+  {
+    std::vector<float> frequencies;
+    std::vector<float> levels; // band levels in dB, 0 dB is a full-scale sine
+    size_t numFrames = 0;      // in the average
+  };
+
+  RealTimeAnalyzer() = default;
+  ~RealTimeAnalyzer() override { stopAnalysis(); }
+
+  // Sizes the rings, must not be called concurrently with process():
+  void prepare(double newSampleRate, int maxBlockSize)
+  {
+    stopAnalysis();
+    sampleRate = newSampleRate;
+    const auto blockSize = size_t(std::max(maxBlockSize, 1));
+    captures.resize(2, std::max(size_t(sampleRate), 4 * blockSize));
+    noise.resize(1, std::max(size_t(sampleRate / 10), 4 * blockSize));
+    if (enabled)
+      startAnalysis();
+  }
+
+  // Starts or stops the analysis thread (not to be called from the audio
+  // thread). process() should only be called while enabled:
+  void setEnabled(bool shouldBeEnabled)
+  {
+    enabled = shouldBeEnabled;
+    if (enabled)
+      startAnalysis();
+    else
+      stopAnalysis();
+  }
+  bool isEnabled() const { return enabled; }
+
+  // Output channel the pink noise is meant for, -1 for none:
+  void setNoiseChannel(int channel) { noiseChannel = channel; }
+  int getNoiseChannel() const { return noiseChannel; }
+
+  // Input channel with the reference of the transfer function, -1 to use the
+  // played noise instead:
+  void setReferenceChannel(int channel) { referenceChannel = channel; }
+  int getReferenceChannel() const { return referenceChannel; }
+
+  // RMS level of the noise. Noise that is already generated (up to 100 ms)
+  // is still played at the previous level:
+  void setNoiseLevel(float decibels)
+  {
+    noiseGain = std::pow(10.0f, decibels / 20);
+  }
+
+  void setSettings(const Settings& newSettings)
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      settings = newSettings;
+      ++settingsRevision;
+    }
+    changed.notify_all();
+  }
+  Settings getSettings() const
+  {
+    const auto lock = std::lock_guard<std::mutex>(mutex);
+    return settings;
+  }
+
+  // Restarts the average with the next analysed samples:
+  void resetAverage() { resetRequested = true; }
+
+  // The latest results of either mode, null before the first one:
+  std::shared_ptr<const Spectrum> getSpectrum() const
+  {
+    const auto lock = std::lock_guard<std::mutex>(mutex);
+    return spectrum;
+  }
+  std::shared_ptr<const TransferFunctionEstimate> getTransferFunction() const
+  {
+    const auto lock = std::lock_guard<std::mutex>(mutex);
+    return transferFunction;
+  }
+
+  // Audio thread. Queues the input for analysis and, if excitation is not
+  // null, overwrites it with the next pink noise samples. The reference (or
+  // else the noise) is queued along with the input. Input and excitation may
+  // be the same channel; the input is queued first. Samples only get lost if
+  // the analysis thread stalls for longer than a second, and the noise is
+  // silent if its generation falls behind:
+  void process(const float* input,
+               const float* reference,
+               float* excitation,
+               int numSamples)
+  {
+    const auto n = size_t(std::max(numSamples, 0));
+    const auto region = captures.prepareWrite(n);
+    copy(input, captures.channel(0), region);
+    if (excitation != nullptr) {
+      const auto numGenerated = noise.read(&excitation, n);
+      std::fill(excitation + numGenerated, excitation + n, 0.0f);
+    }
+    if (reference != nullptr) {
+      copy(reference, captures.channel(1), region);
+    } else if (excitation != nullptr) {
+      copy(excitation, captures.channel(1), region);
+    } else {
+      auto* queued = captures.channel(1);
+      std::fill_n(queued + region.start1, region.size1, 0.0f);
+      std::fill_n(queued + region.start2, region.size2, 0.0f);
+    }
+    captures.finishWrite(region.size());
+  }
+
+private:
+  using Ring = SpscRing<float>;
+
+  static void copy(const float* source, float* ring, const Ring::Region& region)
+  {
+    std::copy_n(source, region.size1, ring + region.start1);
+    std::copy_n(source + region.size1, region.size2, ring + region.start2);
+  }
+
+  void startAnalysis()
+  {
+    if (sampleRate <= 0 || worker.joinable())
+      return;
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      stopping = false;
+    }
+    worker = std::thread([this] { analyse(); });
+  }
+
+  void stopAnalysis()
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    if (worker.joinable())
+      worker.join();
+  }
+
+  void analyse()
+  {
+    using Clock = std::chrono::steady_clock;
+    constexpr auto pollInterval = std::chrono::milliseconds(10);
+
+    // Whatever was queued while the analysis was stopped is stale:
+    captures.finishRead(captures.prepareRead(captures.getCapacity()).size());
+
+    auto pink = PinkNoise();
+    auto analyzer = std::unique_ptr<SpectrumAnalyzer>();
+    auto transfer = std::unique_ptr<TransferFunctionAnalyzer>();
+    auto smoother = std::unique_ptr<SpectrumSmoother>();
+    auto publishInterval = Clock::duration();
+    auto nextPublish = Clock::now();
+
+    // settingsRevision is only read under the lock, like settings:
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    auto revision = settingsRevision - 1;
+    while (!stopping) {
+      if (revision != settingsRevision) {
+        revision = settingsRevision;
+        const auto current = settings;
+        spectrum.reset();
+        transferFunction.reset();
+        lock.unlock();
+        analyzer.reset();
+        transfer.reset();
+        auto fftSize = current.analysis.fftSize;
+        if (current.mode == Mode::spectrum) {
+          analyzer =
+            std::make_unique<SpectrumAnalyzer>(sampleRate, current.analysis);
+        } else {
+          transfer = std::make_unique<TransferFunctionAnalyzer>(
+            sampleRate, current.transfer);
+          fftSize = current.transfer.analysis.fftSize;
+        }
+        smoother = std::make_unique<SpectrumSmoother>(
+          sampleRate,
+          fftSize,
+          dft_log_bins(current.numBands, 20, 20e3),
+          current.smoothing);
+        publishInterval = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1 / current.displayRate));
+        lock.lock();
+        continue; // the settings may have changed again meanwhile
+      }
+      lock.unlock();
+
+      // Top up the noise:
+      const auto gain = noiseGain.load();
+      const auto free = noise.prepareWrite(noise.getCapacity());
+      pink.generate(noise.channel(0) + free.start1, free.size1, gain);
+      pink.generate(noise.channel(0) + free.start2, free.size2, gain);
+      noise.finishWrite(free.size());
+
+      const auto reset = resetRequested.exchange(false);
+      const auto ready = captures.prepareRead(captures.getCapacity());
+      const auto* input = captures.channel(0);
+      const auto* reference = captures.channel(1);
+      if (analyzer) {
+        if (reset)
+          analyzer->reset();
+        analyzer->push(input + ready.start1, ready.size1);
+        analyzer->push(input + ready.start2, ready.size2);
+      } else {
+        if (reset)
+          transfer->reset();
+        transfer->push(
+          reference + ready.start1, input + ready.start1, ready.size1);
+        transfer->push(
+          reference + ready.start2, input + ready.start2, ready.size2);
+      }
+      captures.finishRead(ready.size());
+
+      const auto now = Clock::now();
+      if (now >= nextPublish) {
+        nextPublish = std::max(nextPublish + publishInterval, now);
+        if (analyzer)
+          publish(*analyzer, *smoother);
+        else
+          publish(*transfer, *smoother);
+      }
+
+      lock.lock();
+      changed.wait_for(lock, pollInterval, [this] { return stopping; });
+    }
+  }
+
+  void publish(const SpectrumAnalyzer& analyzer, SpectrumSmoother& smoother)
+  {
+    auto next = std::make_shared<Spectrum>();
+    next->frequencies = smoother.getFrequencies();
+    next->numFrames = analyzer.getNumFrames();
+    const auto power = smoother.bandPower(analyzer.getPower());
+    next->levels.resize(power.size());
+    std::transform(
+      power.cbegin(), power.cend(), next->levels.begin(), [](double p) {
+        return float(10 * std::log10(std::max(p, 1e-20)));
+      });
+
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      spectrum = std::move(next);
+    }
+    sendChangeMessage();
+  }
+
+  void publish(const TransferFunctionAnalyzer& transfer,
+               SpectrumSmoother& smoother)
+  {
+    auto next = std::make_shared<const TransferFunctionEstimate>(
+      transfer.estimate(smoother));
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      transferFunction = std::move(next);
+    }
+    sendChangeMessage();
+  }
+
+  double sampleRate = 0;
+  Ring captures; // input and excitation, audio thread -> analysis thread
+  Ring noise;    // pink noise, analysis thread -> audio thread
+  std::atomic<bool> enabled{ false };
+  std::atomic<int> noiseChannel{ -1 };
+  std::atomic<int> referenceChannel{ -1 };
+  std::atomic<float> noiseGain{ 0.1f };
+  std::atomic<bool> resetRequested{ false };
+  std::thread worker;
+
+  // Guards everything below:
+  mutable std::mutex mutex;
+  std::condition_variable changed;
+  Settings settings;
+  unsigned settingsRevision = 0;
+  std::shared_ptr<const Spectrum> spectrum;
+  std::shared_ptr<const TransferFunctionEstimate> transferFunction;
+  bool stopping = false;
+};
@@ -0,0 +1,213 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "RoomAcoustics.h"
+#include "ParallelFor.h"
+#include "Truncation.h"
+#include <algorithm>
+#include <memory>
+
+namespace {
+// Noise-compensated Schroeder integral of one band: the sum of energy from n
+// to the crosspoint, plus the energy the fitted decay would have behind it:
+class DecayCurve
+{
+public:
+  DecayCurve(const std::vector<float>& energy, double fs)
+  {
+    const auto truncation = find_truncation_point_from_energy(energy, fs);
+    noiseFloorDb = truncation.noiseFloorDb;
+    end = truncation.point;
+
+    // Decay rate in dB per sample; the decay meets the noise at the
+    // crosspoint, so its level there is the noise power:
+    if (truncation.found) {
+      slope = truncation.decayRateDbPerSecond / fs;
+      const auto peak = *std::max_element(energy.cbegin(), energy.cend());
+      const auto noisePower = double(peak) * std::pow(10.0, noiseFloorDb / 10);
+      tail = noisePower / (-slope * std::log(10.0) / 10);
+    }
+
+    remaining.assign(end + 1, 0.0);
+    remaining[end] = tail;
+    for (auto n = end; n-- > 0;)
+      remaining[n] = remaining[n + 1] + double(energy[n]);
+  }
+
+  // Energy from sample n onwards:
+  double at(size_t n) const
+  {
+    if (n <= end)
+      return remaining[n];
+    return slope < 0 ? tail * std::pow(10.0, slope * double(n - end) / 10) : 0;
+  }
+
+  size_t getEnd() const { return end; }
+  double getNoiseFloorDb() const { return noiseFloorDb; }
+
+private:
+  std::vector<double> remaining;
+  size_t end = 0;
+  double slope = 0;
+  double tail = 0;
+  double noiseFloorDb = 0;
+};
+
+// Level of the decay curve in dB relative to the onset, on a grid of step
+// samples, until it falls below lowestDb (inclusive) or reaches the
+// crosspoint. The integrated curve is smooth, so a coarse grid is enough:
+std::vector<double> decay_levels(const DecayCurve& curve,
+                                 size_t onset,
+                                 size_t step,
+                                 double lowestDb)
+{
+  auto levels = std::vector<double>();
+  const auto reference = curve.at(onset);
+  if (reference <= 0)
+    return levels;
+  for (auto n = onset; n < curve.getEnd(); n += step) {
+    levels.push_back(10 * std::log10(curve.at(n) / reference));
+    if (levels.back() <= lowestDb)
+      break;
+  }
+  return levels;
+}
+
+// Decay time (seconds for 60 dB) from a line fitted to the levels between the
+// first at or below upperDb and the first at or below lowerDb. NaN if the
+// levels don't reach lowerDb:
+double decay_time(const std::vector<double>& levels,
+                  size_t step,
+                  double upperDb,
+                  double lowerDb,
+                  double fs)
+{
+  auto n = size_t(0);
+  while (n < levels.size() && levels[n] > upperDb)
+    ++n;
+  const auto first = n;
+  double count = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (; n < levels.size() && levels[n] > lowerDb; ++n) {
+    const auto x = double(n - first);
+    count += 1;
+    sx += x;
+    sy += levels[n];
+    sxx += x * x;
+    sxy += x * levels[n];
+  }
+  const auto denominator = count * sxx - sx * sx;
+  if (n == levels.size() || count < 2 || denominator <= 0)
+    return RoomAcousticParameters::nan;
+
+  const auto slope = (count * sxy - sx * sy) / denominator; // dB per step
+  return slope < 0 ? -60 * double(step) / (slope * fs)
+                   : RoomAcousticParameters::nan;
+}
+
+RoomAcousticParameters evaluate_band(const std::vector<float>& energy,
+                                     size_t onset,
+                                     double fs)
+{
+  const auto curve = DecayCurve(energy, fs);
+  auto result = RoomAcousticParameters{};
+  result.noiseFloorDb = curve.getNoiseFloorDb();
+
+  const auto step = std::max(size_t(1), size_t(fs / 4000)); // 0.25 ms
+  const auto levels = decay_levels(curve, onset, step, -35);
+  result.edt = decay_time(levels, step, 0, -10, fs);
+  result.t20 = decay_time(levels, step, -5, -25, fs);
+  result.t30 = decay_time(levels, step, -5, -35, fs);
+
+  const auto total = curve.at(onset);
+  const auto after50 = curve.at(onset + size_t(std::lround(0.05 * fs)));
+  const auto after80 = curve.at(onset + size_t(std::lround(0.08 * fs)));
+  if (total > 0 && after50 > 0 && after80 > 0) {
+    result.c50 = 10 * std::log10((total - after50) / after50);
+    result.c80 = 10 * std::log10((total - after80) / after80);
+    result.d50 = (total - after50) / total;
+  }
+  return result;
+}
+
+// First sample within 20 dB of the broadband maximum:
+size_t find_onset(const std::vector<float>& ir)
+{
+  auto peak = 0.0f;
+  for (const auto x : ir)
+    peak = std::max(peak, x * x);
+  const auto threshold = peak * 0.01f;
+  return size_t(std::distance(
+    ir.cbegin(), std::find_if(ir.cbegin(), ir.cend(), [=](float x) {
+      return x * x >= threshold;
+    })));
+}
+} // namespace
+
+std::vector<std::vector<RoomAcousticParameters>> room_acoustic_parameters(
+  const std::vector<std::vector<float>>& irs,
+  double fs,
+  const RoomAcousticsSettings& settings)
+{
+  const auto centers = band_center_frequencies(settings.bands, fs);
+  auto bands = std::vector<RoomAcousticParameters>(centers.size());
+  for (size_t band = 0; band < centers.size(); ++band)
+    bands[band].frequency = centers[band];
+  auto results = std::vector<std::vector<RoomAcousticParameters>>(irs.size(),
+                                                                  bands);
+
+  // Per worker: a filter bank and the band signals of one channel:
+  const auto numThreads = resolve_num_threads(settings.numThreads, irs.size());
+  auto filterBanks = std::vector<std::unique_ptr<FilterBank>>(numThreads);
+  auto energies = std::vector<std::vector<std::vector<float>>>(numThreads);
+  parallel_for_with_worker(
+    irs.size(),
+    [&](size_t channel, unsigned worker) {
+      const auto& ir = irs[channel];
+      if (ir.empty())
+        return;
+
+      auto& filterBank = filterBanks[worker];
+      if (!filterBank)
+        filterBank = std::make_unique<FilterBank>(settings.bands, fs);
+      auto& energy = energies[worker];
+      energy.resize(centers.size());
+      auto outputs = std::vector<float*>();
+      for (auto& band : energy) {
+        band.resize(ir.size());
+        outputs.push_back(band.data());
+      }
+      filterBank->reset();
+      filterBank->process(ir.data(), outputs.data(), ir.size());
+
+      const auto onset = find_onset(ir);
+      for (size_t band = 0; band < centers.size(); ++band) {
+        for (auto& sample : energy[band])
+          sample *= sample;
+        const auto frequency = results[channel][band].frequency;
+        results[channel][band] = evaluate_band(energy[band], onset, fs);
+        results[channel][band].frequency = frequency;
+      }
+    },
+    numThreads);
+  return results;
+}
@@ -0,0 +1,65 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include "FilterBank.h"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Room-acoustic parameters after ISO 3382-1, per octave or third-octave band
+// (see FilterBank.h). Each band's energy decay is Schroeder-integrated from
+// its noise-floor crosspoint (see Truncation.h), with the energy that the
+// fitted decay would have had behind the crosspoint added as compensation.
+
+struct RoomAcousticsSettings
+{
+  FilterBankSettings bands;
+  unsigned numThreads = 0; // 0 = one per hardware thread
+};
+
+// NaN wherever the decay doesn't cover the evaluation range above its noise
+// floor:
+struct RoomAcousticParameters
+{
+  static constexpr auto nan = std::numeric_limits<double>::quiet_NaN();
+
+  double frequency = 0; // nominal band center
+  double edt = nan;     // early decay time (0 ... -10 dB), seconds
+  double t20 = nan;     // reverberation time from -5 ... -25 dB, seconds
+  double t30 = nan;     // reverberation time from -5 ... -35 dB, seconds
+  double c50 = nan;     // clarity, dB
+  double c80 = nan;     // clarity, dB
+  double d50 = nan;     // definition, 0 ... 1
+  double noiseFloorDb = 0; // relative to the band's peak
+};
+
+// Parameters for every band of every IR, result[channel][band]. IRs should
+// start before the direct sound; all times are relative to the point where
+// the broadband energy first comes within 20 dB of its maximum. Channels are
+// processed in parallel:
+std::vector<std::vector<RoomAcousticParameters>> room_acoustic_parameters(
+  const std::vector<std::vector<float>>& irs,
+  double fs,
+  const RoomAcousticsSettings& = {});
@@ -0,0 +1,257 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "SessionStore.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Headers are plain structs copied with memcpy, in host byte order like the
+// sample data (see DataFiles.cpp).
+
+namespace {
+constexpr char fileMagic[8] = { 'M', 'S', 'W', 'S', 'E', 'S', 'S', 'N' };
+constexpr uint32_t fileVersion = 1;
+constexpr size_t alignment = 64;
+
+struct FileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t numChunks;
+  char reserved[48];
+};
+
+struct ChunkHeader
+{
+  char id[4];
+  uint32_t reserved0;
+  uint64_t payloadSize; // bytes following this header
+  int32_t channel;
+  uint32_t numCaptureChannels;
+  uint64_t captureLength;
+  uint64_t irLength;
+  uint64_t irOffset;
+  double fs;
+  double duration;
+  double lowerFreq;
+  double upperFreq;
+  uint32_t referenceChannel;
+  float regularization;
+  uint32_t truncation; // 0: off, 1: on, 2: on and a point was found
+  float fadeLength;
+  uint64_t truncationPoint; // relative to irOffset
+  float noiseFloorDb;
+  float decayRateDbPerSecond;
+  float discardedEnergyDb;
+  uint32_t numBands; // of room acoustics, following the IR
+  char reserved1[8];
+};
+
+struct AcousticsBand
+{
+  double frequency;
+  double edt;
+  double t20;
+  double t30;
+  double c50;
+  double c80;
+  double d50;
+  double noiseFloorDb;
+};
+
+static_assert(sizeof(FileHeader) == 64, "unexpected padding");
+static_assert(sizeof(ChunkHeader) == 128, "unexpected padding");
+static_assert(sizeof(AcousticsBand) == alignment, "unexpected padding");
+
+size_t padded_bytes(size_t numFloats)
+{
+  return (numFloats * sizeof(float) + alignment - 1) / alignment * alignment;
+}
+
+bool write_padded(std::FILE* file, const float* data, size_t numFloats)
+{
+  static const char zeros[alignment] = {};
+  const auto padding = padded_bytes(numFloats) - numFloats * sizeof(float);
+  return (numFloats == 0 ||
+          std::fwrite(data, sizeof(float), numFloats, file) == numFloats) &&
+         std::fwrite(zeros, 1, padding, file) == padding;
+}
+} // namespace
+
+bool write_session(const std::string& path,
+                   const std::vector<SessionChannel>& channels)
+{
+  const auto temporaryPath = path + ".tmp";
+  auto* file = std::fopen(temporaryPath.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+
+  auto header = FileHeader{};
+  std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+  header.version = fileVersion;
+  header.numChunks = uint32_t(channels.size());
+  auto ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+  for (const auto& channel : channels) {
+    auto chunk = ChunkHeader{};
+    std::memcpy(chunk.id, "CHAN", 4);
+    chunk.irLength = channel.ir != nullptr ? channel.irLength : 0;
+    chunk.payloadSize = channel.capture.size() *
+                          padded_bytes(channel.captureLength) +
+                        padded_bytes(chunk.irLength) +
+                        channel.acoustics.size() * sizeof(AcousticsBand);
+    chunk.channel = channel.channel;
+    chunk.numCaptureChannels = uint32_t(channel.capture.size());
+    chunk.captureLength = channel.captureLength;
+    chunk.irOffset = channel.irOffset;
+    chunk.fs = channel.sweep.fs;
+    chunk.duration = channel.sweep.duration;
+    chunk.lowerFreq = channel.sweep.lowerFreq;
+    chunk.upperFreq = channel.sweep.upperFreq;
+    chunk.referenceChannel = channel.referenceChannel ? 1 : 0;
+    chunk.regularization = channel.regularization;
+    chunk.truncation = !channel.truncation.enabled        ? 0
+                       : !channel.truncationResult.found ? 1
+                                                         : 2;
+    chunk.fadeLength = channel.truncation.fadeLength;
+    chunk.truncationPoint = channel.truncationResult.point;
+    chunk.noiseFloorDb = float(channel.truncationResult.noiseFloorDb);
+    chunk.decayRateDbPerSecond =
+      float(channel.truncationResult.decayRateDbPerSecond);
+    chunk.discardedEnergyDb = float(channel.truncationResult.discardedEnergyDb);
+    chunk.numBands = uint32_t(channel.acoustics.size());
+
+    ok = ok && std::fwrite(&chunk, sizeof(chunk), 1, file) == 1;
+    for (const auto* capture : channel.capture)
+      ok = ok && write_padded(file, capture, channel.captureLength);
+    ok = ok && write_padded(file, channel.ir, chunk.irLength);
+    for (const auto& parameters : channel.acoustics) {
+      const auto band = AcousticsBand{
+        parameters.frequency, parameters.edt, parameters.t20,
+        parameters.t30,       parameters.c50, parameters.c80,
+        parameters.d50,       parameters.noiseFloorDb
+      };
+      ok = ok && std::fwrite(&band, sizeof(band), 1, file) == 1;
+    }
+  }
+
+  ok = std::fclose(file) == 0 && ok;
+  ok = ok && std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+  if (!ok)
+    std::remove(temporaryPath.c_str());
+  return ok;
+}
+
+// =============================================================================
+
+SessionFile::SessionFile(const std::string& path)
+  : file(path)
+{
+  auto header = FileHeader{};
+  if (file.size() < sizeof(header))
+    return;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, fileMagic, sizeof(fileMagic)) != 0 ||
+      header.version != fileVersion)
+    return;
+
+  auto offset = sizeof(header);
+  for (uint32_t i = 0; i < header.numChunks; ++i) {
+    auto chunk = ChunkHeader{};
+    if (file.size() - offset < sizeof(chunk))
+      return;
+    std::memcpy(&chunk, file.data() + offset, sizeof(chunk));
+    offset += sizeof(chunk);
+    if (file.size() - offset < chunk.payloadSize)
+      return;
+
+    if (std::memcmp(chunk.id, "CHAN", 4) == 0) {
+      // Checked piecewise, so corrupt lengths can't overflow:
+      if (chunk.captureLength > chunk.payloadSize ||
+          chunk.irLength > chunk.payloadSize)
+        return;
+      const auto captureBytes = padded_bytes(chunk.captureLength);
+      const auto irBytes = padded_bytes(chunk.irLength);
+      const auto bandBytes = uint64_t(chunk.numBands) * sizeof(AcousticsBand);
+      if (irBytes > chunk.payloadSize ||
+          bandBytes > chunk.payloadSize - irBytes ||
+          (chunk.numCaptureChannels > 0 &&
+           captureBytes > (chunk.payloadSize - irBytes - bandBytes) /
+                            chunk.numCaptureChannels))
+        return;
+
+      // Both headers are multiples of 64 bytes, so all data is aligned:
+      const auto* data = file.data() + offset;
+      auto channel = SessionChannel{};
+      channel.channel = chunk.channel;
+      channel.sweep = { chunk.fs, chunk.duration, chunk.lowerFreq,
+                        chunk.upperFreq };
+      for (uint32_t c = 0; c < chunk.numCaptureChannels; ++c)
+        channel.capture.push_back(
+          reinterpret_cast<const float*>(data + c * captureBytes));
+      channel.captureLength = size_t(chunk.captureLength);
+      channel.irLength = size_t(chunk.irLength);
+      if (channel.irLength > 0)
+        channel.ir = reinterpret_cast<const float*>(
+          data + chunk.numCaptureChannels * captureBytes);
+      channel.irOffset = size_t(chunk.irOffset);
+      channel.referenceChannel = chunk.referenceChannel != 0;
+      channel.regularization = chunk.regularization;
+      channel.truncation = { chunk.truncation != 0, chunk.fadeLength };
+      auto& truncation = channel.truncationResult;
+      truncation.found = chunk.truncation == 2;
+      truncation.point = size_t(chunk.truncationPoint);
+      truncation.noiseFloorDb = chunk.noiseFloorDb;
+      truncation.decayRateDbPerSecond = chunk.decayRateDbPerSecond;
+      truncation.discardedEnergyDb = chunk.discardedEnergyDb;
+      const auto* bands =
+        data + chunk.numCaptureChannels * captureBytes + irBytes;
+      for (uint32_t b = 0; b < chunk.numBands; ++b) {
+        auto band = AcousticsBand{};
+        std::memcpy(&band, bands + b * sizeof(band), sizeof(band));
+        channel.acoustics.push_back({ band.frequency,
+                                      band.edt,
+                                      band.t20,
+                                      band.t30,
+                                      band.c50,
+                                      band.c80,
+                                      band.d50,
+                                      band.noiseFloorDb });
+      }
+      channels.push_back(channel);
+    }
+    offset += chunk.payloadSize;
+  }
+  valid = true;
+}
+
+const SessionChannel* SessionFile::find(int channel) const
+{
+  const auto entry = std::find_if(
+    channels.cbegin(), channels.cend(), [channel](const auto& candidate) {
+      return candidate.channel == channel;
+    });
+  return entry != channels.cend() ? &*entry : nullptr;
+}
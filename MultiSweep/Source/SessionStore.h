@@ -0,0 +1,96 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include "DataFiles.h"
+#include "RoomAcoustics.h"
+#include "Truncation.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Measurements of a session (raw captures, the sweep that was played and the
+// derived IRs) in one chunked binary file. Opening a session only reads the
+// chunk headers; the float data stays in the memory-mapped file and is paged
+// in when a channel is actually used.
+//
+// Layout, all numbers in the byte order of the writing host (files from hosts
+// of the other order are rejected, as their version doesn't match): a 64 byte
+// file header ("MSWSESSN", version, number of chunks), then one chunk per
+// measured output channel: a 128 byte chunk header (id "CHAN", payload size,
+// channel, sweep parameters, lengths) followed by the capture channels and
+// the IR as float32, each padded to a multiple of 64 bytes, and the room
+// acoustics of the IR as 64 bytes (8 doubles) per band. Chunks with unknown
+// ids are skipped.
+
+struct SessionSweep
+{
+  double fs = 48000;
+  double duration = 2;
+  double lowerFreq = 20;
+  double upperFreq = 20e3;
+};
+
+// One measured output channel. Data pointers refer to the caller's buffers
+// when writing and into the mapping when reading:
+struct SessionChannel
+{
+  int channel = 0;
+  SessionSweep sweep;
+
+  std::vector<const float*> capture; // mic (+ loopback)
+  size_t captureLength = 0;
+
+  // How the IR was derived, so it is only reused with the same settings:
+  const float* ir = nullptr;
+  size_t irLength = 0;
+  size_t irOffset = 0; // of the zero-delay sample, after the lead-in trim
+  bool referenceChannel = false;
+  float regularization = 0;
+  TruncationSettings truncation{ false };
+  TruncationResult truncationResult;
+  std::vector<RoomAcousticParameters> acoustics; // empty if not evaluated
+};
+
+// Writes to a temporary file next to path and renames it, so a session is
+// never seen half-written. Sessions are written to new files rather than
+// replacing existing ones, which may still be mapped (and can't be replaced
+// at all on Windows then):
+bool write_session(const std::string& path,
+                   const std::vector<SessionChannel>& channels);
+
+class SessionFile
+{
+public:
+  explicit SessionFile(const std::string& path);
+
+  bool isOpen() const { return valid; }
+  const std::vector<SessionChannel>& getChannels() const { return channels; }
+  const SessionChannel* find(int channel) const;
+
+private:
+  MappedFile file;
+  std::vector<SessionChannel> channels;
+  bool valid = false;
+};
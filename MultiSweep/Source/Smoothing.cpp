@@ -0,0 +1,201 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#include "Smoothing.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+double window_width_octaves(float fraction)
+{
+  return 1.0 / double(std::clamp(fraction, 1.0f, 48.0f));
+}
+
+// Glasberg & Moore
+double equivalent_rectangular_bandwidth(double frequency)
+{
+  return 24.7 * (4.37 * frequency / 1000 + 1);
+}
+} // namespace
+
+SpectrumSmoother::SpectrumSmoother(double _sampleRate,
+                                   size_t _fftSize,
+                                   std::vector<float> _frequencies,
+                                   Smoothing _smoothing)
+  : sampleRate(_sampleRate)
+  , fftSize(_fftSize)
+  , numInputBins(fftSize / 2 + 1)
+  , smoothing(_smoothing)
+  , frequencies(std::move(_frequencies))
+  , windows(frequencies.size())
+  , prefixSum(numInputBins + 1)
+{
+  const auto& f = frequencies;
+  const auto binWidth = sampleRate / double(fftSize);
+  const auto lastBin = double(numInputBins - 1);
+
+  // Bin k covers [k - 0.5, k + 0.5) in bin coordinates:
+  const auto position = [&](double frequency) {
+    const auto x = std::clamp(frequency / binWidth + 0.5, 0.0, lastBin + 1);
+    const auto index = std::min(std::floor(x), lastBin);
+    return Position{ uint32_t(index), x - index };
+  };
+
+  for (size_t i = 0; i < f.size(); ++i) {
+    auto lower = double(f[i]);
+    auto upper = double(f[i]);
+    switch (smoothing.type) {
+      case SmoothingType::none:
+        // Geometric midpoints to the neighbours (mirrored at the ends):
+        if (f.size() > 1) {
+          const auto previous = i > 0 ? double(f[i - 1])
+                                      : double(f[i]) * f[i] / double(f[i + 1]);
+          const auto next = i + 1 < f.size()
+                              ? double(f[i + 1])
+                              : double(f[i]) * f[i] / double(f[i - 1]);
+          lower = std::sqrt(previous * f[i]);
+          upper = std::sqrt(next * f[i]);
+        }
+        break;
+      case SmoothingType::fractionalOctave: {
+        const auto halfWidth =
+          std::exp2(window_width_octaves(smoothing.octaveFraction) / 2);
+        lower = f[i] / halfWidth;
+        upper = f[i] * halfWidth;
+        break;
+      }
+      case SmoothingType::erb: {
+        const auto halfWidth = equivalent_rectangular_bandwidth(f[i]) / 2;
+        lower = std::max(0.0, f[i] - halfWidth);
+        upper = f[i] + halfWidth;
+        break;
+      }
+    }
+
+    auto& window = windows[i];
+    const auto widthInBins = (upper - lower) / binWidth;
+    if (widthInBins >= 1 && std::isfinite(widthInBins)) {
+      window.lower = position(lower);
+      window.upper = position(upper);
+      const auto extent = (window.upper.index + window.upper.fraction) -
+                          (window.lower.index + window.lower.fraction);
+      window.normalisation = extent > 0 ? 1 / extent : 0;
+    }
+    if (window.normalisation == 0) {
+      // Interpolate between the two bins around f[i]:
+      const auto x = std::clamp(double(f[i]) / binWidth, 0.0, lastBin);
+      const auto index = std::min(std::floor(x), std::max(0.0, lastBin - 1));
+      window.lower = { uint32_t(index), numInputBins > 1 ? x - index : 0 };
+    }
+  }
+}
+
+bool SpectrumSmoother::matches(double otherSampleRate,
+                               size_t otherFFTSize,
+                               const std::vector<float>& otherFrequencies,
+                               Smoothing otherSmoothing) const
+{
+  return sampleRate == otherSampleRate && fftSize == otherFFTSize &&
+         smoothing == otherSmoothing && frequencies == otherFrequencies;
+}
+
+template<typename Value>
+void SpectrumSmoother::buildPrefixSum(const Value* values, bool square)
+{
+  prefixSum[0] = 0;
+  for (size_t k = 0; k < numInputBins; ++k) {
+    const auto value = double(values[k]);
+    prefixSum[k + 1] = prefixSum[k] + (square ? value * value : value);
+  }
+}
+
+double SpectrumSmoother::evaluate(const Window& window) const
+{
+  const auto& P = prefixSum;
+  const auto cumulative = [&P](const Position& position) {
+    return (1 - position.fraction) * P[position.index] +
+           position.fraction * P[position.index + 1];
+  };
+
+  if (window.normalisation > 0)
+    return (cumulative(window.upper) - cumulative(window.lower)) *
+           window.normalisation;
+
+  const auto k = window.lower.index;
+  const auto fraction = window.lower.fraction;
+  const auto current = P[k + 1] - P[k];
+  const auto next = k + 2 < P.size() ? P[k + 2] - P[k + 1] : current;
+  return (1 - fraction) * current + fraction * next;
+}
+
+std::vector<float> SpectrumSmoother::magnitudeDb(
+  const std::vector<float>& magnitude)
+{
+  assert(magnitude.size() == numInputBins);
+  buildPrefixSum(magnitude.data(), true);
+
+  auto output = std::vector<float>(windows.size());
+  for (size_t i = 0; i < windows.size(); ++i)
+    output[i] = float(10 * std::log10(evaluate(windows[i])));
+  return output;
+}
+
+RealVector SpectrumSmoother::power(const RealVector& power)
+{
+  assert(power.size() == numInputBins);
+  buildPrefixSum(power.data(), false);
+
+  auto output = RealVector(windows.size());
+  for (size_t i = 0; i < windows.size(); ++i)
+    output[i] = evaluate(windows[i]);
+  return output;
+}
+
+RealVector SpectrumSmoother::bandPower(const RealVector& power)
+{
+  assert(power.size() == numInputBins);
+  buildPrefixSum(power.data(), false);
+
+  auto output = RealVector(windows.size());
+  for (size_t i = 0; i < windows.size(); ++i) {
+    const auto& window = windows[i];
+    output[i] = window.normalisation > 0
+                  ? evaluate(window) / window.normalisation
+                  : evaluate(window);
+  }
+  return output;
+}
+
+std::vector<float> smoothed_magnitude_with_log_bins(
+  const std::vector<float>& input,
+  float sampleRate,
+  uint numbins,
+  Smoothing smoothing)
+{
+  auto smoother = SpectrumSmoother(
+    sampleRate,
+    dft_size(input.size()),
+    dft_log_bins(numbins, 20e0, 20e3),
+    smoothing);
+  return smoother.magnitudeDb(dft_magnitude(input));
+}
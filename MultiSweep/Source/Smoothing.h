@@ -0,0 +1,113 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#pragma once
+
+#include "fft.h"
+#include <cstdint>
+#include <vector>
+
+enum class SmoothingType
+{
+  none,             // plain average over each output bin's own extent
+  fractionalOctave, // 1 / octaveFraction octave wide window
+  erb               // one equivalent rectangular bandwidth wide window
+};
+
+struct Smoothing
+{
+  SmoothingType type = SmoothingType::none;
+  float octaveFraction = 6; // 1 (octave) ... 48
+
+  bool operator==(const Smoothing& other) const
+  {
+    return type == other.type && octaveFraction == other.octaveFraction;
+  }
+};
+
+// Maps a linear DFT spectrum (fftSize / 2 + 1 bins) onto arbitrary output
+// frequencies, e.g. the log-spaced grid from dft_log_bins(), averaging power
+// over a window around each output frequency. Window edges and weights are
+// computed once in the constructor; each call then builds a prefix sum over
+// the power spectrum, so every output bin costs O(1) regardless of its width.
+// Windows narrower than one DFT bin fall back to linear interpolation.
+// Not thread-safe, use one instance per thread.
+class SpectrumSmoother
+{
+public:
+  SpectrumSmoother(double sampleRate,
+                   size_t fftSize,
+                   std::vector<float> frequencies,
+                   Smoothing smoothing = {});
+
+  bool matches(double sampleRate,
+               size_t fftSize,
+               const std::vector<float>& frequencies,
+               Smoothing smoothing) const;
+
+  const std::vector<float>& getFrequencies() const { return frequencies; }
+  size_t getNumInputBins() const { return numInputBins; }
+
+  // Linear magnitudes in, smoothed levels in dB out:
+  std::vector<float> magnitudeDb(const std::vector<float>& magnitude);
+
+  // Power (|X|^2) in, smoothed power out:
+  RealVector power(const RealVector& power);
+
+  // Power in, total power inside each window out (band levels, e.g. for an
+  // RTA). Windows narrower than one bin yield the interpolated bin instead:
+  RealVector bandPower(const RealVector& power);
+
+private:
+  // Cumulative power at a fractional bin position is interpolated between two
+  // prefix sums: (1 - fraction) * P[index] + fraction * P[index + 1].
+  struct Position
+  {
+    uint32_t index;
+    double fraction;
+  };
+  struct Window
+  {
+    Position lower;
+    Position upper;
+    double normalisation; // 0 means interpolate at lower
+  };
+
+  template<typename Value>
+  void buildPrefixSum(const Value* values, bool square);
+  double evaluate(const Window& window) const;
+
+  double sampleRate;
+  size_t fftSize;
+  size_t numInputBins;
+  Smoothing smoothing;
+  std::vector<float> frequencies;
+  std::vector<Window> windows;
+  RealVector prefixSum;
+};
+
+// Convenience wrapper for one-off use, builds the tables on every call:
+std::vector<float> smoothed_magnitude_with_log_bins(
+  const std::vector<float>& input,
+  float sampleRate,
+  uint numbins,
+  Smoothing smoothing);
@@ -0,0 +1,316 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#include "SpectralKernels.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MULTISWEEP_SSE2 1
+#endif
+
+namespace {
+constexpr auto ln2 = 0.69314718055994530942;
+constexpr auto tanPiOver8 = 0.41421356237309504880;
+constexpr auto smallestNormal = 2.2250738585072014e-308;
+
+// Scalar and SSE2 versions of the polynomial evaluations share one template,
+// these overloads provide the arithmetic for both:
+double constant(double value, double) { return value; }
+double multiply(double a, double b) { return a * b; }
+double multiply_add(double a, double b, double c) { return a * b + c; }
+
+#ifdef MULTISWEEP_SSE2
+__m128d constant(double value, __m128d) { return _mm_set1_pd(value); }
+__m128d multiply(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+__m128d multiply_add(__m128d a, __m128d b, __m128d c)
+{
+  return _mm_add_pd(_mm_mul_pd(a, b), c);
+}
+#endif
+
+// ln(m) for m in [sqrt(1/2), sqrt(2)) with s = (m - 1) / (m + 1):
+// ln(m) = 2 (s + s^3 / 3 + s^5 / 5 + ...), |s| < 0.172
+template<typename Value>
+Value log_series(Value s)
+{
+  const auto s2 = multiply(s, s);
+  auto sum = constant(1.0 / 13, s);
+  for (int k = 11; k >= 1; k -= 2)
+    sum = multiply_add(sum, s2, constant(1.0 / k, s));
+  return multiply(constant(2, s), multiply(s, sum));
+}
+
+// atan(a) for a in [0, tan(pi / 8)], Taylor series up to a^23:
+template<typename Value>
+Value atan_series(Value a)
+{
+  const auto a2 = multiply(a, a);
+  auto sum = constant(-1.0 / 23, a);
+  for (int k = 21; k >= 1; k -= 2)
+    sum = multiply_add(sum, a2, constant(((k / 2) % 2 ? -1.0 : 1.0) / k, a));
+  return multiply(a, sum);
+}
+
+double fast_ln(double x)
+{
+  x = x < smallestNormal ? smallestNormal : x;
+  auto bits = uint64_t();
+  std::memcpy(&bits, &x, sizeof(x));
+
+  // x = 2^e * m, with m moved into [sqrt(1/2), sqrt(2)):
+  auto exponent = int64_t(bits >> 52) - 1023;
+  bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+  auto mantissa = 0.0;
+  std::memcpy(&mantissa, &bits, sizeof(bits));
+  if (mantissa > M_SQRT2) {
+    mantissa *= 0.5;
+    ++exponent;
+  }
+  return double(exponent) * ln2 +
+         log_series((mantissa - 1) / (mantissa + 1));
+}
+
+double fast_atan2(double y, double x)
+{
+  const auto ax = std::abs(x);
+  const auto ay = std::abs(y);
+  const auto larger = ax > ay ? ax : ay;
+  const auto smaller = ax > ay ? ay : ax;
+  auto a = larger > 0 ? smaller / larger : 0.0;
+
+  // atan(a) = pi / 4 + atan((a - 1) / (a + 1)):
+  const auto reduce = a > tanPiOver8;
+  a = reduce ? (a - 1) / (a + 1) : a;
+  auto r = atan_series(a) + (reduce ? M_PI / 4 : 0.0);
+
+  r = ay > ax ? M_PI / 2 - r : r;
+  r = x < 0 ? M_PI - r : r;
+  return std::signbit(y) ? -r : r;
+}
+
+#ifdef MULTISWEEP_SSE2
+// Re and im of two bins, deinterleaved:
+struct TwoBins
+{
+  __m128d re;
+  __m128d im;
+};
+
+TwoBins load_two(const ComplexType* input)
+{
+  const auto* data = reinterpret_cast<const double*>(input);
+  const auto first = _mm_loadu_pd(data);
+  const auto second = _mm_loadu_pd(data + 2);
+  return { _mm_unpacklo_pd(first, second), _mm_unpackhi_pd(first, second) };
+}
+
+__m128d power_two(const TwoBins& bins)
+{
+  return _mm_add_pd(_mm_mul_pd(bins.re, bins.re),
+                    _mm_mul_pd(bins.im, bins.im));
+}
+
+__m128d select(__m128d mask, __m128d ifTrue, __m128d ifFalse)
+{
+  return _mm_or_pd(_mm_and_pd(mask, ifTrue), _mm_andnot_pd(mask, ifFalse));
+}
+
+__m128d fast_ln(__m128d x)
+{
+  x = _mm_max_pd(x, _mm_set1_pd(smallestNormal));
+  const auto bits = _mm_castpd_si128(x);
+
+  // Biased exponents of both lanes, packed into the low two int32s:
+  const auto biased = _mm_shuffle_epi32(_mm_srli_epi64(bits, 52),
+                                        _MM_SHUFFLE(3, 1, 2, 0));
+  auto exponent = _mm_sub_pd(_mm_cvtepi32_pd(biased), _mm_set1_pd(1023));
+
+  auto mantissa = _mm_castsi128_pd(
+    _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(0x000fffffffffffffll)),
+                 _mm_set1_epi64x(0x3ff0000000000000ll)));
+  const auto large = _mm_cmpgt_pd(mantissa, _mm_set1_pd(M_SQRT2));
+  mantissa =
+    select(large, _mm_mul_pd(mantissa, _mm_set1_pd(0.5)), mantissa);
+  exponent = _mm_add_pd(exponent, _mm_and_pd(large, _mm_set1_pd(1)));
+
+  const auto one = _mm_set1_pd(1);
+  const auto s =
+    _mm_div_pd(_mm_sub_pd(mantissa, one), _mm_add_pd(mantissa, one));
+  return _mm_add_pd(_mm_mul_pd(exponent, _mm_set1_pd(ln2)), log_series(s));
+}
+
+__m128d fast_atan2(__m128d y, __m128d x)
+{
+  const auto signMask = _mm_set1_pd(-0.0);
+  const auto ax = _mm_andnot_pd(signMask, x);
+  const auto ay = _mm_andnot_pd(signMask, y);
+  const auto larger = _mm_max_pd(ax, ay);
+  const auto smaller = _mm_min_pd(ax, ay);
+  const auto zero = _mm_setzero_pd();
+  const auto nonZero = _mm_cmpgt_pd(larger, zero);
+  auto a = _mm_and_pd(nonZero, _mm_div_pd(smaller, _mm_max_pd(larger, zero)));
+
+  const auto one = _mm_set1_pd(1);
+  const auto reduce = _mm_cmpgt_pd(a, _mm_set1_pd(tanPiOver8));
+  a = select(reduce, _mm_div_pd(_mm_sub_pd(a, one), _mm_add_pd(a, one)), a);
+  auto r =
+    _mm_add_pd(atan_series(a), _mm_and_pd(reduce, _mm_set1_pd(M_PI / 4)));
+
+  r = select(_mm_cmpgt_pd(ay, ax), _mm_sub_pd(_mm_set1_pd(M_PI / 2), r), r);
+  r = select(_mm_cmplt_pd(x, zero), _mm_sub_pd(_mm_set1_pd(M_PI), r), r);
+  return _mm_or_pd(r, _mm_and_pd(signMask, y));
+}
+
+// (ar + j ai) * (br + j bi) for one bin stored as [re, im]:
+__m128d complex_multiply(__m128d a, __m128d b)
+{
+  const auto bRe = _mm_unpacklo_pd(b, b);
+  const auto bIm = _mm_unpackhi_pd(b, b);
+  const auto aSwapped = _mm_shuffle_pd(a, a, 1);
+  const auto sign = _mm_set_pd(1.0, -1.0);
+  return _mm_add_pd(_mm_mul_pd(a, bRe),
+                    _mm_mul_pd(_mm_mul_pd(aSwapped, bIm), sign));
+}
+#endif
+} // namespace
+
+
+void spectral_magnitude(const ComplexType* input, RealType* output, size_t n)
+{
+  size_t k = 0;
+#ifdef MULTISWEEP_SSE2
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(output + k, _mm_sqrt_pd(power_two(load_two(input + k))));
+#endif
+  for (; k < n; ++k)
+    output[k] = std::sqrt(std::norm(input[k]));
+}
+
+void spectral_power(const ComplexType* input, RealType* output, size_t n)
+{
+  size_t k = 0;
+#ifdef MULTISWEEP_SSE2
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(output + k, power_two(load_two(input + k)));
+#endif
+  for (; k < n; ++k)
+    output[k] = std::norm(input[k]);
+}
+
+void spectral_db(const RealType* magnitude, RealType* output, size_t n)
+{
+  constexpr auto factor = 20 / 2.30258509299404568402; // 20 / ln(10)
+  size_t k = 0;
+#ifdef MULTISWEEP_SSE2
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(output + k,
+                  _mm_mul_pd(_mm_set1_pd(factor),
+                             fast_ln(_mm_loadu_pd(magnitude + k))));
+#endif
+  for (; k < n; ++k)
+    output[k] = factor * fast_ln(magnitude[k]);
+}
+
+void spectral_power_db(const ComplexType* input, RealType* output, size_t n)
+{
+  constexpr auto factor = 10 / 2.30258509299404568402; // 10 / ln(10)
+  size_t k = 0;
+#ifdef MULTISWEEP_SSE2
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(
+      output + k,
+      _mm_mul_pd(_mm_set1_pd(factor), fast_ln(power_two(load_two(input + k)))));
+#endif
+  for (; k < n; ++k)
+    output[k] = factor * fast_ln(std::norm(input[k]));
+}
+
+void spectral_phase(const ComplexType* input, RealType* output, size_t n)
+{
+  size_t k = 0;
+#ifdef MULTISWEEP_SSE2
+  for (; k + 2 <= n; k += 2) {
+    const auto bins = load_two(input + k);
+    _mm_storeu_pd(output + k, fast_atan2(bins.im, bins.re));
+  }
+#endif
+  for (; k < n; ++k)
+    output[k] = fast_atan2(input[k].imag(), input[k].real());
+}
+
+void complex_multiply_accumulate(const ComplexType* a,
+                                 const ComplexType* b,
+                                 ComplexType* accumulator,
+                                 size_t n)
+{
+#ifdef MULTISWEEP_SSE2
+  const auto* x = reinterpret_cast<const double*>(a);
+  const auto* y = reinterpret_cast<const double*>(b);
+  auto* sum = reinterpret_cast<double*>(accumulator);
+  for (size_t k = 0; k < 2 * n; k += 2)
+    _mm_storeu_pd(sum + k,
+                  _mm_add_pd(_mm_loadu_pd(sum + k),
+                             complex_multiply(_mm_loadu_pd(x + k),
+                                              _mm_loadu_pd(y + k))));
+#else
+  for (size_t k = 0; k < n; ++k) {
+    const auto re = a[k].real() * b[k].real() - a[k].imag() * b[k].imag();
+    const auto im = a[k].real() * b[k].imag() + a[k].imag() * b[k].real();
+    accumulator[k] += ComplexType(re, im);
+  }
+#endif
+}
+
+void complex_multiply_scaled(const ComplexType* a,
+                             const ComplexType* b,
+                             RealType scale,
+                             ComplexType* output,
+                             size_t n)
+{
+#ifdef MULTISWEEP_SSE2
+  const auto* x = reinterpret_cast<const double*>(a);
+  const auto* y = reinterpret_cast<const double*>(b);
+  auto* result = reinterpret_cast<double*>(output);
+  const auto factor = _mm_set1_pd(scale);
+  for (size_t k = 0; k < 2 * n; k += 2)
+    _mm_storeu_pd(
+      result + k,
+      _mm_mul_pd(factor,
+                 complex_multiply(_mm_loadu_pd(x + k), _mm_loadu_pd(y + k))));
+#else
+  for (size_t k = 0; k < n; ++k) {
+    const auto re = a[k].real() * b[k].real() - a[k].imag() * b[k].imag();
+    const auto im = a[k].real() * b[k].imag() + a[k].imag() * b[k].real();
+    output[k] = ComplexType(scale * re, scale * im);
+  }
+#endif
+}
+
+void real_scale(RealType* data, RealType scale, size_t n)
+{
+  // Simple enough for the compiler to vectorize:
+  for (size_t k = 0; k < n; ++k)
+    data[k] *= scale;
+}
@@ -0,0 +1,61 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#pragma once
+
+#include "fft.h"
+#include <cstddef>
+
+// Elementwise kernels for interleaved complex spectra (std::complex is laid out
+// as re, im). They process two bins per SSE2 register where available and fall
+// back to the same (branch-free) scalar code elsewhere. Input and output may
+// alias only where noted.
+
+// |x| and |x|^2:
+void spectral_magnitude(const ComplexType* input, RealType* output, size_t n);
+void spectral_power(const ComplexType* input, RealType* output, size_t n);
+
+// Fast approximate 20 log10(magnitude) and 10 log10(|x|^2), accurate to about
+// 1e-8 dB. Zero maps to a large negative level instead of -inf (about
+// -6153 dB for spectral_db, -3077 dB for spectral_power_db). spectral_db may
+// work in place:
+void spectral_db(const RealType* magnitude, RealType* output, size_t n);
+void spectral_power_db(const ComplexType* input, RealType* output, size_t n);
+
+// atan2(im, re), accurate to about 1e-10 rad:
+void spectral_phase(const ComplexType* input, RealType* output, size_t n);
+
+// accumulator += a * b:
+void complex_multiply_accumulate(const ComplexType* a,
+                                 const ComplexType* b,
+                                 ComplexType* accumulator,
+                                 size_t n);
+
+// output = scale * a * b, output may alias a or b:
+void complex_multiply_scaled(const ComplexType* a,
+                             const ComplexType* b,
+                             RealType scale,
+                             ComplexType* output,
+                             size_t n);
+
+// data *= scale, in place:
+void real_scale(RealType* data, RealType scale, size_t n);
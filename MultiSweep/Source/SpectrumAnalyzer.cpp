@@ -0,0 +1,126 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "SpectrumAnalyzer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+size_t hop_size(const SpectrumAnalyzerSettings& settings)
+{
+  const auto hop =
+    std::lround(double(settings.fftSize) * (1 - settings.overlap));
+  return std::clamp(size_t(std::max(hop, 1L)), size_t(1), settings.fftSize);
+}
+
+RealVector hann_window(size_t size)
+{
+  auto window = RealVector(size);
+  for (size_t n = 0; n < size; ++n)
+    window[n] = 0.5 - 0.5 * std::cos(2 * M_PI * double(n) / double(size));
+  return window;
+}
+
+SpectrumAnalyzer::SpectrumAnalyzer(double _sampleRate,
+                                   SpectrumAnalyzerSettings _settings)
+  : sampleRate(_sampleRate)
+  , settings(_settings)
+  , hopSize(hop_size(settings))
+  , plan(settings.fftSize)
+  , window(hann_window(settings.fftSize))
+  , history(settings.fftSize)
+  , frame(settings.fftSize)
+  , power(settings.fftSize / 2 + 1)
+  , average(settings.fftSize / 2 + 1, settings, sampleRate)
+{
+  assert(settings.fftSize > 0 && settings.fftSize % 2 == 0);
+
+  // A sine of amplitude A has a power of A^2 / 4 * size * energy in its bins:
+  const auto energy =
+    std::inner_product(window.cbegin(), window.cend(), window.cbegin(), 0.0);
+  scale = 4 / (double(window.size()) * energy);
+}
+
+void SpectrumAnalyzer::push(const float* samples, size_t numSamples)
+{
+  while (numSamples > 0) {
+    const auto n = std::min(numSamples, history.size() - numBuffered);
+    std::copy(samples, samples + n, history.begin() + long(numBuffered));
+    numBuffered += n;
+    samples += n;
+    numSamples -= n;
+
+    if (numBuffered == history.size()) {
+      analyseFrame();
+      // Keep the overlap for the next frame:
+      std::copy(history.cbegin() + long(hopSize),
+                history.cend(),
+                history.begin());
+      numBuffered -= hopSize;
+    }
+  }
+}
+
+void SpectrumAnalyzer::reset()
+{
+  numBuffered = 0;
+  average.reset();
+}
+
+void SpectrumAnalyzer::analyseFrame()
+{
+  for (size_t n = 0; n < frame.size(); ++n)
+    frame[n] = window[n] * double(history[n]);
+  const auto& spectrum = plan.forward(frame);
+  for (size_t k = 0; k < power.size(); ++k)
+    power[k] = scale * std::norm(spectrum[k]);
+  average.add(power);
+}
+
+PinkNoise::PinkNoise(uint32_t seed)
+  : state(seed != 0 ? seed : 1)
+{}
+
+void PinkNoise::generate(float* output, size_t numSamples, float level)
+{
+  // RMS of the filter output for uniform white noise in [-1, 1):
+  const auto gain = level / 1.7624f;
+
+  for (size_t i = 0; i < numSamples; ++i) {
+    // xorshift32:
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    const auto white = float(int32_t(state)) * (1.0f / 2147483648.0f);
+
+    b0 = 0.99886f * b0 + white * 0.0555179f;
+    b1 = 0.99332f * b1 + white * 0.0750759f;
+    b2 = 0.96900f * b2 + white * 0.1538520f;
+    b3 = 0.86650f * b3 + white * 0.3104856f;
+    b4 = 0.55000f * b4 + white * 0.5329522f;
+    b5 = -0.7616f * b5 - white * 0.0168980f;
+    output[i] = gain * (b0 + b1 + b2 + b3 + b4 + b5 + b6 + white * 0.5362f);
+    b6 = white * 0.115926f;
+  }
+}
@@ -0,0 +1,199 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+
+#pragma once
+
+#include "fft.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Live spectrum of a running signal (real-time analyzer): Hann-windowed,
+// overlapping frames, averaged in power. Levels are scaled so that the power
+// of a full-scale sine, summed over the bins it leaks into, is 1 (0 dB); band
+// levels from SpectrumSmoother::bandPower() are therefore independent of the
+// FFT size and window. Not thread-safe, use one instance per thread.
+
+enum class SpectrumAveraging
+{
+  exponential, // time constant in seconds
+  linear       // equal weights for the last numAverages frames
+};
+
+struct SpectrumAnalyzerSettings
+{
+  size_t fftSize = 8192; // even
+  double overlap = 0.75; // fraction of a frame shared with the next one
+  SpectrumAveraging averaging = SpectrumAveraging::exponential;
+  double timeConstant = 1;
+  size_t numAverages = 16; // 0 averages every frame since the last reset
+};
+
+// Distance between the starts of consecutive frames, at least one sample:
+size_t hop_size(const SpectrumAnalyzerSettings& settings);
+
+// Periodic Hann window, for overlapping frames:
+RealVector hann_window(size_t size);
+
+// Average of the spectra of consecutive frames, as selected by the settings.
+// Value is the type of a bin: double for power, ComplexType for cross-spectra.
+template<typename Value>
+class SpectralAverage
+{
+public:
+  SpectralAverage(size_t numBins,
+                  const SpectrumAnalyzerSettings& settings,
+                  double sampleRate)
+    : averaging(settings.averaging)
+    , coefficient(1 - std::exp(-double(hop_size(settings)) /
+                               (settings.timeConstant * sampleRate)))
+    , average(numBins)
+    , sum(numBins)
+  {
+    if (averaging == SpectrumAveraging::linear && settings.numAverages > 0)
+      recentFrames.assign(settings.numAverages, std::vector<Value>(numBins));
+  }
+
+  void add(const std::vector<Value>& frame)
+  {
+    ++numFrames;
+    if (averaging == SpectrumAveraging::exponential) {
+      // Until the time constant is reached, this is a linear average, so the
+      // first frames don't take ages to rise from zero:
+      const auto weight = std::max(coefficient, 1 / double(numFrames));
+      for (size_t k = 0; k < average.size(); ++k)
+        average[k] += weight * (frame[k] - average[k]);
+      return;
+    }
+
+    if (recentFrames.empty()) {
+      for (size_t k = 0; k < average.size(); ++k) {
+        sum[k] += frame[k];
+        average[k] = sum[k] / double(numFrames);
+      }
+      return;
+    }
+
+    // Moving average. The running sum is rebuilt from the stored frames once
+    // per round, so rounding errors can't accumulate:
+    auto& oldest = recentFrames[nextFrame];
+    for (size_t k = 0; k < average.size(); ++k) {
+      sum[k] += frame[k] - oldest[k];
+      oldest[k] = frame[k];
+    }
+    nextFrame = (nextFrame + 1) % recentFrames.size();
+    if (nextFrame == 0) {
+      std::fill(sum.begin(), sum.end(), Value());
+      for (const auto& recent : recentFrames)
+        for (size_t k = 0; k < sum.size(); ++k)
+          sum[k] += recent[k];
+    }
+
+    numFrames = std::min(numFrames, recentFrames.size());
+    for (size_t k = 0; k < average.size(); ++k)
+      average[k] = sum[k] / double(numFrames);
+  }
+
+  void reset()
+  {
+    numFrames = 0;
+    nextFrame = 0;
+    std::fill(average.begin(), average.end(), Value());
+    std::fill(sum.begin(), sum.end(), Value());
+    for (auto& recent : recentFrames)
+      std::fill(recent.begin(), recent.end(), Value());
+  }
+
+  // Frames in the average (for a moving average at most numAverages):
+  size_t getNumFrames() const { return numFrames; }
+
+  // Zero before the first frame:
+  const std::vector<Value>& get() const { return average; }
+
+private:
+  SpectrumAveraging averaging;
+  double coefficient; // exponential averaging, per frame
+  std::vector<Value> average;
+  size_t numFrames = 0;
+
+  // Linear averaging: the last numAverages frames and their running sum:
+  std::vector<std::vector<Value>> recentFrames;
+  size_t nextFrame = 0;
+  std::vector<Value> sum;
+};
+
+class SpectrumAnalyzer
+{
+public:
+  SpectrumAnalyzer(double sampleRate, SpectrumAnalyzerSettings settings = {});
+
+  // Appends samples and analyses every frame they complete:
+  void push(const float* samples, size_t numSamples);
+
+  // Forgets both the average and the samples of the incomplete frame:
+  void reset();
+
+  double getSampleRate() const { return sampleRate; }
+  const SpectrumAnalyzerSettings& getSettings() const { return settings; }
+  size_t getHopSize() const { return hopSize; }
+
+  // Frames in the average so far (for linear averaging at most numAverages):
+  size_t getNumFrames() const { return average.getNumFrames(); }
+
+  // Averaged power of fftSize / 2 + 1 bins, zero before the first frame:
+  const RealVector& getPower() const { return average.get(); }
+
+private:
+  void analyseFrame();
+
+  double sampleRate;
+  SpectrumAnalyzerSettings settings;
+  size_t hopSize;
+  FFTPlan plan;
+  RealVector window;
+  double scale; // |X|^2 -> power, see above
+
+  std::vector<float> history; // the current (incomplete) frame
+  size_t numBuffered = 0;
+  RealVector frame;
+  RealVector power;
+  SpectralAverage<double> average;
+};
+
+// Pink (-3 dB per octave) noise: uniform white noise through Paul Kellet's
+// 1/f filter, within +-0.05 dB of the ideal slope above 9.2 Hz at 44.1 kHz
+// (the lower limit scales with the sample rate).
+class PinkNoise
+{
+public:
+  explicit PinkNoise(uint32_t seed = 1);
+
+  // Writes numSamples of noise with the given (linear) RMS level:
+  void generate(float* output, size_t numSamples, float level);
+
+private:
+  uint32_t state;
+  float b0 = 0, b1 = 0, b2 = 0, b3 = 0, b4 = 0, b5 = 0, b6 = 0;
+};
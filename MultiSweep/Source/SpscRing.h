@@ -0,0 +1,213 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Lock-free single-producer single-consumer ring of multichannel frames, for
+// handing audio from the audio thread to an analysis thread (or back) without
+// per-sample copies.
+//
+// Channels are stored planar, each with the full (power of two) capacity, and
+// both sides get direct access to the storage: prepareWrite()/prepareRead()
+// return the (up to two) contiguous segments of a transfer, which are filled or
+// consumed in place via channel() and then committed with finishWrite() or
+// finishRead(). write() and read() are the corresponding bulk copies.
+//
+// Positions are free-running counters, so all slots are usable and a full ring
+// is distinguishable from an empty one. Each side caches the other side's last
+// known position and only reloads it (with acquire semantics) when the cached
+// value does not suffice, which keeps the shared cache lines quiet while the
+// ring is neither full nor empty.
+template <typename T>
+class SpscRing
+{
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SpscRing copies its elements with memcpy");
+
+public:
+  // The frames [start1, start1 + size1) followed by [start2, start2 + size2)
+  // of each channel, as in juce::AbstractFifo:
+  struct Region
+  {
+    size_t start1 = 0;
+    size_t size1 = 0;
+    size_t start2 = 0;
+    size_t size2 = 0;
+
+    size_t size() const { return size1 + size2; }
+  };
+
+  SpscRing() = default;
+  SpscRing(size_t numChannels, size_t minCapacity)
+  {
+    resize(numChannels, minCapacity);
+  }
+
+  // Not thread-safe: neither side may access the ring meanwhile. The capacity
+  // is rounded up to a power of two.
+  void resize(size_t numChannels, size_t minCapacity)
+  {
+    capacity = 1;
+    while (capacity < minCapacity)
+      capacity *= 2;
+    channels = numChannels;
+    storage.assign(channels * capacity, T{});
+    reset();
+  }
+
+  // Not thread-safe either; discards everything in the ring.
+  void reset()
+  {
+    writePosition.store(0, std::memory_order_relaxed);
+    readPosition.store(0, std::memory_order_relaxed);
+    cachedReadPosition = 0;
+    cachedWritePosition = 0;
+  }
+
+  size_t getNumChannels() const { return channels; }
+  size_t getCapacity() const { return capacity; }
+
+  T* channel(size_t index)
+  {
+    assert(index < channels);
+    return storage.data() + index * capacity;
+  }
+  const T* channel(size_t index) const
+  {
+    assert(index < channels);
+    return storage.data() + index * capacity;
+  }
+
+  // Approximate from the respective other side, exact from its own side:
+  size_t getNumReady() const
+  {
+    return writePosition.load(std::memory_order_acquire) -
+           readPosition.load(std::memory_order_acquire);
+  }
+  size_t getFreeSpace() const { return capacity - getNumReady(); }
+
+  // Producer side ------------------------------------------------------------
+
+  // Up to maxFrames free frames, to be filled before finishWrite():
+  Region prepareWrite(size_t maxFrames)
+  {
+    const auto position = writePosition.load(std::memory_order_relaxed);
+    if (position - cachedReadPosition + maxFrames > capacity)
+      cachedReadPosition = readPosition.load(std::memory_order_acquire);
+    const auto free = capacity - (position - cachedReadPosition);
+    return makeRegion(position, maxFrames < free ? maxFrames : free);
+  }
+
+  // Publishes the first numFrames frames of the last prepareWrite():
+  void finishWrite(size_t numFrames)
+  {
+    const auto position = writePosition.load(std::memory_order_relaxed);
+    assert(position + numFrames - cachedReadPosition <= capacity);
+    writePosition.store(position + numFrames, std::memory_order_release);
+  }
+
+  // Copies as many of the numFrames frames of every channel as fit, and
+  // returns how many that were:
+  size_t write(const T* const* source, size_t numFrames)
+  {
+    const auto region = prepareWrite(numFrames);
+    for (size_t c = 0; c < channels; ++c) {
+      auto* destination = channel(c);
+      copy(destination + region.start1, source[c], region.size1);
+      copy(destination + region.start2, source[c] + region.size1, region.size2);
+    }
+    finishWrite(region.size());
+    return region.size();
+  }
+
+  // Consumer side ------------------------------------------------------------
+
+  // Up to maxFrames ready frames, to be consumed before finishRead():
+  Region prepareRead(size_t maxFrames)
+  {
+    const auto position = readPosition.load(std::memory_order_relaxed);
+    if (cachedWritePosition - position < maxFrames)
+      cachedWritePosition = writePosition.load(std::memory_order_acquire);
+    const auto ready = cachedWritePosition - position;
+    return makeRegion(position, maxFrames < ready ? maxFrames : ready);
+  }
+
+  // Releases the first numFrames frames of the last prepareRead():
+  void finishRead(size_t numFrames)
+  {
+    const auto position = readPosition.load(std::memory_order_relaxed);
+    assert(numFrames <= cachedWritePosition - position);
+    readPosition.store(position + numFrames, std::memory_order_release);
+  }
+
+  // Copies up to numFrames ready frames of every channel, and returns how many
+  // that were:
+  size_t read(T* const* destination, size_t numFrames)
+  {
+    const auto region = prepareRead(numFrames);
+    for (size_t c = 0; c < channels; ++c) {
+      const auto* source = channel(c);
+      copy(destination[c], source + region.start1, region.size1);
+      copy(destination[c] + region.size1, source + region.start2, region.size2);
+    }
+    finishRead(region.size());
+    return region.size();
+  }
+
+private:
+  Region makeRegion(size_t position, size_t numFrames) const
+  {
+    auto region = Region{};
+    region.start1 = position & (capacity - 1);
+    region.size1 = std::min(numFrames, capacity - region.start1);
+    region.size2 = numFrames - region.size1;
+    return region;
+  }
+
+  static void copy(T* destination, const T* source, size_t numFrames)
+  {
+    if (numFrames > 0)
+      std::memcpy(destination, source, numFrames * sizeof(T));
+  }
+
+  std::vector<T> storage;
+  size_t channels = 0;
+  size_t capacity = 1;
+
+  // Each side's position and its cached copy of the other side's position
+  // share a cache line of their own, so the threads only contend when they
+  // reload:
+  alignas(64) std::atomic<size_t> writePosition{ 0 };
+  size_t cachedReadPosition = 0;
+  alignas(64) std::atomic<size_t> readPosition{ 0 };
+  size_t cachedWritePosition = 0;
+};
@@ -40,7 +40,10 @@ public:
     addAndMakeVisible(playButton);
     playButton.setButtonText("Start Sweep");
     playButton.onClick = [this] {
-      sweep.startSweep({ .channel = channelSelector.getSelectedItemIndex() });
+      const auto loopbackId = loopbackSelector.getSelectedId();
+      sweep.startSweep({ .channel = channelSelector.getSelectedItemIndex(),
+                         .loopbackChannel = loopbackId > 1 ? loopbackId - 1
+                                                           : -1 });
     };
 
     addAndMakeVisible(stopButton);
@@ -55,6 +58,10 @@ public:
     exportButton.onClick = [this] { sweep.exportFilter(); };
     exportButton.setButtonText("Export");
 
+    addAndMakeVisible(exportFiltersButton);
+    exportFiltersButton.onClick = [this] { sweep.exportCorrectionFilters({}); };
+    exportFiltersButton.setButtonText("Export Filters");
+
     addAndMakeVisible(freqDisplay);
 
     // TODO: would be nice to override AudioChannelsIOWidget for this purpose
@@ -65,6 +72,87 @@ public:
 
     addAndMakeVisible(prevChannelButton);
     addAndMakeVisible(nextChannelButton);
+
+    // An input wired directly to the measured output, for the interface
+    // latency (and the time of flight):
+    addAndMakeVisible(loopbackSelector);
+    loopbackSelector.addItem("No Loopback", 1);
+    for (int channel = 1; channel < 10; ++channel)
+      loopbackSelector.addItem("Loopback: In " + juce::String(channel + 1),
+                               channel + 1);
+    loopbackSelector.setSelectedId(1, juce::dontSendNotification);
+
+    // Measurements with a loopback can be divided by it instead of being
+    // convolved with the inverse sweep, which also removes the response of
+    // the interface:
+    addAndMakeVisible(deconvolutionSelector);
+    deconvolutionSelector.addItem("Inverse Sweep", 1);
+    deconvolutionSelector.addItem("Divide by Loopback", 2);
+    deconvolutionSelector.setSelectedId(
+      sweep.getDeconvolutionMode() == DeconvolutionMode::referenceChannel ? 2
+                                                                          : 1,
+      juce::dontSendNotification);
+    deconvolutionSelector.onChange = [this] {
+      sweep.setDeconvolutionMode(deconvolutionSelector.getSelectedId() == 2
+                                   ? DeconvolutionMode::referenceChannel
+                                   : DeconvolutionMode::inverseSweep,
+                                 sweep.getReferenceRegularization());
+    };
+
+    rtaButton.setButtonText("RTA");
+    rtaButton.onClick = [this] {
+      analyzer->setEnabled(rtaButton.getToggleState());
+      freqDisplay.repaint();
+    };
+    noiseButton.setButtonText("Pink Noise");
+    noiseButton.onClick = [this] { updateNoiseChannel(); };
+    channelSelector.onChange = [this] {
+      if (analyzer != nullptr)
+        updateNoiseChannel();
+    };
+
+    // Transfer function of the input relative to another input (the console
+    // feed, say) or to the played noise:
+    transferButton.setButtonText("Transfer");
+    transferButton.onClick = [this] {
+      auto settings = analyzer->getSettings();
+      settings.mode = transferButton.getToggleState()
+                        ? RealTimeAnalyzer::Mode::transferFunction
+                        : RealTimeAnalyzer::Mode::spectrum;
+      analyzer->setSettings(settings);
+    };
+    referenceSelector.addItem("Ref: Noise", 1);
+    for (int channel = 1; channel < 10; ++channel)
+      referenceSelector.addItem("Ref: In " + juce::String(channel + 1),
+                                channel + 1);
+    referenceSelector.setSelectedId(1, juce::dontSendNotification);
+    referenceSelector.onChange = [this] {
+      const auto id = referenceSelector.getSelectedId();
+      analyzer->setReferenceChannel(id > 1 ? id - 1 : -1);
+    };
+  }
+
+  // Adds the controls of a real-time analyzer and shows its spectrum:
+  void setAnalyzer(RealTimeAnalyzer& newAnalyzer)
+  {
+    analyzer = &newAnalyzer;
+    freqDisplay.setAnalyzer(analyzer);
+    rtaButton.setToggleState(analyzer->isEnabled(),
+                             juce::dontSendNotification);
+    noiseButton.setToggleState(analyzer->getNoiseChannel() >= 0,
+                               juce::dontSendNotification);
+    transferButton.setToggleState(
+      analyzer->getSettings().mode == RealTimeAnalyzer::Mode::transferFunction,
+      juce::dontSendNotification);
+    const auto referenceChannel = analyzer->getReferenceChannel();
+    referenceSelector.setSelectedId(
+      referenceChannel > 0 ? referenceChannel + 1 : 1,
+      juce::dontSendNotification);
+    addAndMakeVisible(rtaButton);
+    addAndMakeVisible(noiseButton);
+    addAndMakeVisible(transferButton);
+    addAndMakeVisible(referenceSelector);
+    resized();
   }
 
   void resized() override
@@ -77,6 +165,19 @@ public:
 
     freqDisplay.setBounds(area);
 
+    if (analyzer != nullptr) {
+      auto analyzerArea =
+        firstButtonRow.removeFromRight(firstButtonRow.getWidth() / 3);
+      auto transferArea =
+        analyzerArea.removeFromRight(analyzerArea.getWidth() / 2);
+      rtaButton.setBounds(
+        analyzerArea.removeFromTop(analyzerArea.getHeight() / 2));
+      noiseButton.setBounds(analyzerArea);
+      transferButton.setBounds(
+        transferArea.removeFromTop(transferArea.getHeight() / 2));
+      referenceSelector.setBounds(transferArea);
+    }
+
     auto playButtonArea =
       firstButtonRow.removeFromLeft(firstButtonRow.getWidth() / 2);
     playButton.setBounds(playButtonArea);
@@ -87,8 +188,14 @@ public:
     // const auto buttonPadding = 10;
     const auto buttonPadding = 0;
 
-    exportButton.setBounds(secondButtonRow.removeFromLeft(rowWidth * 0.4));
-    clearButton.setBounds(secondButtonRow.removeFromRight(rowWidth * 0.4));
+    exportButton.setBounds(secondButtonRow.removeFromLeft(rowWidth * 0.15));
+    exportFiltersButton.setBounds(
+      secondButtonRow.removeFromLeft(rowWidth * 0.15));
+    clearButton.setBounds(secondButtonRow.removeFromRight(rowWidth * 0.15));
+    deconvolutionSelector.setBounds(
+      secondButtonRow.removeFromRight(rowWidth * 0.15));
+    loopbackSelector.setBounds(
+      secondButtonRow.removeFromRight(rowWidth * 0.15));
 
     prevChannelButton.setBounds(
       secondButtonRow.removeFromLeft(secondButtonRow.getHeight())
@@ -101,17 +208,34 @@ public:
   }
 
 private:
+  // The noise is played on the selected output channel:
+  void updateNoiseChannel()
+  {
+    analyzer->setNoiseChannel(noiseButton.getToggleState()
+                                ? channelSelector.getSelectedItemIndex()
+                                : -1);
+  }
+
   SweepComponentProcessor& sweep;
+  RealTimeAnalyzer* analyzer = nullptr;
 
   juce::TextButton playButton;
   juce::TextButton stopButton;
 
   juce::TextButton clearButton;
   juce::TextButton exportButton;
+  juce::TextButton exportFiltersButton;
 
   juce::ArrowButton prevChannelButton;
   juce::ComboBox channelSelector;
   juce::ArrowButton nextChannelButton;
+  juce::ComboBox loopbackSelector;
+  juce::ComboBox deconvolutionSelector;
+
+  juce::ToggleButton rtaButton;
+  juce::ToggleButton noiseButton;
+  juce::ToggleButton transferButton;
+  juce::ComboBox referenceSelector;
 
   FreqResponseDisplay freqDisplay;
   std::vector<std::vector<float>> freqResponses;
@@ -21,9 +21,19 @@
  */
 
 #pragma once
+#include "BackgroundWriter.h"
+#include "DataFiles.h"
+#include "EqualizerFit.h"
+#include "FilterDesign.h"
+#include "Latency.h"
 #include "LogSweep.h"
+#include "RoomAcoustics.h"
+#include "SessionStore.h"
+#include "Smoothing.h"
 #include "fft.h"
+#include <functional>
 #include <juce_audio_processors/juce_audio_processors.h>
+#include <mutex>
 
 struct SweepComponentMetadata
 {
@@ -32,11 +42,26 @@ struct SweepComponentMetadata
   double lowerFreq = 10.0;
   double upperFreq = 22e3;
   double responseTailInSeconds = 1;
+  int loopbackChannel = -1; // input channel with an electrical loopback
+};
+
+enum class DeconvolutionMode
+{
+  inverseSweep,    // convolve the capture with the inverse sweep
+  referenceChannel // divide the capture by the loopback capture (H = Y/X)
+};
+
+struct TimeOfFlight
+{
+  double samples = 0;
+  double seconds = 0;
+  bool latencyCompensated = false; // false if no loopback/cache was available
 };
 
 class SweepComponentProcessor
   : public juce::AudioProcessor
   , public juce::ChangeBroadcaster
+  , private juce::AsyncUpdater
 {
 public:
   SweepComponentProcessor() = default;
@@ -113,8 +138,10 @@ public:
     inputBufferIndex = 0;
     outputBufferIndex = 0;
 
-    sweep.reset(new LogSweep(
-      fs, metadata.duration, { metadata.lowerFreq, metadata.upperFreq }));
+    sweep = std::make_shared<LogSweep>(
+      fs,
+      metadata.duration,
+      FreqRange{ metadata.lowerFreq, metadata.upperFreq });
     auto sweepBuffer = makeBufferFromVector(sweep->generateSignal());
     audioSource.reset(new juce::MemoryAudioSource(sweepBuffer, true));
 
@@ -127,81 +154,936 @@ public:
 
     const auto inputBufferSize =
       sweepBuffer.getNumSamples() + int(fs * metadata.responseTailInSeconds);
-    inputBuffer.reset(new juce::AudioSampleBuffer(1, inputBufferSize));
+    loopbackChannel = metadata.loopbackChannel;
+    measuredChannel = metadata.channel;
+    const auto numCaptureChannels = loopbackChannel >= 0 ? 2 : 1;
+    inputBuffer = std::make_shared<juce::AudioSampleBuffer>(numCaptureChannels,
+                                                           inputBufferSize);
     // inputBuffer is NOT guaranteed to be empty on initialization:
     inputBuffer->clear();
 
+    // Re-measuring a channel replaces its previous measurement:
+    measurements[measuredChannel] = {
+      inputBuffer, sweep, nullptr, nullptr, std::nullopt
+    };
+    updateSession();
+    ++revision;
+
     // This needs to happen AFTER all the memory stuff since everything runs
     // concurrently:
     sweepActive = true;
     sweepFinished = false;
   }
 
+  bool isSweepActive() const { return sweepActive; }
+
+  // Also called from the audio thread once the capture is full. The finished
+  // measurement is analysed on the message thread, which then sends a change
+  // message:
   void stopSweep()
   {
     sweepActive = false;
     sweepFinished = false;
-    sendChangeMessage();
+    triggerAsyncUpdate();
+  }
+
+  // Analyses finished measurements right away instead of waiting for the
+  // message thread, e.g. when running without a message loop:
+  void finishMeasurement()
+  {
+    cancelPendingUpdate();
+    handleAsyncUpdate();
   }
 
+  // Saves the current IR (.wav) or its spectrum: freq, mag and db per bin as
+  // CSV columns or as a (3, bins) .npy array. The spectrum is computed and the
+  // file written on the export thread:
   void exportFilter() const
   {
     jassert(inputBuffer);
     jassert(sweep);
-    if (inputBuffer && sweep) {
-      const auto inputVector = makeVectorFromBuffer(*inputBuffer);
-      const auto irVector = sweep->computeIR(inputVector);
-      const auto freqResponse = dft_magnitude(irVector);
-      const auto freqResponseDb = dft_magnitude_db(irVector);
-      const auto freqBins = dft_lin_bins(float(fs), freqResponse.size() * 2);
-
-      juce::FileChooser dialog(
-        "Select a location to save the filter coefficients...");
-      if (dialog.browseForFileToSave(true)) {
-        juce::File file = dialog.getResult();
-        auto fileContents = std::stringstream{};
-
-        fileContents << "freq,mag,db\n";
-
-        for (size_t i = 0; i < freqResponse.size(); ++i)
-          fileContents << freqBins[i] << "," << freqResponse[i] << ","
-                       << freqResponseDb[i] << "\n";
-
-        file.replaceWithText(fileContents.str());
+    if (!inputBuffer || !sweep)
+      return;
+
+    juce::FileChooser dialog(
+      "Select a location to save the filter coefficients...",
+      {},
+      "*.csv;*.npy;*.wav");
+    if (!dialog.browseForFileToSave(true))
+      return;
+
+    const auto file = dialog.getResult();
+    exportWriter.enqueue([file, ir = getImpulseResponse(), sampleRate = fs] {
+      const auto path = file.getFullPathName().toStdString();
+      if (file.hasFileExtension("wav")) {
+        if (!write_wav(path, { ir }, sampleRate))
+          reportWriteFailure("the impulse response", file);
+        return;
       }
+
+      auto spectrum = Channels{ dft_lin_bins(float(sampleRate),
+                                             dft_size(ir.size())),
+                                dft_magnitude(ir),
+                                dft_magnitude_db(ir) };
+      spectrum[0].resize(spectrum[1].size());
+      const auto written =
+        file.hasFileExtension("npy")
+          ? write_npy(path, spectrum)
+          : write_csv(path, { "freq", "mag", "db" }, spectrum);
+      if (!written)
+        reportWriteFailure("the spectrum", file);
+    });
+  }
+
+  // Designs correction filters for all measured channels (in parallel) and
+  // saves them as a multichannel WAV file (or a (channels, taps) .npy array),
+  // one channel per output channel:
+  void exportCorrectionFilters(const FilterDesignSettings& settings) const
+  {
+    const auto results = designCorrectionFilters(settings);
+    if (results.empty())
+      return;
+
+    juce::FileChooser dialog(
+      "Select a location to save the filters...", {}, "*.wav;*.npy");
+    if (!dialog.browseForFileToSave(true))
+      return;
+
+    auto filters = Channels(size_t(results.rbegin()->first + 1),
+                            std::vector<float>(settings.numTaps));
+    for (const auto& [channel, filter] : results)
+      filters[size_t(channel)] = filter.coefficients;
+
+    const auto file = dialog.getResult();
+    exportWriter.enqueue([file, filters = std::move(filters), sampleRate = fs] {
+      const auto path = file.getFullPathName().toStdString();
+      const auto written = file.hasFileExtension("npy")
+                             ? write_npy(path, filters)
+                             : write_wav(path, filters, sampleRate);
+      if (!written)
+        reportWriteFailure("the correction filters", file);
+    });
+  }
+
+  std::map<int, FilterDesignResult> designCorrectionFilters(
+    FilterDesignSettings settings) const
+  {
+    settings.fs = fs;
+
+    auto channels = getMeasuredChannels();
+    auto irs = std::vector<std::vector<float>>();
+    for (const auto channel : channels) {
+      const auto ir = getImpulseResponse(channel);
+      const auto offset = long(std::min(getIROffset(channel), ir.size()));
+      irs.emplace_back(ir.cbegin() + offset, ir.cend());
+    }
+
+    const auto results = design_correction_filters(irs, settings);
+
+    auto filters = std::map<int, FilterDesignResult>();
+    for (size_t i = 0; i < channels.size(); ++i) {
+      DBG("Correction filter for channel " << channels[i] << " designed in "
+                                           << results[i].designTimeMs
+                                           << " ms");
+      filters[channels[i]] = results[i];
     }
+    return filters;
+  }
+
+  // Fits a parametric EQ per measured channel, on the same log-spaced grid
+  // and with the same smoothing the frequency response display uses:
+  std::map<int, EqualizerFitResult> fitEqualizers(
+    const EqualizerFitSettings& settings,
+    const std::vector<TargetPoint>& target,
+    uint numbins = 512) const
+  {
+    return computeEqualizers(
+      getEqualizerFitInput(), settings, target, numbins);
+  }
+
+  // Same, on a background thread, so the message thread isn't blocked.
+  // onFinished gets the results on the message thread, unless the processor
+  // is destroyed first. Fits requested in the meantime are queued:
+  using EqualizerFitCallback =
+    std::function<void(const std::map<int, EqualizerFitResult>&)>;
+  void fitEqualizersAsync(const EqualizerFitSettings& settings,
+                          const std::vector<TargetPoint>& target,
+                          EqualizerFitCallback onFinished,
+                          uint numbins = 512)
+  {
+    equalizerFitter.enqueue([this,
+                             input = getEqualizerFitInput(),
+                             settings,
+                             target,
+                             onFinished = std::move(onFinished),
+                             numbins] {
+      auto equalizers = computeEqualizers(input, settings, target, numbins);
+      {
+        const auto lock = std::lock_guard<std::mutex>(fitMutex);
+        finishedFits.push_back(
+          [onFinished, equalizers = std::move(equalizers)] {
+            if (onFinished)
+              onFinished(equalizers);
+          });
+      }
+      triggerAsyncUpdate(); // --> handleAsyncUpdate()
+    });
   }
 
   void clearData()
   {
     inputBuffer.reset();
+    measurements.clear();
+    timesOfFlight.clear();
+    updateSession();
+    ++revision;
     sendChangeMessage();
   }
 
-  std::vector<float> getImpulseResponse()
+  // Where the plug-in state keeps its measurements, see saveSession():
+  static juce::File getSessionDirectory()
+  {
+    return juce::File::getSpecialLocation(
+             juce::File::userApplicationDataDirectory)
+      .getChildFile("IEM/MultiSweep/Sessions");
+  }
+
+  // Saves every finished measurement (capture, sweep parameters and IR) to a
+  // new session file in directory, see SessionStore.h, and returns it (or
+  // nothing if there are no measurements). Can be called from any thread,
+  // like getStateInformation(): it only uses the snapshot the message thread
+  // takes whenever the measurements change, and the file is written on the
+  // export thread. Session files are never rewritten, so a project and its
+  // copies keep the measurements they were saved with. The same file is
+  // returned as long as the measurements don't change. Nothing is deleted,
+  // see deleteSessions():
+  juce::File saveSession(const juce::File& directory)
+  {
+    const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+    if (pendingSession)
+      return *pendingSession; // not restored yet, see restoreSession()
+    if (!sessionSnapshot || sessionSnapshot->entries.empty())
+      return {};
+
+    auto& file = sessionSnapshot->file;
+    if (file != juce::File())
+      return file;
+
+    file = directory.getChildFile(juce::Uuid().toString() + ".mss");
+    exportWriter.enqueue([snapshot = sessionSnapshot, file, directory] {
+      auto channels = std::vector<SessionChannel>();
+      for (const auto& entry : snapshot->entries) {
+        auto stored = entry.stored;
+        stored.ir = entry.ir.data();
+        stored.irLength = entry.ir.size();
+        channels.push_back(stored);
+      }
+      directory.createDirectory();
+      if (!write_session(file.getFullPathName().toStdString(), channels))
+        reportWriteFailure("the measurements", file);
+    });
+    return file;
+  }
+
+  // Replaces all measurements with the ones in a session file, or clears them
+  // for an empty file. Can be called from any thread, like
+  // setStateInformation(); the session is loaded on the message thread:
+  void restoreSession(const juce::File& file)
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+      pendingSession = file;
+    }
+    triggerAsyncUpdate();
+    if (juce::MessageManager::existsAndIsCurrentThread())
+      handleUpdateNowIfNeeded();
+  }
+
+  // Saved projects (and their copies) may refer to any session file, so they
+  // are only deleted when the user picks them. The current session is kept,
+  // and files that are still mapped can't be deleted on Windows:
+  void deleteSessions()
+  {
+    juce::FileChooser dialog("Select the sessions to delete (projects that "
+                             "refer to them lose their measurements)...",
+                             getSessionDirectory(),
+                             "*.mss");
+    if (!dialog.browseForMultipleFilesToOpen())
+      return;
+
+    auto current = juce::File();
+    {
+      const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+      if (sessionSnapshot)
+        current = sessionSnapshot->file;
+    }
+    for (const auto& file : dialog.getResults())
+      if (file != current && file.hasFileExtension("mss") &&
+          !file.deleteFile())
+        juce::Logger::writeToLog("Could not delete " + file.getFullPathName());
+  }
+
+  // Replaces all measurements with the ones in a session file. IRs derived
+  // with the current settings are read from the memory-mapped file, captures
+  // only when an IR has to be derived again:
+  bool loadSession(const juce::File& file)
+  {
+    auto session =
+      std::make_shared<const SessionFile>(file.getFullPathName().toStdString());
+    if (!session->isOpen())
+      return false;
+
+    measurements.clear();
+    timesOfFlight.clear();
+    for (const auto& stored : session->getChannels()) {
+      if (stored.capture.empty() || stored.captureLength == 0)
+        continue;
+      auto measurement = Measurement{};
+      measurement.sweep = std::make_shared<LogSweep>(
+        stored.sweep.fs,
+        stored.sweep.duration,
+        FreqRange{ stored.sweep.lowerFreq, stored.sweep.upperFreq });
+      measurement.session = session;
+      measurement.stored = &stored;
+      measurements[stored.channel] = measurement;
+    }
+    // Acoustics are only evaluated for sessions saved without them:
+    analyse(getRecordedChannels());
+
+    // The last channel is shown, so its capture is the only one read now:
+    inputBuffer.reset();
+    if (!measurements.empty()) {
+      const auto& [channel, measurement] = *measurements.rbegin();
+      getCapture(measurement);
+      measuredChannel = channel;
+      inputBuffer = measurement.capture;
+      sweep = measurement.sweep;
+    }
+
+    updateSession(file);
+    sendChangeMessage();
+    return true;
+  }
+
+  // Channels with a finished (and analysed) measurement:
+  std::vector<int> getMeasuredChannels() const
+  {
+    auto channels = std::vector<int>();
+    for (const auto& [channel, measurement] : measurements)
+      if (measurement.analysis)
+        channels.push_back(channel);
+    return channels;
+  }
+
+  // In referenceChannel mode (and with a loopback capture available), the IR
+  // is relative to the loopback, so it starts at index 0 and contains neither
+  // the interface latency nor its frequency response. With truncation enabled
+  // (the default), the IR ends where its decay reaches the noise floor. Empty
+  // while the channel is being measured:
+  std::vector<float> getImpulseResponse() const
+  {
+    return getImpulseResponse(measuredChannel);
+  }
+
+  std::vector<float> getImpulseResponse(int channel) const
+  {
+    const auto measurement = measurements.find(channel);
+    if (measurement == measurements.cend() || !measurement->second.analysis)
+      return {};
+    return measurement->second.analysis->ir;
+  }
+
+  // Where the IR of channel was cut off (relative to its zero-delay sample)
+  // and how much energy went with the noise:
+  std::optional<TruncationResult> getTruncation(int channel) const
+  {
+    const auto measurement = measurements.find(channel);
+    if (measurement == measurements.cend() || !measurement->second.analysis)
+      return std::nullopt;
+    return measurement->second.analysis->truncation;
+  }
+  std::optional<TruncationResult> getTruncation() const
+  {
+    return getTruncation(measuredChannel);
+  }
+
+  // ISO 3382-1 parameters of every band of every measured channel, see
+  // RoomAcoustics.h. They are evaluated on the untruncated IRs (from their
+  // zero-delay sample on), since every band has a noise floor of its own:
+  std::map<int, std::vector<RoomAcousticParameters>> computeRoomAcoustics(
+    const RoomAcousticsSettings& settings = {}) const
+  {
+    const auto channels = getMeasuredChannels();
+    auto irs = std::vector<std::vector<float>>();
+    for (const auto channel : channels)
+      irs.push_back(getUntruncatedImpulseResponse(channel));
+
+    const auto start = juce::Time::getMillisecondCounterHiRes();
+    const auto results = room_acoustic_parameters(irs, fs, settings);
+    const auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+    DBG("Room acoustics of " << channels.size() << " channels evaluated in "
+                             << elapsed << " ms");
+    juce::ignoreUnused(elapsed);
+
+    auto parameters = std::map<int, std::vector<RoomAcousticParameters>>();
+    for (size_t i = 0; i < channels.size(); ++i)
+      parameters[channels[i]] = results[i];
+    return parameters;
+  }
+
+  // Same, in third-octave bands for a single channel. Evaluated once per
+  // measurement (see analyse()), empty while the channel is being measured:
+  std::vector<RoomAcousticParameters> getRoomAcoustics(int channel) const
+  {
+    const auto measurement = measurements.find(channel);
+    if (measurement == measurements.cend() || !measurement->second.analysis)
+      return {};
+    return measurement->second.analysis->acoustics;
+  }
+  std::vector<RoomAcousticParameters> getRoomAcoustics() const
+  {
+    return getRoomAcoustics(measuredChannel);
+  }
+
+  // Automatic truncation of all IRs at the noise floor, see Truncation.h:
+  void setTruncation(TruncationSettings newTruncation)
+  {
+    truncation = newTruncation;
+    analyse(getMeasuredChannels(), false); // untruncated IRs are unchanged
+    sendChangeMessage();
+  }
+  TruncationSettings getTruncationSettings() const { return truncation; }
+
+  // Sample rate of the measurements (and of their IRs):
+  double getMeasurementSampleRate() const { return fs; }
+
+  // Index of the zero-delay sample in getImpulseResponse(channel). With
+  // truncation, only a short pre-roll of the lead-in is left before it:
+  size_t getIROffset(int channel) const
+  {
+    const auto measurement = measurements.find(channel);
+    if (measurement == measurements.cend() || !measurement->second.analysis)
+      return 0;
+    return measurement->second.analysis->irOffset;
+  }
+
+  void setDeconvolutionMode(DeconvolutionMode mode, float regularization)
+  {
+    deconvolutionMode = mode;
+    referenceRegularization = regularization;
+    analyse(getMeasuredChannels());
+    sendChangeMessage();
+  }
+
+  DeconvolutionMode getDeconvolutionMode() const { return deconvolutionMode; }
+
+  float getReferenceRegularization() const { return referenceRegularization; }
+
+  std::vector<float> getLoopbackImpulseResponse() const
   {
-    jassert(inputBuffer);
     jassert(sweep);
-    if (inputBuffer && sweep) {
-      const auto inputVector = makeVectorFromBuffer(*inputBuffer);
-      return sweep->computeIR(inputVector);
+    if (hasLoopback() && sweep) {
+      const auto loopbackVector = makeVectorFromBuffer(*inputBuffer, 1);
+      return sweep->computeIR(loopbackVector);
     }
     return {};
   }
 
-  std::vector<float> getFrequencyResponse(uint numbins)
+  bool hasLoopback() const
+  {
+    return inputBuffer && inputBuffer->getNumChannels() > 1;
+  }
+
+  // Used to look up the cached round-trip latency of the current device, from
+  // the message thread:
+  void setDeviceName(const juce::String& name) { deviceName = name; }
+
+  // Estimates the acoustic time of flight of the last measurement. With a
+  // loopback capture, the interface latency is measured directly and cached
+  // for the current device configuration. Without one, the cached latency
+  // (if any) is subtracted instead. The result is stored per output channel.
+  TimeOfFlight estimateTimeOfFlight()
   {
     jassert(inputBuffer);
     jassert(sweep);
-    if (inputBuffer && sweep) {
-      const auto inputVector = makeVectorFromBuffer(*inputBuffer);
-      const auto irVector = sweep->computeIR(inputVector);
-      return dft_magnitude_with_log_bins(irVector, float(fs), numbins);
+    if (!inputBuffer || !sweep)
+      return {};
+
+    const auto key = RoundTripLatencyCache::makeKey(
+      deviceName.toStdString(), fs, samplesPerBlock);
+    const auto offset = double(sweep->getIROffset());
+    const auto arrival =
+      estimate_arrival(sweep->computeIR(makeVectorFromBuffer(*inputBuffer)))
+        .peak;
+
+    auto result = TimeOfFlight{};
+    if (hasLoopback()) {
+      const auto latency =
+        estimate_arrival(getLoopbackImpulseResponse()).peak - offset;
+      latencyCache.store(key, latency);
+      result.samples = arrival - offset - latency;
+      result.latencyCompensated = true;
+    } else {
+      const auto latency = latencyCache.lookup(key);
+      result.samples = arrival - offset - latency.value_or(0);
+      result.latencyCompensated = latency.has_value();
+    }
+    result.seconds = result.samples / fs;
+
+    timesOfFlight[measuredChannel] = result.seconds;
+    return result;
+  }
+
+  // Called on the message thread whenever the time of flight of a new
+  // measurement has been estimated:
+  std::function<void()> onTimeOfFlight;
+
+  // Per-channel delays (in seconds, indexed by output channel) that align all
+  // channels measured so far. Unmeasured channels get a delay of zero.
+  std::vector<float> getDelayCompensation() const
+  {
+    if (timesOfFlight.empty())
+      return {};
+
+    auto arrivals = std::vector<double>();
+    for (const auto& [channel, seconds] : timesOfFlight)
+      arrivals.push_back(seconds);
+    const auto delays = delay_compensation(arrivals);
+
+    auto output = std::vector<float>(size_t(timesOfFlight.rbegin()->first + 1));
+    auto delay = delays.cbegin();
+    for (const auto& entry : timesOfFlight)
+      output[size_t(entry.first)] = float(*delay++);
+    return output;
+  }
+
+  std::vector<float> getFrequencyResponse(uint numbins)
+  {
+    const auto irVector = getImpulseResponse();
+    if (!irVector.empty()) {
+      const auto frequencies = dft_log_bins(numbins, 20e0, 20e3);
+      const auto fftSize = dft_size(irVector.size());
+      if (!displaySmoother ||
+          !displaySmoother->matches(fs, fftSize, frequencies, smoothing))
+        displaySmoother = std::make_unique<SpectrumSmoother>(
+          fs, fftSize, frequencies, smoothing);
+      return displaySmoother->magnitudeDb(dft_magnitude(irVector));
     }
     return {};
   }
 
+  void setSmoothing(Smoothing newSmoothing)
+  {
+    smoothing = newSmoothing;
+    ++revision;
+    sendChangeMessage();
+  }
+  Smoothing getSmoothing() const { return smoothing; }
+
+  // Changes whenever the frequency response, truncation or room acoustics of
+  // the current measurement may have changed, so they can be cached:
+  int getRevision() const { return revision; }
+
 private:
+  // Derived from a finished measurement with the current settings:
+  struct Analysis
+  {
+    std::vector<float> ir;
+    size_t irOffset = 0; // of the zero-delay sample in ir
+    TruncationResult truncation;
+    std::vector<RoomAcousticParameters> acoustics; // third-octave bands
+  };
+
+  // Everything needed to (re-)compute the IR of one output channel:
+  struct Measurement
+  {
+    // Mic (+ loopback). For measurements restored from a session, this stays
+    // empty until the channel is used and is then copied from the mapping:
+    mutable std::shared_ptr<juce::AudioSampleBuffer> capture;
+    std::shared_ptr<ImpulseResponse> sweep;
+
+    std::shared_ptr<const SessionFile> session; // keeps stored valid
+    const SessionChannel* stored = nullptr;
+
+    // Empty while recording, see analyse():
+    std::optional<Analysis> analysis;
+  };
+
+  void handleAsyncUpdate() override
+  {
+    restorePendingSession();
+    deliverFinishedFits();
+
+    auto finished = std::vector<int>();
+    for (const auto channel : getRecordedChannels())
+      if (!measurements.at(channel).analysis)
+        finished.push_back(channel);
+    if (finished.empty())
+      return;
+
+    analyse(finished);
+
+    // The arrival of a fresh measurement (not one restored from a session) is
+    // estimated once, which also caches the interface latency if there was a
+    // loopback:
+    const auto measurement = measurements.find(measuredChannel);
+    if (measurement != measurements.end() && inputBuffer &&
+        measurement->second.capture == inputBuffer &&
+        measurement->second.stored == nullptr &&
+        std::find(finished.cbegin(), finished.cend(), measuredChannel) !=
+          finished.cend()) {
+      estimateTimeOfFlight();
+      if (onTimeOfFlight)
+        onTimeOfFlight();
+    }
+
+    sendChangeMessage();
+  }
+
+  // Calls the callbacks of fitEqualizersAsync() whose fits have finished:
+  void deliverFinishedFits()
+  {
+    auto finishedCallbacks = std::vector<std::function<void()>>();
+    {
+      const auto lock = std::lock_guard<std::mutex>(fitMutex);
+      finishedCallbacks.swap(finishedFits);
+    }
+    for (const auto& callback : finishedCallbacks)
+      callback();
+  }
+
+  // Everything fitting equalizers needs, copied on the message thread so the
+  // fit can run on another one:
+  struct EqualizerFitInput
+  {
+    double fs = 0;
+    Smoothing smoothing;
+    std::vector<int> channels;
+    std::vector<std::vector<float>> irs; // from the zero-delay sample on
+  };
+
+  EqualizerFitInput getEqualizerFitInput() const
+  {
+    auto input = EqualizerFitInput{ fs, smoothing, getMeasuredChannels(), {} };
+    for (const auto channel : input.channels) {
+      const auto ir = getImpulseResponse(channel);
+      const auto offset = long(std::min(getIROffset(channel), ir.size()));
+      input.irs.emplace_back(ir.cbegin() + offset, ir.cend());
+    }
+    return input;
+  }
+
+  static std::map<int, EqualizerFitResult> computeEqualizers(
+    const EqualizerFitInput& input,
+    EqualizerFitSettings settings,
+    const std::vector<TargetPoint>& target,
+    uint numbins)
+  {
+    settings.fs = input.fs;
+
+    const auto frequencies = dft_log_bins(numbins, 20e0, 20e3);
+    auto smoother = std::unique_ptr<SpectrumSmoother>();
+    auto responses = std::vector<std::vector<float>>();
+    for (const auto& ir : input.irs) {
+      const auto length = dft_size(ir.size());
+      if (!smoother ||
+          !smoother->matches(input.fs, length, frequencies, input.smoothing))
+        smoother = std::make_unique<SpectrumSmoother>(
+          input.fs, length, frequencies, input.smoothing);
+      responses.push_back(smoother->magnitudeDb(dft_magnitude(ir)));
+    }
+
+    const auto start = juce::Time::getMillisecondCounterHiRes();
+    const auto results =
+      fit_equalizers(responses, frequencies, target, settings);
+    DBG("Fitted " << input.channels.size() << " equalizers in "
+                  << juce::Time::getMillisecondCounterHiRes() - start
+                  << " ms");
+
+    auto equalizers = std::map<int, EqualizerFitResult>();
+    for (size_t i = 0; i < input.channels.size(); ++i)
+      equalizers[input.channels[i]] = results[i];
+    return equalizers;
+  }
+
+  // All measurements, except the one being recorded:
+  std::vector<int> getRecordedChannels() const
+  {
+    auto channels = std::vector<int>();
+    for (const auto& entry : measurements)
+      if (!sweepActive || entry.first != measuredChannel)
+        channels.push_back(entry.first);
+    return channels;
+  }
+
+  // Derives the IRs and room-acoustic parameters of channels once, when they
+  // are measured or restored and whenever the settings change, on the message
+  // thread. Everything else (display, exports, sessions) only reads the
+  // results. IRs and acoustics restored from a session are used as long as
+  // they were derived with the current settings, so their captures aren't
+  // read. Other acoustics are evaluated in one (parallel) pass over the
+  // untruncated IRs, unless withAcoustics is false: then the ones of the
+  // previous analysis are kept:
+  void analyse(const std::vector<int>& channels, bool withAcoustics = true)
+  {
+    auto evaluated = std::vector<int>();
+    auto untruncated = std::vector<std::vector<float>>();
+    for (const auto channel : channels) {
+      auto& measurement = measurements.at(channel);
+      auto analysis = Analysis{};
+      const auto matching = hasMatchingIR(
+        measurement, usesReferenceChannel(getNumCaptureChannels(measurement)));
+      if (matching) {
+        const auto& stored = *measurement.stored;
+        analysis.ir.assign(stored.ir, stored.ir + stored.irLength);
+        analysis.irOffset = stored.irOffset;
+        analysis.truncation = stored.truncationResult;
+        analysis.acoustics = stored.acoustics;
+      }
+      if (!withAcoustics && measurement.analysis)
+        analysis.acoustics = std::move(measurement.analysis->acoustics);
+      const auto needsAcoustics = withAcoustics && analysis.acoustics.empty();
+      if (!matching || needsAcoustics) {
+        const auto capture = describeCapture(measurement);
+        auto ir = deconvolve(capture, *measurement.sweep);
+        if (needsAcoustics) {
+          const auto offset =
+            std::min(getDeconvolutionOffset(capture, *measurement.sweep),
+                     ir.size());
+          evaluated.push_back(channel);
+          untruncated.emplace_back(ir.cbegin() + long(offset), ir.cend());
+        }
+        if (!matching) {
+          analysis.irOffset =
+            getDeconvolutionOffset(capture, *measurement.sweep);
+          analysis.truncation =
+            truncate(ir, analysis.irOffset, capture, *measurement.sweep);
+          analysis.ir = std::move(ir);
+        }
+      }
+      measurement.analysis = std::move(analysis);
+    }
+
+    if (!untruncated.empty()) {
+      const auto results = room_acoustic_parameters(untruncated, fs);
+      for (size_t i = 0; i < evaluated.size(); ++i)
+        measurements.at(evaluated[i]).analysis->acoustics = results[i];
+    }
+    updateSession();
+    ++revision;
+  }
+
+  // A finished measurement as it is saved, see saveSession():
+  struct SessionEntry
+  {
+    SessionChannel stored; // everything but the IR pointer is filled in
+    std::vector<float> ir;
+    std::shared_ptr<juce::AudioSampleBuffer> capture;
+    std::shared_ptr<const SessionFile> session; // keeps the mapping alive
+  };
+
+  struct SessionSnapshot
+  {
+    std::vector<SessionEntry> entries;
+    juce::File file; // where the entries are saved, if they are yet
+  };
+
+  // Takes the snapshot saveSession() writes, on the message thread whenever
+  // the measurements change. Restored measurements are already saved in
+  // file:
+  void updateSession(const juce::File& file = {})
+  {
+    auto snapshot = std::make_shared<SessionSnapshot>();
+    for (const auto& [channel, measurement] : measurements) {
+      if (!measurement.analysis)
+        continue; // still recording
+
+      auto entry = SessionEntry{};
+      entry.stored.channel = channel;
+      entry.stored.sweep = { measurement.sweep->getSampleRate(),
+                             measurement.sweep->getDuration(),
+                             measurement.sweep->getRange().lower,
+                             measurement.sweep->getRange().upper };
+      entry.stored.referenceChannel =
+        usesReferenceChannel(getNumCaptureChannels(measurement));
+      entry.stored.regularization = referenceRegularization;
+      entry.stored.truncation = truncation;
+      if (const auto& capture = measurement.capture) {
+        for (int c = 0; c < capture->getNumChannels(); ++c)
+          entry.stored.capture.push_back(capture->getReadPointer(c));
+        entry.stored.captureLength = size_t(capture->getNumSamples());
+      } else {
+        entry.stored.capture = measurement.stored->capture;
+        entry.stored.captureLength = measurement.stored->captureLength;
+      }
+      entry.stored.truncationResult = measurement.analysis->truncation;
+      entry.stored.acoustics = measurement.analysis->acoustics;
+      entry.stored.irOffset = measurement.analysis->irOffset;
+      entry.ir = measurement.analysis->ir;
+      entry.capture = measurement.capture;
+      entry.session = measurement.session;
+      snapshot->entries.push_back(std::move(entry));
+    }
+    snapshot->file = file;
+
+    const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+    sessionSnapshot = std::move(snapshot);
+  }
+
+  // Loads (or clears) the session passed to restoreSession(). Until it is
+  // loaded, saveSession() keeps returning it:
+  void restorePendingSession()
+  {
+    auto file = std::optional<juce::File>();
+    {
+      const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+      file = pendingSession;
+    }
+    if (!file)
+      return;
+
+    if (*file == juce::File() || !loadSession(*file))
+      clearData();
+
+    const auto lock = std::lock_guard<std::mutex>(sessionMutex);
+    if (pendingSession == file)
+      pendingSession.reset();
+  }
+
+  // Called from export jobs: logs the failure and tells the user from the
+  // message thread.
+  static void reportWriteFailure(const juce::String& what,
+                                 const juce::File& file)
+  {
+    const auto message =
+      "Could not write " + what + " to " + file.getFullPathName();
+    juce::Logger::writeToLog(message);
+    juce::MessageManager::callAsync([message] {
+      juce::AlertWindow::showMessageBoxAsync(
+        juce::AlertWindow::WarningIcon, "Write failed", message);
+    });
+  }
+
+  bool usesReferenceChannel(int numCaptureChannels) const
+  {
+    return deconvolutionMode == DeconvolutionMode::referenceChannel &&
+           numCaptureChannels > 1;
+  }
+
+  static int getNumCaptureChannels(const Measurement& measurement)
+  {
+    return measurement.capture ? measurement.capture->getNumChannels()
+                               : int(measurement.stored->capture.size());
+  }
+
+  static const juce::AudioSampleBuffer& getCapture(
+    const Measurement& measurement)
+  {
+    if (!measurement.capture) {
+      const auto& stored = *measurement.stored;
+      measurement.capture = std::make_shared<juce::AudioSampleBuffer>(
+        int(stored.capture.size()), int(stored.captureLength));
+      for (size_t c = 0; c < stored.capture.size(); ++c)
+        measurement.capture->copyFrom(
+          int(c), 0, stored.capture[c], int(stored.captureLength));
+    }
+    return *measurement.capture;
+  }
+
+  bool hasMatchingIR(const Measurement& measurement,
+                     bool referenceChannel) const
+  {
+    const auto* stored = measurement.stored;
+    return stored != nullptr && stored->ir != nullptr &&
+           stored->truncation.enabled == truncation.enabled &&
+           (!truncation.enabled ||
+            stored->truncation.fadeLength == truncation.fadeLength) &&
+           stored->referenceChannel == referenceChannel &&
+           (!referenceChannel ||
+            stored->regularization == referenceRegularization);
+  }
+
+  // The capture of a measurement, to be deconvolved with the current
+  // settings:
+  SessionChannel describeCapture(const Measurement& measurement) const
+  {
+    const auto& capture = getCapture(measurement);
+    auto stored = SessionChannel{};
+    for (int c = 0; c < capture.getNumChannels(); ++c)
+      stored.capture.push_back(capture.getReadPointer(c));
+    stored.captureLength = size_t(capture.getNumSamples());
+    stored.referenceChannel =
+      usesReferenceChannel(getNumCaptureChannels(measurement));
+    stored.regularization = referenceRegularization;
+    stored.truncation = truncation;
+    return stored;
+  }
+
+  std::vector<float> getUntruncatedImpulseResponse(int channel) const
+  {
+    const auto measurement = measurements.find(channel);
+    if (measurement == measurements.cend())
+      return {};
+
+    const auto& entry = measurement->second;
+    const auto capture = describeCapture(entry);
+    auto ir = deconvolve(capture, *entry.sweep);
+    const auto offset = getDeconvolutionOffset(capture, *entry.sweep);
+    ir.erase(ir.begin(), ir.begin() + long(std::min(offset, ir.size())));
+    return ir;
+  }
+
+  // Index of the zero-delay sample in the IR deconvolve() returns:
+  static size_t getDeconvolutionOffset(const SessionChannel& capture,
+                                       const ImpulseResponse& sweep)
+  {
+    return capture.referenceChannel ? 0 : sweep.getIROffset();
+  }
+
+  // The IR of a capture, as described at getImpulseResponse(), before it is
+  // truncated:
+  static std::vector<float> deconvolve(const SessionChannel& capture,
+                                       const ImpulseResponse& sweep)
+  {
+    const auto* mic = capture.capture[0];
+    const auto input = std::vector<float>(mic, mic + capture.captureLength);
+    auto ir = std::vector<float>();
+    if (capture.referenceChannel) {
+      const auto* loopback = capture.capture[1];
+      ir = transfer_function_ir(
+        input,
+        std::vector<float>(loopback, loopback + capture.captureLength),
+        capture.regularization);
+    } else {
+      ir = sweep.computeIR(input);
+    }
+    return ir;
+  }
+
+  // The lead-in before the zero-delay sample (at offset, which is updated)
+  // and the noise behind the decay are cut off, so everything downstream
+  // (display, filter design, exports) works on a fraction of the full
+  // convolution:
+  static TruncationResult truncate(std::vector<float>& ir,
+                                   size_t& offset,
+                                   const SessionChannel& capture,
+                                   const ImpulseResponse& sweep)
+  {
+    auto result = TruncationResult{};
+    if (capture.truncation.enabled) {
+      offset = trim_lead_in(
+        ir, offset, size_t(preRollSeconds * sweep.getSampleRate()));
+      result = find_truncation_point(
+        std::vector<float>(ir.cbegin() + long(offset), ir.cend()),
+        sweep.getSampleRate());
+      if (result.found)
+        truncate_ir(ir,
+                    offset + result.point,
+                    size_t(capture.truncation.fadeLength * result.point));
+    }
+    return result;
+  }
+
   void saveInputBuffer(juce::AudioSampleBuffer& input)
   {
     jassert(inputBuffer);
@@ -214,6 +1096,10 @@ private:
     const auto numSamples = juce::jmin(
       inputBuffer->getNumSamples() - inputBufferIndex, input.getNumSamples());
     inputBuffer->copyFrom(0, inputBufferIndex, input, 0, 0, numSamples);
+    if (inputBuffer->getNumChannels() > 1 &&
+        loopbackChannel < input.getNumChannels())
+      inputBuffer->copyFrom(
+        1, inputBufferIndex, input, loopbackChannel, 0, numSamples);
     inputBufferIndex += numSamples;
   }
 
@@ -227,14 +1113,19 @@ private:
   }
 
   template<typename T>
-  static std::vector<T> makeVectorFromBuffer(const juce::AudioBuffer<T>& buffer)
+  static std::vector<T> makeVectorFromBuffer(const juce::AudioBuffer<T>& buffer,
+                                             int channel = 0)
   {
-    const float* const ptr = buffer.getReadPointer(0);
+    const float* const ptr = buffer.getReadPointer(channel);
     const auto length = buffer.getNumSamples();
     return std::vector<T>(ptr, ptr + length);
   }
 
 private:
+  // Kept of the lead-in before the zero-delay sample of truncated IRs, for
+  // pre-ringing of the interface's anti-aliasing filters:
+  static constexpr double preRollSeconds = 0.005;
+
   bool sweepActive = false;   // used in check for recording AND playback
   bool sweepFinished = false; // only used in check for playback
   double fs = 0;
@@ -243,11 +1134,49 @@ private:
   int outputBufferIndex = 0;
   int inputBufferIndex = 0;
 
+  int measuredChannel = 0;
+  int loopbackChannel = -1;
+
+  DeconvolutionMode deconvolutionMode = DeconvolutionMode::inverseSweep;
+  float referenceRegularization = 1e-3f;
+
+  juce::String deviceName;
+  RoundTripLatencyCache latencyCache;
+  std::map<int, double> timesOfFlight; // output channel -> seconds
+
+  // Applied to the displayed response and before fitting equalizers. The
+  // smoother keeps its lin -> log tables as long as the IR length and the
+  // display width stay the same:
+  Smoothing smoothing{ SmoothingType::fractionalOctave, 6 };
+  std::unique_ptr<SpectrumSmoother> displaySmoother;
+
   std::unique_ptr<juce::MemoryAudioSource> audioSource;
   std::unique_ptr<juce::ChannelRemappingAudioSource> outputChannelMapper;
 
-  std::unique_ptr<juce::AudioSampleBuffer> inputBuffer;
-  std::unique_ptr<ImpulseResponse> sweep;
+  std::shared_ptr<juce::AudioSampleBuffer> inputBuffer;
+  std::shared_ptr<ImpulseResponse> sweep;
+
+  std::map<int, Measurement> measurements; // output channel -> measurement
+
+  TruncationSettings truncation;
+
+  int revision = 0; // see getRevision()
+
+  // Guards the snapshot of the measurements and a restored session that
+  // hasn't been loaded yet, which saveSession() reads from any thread:
+  std::mutex sessionMutex;
+  std::shared_ptr<SessionSnapshot> sessionSnapshot;
+  std::optional<juce::File> pendingSession;
+
+  // Exports are written in the background, so the message thread isn't
+  // blocked by large files:
+  mutable BackgroundWriter exportWriter;
+
+  // Runs fitEqualizersAsync(), whose results wait here for the message
+  // thread. Declared last, so it finishes its jobs while the rest is alive:
+  std::mutex fitMutex;
+  std::vector<std::function<void()>> finishedFits;
+  BackgroundWriter equalizerFitter;
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SweepComponentProcessor)
 };
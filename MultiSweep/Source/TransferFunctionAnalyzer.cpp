@@ -0,0 +1,233 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "TransferFunctionAnalyzer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+namespace {
+// A delay estimate needs a correlation peak this far above the RMS of the
+// correlation over all candidate delays:
+constexpr auto minPeakToRms = 8.0;
+
+size_t next_power_of_two(size_t value)
+{
+  auto result = size_t(1);
+  while (result < value)
+    result *= 2;
+  return result;
+}
+} // namespace
+
+TransferFunctionAnalyzer::TransferFunctionAnalyzer(
+  double _sampleRate,
+  TransferFunctionSettings _settings)
+  : sampleRate(_sampleRate)
+  , settings(_settings)
+  , fftSize(settings.analysis.fftSize)
+  , hopSize(hop_size(settings.analysis))
+  , maxDelay(size_t(std::max(0.0, settings.maxDelay * sampleRate)))
+  , delayInterval(size_t(std::max(0.0, settings.delayInterval * sampleRate)))
+  , plan(fftSize)
+  , window(hann_window(fftSize))
+  , referenceHistory(fftSize + maxDelay)
+  , measurementHistory(fftSize + maxDelay)
+  , frame(fftSize)
+  , referenceSpectrum(fftSize / 2 + 1)
+  , power(fftSize / 2 + 1)
+  , cross(fftSize / 2 + 1)
+  , referenceAverage(fftSize / 2 + 1, settings.analysis, sampleRate)
+  , measurementAverage(fftSize / 2 + 1, settings.analysis, sampleRate)
+  , crossAverage(fftSize / 2 + 1, settings.analysis, sampleRate)
+  , correlationPlan(next_power_of_two(fftSize + maxDelay))
+  , correlationInput(correlationPlan.size())
+  , correlationSpectrum(correlationPlan.numBins())
+  , sinceDelayEstimate(delayInterval)
+{
+  assert(fftSize > 0 && fftSize % 2 == 0);
+
+  const auto energy =
+    std::inner_product(window.cbegin(), window.cend(), window.cbegin(), 0.0);
+  scale = 4 / (double(fftSize) * energy);
+}
+
+void TransferFunctionAnalyzer::push(const float* reference,
+                                    const float* measurement,
+                                    size_t numSamples)
+{
+  const auto historySize = referenceHistory.size();
+  while (numSamples > 0) {
+    const auto n = std::min(numSamples, historySize - numBuffered);
+    const auto position = long(numBuffered);
+    std::copy(reference, reference + n, referenceHistory.begin() + position);
+    std::copy(
+      measurement, measurement + n, measurementHistory.begin() + position);
+    numBuffered += n;
+    reference += n;
+    measurement += n;
+    numSamples -= n;
+
+    if (numBuffered == historySize) {
+      sinceDelayEstimate += hopSize;
+      if (sinceDelayEstimate >= delayInterval) {
+        estimateDelay();
+        sinceDelayEstimate = 0;
+      }
+      if (delay)
+        analyseFrame();
+
+      for (auto* history : { &referenceHistory, &measurementHistory })
+        std::copy(history->cbegin() + long(hopSize),
+                  history->cend(),
+                  history->begin());
+      numBuffered -= hopSize;
+    }
+  }
+}
+
+void TransferFunctionAnalyzer::reset()
+{
+  referenceAverage.reset();
+  measurementAverage.reset();
+  crossAverage.reset();
+}
+
+void TransferFunctionAnalyzer::estimateDelay()
+{
+  // Correlates the measurement frame with the whole reference history. At
+  // lag l, the frame matches the reference l samples into the history, i.e.
+  // a delay of maxDelay - l. The history fits into the (zero-padded)
+  // transform, so no lag wraps around:
+  std::fill(correlationInput.begin(), correlationInput.end(), 0);
+  std::copy(referenceHistory.cbegin(),
+            referenceHistory.cend(),
+            correlationInput.begin());
+  correlationSpectrum = correlationPlan.forward(correlationInput);
+
+  std::fill(correlationInput.begin(), correlationInput.end(), 0);
+  std::copy(measurementHistory.cbegin() + long(maxDelay),
+            measurementHistory.cend(),
+            correlationInput.begin());
+  const auto& measured = correlationPlan.forward(correlationInput);
+
+  // Phase transform: only the phase of the cross-spectrum is kept, so the
+  // peak is sharp regardless of the spectrum of the program material:
+  for (size_t k = 0; k < correlationSpectrum.size(); ++k) {
+    const auto product = std::conj(measured[k]) * correlationSpectrum[k];
+    const auto magnitude = std::abs(product);
+    correlationSpectrum[k] = magnitude > 0 ? product / magnitude : 0;
+  }
+  const auto& correlation = correlationPlan.inverse(correlationSpectrum);
+
+  auto bestLag = size_t(0);
+  auto energy = 0.0;
+  for (size_t lag = 0; lag <= maxDelay; ++lag) {
+    energy += correlation[lag] * correlation[lag];
+    if (correlation[lag] > correlation[bestLag])
+      bestLag = lag;
+  }
+  const auto rms = std::sqrt(energy / double(maxDelay + 1));
+  if (!(correlation[bestLag] > minPeakToRms * rms))
+    return; // no clear peak, e.g. silence or unrelated signals
+
+  const auto estimate = maxDelay - bestLag;
+  if (!delay) {
+    delay = estimate;
+  } else if (estimate == *delay) {
+    candidate.reset();
+  } else if (candidate == estimate) {
+    delay = estimate;
+    candidate.reset();
+    reset(); // frames aligned by the old delay don't belong to the new one
+  } else {
+    candidate = estimate;
+  }
+}
+
+void TransferFunctionAnalyzer::analyseFrame()
+{
+  const auto offset = long(maxDelay - *delay);
+  for (size_t n = 0; n < fftSize; ++n)
+    frame[n] = window[n] * double(referenceHistory[size_t(offset) + n]);
+  referenceSpectrum = plan.forward(frame);
+
+  for (size_t n = 0; n < fftSize; ++n)
+    frame[n] = window[n] * double(measurementHistory[maxDelay + n]);
+  const auto& measured = plan.forward(frame);
+
+  for (size_t k = 0; k < power.size(); ++k)
+    power[k] = scale * std::norm(referenceSpectrum[k]);
+  referenceAverage.add(power);
+  for (size_t k = 0; k < power.size(); ++k)
+    power[k] = scale * std::norm(measured[k]);
+  measurementAverage.add(power);
+  for (size_t k = 0; k < cross.size(); ++k)
+    cross[k] = scale * std::conj(referenceSpectrum[k]) * measured[k];
+  crossAverage.add(cross);
+}
+
+TransferFunctionEstimate TransferFunctionAnalyzer::estimate(
+  SpectrumSmoother& smoother) const
+{
+  assert(smoother.getNumInputBins() == fftSize / 2 + 1);
+
+  auto result = TransferFunctionEstimate{};
+  result.frequencies = smoother.getFrequencies();
+  result.delay = delay;
+  result.numFrames = getNumFrames();
+
+  // The smoothing is linear, so the cross-spectrum is smoothed per part:
+  const auto& crossSpectrum = crossAverage.get();
+  auto part = RealVector(crossSpectrum.size());
+  std::transform(crossSpectrum.cbegin(),
+                 crossSpectrum.cend(),
+                 part.begin(),
+                 [](const ComplexType& value) { return value.real(); });
+  const auto crossReal = smoother.power(part);
+  std::transform(crossSpectrum.cbegin(),
+                 crossSpectrum.cend(),
+                 part.begin(),
+                 [](const ComplexType& value) { return value.imag(); });
+  const auto crossImag = smoother.power(part);
+  const auto gxx = smoother.power(referenceAverage.get());
+  const auto gyy = smoother.power(measurementAverage.get());
+
+  const auto numBands = result.frequencies.size();
+  result.magnitudeDb.resize(numBands);
+  result.phase.resize(numBands);
+  result.coherence.resize(numBands);
+  for (size_t i = 0; i < numBands; ++i) {
+    const auto gxy = ComplexType(crossReal[i], crossImag[i]);
+    const auto h = gxx[i] > 0 ? gxy / gxx[i] : ComplexType();
+    result.magnitudeDb[i] =
+      float(20 * std::log10(std::max(std::abs(h), 1e-10)));
+    result.phase[i] = float(std::arg(h));
+    result.coherence[i] =
+      gxx[i] > 0 && gyy[i] > 0
+        ? float(std::min(1.0, std::norm(gxy) / (gxx[i] * gyy[i])))
+        : 0.0f;
+  }
+  return result;
+}
@@ -0,0 +1,131 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+
+#pragma once
+
+#include "Smoothing.h"
+#include "SpectrumAnalyzer.h"
+#include "fft.h"
+#include <optional>
+#include <vector>
+
+// Live (dual-FFT) transfer function between a reference, e.g. the console
+// feed, and a measurement, e.g. the mic, from arbitrary program material.
+// The delay of the measurement behind the reference is found by cross-
+// correlating (GCC-PHAT) the latest frame with the reference history, and
+// tracked: a different delay is only taken over once two estimates in a row
+// agree, and the averages restart with it. Frames aligned by that delay are
+// windowed (Hann) and accumulate the auto-spectra Gxx, Gyy and the cross-
+// spectrum Gxy, from which H = Gxy / Gxx and the coherence
+// |Gxy|^2 / (Gxx Gyy) follow. Memory is fixed by the settings: histories of
+// fftSize + maxDelay samples. Not thread-safe, use one instance per thread.
+
+struct TransferFunctionSettings
+{
+  SpectrumAnalyzerSettings analysis = { 16384,
+                                        0.75,
+                                        SpectrumAveraging::exponential,
+                                        2,
+                                        16 };
+  double maxDelay = 0.5;    // seconds the measurement may lag the reference
+  double delayInterval = 1; // seconds between delay estimates
+};
+
+struct TransferFunctionEstimate
+{
+  std::vector<float> frequencies;
+  std::vector<float> magnitudeDb;
+  std::vector<float> phase;     // in radians, relative to the found delay
+  std::vector<float> coherence; // 0 (unrelated) ... 1 (linearly related)
+  std::optional<size_t> delay;  // in samples
+  size_t numFrames = 0;
+};
+
+class TransferFunctionAnalyzer
+{
+public:
+  TransferFunctionAnalyzer(double sampleRate,
+                           TransferFunctionSettings settings = {});
+
+  // Appends samples of both signals, estimates the delay when due and
+  // analyses every frame they complete (once a delay has been found):
+  void push(const float* reference,
+            const float* measurement,
+            size_t numSamples);
+
+  // Restarts the averages (and keeps the delay):
+  void reset();
+
+  double getSampleRate() const { return sampleRate; }
+  const TransferFunctionSettings& getSettings() const { return settings; }
+  std::optional<size_t> getDelay() const { return delay; }
+  size_t getNumFrames() const { return crossAverage.getNumFrames(); }
+
+  // Averaged spectra (scaled like SpectrumAnalyzer), fftSize / 2 + 1 bins:
+  const RealVector& getReferencePower() const { return referenceAverage.get(); }
+  const RealVector& getMeasurementPower() const
+  {
+    return measurementAverage.get();
+  }
+  const ComplexVector& getCrossSpectrum() const { return crossAverage.get(); }
+
+  // Smooths the averaged spectra onto the smoother's frequencies (built for
+  // this sample rate and FFT size) and derives the transfer function:
+  TransferFunctionEstimate estimate(SpectrumSmoother& smoother) const;
+
+private:
+  void estimateDelay();
+  void analyseFrame();
+
+  double sampleRate;
+  TransferFunctionSettings settings;
+  size_t fftSize;
+  size_t hopSize;
+  size_t maxDelay;      // in samples
+  size_t delayInterval; // in samples
+  FFTPlan plan;
+  RealVector window;
+  double scale;
+
+  // The last fftSize + maxDelay samples of both signals, the measurement
+  // frame is at the end:
+  std::vector<float> referenceHistory;
+  std::vector<float> measurementHistory;
+  size_t numBuffered = 0;
+
+  RealVector frame;
+  ComplexVector referenceSpectrum;
+  RealVector power;
+  ComplexVector cross;
+  SpectralAverage<double> referenceAverage;
+  SpectralAverage<double> measurementAverage;
+  SpectralAverage<ComplexType> crossAverage;
+
+  FFTPlan correlationPlan; // at least fftSize + maxDelay long
+  RealVector correlationInput;
+  ComplexVector correlationSpectrum;
+  std::optional<size_t> delay;
+  std::optional<size_t> candidate; // differing delay, seen once
+  size_t sinceDelayEstimate;
+};
@@ -0,0 +1,201 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#include "Truncation.h"
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+namespace {
+
+double to_db(double power)
+{
+  return 10 * std::log10(std::max(power, 1e-300));
+}
+
+// Energy sums in O(1) per range:
+class EnergySums
+{
+public:
+  explicit EnergySums(const std::vector<float>& energy)
+    : sums(energy.size() + 1)
+  {
+    for (size_t i = 0; i < energy.size(); ++i)
+      sums[i + 1] = sums[i] + double(energy[i]);
+  }
+
+  size_t size() const { return sums.size() - 1; }
+  double sum(size_t begin, size_t end) const { return sums[end] - sums[begin]; }
+  double meanDb(size_t begin, size_t end) const
+  {
+    return to_db(sum(begin, end) / double(std::max(end - begin, size_t(1))));
+  }
+
+private:
+  std::vector<double> sums;
+};
+
+// Level in dB = intercept + slope * sample:
+struct Line
+{
+  double slope;
+  double intercept;
+
+  double crossing(double level) const { return (level - intercept) / slope; }
+};
+
+// Averages the energy in blocks starting at begin and fits a line to the block
+// levels, from the first block at or below upperDb to the last one before the
+// level falls below lowerDb. Needs at least two blocks and a falling slope:
+std::optional<Line> fit_decay(const EnergySums& energy,
+                              size_t begin,
+                              size_t blockSize,
+                              double upperDb,
+                              double lowerDb)
+{
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (auto block = begin; block + blockSize <= energy.size();
+       block += blockSize) {
+    const auto level = energy.meanDb(block, block + blockSize);
+    if (level < lowerDb)
+      break;
+    if (level > upperDb)
+      continue;
+    const auto x = double(block) + 0.5 * double(blockSize);
+    n += 1;
+    sx += x;
+    sy += level;
+    sxx += x * x;
+    sxy += x * level;
+  }
+
+  const auto denominator = n * sxx - sx * sx;
+  if (n < 2 || denominator <= 0)
+    return std::nullopt;
+  const auto slope = (n * sxy - sx * sy) / denominator;
+  if (slope >= 0)
+    return std::nullopt;
+  return Line{ slope, (sy - slope * sx) / n };
+}
+} // namespace
+
+TruncationResult find_truncation_point(const std::vector<float>& ir, double fs)
+{
+  auto energy = std::vector<float>(ir.size());
+  std::transform(
+    ir.cbegin(), ir.cend(), energy.begin(), [](float x) { return x * x; });
+  return find_truncation_point_from_energy(energy, fs);
+}
+
+TruncationResult find_truncation_point_from_energy(
+  const std::vector<float>& energy,
+  double fs)
+{
+  auto result = TruncationResult{};
+  result.point = energy.size();
+  if (energy.size() < 16)
+    return result;
+
+  const auto sums = EnergySums(energy);
+  const auto size = energy.size();
+  const auto peak = size_t(std::distance(
+    energy.cbegin(), std::max_element(energy.cbegin(), energy.cend())));
+  const auto peakDb = to_db(energy[peak]);
+  const auto tailLength = std::max(size_t(1), (size - peak) / 10);
+
+  // 1. Initial noise estimate from the last 10 % of the decay:
+  auto noiseDb = sums.meanDb(size - tailLength, size);
+
+  // 2. Decay fitted with 10 ms blocks, from the peak to 10 dB above the noise:
+  auto blockSize = std::max(size_t(1), size_t(fs * 0.01));
+  const auto firstLine =
+    fit_decay(sums, peak, blockSize, peakDb, noiseDb + 10);
+  if (!firstLine)
+    return result;
+  auto line = *firstLine;
+  auto crosspoint =
+    std::clamp(line.crossing(noiseDb), double(peak), double(size));
+
+  // 3. Refinement: 5 blocks per 10 dB of decay, noise estimated from 5 dB of
+  // decay behind the crosspoint (but at least the last 10 % of the IR) and a
+  // fit over the 20 dB above a safety margin of 5 dB over the noise:
+  for (int iteration = 0; iteration < 10; ++iteration) {
+    const auto samplesPer10Db = 10 / -line.slope;
+    blockSize = std::clamp(
+      size_t(samplesPer10Db / 5), size_t(1), std::max(size_t(1), size / 20));
+
+    const auto noiseBegin = std::min(size_t(crosspoint + samplesPer10Db / 2),
+                                     size - tailLength);
+    noiseDb = sums.meanDb(noiseBegin, size);
+
+    const auto refined =
+      fit_decay(sums, peak, blockSize, noiseDb + 25, noiseDb + 5);
+    if (!refined)
+      break;
+    line = *refined;
+
+    const auto previous = crosspoint;
+    crosspoint =
+      std::clamp(line.crossing(noiseDb), double(peak), double(size));
+    if (std::abs(crosspoint - previous) < double(blockSize))
+      break;
+  }
+
+  // Decays that never leave the noise are not worth cutting:
+  if (noiseDb > peakDb - 10)
+    return result;
+
+  result.found = true;
+  result.point = std::clamp(size_t(std::lround(crosspoint)), peak + 1, size);
+  result.noiseFloorDb = noiseDb - peakDb;
+  result.decayRateDbPerSecond = line.slope * fs;
+  const auto total = sums.sum(0, size);
+  const auto discarded = sums.sum(result.point, size);
+  if (total > 0 && discarded > 0)
+    result.discardedEnergyDb = to_db(discarded / total);
+  return result;
+}
+
+void truncate_ir(std::vector<float>& ir, size_t point, size_t fadeLength)
+{
+  point = std::min(point, ir.size());
+  fadeLength = std::min(fadeLength, point);
+  const auto fadeStart = point - fadeLength;
+  for (size_t i = 0; i < fadeLength; ++i)
+    ir[fadeStart + i] *= float(
+      0.5 + 0.5 * std::cos(M_PI * double(i + 1) / double(fadeLength + 1)));
+  ir.resize(point);
+  ir.resize(point + point % 2, 0);
+}
+
+size_t trim_lead_in(std::vector<float>& ir, size_t offset, size_t preRoll)
+{
+  offset = std::min(offset, ir.size());
+  preRoll = std::min(preRoll, offset);
+  ir.erase(ir.begin(), ir.begin() + long(offset - preRoll));
+  const auto fadeLength = preRoll / 2;
+  for (size_t i = 0; i < fadeLength; ++i)
+    ir[i] *= float(
+      0.5 - 0.5 * std::cos(M_PI * double(i + 1) / double(fadeLength + 1)));
+  return preRoll;
+}
@@ -0,0 +1,73 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Where a measured IR disappears in the noise floor, following Lundeby et al.
+// (1995): the energy envelope is averaged in blocks, a line is fitted to the
+// decay, and its crossing with the noise floor estimated behind it is refined
+// iteratively with block sizes and fit ranges adapted to the decay rate.
+// Everything after the crosspoint is mostly noise and can be cut off.
+
+struct TruncationSettings
+{
+  bool enabled = true;
+
+  // Raised-cosine fade-out at the end of the kept part, relative to its
+  // length (0 cuts the IR off hard):
+  float fadeLength = 0.1f;
+};
+
+struct TruncationResult
+{
+  bool found = false; // false if the IR doesn't decay into a noise floor
+  size_t point = 0;   // first discarded sample, the size of the IR if !found
+  double noiseFloorDb = 0;         // mean noise power relative to the peak
+  double decayRateDbPerSecond = 0; // slope of the fitted decay
+  double discardedEnergyDb =       // energy after point relative to the total
+    -std::numeric_limits<double>::infinity();
+};
+
+// ir should start at (or shortly before) the direct sound:
+TruncationResult find_truncation_point(const std::vector<float>& ir,
+                                       double fs);
+
+// Same, for the squared (e.g. band-filtered) IR:
+TruncationResult find_truncation_point_from_energy(
+  const std::vector<float>& energy,
+  double fs);
+
+// Cuts ir off at point, after a raised-cosine fade over the fadeLength samples
+// before it. An odd point is padded with one zero, so the result has the even
+// length dft() would transform anyway:
+void truncate_ir(std::vector<float>& ir, size_t point, size_t fadeLength);
+
+// Drops the lead-in of ir (e.g. the harmonic distortion a log sweep leaves
+// before the zero-delay sample at offset) except for the preRoll samples
+// before offset, which are faded in with a raised cosine over their first
+// half. Returns the new index of the zero-delay sample:
+size_t trim_lead_in(std::vector<float>& ir, size_t offset, size_t preRoll);
@@ -0,0 +1,200 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#pragma once
+
+#include "ParallelFor.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Fixed set of worker threads, each with its own task deque. A worker takes
+// its newest task first; when its deque is empty it steals the oldest task of
+// another worker. Tasks submitted from inside a task go to the current
+// worker's deque, tasks from outside are spread round-robin.
+class WorkStealingPool
+{
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(unsigned numThreads = 0)
+  {
+    numThreads = resolve_num_threads(numThreads, size_t(-1));
+    for (unsigned i = 0; i < numThreads; ++i)
+      queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < numThreads; ++i)
+      threads.emplace_back([this, i] { work(i); });
+  }
+
+  ~WorkStealingPool()
+  {
+    wait();
+    {
+      const auto lock = std::lock_guard<std::mutex>(stateMutex);
+      stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  unsigned size() const { return unsigned(threads.size()); }
+
+  void submit(Task task)
+  {
+    const auto& current = currentWorker();
+    const auto target = current.pool == this ? current.index
+                                             : nextQueue++ % queues.size();
+    {
+      const auto lock = std::lock_guard<std::mutex>(stateMutex);
+      ++pending;
+      ++queued;
+    }
+    {
+      auto& queue = *queues[target];
+      const auto lock = std::lock_guard<std::mutex>(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    workAvailable.notify_one();
+  }
+
+  // Blocks until every submitted task (including ones they submitted) is done.
+  // Must not be called from inside a task:
+  void wait()
+  {
+    auto lock = std::unique_lock<std::mutex>(stateMutex);
+    allDone.wait(lock, [this] { return pending == 0; });
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // The pool and worker index running on this thread, if any:
+  struct Worker
+  {
+    const WorkStealingPool* pool = nullptr;
+    size_t index = 0;
+  };
+  static Worker& currentWorker()
+  {
+    thread_local auto worker = Worker{};
+    return worker;
+  }
+
+  bool take(unsigned worker, Task& task)
+  {
+    for (size_t n = 0; n < queues.size(); ++n) {
+      auto& queue = *queues[(worker + n) % queues.size()];
+      const auto lock = std::lock_guard<std::mutex>(queue.mutex);
+      if (queue.tasks.empty())
+        continue;
+      if (n == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void work(unsigned worker)
+  {
+    currentWorker() = { this, worker };
+    for (;;) {
+      {
+        auto lock = std::unique_lock<std::mutex>(stateMutex);
+        workAvailable.wait(lock, [this] { return queued > 0 || stopping; });
+        if (queued == 0 && stopping)
+          return;
+        --queued; // claims one task, which is in some deque
+      }
+
+      auto task = Task();
+      while (!take(worker, task))
+        std::this_thread::yield(); // only until its push has completed
+
+      task();
+
+      const auto lock = std::lock_guard<std::mutex>(stateMutex);
+      if (--pending == 0)
+        allDone.notify_all();
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> nextQueue{ 0 };
+
+  std::mutex stateMutex;
+  std::condition_variable workAvailable;
+  std::condition_variable allDone;
+  size_t pending = 0; // submitted but not finished
+  size_t queued = 0;  // submitted but not yet claimed by a worker
+  bool stopping = false;
+};
+
+// Limits how many bytes concurrent tasks may hold at once. acquire() blocks
+// until enough of the budget is free; a request larger than the whole budget
+// is let through once nothing else is held, so it can't deadlock.
+class MemoryBudget
+{
+public:
+  explicit MemoryBudget(size_t bytes)
+    : total(bytes)
+  {}
+
+  void acquire(size_t bytes)
+  {
+    auto lock = std::unique_lock<std::mutex>(mutex);
+    released.wait(lock, [&] {
+      return used == 0 || used + bytes <= total;
+    });
+    used += bytes;
+  }
+
+  void release(size_t bytes)
+  {
+    {
+      const auto lock = std::lock_guard<std::mutex>(mutex);
+      used -= std::min(bytes, used);
+    }
+    released.notify_all();
+  }
+
+private:
+  size_t total;
+  size_t used = 0;
+  std::mutex mutex;
+  std::condition_variable released;
+};
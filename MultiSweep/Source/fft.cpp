@@ -21,29 +21,57 @@
  */
 
 #include "fft.h"
+#include "Smoothing.h"
+#include "SpectralKernels.h"
 #include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <functional>
 #include <iterator>
+#include <mutex>
 #include <numeric>
 
+namespace {
+// Only fftw_execute() is thread-safe. Creating and destroying plans has to be
+// serialised, otherwise the fft functions can't be called from worker threads:
+std::mutex plannerMutex;
+
+template<typename PlanFunction>
+fftw_plan with_planner_lock(PlanFunction planFunction)
+{
+  const std::lock_guard<std::mutex> lock(plannerMutex);
+  return planFunction();
+}
+
+void destroy_plan(fftw_plan plan)
+{
+  const std::lock_guard<std::mutex> lock(plannerMutex);
+  fftw_destroy_plan(plan);
+}
+} // namespace
+
+size_t dft_size(size_t numSamples)
+{
+  return numSamples + numSamples % 2;
+}
+
 ComplexVector dft(RealVector input)
 {
   // To avoid confusion when calculating the inverse dft, dft() needs an input
   // of even length:
-  input.resize(input.size() + input.size() % 2, 0);
+  input.resize(dft_size(input.size()), 0);
   ComplexVector output(input.size() / 2 + 1);
 
   // NOTE: if FFTW_ESTIMATE is not specified, this will overwrite the contents
   // of the input/output buffers!
-  auto* const plan =
-    fftw_plan_dft_r2c_1d(int(input.size()),
-                         input.data(),
-                         reinterpret_cast<fftw_complex*>(output.data()),
-                         FFTW_ESTIMATE);
+  auto* const plan = with_planner_lock([&] {
+    return fftw_plan_dft_r2c_1d(int(input.size()),
+                                input.data(),
+                                reinterpret_cast<fftw_complex*>(output.data()),
+                                FFTW_ESTIMATE);
+  });
   fftw_execute(plan);
-  fftw_destroy_plan(plan);
+  destroy_plan(plan);
 
   return output;
 }
@@ -56,22 +84,72 @@ RealVector idft(ComplexVector input)
 
   // NOTE: if FFTW_ESTIMATE is not specified, this will overwrite the contents
   // of the input/output buffers!
-  auto* const plan =
-    fftw_plan_dft_c2r_1d(int(output.size()),
-                         reinterpret_cast<fftw_complex*>(input.data()),
-                         output.data(),
-                         FFTW_ESTIMATE);
+  auto* const plan = with_planner_lock([&] {
+    return fftw_plan_dft_c2r_1d(int(output.size()),
+                                reinterpret_cast<fftw_complex*>(input.data()),
+                                output.data(),
+                                FFTW_ESTIMATE);
+  });
   fftw_execute(plan);
-  fftw_destroy_plan(plan);
+  destroy_plan(plan);
 
   // FFTW doesn't normalise the IFFT by itself, so we have to do it manually:
-  std::for_each(output.begin(), output.end(), [output](RealType& n) {
-    n /= output.size();
-  });
+  real_scale(output.data(), 1 / RealType(output.size()), output.size());
 
   return output;
 }
 
+FFTPlan::FFTPlan(size_t size)
+  : real(size)
+  , complex(size / 2 + 1)
+{
+  assert(size % 2 == 0);
+
+  forwardPlan = with_planner_lock([&] {
+    return fftw_plan_dft_r2c_1d(int(real.size()),
+                                real.data(),
+                                reinterpret_cast<fftw_complex*>(complex.data()),
+                                FFTW_ESTIMATE);
+  });
+  inversePlan = with_planner_lock([&] {
+    return fftw_plan_dft_c2r_1d(int(real.size()),
+                                reinterpret_cast<fftw_complex*>(complex.data()),
+                                real.data(),
+                                FFTW_ESTIMATE);
+  });
+}
+
+FFTPlan::~FFTPlan()
+{
+  destroy_plan(forwardPlan);
+  destroy_plan(inversePlan);
+}
+
+const ComplexVector& FFTPlan::forward(const RealType* input, size_t length)
+{
+  length = std::min(length, real.size());
+  std::copy(input, input + length, real.begin());
+  std::fill(real.begin() + long(length), real.end(), 0);
+  fftw_execute(forwardPlan);
+  return complex;
+}
+
+const ComplexVector& FFTPlan::forward(const RealVector& input)
+{
+  return forward(input.data(), input.size());
+}
+
+const RealVector& FFTPlan::inverse(const ComplexVector& spectrum)
+{
+  assert(spectrum.size() == complex.size());
+  // c2r transforms destroy their input, so it is copied first:
+  std::copy(spectrum.cbegin(), spectrum.cend(), complex.begin());
+  fftw_execute(inversePlan);
+
+  real_scale(real.data(), 1 / RealType(real.size()), real.size());
+  return real;
+}
+
 RealVector convolve(RealVector a, RealVector b)
 {
   auto outputSize = a.size() + b.size() - 1;
@@ -81,17 +159,16 @@ RealVector convolve(RealVector a, RealVector b)
   a.resize(outputSize, 0);
   b.resize(outputSize, 0);
 
-  const auto a_dft = dft(a);
+  auto convolution = dft(a);
   const auto b_dft = dft(b);
-  assert(a_dft.size() == b_dft.size());
-  auto convolution = ComplexVector(a_dft.size());
+  assert(convolution.size() == b_dft.size());
 
-  // Element-wise multiplication of a_dft & b_dft:
-  std::transform(a_dft.cbegin(),
-                 a_dft.cend(),
-                 b_dft.cbegin(),
-                 convolution.begin(),
-                 std::multiplies<>());
+  // Element-wise multiplication of a_dft & b_dft, in place:
+  complex_multiply_scaled(convolution.data(),
+                          b_dft.data(),
+                          1,
+                          convolution.data(),
+                          convolution.size());
 
   const auto output = idft(convolution);
   // Sanity check:
@@ -108,6 +185,78 @@ std::vector<float> convolve(const std::vector<float>& a,
   return std::vector<float>(output.cbegin(), output.cend());
 }
 
+std::pair<ComplexVector, ComplexVector> dft_pair(RealVector a, RealVector b)
+{
+  // Same length and padding rules as dft():
+  auto size = std::max(a.size(), b.size());
+  size += size % 2;
+  a.resize(size, 0);
+  b.resize(size, 0);
+
+  // z = a + jb
+  ComplexVector packed(size);
+  for (size_t i = 0; i < size; ++i)
+    packed[i] = { a[i], b[i] };
+
+  auto* const plan = with_planner_lock([&] {
+    return fftw_plan_dft_1d(int(size),
+                            reinterpret_cast<fftw_complex*>(packed.data()),
+                            reinterpret_cast<fftw_complex*>(packed.data()),
+                            FFTW_FORWARD,
+                            FFTW_ESTIMATE);
+  });
+  fftw_execute(plan);
+  destroy_plan(plan);
+
+  // Both spectra are Hermitian, so they can be separated again using
+  // A[k] = (Z[k] + Z*[N-k]) / 2 and B[k] = (Z[k] - Z*[N-k]) / 2j:
+  const auto numBins = size / 2 + 1;
+  auto output = std::make_pair(ComplexVector(numBins), ComplexVector(numBins));
+  for (size_t k = 0; k < numBins; ++k) {
+    const auto z = packed[k];
+    const auto z_mirrored = std::conj(packed[(size - k) % size]);
+    output.first[k] = (z + z_mirrored) * 0.5;
+    output.second[k] = (z - z_mirrored) * ComplexType(0, -0.5);
+  }
+  return output;
+}
+
+ComplexVector transfer_function(RealVector response,
+                                RealVector reference,
+                                RealType regularization)
+{
+  // Zero-pad to twice the length so the division does not wrap around
+  // (deconvolution in the DFT domain is circular):
+  auto size = 2 * std::max(response.size(), reference.size());
+  response.resize(size, 0);
+  reference.resize(size, 0);
+
+  const auto [Y, X] = dft_pair(response, reference);
+
+  const auto power = [](auto x) { return std::norm(x); };
+  const auto meanPower =
+    std::transform_reduce(
+      X.cbegin(), X.cend(), RealType(0), std::plus<>(), power) /
+    RealType(X.size());
+  const auto epsilon = regularization * meanPower;
+
+  ComplexVector H(X.size());
+  for (size_t k = 0; k < H.size(); ++k)
+    H[k] = Y[k] * std::conj(X[k]) / (std::norm(X[k]) + epsilon);
+  return H;
+}
+
+std::vector<float> transfer_function_ir(const std::vector<float>& response,
+                                        const std::vector<float>& reference,
+                                        float regularization)
+{
+  const auto output =
+    idft(transfer_function(RealVector(response.cbegin(), response.cend()),
+                           RealVector(reference.cbegin(), reference.cend()),
+                           regularization));
+  return std::vector<float>(output.cbegin(), output.cend());
+}
+
 std::vector<float> dft_lin_bins(float fs, size_t numSamples)
 {
   const size_t numBins = numSamples;
@@ -126,8 +275,7 @@ RealVector dft_magnitude(RealVector input)
 {
   const auto spectrum = dft(input);
   RealVector output(spectrum.size());
-  const auto magnitude = [](auto x) { return std::abs(x); };
-  std::transform(spectrum.cbegin(), spectrum.cend(), output.begin(), magnitude);
+  spectral_magnitude(spectrum.data(), output.data(), spectrum.size());
   return output;
 }
 
@@ -140,18 +288,17 @@ std::vector<float> dft_magnitude(std::vector<float> input)
 
 std::vector<float> dft_magnitude_db(std::vector<float> input)
 {
-  const auto actual_db = [](float x) { return 20.0f * std::log10(x); };
-  auto mag = dft_magnitude(input);
-  std::transform(mag.begin(), mag.end(), mag.begin(), actual_db);
-  return mag;
+  const auto spectrum = dft(RealVector(input.cbegin(), input.cend()));
+  RealVector db(spectrum.size());
+  spectral_power_db(spectrum.data(), db.data(), spectrum.size());
+  return std::vector<float>(db.cbegin(), db.cend());
 }
 
 RealVector dft_phase(RealVector input)
 {
   const auto spectrum = dft(input);
   RealVector output(spectrum.size());
-  const auto phase = [](auto x) { return std::arg(x); };
-  std::transform(spectrum.cbegin(), spectrum.cend(), output.begin(), phase);
+  spectral_phase(spectrum.data(), output.data(), spectrum.size());
   return output;
 }
 
@@ -177,17 +324,9 @@ std::vector<float> dft_magnitude_with_log_bins(const std::vector<float>& input,
                                                float sampleRate,
                                                uint numbins)
 {
-  const auto lin_mag = dft_magnitude_db(input);
-  const auto lin_bins = dft_lin_bins(sampleRate, lin_mag.size() * 2);
-  const auto log_bins = dft_log_bins(numbins, 20e0, 20e3);
-  auto log_mag = std::vector<float>(log_bins.size());
-  const auto indices = map_log_to_lin_bins(lin_bins, log_bins);
-
-  const auto resolve_indices = [&](auto index) { return lin_mag[index]; };
-  std::transform(
-    indices.cbegin(), indices.cend(), log_mag.begin(), resolve_indices);
-
-  return log_mag;
+  // Averages the power of all linear bins that fall into each log bin, instead
+  // of picking a single one:
+  return smoothed_magnitude_with_log_bins(input, sampleRate, numbins, {});
 }
 
 std::vector<uint> map_log_to_lin_bins(const std::vector<float>& lin_bins,
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal timing harness for the benchmark target. Each case is run
+// repeatedly until minSeconds have passed; the fastest and the mean
+// iteration time are printed and can be written as JSON for tracking.
+
+template<typename T>
+inline void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+struct BenchmarkResult
+{
+  std::string name;
+  std::vector<std::pair<std::string, double>> parameters;
+  size_t iterations = 0;
+  double minNs = 0;
+  double meanNs = 0;
+  double itemsPerSecond = 0; // based on minNs, 0 if not applicable
+};
+
+class BenchmarkRunner
+{
+public:
+  explicit BenchmarkRunner(double minSeconds = 0.2)
+    : minSeconds(minSeconds)
+  {}
+
+  // Only cases whose name contains filter are run:
+  void setFilter(std::string newFilter) { filter = std::move(newFilter); }
+
+  // function is called once untimed (warm-up), then timed until minSeconds
+  // are used up (but at least three times). itemsPerIteration is e.g. the
+  // number of bins or samples processed per call:
+  template<typename Function>
+  void run(
+    std::string name,
+    std::vector<std::pair<std::string, double>> parameters,
+    size_t itemsPerIteration,
+    Function&& function)
+  {
+    if (name.find(filter) == std::string::npos)
+      return;
+
+    using Clock = std::chrono::steady_clock;
+    function();
+
+    auto times = std::vector<double>();
+    const auto start = Clock::now();
+    while (times.size() < 3 ||
+           std::chrono::duration<double>(Clock::now() - start).count() <
+             minSeconds) {
+      const auto before = Clock::now();
+      function();
+      const auto after = Clock::now();
+      times.push_back(
+        std::chrono::duration<double, std::nano>(after - before).count());
+    }
+
+    auto result = BenchmarkResult{ std::move(name), std::move(parameters) };
+    result.iterations = times.size();
+    result.minNs = *std::min_element(times.cbegin(), times.cend());
+    for (const auto time : times)
+      result.meanNs += time / double(times.size());
+    if (itemsPerIteration > 0)
+      result.itemsPerSecond = double(itemsPerIteration) / result.minNs * 1e9;
+
+    print(result);
+    results.push_back(std::move(result));
+  }
+
+  const std::vector<BenchmarkResult>& getResults() const { return results; }
+
+  void writeJson(std::ostream& stream) const
+  {
+    stream << "{\n  \"context\": {\n";
+    stream << "    \"compiler\": \"" << compiler() << "\",\n";
+    stream << "    \"optimized\": " << (optimized() ? "true" : "false")
+           << ",\n";
+    stream << "    \"min_seconds\": " << format_number(minSeconds) << "\n";
+    stream << "  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const auto& result = results[i];
+      stream << (i > 0 ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+             << "\", \"parameters\": {";
+      for (size_t p = 0; p < result.parameters.size(); ++p)
+        stream << (p > 0 ? ", " : "") << "\"" << result.parameters[p].first
+               << "\": " << format_number(result.parameters[p].second);
+      stream << "}, \"iterations\": " << result.iterations
+             << ", \"min_ns\": " << format_number(result.minNs)
+             << ", \"mean_ns\": " << format_number(result.meanNs)
+             << ", \"items_per_second\": "
+             << format_number(result.itemsPerSecond) << "}";
+    }
+    stream << "\n  ]\n}\n";
+  }
+
+private:
+  static void print(const BenchmarkResult& result)
+  {
+    auto label = result.name;
+    for (const auto& [key, value] : result.parameters)
+      label += " " + key + "=" + format_number(value);
+    std::printf("%-48s %12.1f us (mean %12.1f us, %6zu runs)",
+                label.c_str(),
+                result.minNs / 1e3,
+                result.meanNs / 1e3,
+                result.iterations);
+    if (result.itemsPerSecond > 0)
+      std::printf(" %10.1f M/s", result.itemsPerSecond / 1e6);
+    std::printf("\n");
+  }
+
+  static std::string format_number(double value)
+  {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.12g", value);
+    return buffer;
+  }
+
+  static const char* compiler()
+  {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+  }
+
+  static bool optimized()
+  {
+#ifdef NDEBUG
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  double minSeconds;
+  std::string filter;
+  std::vector<BenchmarkResult> results;
+};
@@ -0,0 +1,485 @@
+#include "../Source/CorrectionChain.h"
+#include "../Source/FilterBank.h"
+#include "../Source/LogSweep.h"
+#include "../Source/RoomAcoustics.h"
+#include "../Source/SpectralKernels.h"
+#include "../Source/SpscRing.h"
+#include "../Source/fft.h"
+#include "Benchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+
+void benchmarkTransforms(BenchmarkRunner&, bool quick);
+void benchmarkSweeps(BenchmarkRunner&, bool quick);
+void benchmarkSpectralKernels(BenchmarkRunner&, const std::vector<size_t>&);
+void benchmarkFilterBank(BenchmarkRunner&, bool quick);
+void benchmarkRoomAcoustics(BenchmarkRunner&, bool quick);
+void benchmarkCorrection(BenchmarkRunner&, bool quick);
+void benchmarkRing(BenchmarkRunner&, bool quick);
+RealVector makeNoise(size_t length);
+
+// =============================================================================
+
+// Usage: MultiSweepBench [--quick] [--filter <name part>] [--json <file>|-]
+//   --quick  shorter runs, skips the largest sizes
+//   --filter only runs cases whose name contains the given string
+//   --json   writes all results as JSON (to stdout for "-")
+int main(int argc, char* argv[])
+{
+  auto quick = false;
+  auto filter = std::string();
+  auto jsonPath = std::string();
+  for (int i = 1; i < argc; ++i) {
+    const auto hasValue = i + 1 < argc;
+    if (std::strcmp(argv[i], "--quick") == 0)
+      quick = true;
+    else if (std::strcmp(argv[i], "--filter") == 0 && hasValue)
+      filter = argv[++i];
+    else if (std::strcmp(argv[i], "--json") == 0 && hasValue)
+      jsonPath = argv[++i];
+    else {
+      std::cerr << "Unknown argument: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  auto runner = BenchmarkRunner(quick ? 0.05 : 0.2);
+  runner.setFilter(filter);
+
+  benchmarkTransforms(runner, quick);
+  benchmarkSweeps(runner, quick);
+
+  auto bins = std::vector<size_t>{ 4096, 65536, 1 << 20 };
+  if (!quick)
+    bins.push_back(1 << 24);
+  benchmarkSpectralKernels(runner, bins);
+  benchmarkFilterBank(runner, quick);
+  benchmarkRoomAcoustics(runner, quick);
+  benchmarkCorrection(runner, quick);
+  benchmarkRing(runner, quick);
+
+  if (jsonPath == "-") {
+    runner.writeJson(std::cout);
+  } else if (!jsonPath.empty()) {
+    auto file = std::ofstream(jsonPath);
+    runner.writeJson(file);
+    if (!file) {
+      std::cerr << "Could not write " << jsonPath << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// =============================================================================
+
+RealVector makeNoise(size_t length)
+{
+  auto generator = std::mt19937(1);
+  auto distribution = std::uniform_real_distribution<RealType>(-1, 1);
+  auto noise = RealVector(length);
+  for (auto& x : noise)
+    x = distribution(generator);
+  return noise;
+}
+
+// Powers of two as used for filters, plus the (non power of two) length of a
+// 10 s sweep at 48 kHz:
+void benchmarkTransforms(BenchmarkRunner& runner, bool quick)
+{
+  auto sizes = std::vector<size_t>{ 4096, 65536, 480000, 1 << 20 };
+  if (!quick)
+    sizes.push_back(1 << 22);
+
+  for (const auto n : sizes) {
+    const auto params =
+      std::vector<std::pair<std::string, double>>{ { "samples", double(n) } };
+    const auto signal = makeNoise(n);
+    const auto spectrum = dft(signal);
+
+    runner.run("dft", params, n, [&] { do_not_optimize(dft(signal)); });
+    runner.run("idft", params, n, [&] { do_not_optimize(idft(spectrum)); });
+    if (n <= 480000)
+      runner.run("convolve", params, n, [&] {
+        do_not_optimize(convolve(signal, signal));
+      });
+  }
+}
+
+// Sweeps of realistic lengths and sample rates. The response that is
+// deconvolved is the sweep itself plus one second of tail:
+void benchmarkSweeps(BenchmarkRunner& runner, bool quick)
+{
+  const auto sampleRates = quick ? std::vector<double>{ 48000 }
+                                 : std::vector<double>{ 44100, 48000, 96000 };
+  const auto durations = quick ? std::vector<double>{ 1, 5 }
+                               : std::vector<double>{ 1, 5, 10 };
+
+  for (const auto fs : sampleRates)
+    for (const auto duration : durations) {
+      const auto params = std::vector<std::pair<std::string, double>>{
+        { "fs", fs }, { "seconds", duration }
+      };
+      const auto range = FreqRange{ 20, fs / 2 };
+      const auto numSamples = size_t(fs * duration);
+
+      // Signals are cached inside LogSweep, so a fresh object is needed for
+      // every generation:
+      runner.run("LogSweep::generateSignal", params, numSamples, [&] {
+        const auto sweep =
+          LogSweep(Frequency{ fs }, Duration{ duration }, range);
+        do_not_optimize(sweep.generateSignal());
+      });
+      runner.run("LogSweep::generateInverse", params, numSamples, [&] {
+        const auto sweep =
+          LogSweep(Frequency{ fs }, Duration{ duration }, range);
+        do_not_optimize(sweep.generateInverse());
+      });
+
+      const auto sweep = LogSweep(Frequency{ fs }, Duration{ duration }, range);
+      auto response = sweep.generateSignal();
+      response.resize(response.size() + size_t(fs), 0);
+      sweep.generateInverse();
+      runner.run("LogSweep::computeIR", params, numSamples, [&] {
+        do_not_optimize(sweep.computeIR(response));
+      });
+
+      const auto ir = sweep.computeIR(response);
+      for (const auto numbins : { 512u, 2048u }) {
+        auto binParams = params;
+        binParams.emplace_back("bins", double(numbins));
+        runner.run("dft_magnitude_with_log_bins", binParams, ir.size(), [&] {
+          do_not_optimize(dft_magnitude_with_log_bins(ir, float(fs), numbins));
+        });
+      }
+    }
+}
+
+// =============================================================================
+
+// Each kernel is compared against the std::transform version it replaced:
+void benchmarkSpectralKernels(BenchmarkRunner& runner,
+                              const std::vector<size_t>& sizes)
+{
+  for (const auto n : sizes) {
+    auto spectrum = ComplexVector(n);
+    for (size_t k = 0; k < n; ++k)
+      spectrum[k] = std::polar(1.0 + double(k % 13), 0.1 * double(k));
+    auto other = spectrum;
+    auto product = ComplexVector(n);
+    auto output = RealVector(n);
+    const auto params = std::vector<std::pair<std::string, double>>{
+      { "bins", double(n) }
+    };
+
+    runner.run("magnitude/std", params, n, [&] {
+      std::transform(spectrum.cbegin(),
+                     spectrum.cend(),
+                     output.begin(),
+                     [](auto x) { return std::abs(x); });
+      do_not_optimize(output.data());
+    });
+    runner.run("magnitude/kernel", params, n, [&] {
+      spectral_magnitude(spectrum.data(), output.data(), n);
+      do_not_optimize(output.data());
+    });
+
+    runner.run("power/std", params, n, [&] {
+      std::transform(spectrum.cbegin(),
+                     spectrum.cend(),
+                     output.begin(),
+                     [](auto x) { return std::norm(x); });
+      do_not_optimize(output.data());
+    });
+    runner.run("power/kernel", params, n, [&] {
+      spectral_power(spectrum.data(), output.data(), n);
+      do_not_optimize(output.data());
+    });
+
+    runner.run("db/std", params, n, [&] {
+      std::transform(spectrum.cbegin(),
+                     spectrum.cend(),
+                     output.begin(),
+                     [](auto x) { return 20 * std::log10(std::abs(x)); });
+      do_not_optimize(output.data());
+    });
+    runner.run("db/kernel", params, n, [&] {
+      spectral_power_db(spectrum.data(), output.data(), n);
+      do_not_optimize(output.data());
+    });
+
+    runner.run("phase/std", params, n, [&] {
+      std::transform(spectrum.cbegin(),
+                     spectrum.cend(),
+                     output.begin(),
+                     [](auto x) { return std::arg(x); });
+      do_not_optimize(output.data());
+    });
+    runner.run("phase/kernel", params, n, [&] {
+      spectral_phase(spectrum.data(), output.data(), n);
+      do_not_optimize(output.data());
+    });
+
+    runner.run("multiply/std", params, n, [&] {
+      std::transform(spectrum.cbegin(),
+                     spectrum.cend(),
+                     other.cbegin(),
+                     product.begin(),
+                     std::multiplies<>());
+      do_not_optimize(product.data());
+    });
+    runner.run("multiply/kernel", params, n, [&] {
+      complex_multiply_scaled(
+        spectrum.data(), other.data(), 1, product.data(), n);
+      do_not_optimize(product.data());
+    });
+    runner.run("multiply_accumulate/kernel", params, n, [&] {
+      complex_multiply_accumulate(
+        spectrum.data(), other.data(), product.data(), n);
+      do_not_optimize(product.data());
+    });
+  }
+}
+
+// =============================================================================
+
+// One second of noise through all bands; items are samples x bands. The
+// scalar reference filters band by band through the same sections:
+void benchmarkFilterBank(BenchmarkRunner& runner, bool quick)
+{
+  const auto sampleRates = quick ? std::vector<double>{ 48000 }
+                                 : std::vector<double>{ 48000, 96000 };
+  for (const auto fs : sampleRates)
+    for (const auto resolution :
+         { BandResolution::octave, BandResolution::thirdOctave }) {
+      auto settings = FilterBankSettings{};
+      settings.resolution = resolution;
+      auto filterBank = FilterBank(settings, fs);
+      const auto numBands = filterBank.getNumBands();
+      const auto noise = makeNoise(size_t(fs));
+      const auto input = std::vector<float>(noise.cbegin(), noise.cend());
+      auto outputs =
+        std::vector<std::vector<float>>(numBands, std::vector<float>(input));
+      auto pointers = std::vector<float*>();
+      for (auto& output : outputs)
+        pointers.push_back(output.data());
+
+      const auto params = std::vector<std::pair<std::string, double>>{
+        { "fs", fs }, { "bands", double(numBands) }
+      };
+      const auto items = input.size() * numBands;
+
+      runner.run("filterbank/scalar", params, items, [&] {
+        const auto& centers = filterBank.getCenterFrequencies();
+        for (size_t band = 0; band < numBands; ++band) {
+          auto& output = outputs[band];
+          std::copy(input.cbegin(), input.cend(), output.begin());
+          for (const auto& section :
+               design_band_pass(centers[band], resolution, fs)) {
+            auto z1 = 0.0, z2 = 0.0;
+            for (auto& sample : output) {
+              const auto x = section.gain * double(sample);
+              const auto y = x + z1;
+              z1 = z2 - section.a1 * y;
+              z2 = -x - section.a2 * y;
+              sample = float(y);
+            }
+          }
+        }
+        do_not_optimize(pointers.data());
+      });
+      runner.run("filterbank/simd", params, items, [&] {
+        filterBank.reset();
+        filterBank.process(input.data(), pointers.data(), input.size());
+        do_not_optimize(pointers.data());
+      });
+      runner.run("filterbank/zero-phase", params, items, [&] {
+        filterBank.processZeroPhase(
+          input.data(), pointers.data(), input.size());
+        do_not_optimize(pointers.data());
+      });
+    }
+}
+
+// =============================================================================
+
+// All parameters of 1.5 s IRs (decaying noise above a -70 dB floor) in every
+// band, with channels in parallel; items are channels. 64 channels in third
+// octaves should take well under a second:
+void benchmarkRoomAcoustics(BenchmarkRunner& runner, bool quick)
+{
+  const auto fs = 48000.0;
+  const auto t60 = 0.5;
+  const auto channelCounts =
+    quick ? std::vector<size_t>{ 8 } : std::vector<size_t>{ 8, 64 };
+  for (const auto numChannels : channelCounts)
+    for (const auto resolution :
+         { BandResolution::octave, BandResolution::thirdOctave }) {
+      auto generator = std::mt19937(1);
+      auto gaussian = std::normal_distribution<float>();
+      auto irs = std::vector<std::vector<float>>(numChannels);
+      for (auto& ir : irs) {
+        ir.resize(size_t(1.5 * fs));
+        for (size_t i = 0; i < ir.size(); ++i)
+          ir[i] = float(std::pow(10.0, -3 * double(i) / fs / t60) *
+                          gaussian(generator) +
+                        std::pow(10.0, -70.0 / 20) * gaussian(generator));
+      }
+
+      auto settings = RoomAcousticsSettings{};
+      settings.bands.resolution = resolution;
+      const auto numBands = band_center_frequencies(settings.bands, fs).size();
+      const auto params = std::vector<std::pair<std::string, double>>{
+        { "channels", double(numChannels) }, { "bands", double(numBands) }
+      };
+      runner.run("acoustics/parameters", params, numChannels, [&] {
+        const auto results = room_acoustic_parameters(irs, fs, settings);
+        do_not_optimize(results.data());
+      });
+    }
+}
+
+// =============================================================================
+
+// One second of audio at 48 kHz in blocks of 512 samples through the room
+// correction, so the time is the share of one core: the target for 64
+// channels x 16 bands is under 1 % (10 ms). Items are samples x channels.
+// "update" also publishes a new EQ for one channel every block (copying and
+// freeing the snapshots is included):
+void benchmarkCorrection(BenchmarkRunner& runner, bool quick)
+{
+  const auto fs = 48000.0;
+  constexpr int blockSize = 512;
+  const auto numBlocks = int(fs) / blockSize;
+  const auto channelCounts =
+    quick ? std::vector<size_t>{ 64 } : std::vector<size_t>{ 16, 64 };
+  for (const auto numChannels : channelCounts)
+    for (const auto numBands : { size_t(0), size_t(16) }) {
+      auto settings = CorrectionChain::Settings(numChannels);
+      for (size_t channel = 0; channel < numChannels; ++channel) {
+        auto& setting = settings[channel].emplace();
+        setting.delay = float(channel) + 0.5f;
+        for (size_t band = 0; band < numBands; ++band)
+          setting.equalizer.push_back(make_biquad(
+            { BiquadType::peak, 50.0 * double(band + 1), 2, 3 }, fs));
+      }
+
+      auto chain = CorrectionChain();
+      chain.prepare(int(numChannels), blockSize, float(numChannels));
+      chain.setSettings(settings);
+      const auto noise = makeNoise(blockSize);
+      const auto input = std::vector<float>(noise.cbegin(), noise.cend());
+      auto outputs = std::vector<std::vector<float>>(
+        numChannels, std::vector<float>(blockSize));
+      auto pointers = std::vector<float*>();
+      for (auto& output : outputs)
+        pointers.push_back(output.data());
+
+      const auto params = std::vector<std::pair<std::string, double>>{
+        { "channels", double(numChannels) }, { "bands", double(numBands) }
+      };
+      const auto items = size_t(numBlocks * blockSize) * numChannels;
+      runner.run("correction/process", params, items, [&] {
+        for (int block = 0; block < numBlocks; ++block)
+          chain.process(
+            input.data(), pointers.data(), int(numChannels), blockSize);
+        do_not_optimize(pointers.data());
+      });
+      if (numBands == 0)
+        continue;
+
+      auto updated = size_t(0);
+      runner.run("correction/update", params, items, [&] {
+        for (int block = 0; block < numBlocks; ++block) {
+          auto setting = *settings[updated % numChannels];
+          setting.equalizer[0].b0 *= 1.0f - 0.1f * float(updated % 2);
+          chain.setChannel(updated++ % numChannels, std::move(setting));
+          chain.process(
+            input.data(), pointers.data(), int(numChannels), blockSize);
+        }
+        do_not_optimize(pointers.data());
+      });
+    }
+}
+
+// Audio-thread-sized blocks through the ring, compared to the per-element
+// copies of the old Queue; "threaded" moves the same amount of data from a
+// producer thread to the benchmark thread.
+void benchmarkRing(BenchmarkRunner& runner, bool quick)
+{
+  constexpr size_t blockSize = 512;
+  constexpr size_t numBlocks = 64;
+  const auto channelCounts =
+    quick ? std::vector<size_t>{ 2 } : std::vector<size_t>{ 2, 16 };
+  for (const auto numChannels : channelCounts) {
+    auto ring = SpscRing<float>(numChannels, 8 * blockSize);
+    const auto noise = makeNoise(blockSize);
+    const auto input = std::vector<std::vector<float>>(
+      numChannels, std::vector<float>(noise.cbegin(), noise.cend()));
+    auto output = input;
+    auto inputs = std::vector<const float*>();
+    auto outputs = std::vector<float*>();
+    for (size_t c = 0; c < numChannels; ++c) {
+      inputs.push_back(input[c].data());
+      outputs.push_back(output[c].data());
+    }
+
+    const auto params = std::vector<std::pair<std::string, double>>{
+      { "channels", double(numChannels) }, { "block", double(blockSize) }
+    };
+    const auto items = numBlocks * blockSize * numChannels;
+
+    runner.run("ring/element", params, items, [&] {
+      for (size_t block = 0; block < numBlocks; ++block) {
+        const auto write = ring.prepareWrite(blockSize);
+        for (size_t c = 0; c < numChannels; ++c) {
+          for (size_t i = 0; i < write.size1; ++i)
+            ring.channel(c)[write.start1 + i] = inputs[c][i];
+          for (size_t i = 0; i < write.size2; ++i)
+            ring.channel(c)[write.start2 + i] = inputs[c][write.size1 + i];
+        }
+        ring.finishWrite(write.size());
+        const auto read = ring.prepareRead(blockSize);
+        for (size_t c = 0; c < numChannels; ++c) {
+          for (size_t i = 0; i < read.size1; ++i)
+            outputs[c][i] = ring.channel(c)[read.start1 + i];
+          for (size_t i = 0; i < read.size2; ++i)
+            outputs[c][read.size1 + i] = ring.channel(c)[read.start2 + i];
+        }
+        ring.finishRead(read.size());
+      }
+      do_not_optimize(outputs.data());
+    });
+    runner.run("ring/bulk", params, items, [&] {
+      for (size_t block = 0; block < numBlocks; ++block) {
+        ring.write(inputs.data(), blockSize);
+        ring.read(outputs.data(), blockSize);
+      }
+      do_not_optimize(outputs.data());
+    });
+    runner.run("ring/threaded", params, items, [&] {
+      auto producer = std::thread([&] {
+        for (size_t written = 0; written < numBlocks * blockSize;) {
+          const auto n = ring.write(inputs.data(), blockSize);
+          if (n == 0)
+            std::this_thread::yield();
+          written += n;
+        }
+      });
+      for (size_t read = 0; read < numBlocks * blockSize;) {
+        const auto n = ring.read(outputs.data(), blockSize);
+        if (n == 0)
+          std::this_thread::yield();
+        read += n;
+      }
+      producer.join();
+      do_not_optimize(outputs.data());
+    });
+  }
+}
@@ -0,0 +1,317 @@
+#include "../Source/PartitionedConvolver.h"
+#include "../Source/SweepComponentProcessor.h"
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <random>
+
+#if JUCE_LINUX || JUCE_MAC
+#include <sys/resource.h>
+#endif
+
+// Headless end-to-end measurement: SweepComponentProcessor plays its sweeps
+// block by block into a simulated room (per-output IR, device latency and
+// noise), whose response is fed back as the next input block. Every stage is
+// timed for 1 to 64 measured outputs.
+
+struct Options
+{
+  double fs = 48000;
+  int blockSize = 512;
+  double sweepSeconds = 2;
+  int latency = 1024;  // round trip in samples, at least one block
+  float noiseDb = -80; // RMS of the microphone noise in dBFS
+  std::vector<int> channelCounts{ 1, 8, 64 };
+};
+
+struct StageResult
+{
+  std::string name;
+  double wallMs;
+  double cpuMs;
+  double peakMemoryMB;
+};
+
+bool parseOptions(int argc, char* argv[], Options&);
+std::vector<float> makeRoomResponse(int output, const Options&);
+double peakMemoryMB();
+double inBandErrorDb(const std::vector<float>& measured,
+                     const std::vector<float>& expected,
+                     const SweepComponentMetadata&,
+                     double fs);
+void runMeasurement(int numOutputs, const Options&);
+
+// The editor is neither needed nor linked here:
+juce::AudioProcessorEditor* SweepComponentProcessor::createEditor()
+{
+  return nullptr;
+}
+
+// =============================================================================
+
+// Usage: MultiSweepOfflineBench [--channels 1,8,64] [--block-size 512]
+//   [--fs 48000] [--sweep-seconds 2] [--latency 1024] [--noise-db -80]
+int main(int argc, char* argv[])
+{
+  auto options = Options{};
+  if (!parseOptions(argc, argv, options))
+    return 1;
+
+  for (const auto numOutputs : options.channelCounts)
+    runMeasurement(numOutputs, options);
+  return 0;
+}
+
+// =============================================================================
+
+class StageTimer
+{
+public:
+  explicit StageTimer(std::string name)
+    : name(std::move(name))
+    , wallStart(std::chrono::steady_clock::now())
+    , cpuStart(std::clock())
+  {}
+
+  StageResult stop() const
+  {
+    const auto wall = std::chrono::steady_clock::now() - wallStart;
+    return { name,
+             std::chrono::duration<double, std::milli>(wall).count(),
+             double(std::clock() - cpuStart) * 1000 / CLOCKS_PER_SEC,
+             peakMemoryMB() };
+  }
+
+private:
+  std::string name;
+  std::chrono::steady_clock::time_point wallStart;
+  std::clock_t cpuStart;
+};
+
+void runMeasurement(int numOutputs, const Options& options)
+{
+  const auto fs = options.fs;
+  const auto blockSize = options.blockSize;
+  auto results = std::vector<StageResult>();
+
+  // The round trip is one block (output -> next input) plus the rest of the
+  // latency, which is prepended to each room response:
+  const auto extraLatency = size_t(std::max(0, options.latency - blockSize));
+  auto systemResponses = std::vector<std::vector<float>>();
+  auto convolvers = std::vector<std::unique_ptr<PartitionedConvolver>>();
+  for (int output = 0; output < numOutputs; ++output) {
+    auto response = std::vector<float>(extraLatency, 0);
+    const auto room = makeRoomResponse(output, options);
+    response.insert(response.end(), room.cbegin(), room.cend());
+    convolvers.push_back(
+      std::make_unique<PartitionedConvolver>(response, size_t(blockSize)));
+    // What the deconvolution should find, including the block of latency:
+    response.insert(response.begin(), size_t(blockSize), 0);
+    systemResponses.push_back(std::move(response));
+  }
+
+  auto noise = std::normal_distribution<float>(
+    0, std::pow(10.0f, options.noiseDb / 20));
+  auto generator = std::mt19937(1);
+
+  auto processor = SweepComponentProcessor();
+  processor.prepareToPlay(fs, blockSize);
+  auto buffer = juce::AudioSampleBuffer(numOutputs, blockSize);
+  auto midi = juce::MidiBuffer();
+  auto microphone = std::vector<float>(size_t(blockSize), 0);
+
+  auto metadata = SweepComponentMetadata{};
+  metadata.duration = options.sweepSeconds;
+  metadata.lowerFreq = 20;
+  metadata.upperFreq = std::min(20e3, 0.45 * fs);
+  metadata.responseTailInSeconds = 0.5;
+
+  auto timer = StageTimer("capture");
+  for (int output = 0; output < numOutputs; ++output) {
+    metadata.channel = output;
+    processor.startSweep(metadata);
+    while (processor.isSweepActive()) {
+      buffer.clear();
+      buffer.copyFrom(0, 0, microphone.data(), blockSize);
+      processor.processBlock(buffer, midi);
+
+      for (auto& sample : microphone)
+        sample = noise(generator);
+      for (int channel = 0; channel < numOutputs; ++channel)
+        convolvers[size_t(channel)]->processAdding(
+          buffer.getReadPointer(channel), microphone.data());
+    }
+  }
+  results.push_back(timer.stop());
+
+  // There is no message loop to analyse the measurements as they finish:
+  timer = StageTimer("deconvolution");
+  processor.finishMeasurement();
+  auto irs = std::vector<std::vector<float>>();
+  for (int output = 0; output < numOutputs; ++output) {
+    const auto ir = processor.getImpulseResponse(output);
+    const auto offset = long(processor.getIROffset(output));
+    irs.emplace_back(ir.cbegin() + offset, ir.cend());
+  }
+  results.push_back(timer.stop());
+
+  auto keptSeconds = 0.0;
+  auto discardedDb = -1000.0;
+  for (int output = 0; output < numOutputs; ++output) {
+    keptSeconds += double(irs[size_t(output)].size()) / fs / numOutputs;
+    if (const auto truncation = processor.getTruncation(output))
+      discardedDb = std::max(discardedDb, truncation->discardedEnergyDb);
+  }
+
+  timer = StageTimer("analysis");
+  auto filterSettings = FilterDesignSettings{};
+  filterSettings.numTaps = 8192;
+  filterSettings.minimumPhase = true;
+  const auto filters = processor.designCorrectionFilters(filterSettings);
+  const auto equalizers = processor.fitEqualizers({}, {});
+  results.push_back(timer.stop());
+
+  // Mean T30 of the 1 kHz octave, against the simulated decay:
+  timer = StageTimer("room acoustics");
+  auto octaves = RoomAcousticsSettings{};
+  octaves.bands.resolution = BandResolution::octave;
+  const auto acoustics = processor.computeRoomAcoustics(octaves);
+  results.push_back(timer.stop());
+  auto meanT30 = 0.0;
+  for (const auto& channel : acoustics)
+    for (const auto& band : channel.second)
+      if (std::abs(band.frequency - 1000) < 1)
+        meanT30 += band.t30 / numOutputs;
+
+  timer = StageTimer("export");
+  const auto directory =
+    juce::File::getSpecialLocation(juce::File::tempDirectory)
+      .getChildFile("MultiSweepOfflineBench");
+  directory.createDirectory();
+  auto exported = Channels();
+  for (const auto& ir : irs)
+    exported.emplace_back(ir.cbegin(),
+                          ir.cbegin() + long(std::min(ir.size(), size_t(fs))));
+  const auto path = directory.getFullPathName().toStdString();
+  write_wav(path + "/irs.wav", exported, fs);
+  write_npy(path + "/irs.npy", exported);
+  results.push_back(timer.stop());
+  directory.deleteRecursively();
+
+  auto meanError = 0.0;
+  auto worstError = -1000.0;
+  for (int output = 0; output < numOutputs; ++output) {
+    const auto error = inBandErrorDb(
+      irs[size_t(output)], systemResponses[size_t(output)], metadata, fs);
+    meanError += error / numOutputs;
+    worstError = std::max(worstError, error);
+  }
+
+  std::printf("%d output(s), %d filters, %d equalizers:\n",
+              numOutputs,
+              int(filters.size()),
+              int(equalizers.size()));
+  for (const auto& result : results)
+    std::printf("  %-14s wall %10.1f ms  cpu %10.1f ms  peak %8.1f MB\n",
+                result.name.c_str(),
+                result.wallMs,
+                result.cpuMs,
+                result.peakMemoryMB);
+  std::printf("  IR error in band: mean %.1f dB, worst %.1f dB\n",
+              meanError,
+              worstError);
+  std::printf("  IR length after truncation: mean %.3f s, discarded energy "
+              "at most %.1f dB\n",
+              keptSeconds,
+              discardedDb);
+  std::printf("  T30 at 1 kHz: mean %.3f s (simulated 0.4 s)\n", meanT30);
+}
+
+// A direct sound whose delay grows with the output index, followed by an
+// exponentially decaying diffuse tail (T60 of 0.4 s):
+std::vector<float> makeRoomResponse(int output, const Options& options)
+{
+  const auto fs = options.fs;
+  auto response = std::vector<float>(size_t(0.5 * fs), 0);
+  const auto direct = size_t((0.002 + 0.0003 * output) * fs);
+  response[direct] = 1.0f / (1.0f + 0.02f * float(output));
+
+  auto generator = std::mt19937(unsigned(output + 100));
+  auto tail = std::normal_distribution<float>(0, 0.05f);
+  const auto decay = std::log(1e-3) / (0.4 * fs);
+  for (auto i = direct + 1; i < response.size(); ++i)
+    response[i] = tail(generator) * float(std::exp(decay * double(i - direct)));
+  return response;
+}
+
+// Energy of the difference relative to the expected response, only counting
+// the band the sweep covers:
+double inBandErrorDb(const std::vector<float>& measured,
+                     const std::vector<float>& expected,
+                     const SweepComponentMetadata& metadata,
+                     double fs)
+{
+  auto a = RealVector(expected.size(), 0);
+  std::copy_n(
+    measured.cbegin(), std::min(measured.size(), a.size()), a.begin());
+  const auto A = dft(a);
+  const auto B = dft(RealVector(expected.cbegin(), expected.cend()));
+
+  auto error = 0.0;
+  auto reference = 0.0;
+  for (size_t k = 0; k < A.size(); ++k) {
+    const auto f = double(k) * fs / double(2 * (A.size() - 1));
+    if (f >= metadata.lowerFreq && f <= metadata.upperFreq) {
+      error += std::norm(A[k] - B[k]);
+      reference += std::norm(B[k]);
+    }
+  }
+  return 10 * std::log10(error / reference);
+}
+
+double peakMemoryMB()
+{
+#if JUCE_LINUX || JUCE_MAC
+  auto usage = rusage{};
+  getrusage(RUSAGE_SELF, &usage);
+#if JUCE_MAC
+  return double(usage.ru_maxrss) / (1024 * 1024); // bytes
+#else
+  return double(usage.ru_maxrss) / 1024; // kilobytes
+#endif
+#else
+  return 0;
+#endif
+}
+
+bool parseOptions(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const auto value = juce::String(argv[i + 1]);
+    if (std::strcmp(argv[i], "--channels") == 0) {
+      options.channelCounts.clear();
+      for (const auto& count : juce::StringArray::fromTokens(value, ",", ""))
+        options.channelCounts.push_back(
+          juce::jlimit(1, 64, count.getIntValue()));
+    } else if (std::strcmp(argv[i], "--block-size") == 0)
+      options.blockSize = juce::jmax(16, value.getIntValue());
+    else if (std::strcmp(argv[i], "--fs") == 0)
+      options.fs = value.getDoubleValue();
+    else if (std::strcmp(argv[i], "--sweep-seconds") == 0)
+      options.sweepSeconds = value.getDoubleValue();
+    else if (std::strcmp(argv[i], "--latency") == 0)
+      options.latency = value.getIntValue();
+    else if (std::strcmp(argv[i], "--noise-db") == 0)
+      options.noiseDb = value.getFloatValue();
+    else {
+      std::cerr << "Unknown argument: " << argv[i] << "\n";
+      return false;
+    }
+  }
+  if (argc % 2 == 0) {
+    std::cerr << "Missing value for " << argv[argc - 1] << "\n";
+    return false;
+  }
+  return true;
+}
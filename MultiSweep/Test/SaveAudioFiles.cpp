@@ -1,61 +1,351 @@
+#include "../Source/DataFiles.h"
+#include "../Source/FilterDesign.h"
 #include "../Source/LogSweep.h"
+#include "../Source/RoomAcoustics.h"
+#include "../Source/Smoothing.h"
+#include "../Source/Truncation.h"
+#include "../Source/WorkStealingPool.h"
 #include "../Source/fft.h"
+#include <atomic>
+#include <iostream>
 #include <juce_audio_formats/juce_audio_formats.h>
 #include <juce_core/juce_core.h>
+#include <map>
+#include <mutex>
 
-// Generate unique filename so we don't append to existing files:
-const auto timestamp = juce::Time::getCurrentTime().toISO8601(false);
+// Batch analysis of recorded sweep responses.
+//
+//   SaveAudioFiles --input <dir> | --manifest <file>  --output <dir>
+//       [--duration 2] [--lower 20] [--upper 20000]   sweep that was played
+//       [--ir-length 1] [--no-truncation] seconds of IR to keep at most
+//       [--taps 8192] [--minimum-phase] correction filter design
+//       [--threads 0] [--memory-mb 2048] [--shard i/n] [--format wav|npy]
+//
+// Every channel of every WAV file is one capture. For each file, the IRs,
+// their smoothed magnitude responses (CSV) and the correction filters are
+// written to the output directory, as float32 WAV (default) or .npy files of
+// shape (channels, samples), along with the ISO 3382-1 parameters of every
+// third-octave band (<stem>_acoustics.csv). A manifest lists one file per line,
+// relative to the manifest's directory; lines starting with # are ignored.
+// With --shard i/n only every n-th file (starting at i, counting from 0) of the
+// sorted file list is processed, so archives can be split across machines.
+// Unless --no-truncation is given, the IRs of a file are cut off where the
+// slowest decaying channel reaches the noise floor.
+//
+//   SaveAudioFiles --sweeps <dir> [--fs 44100] [--duration 2]
+//
+// only writes the sweep and its inverse.
 
-const auto basePath = "~/Documents/Toningenieur/Algorithmen 2/sweeptest/";
-const auto fs = 44100;
-const auto sweepLength = 2;
+struct Options
+{
+  std::map<juce::String, juce::String> values;
+  bool has(const juce::String& name) const { return values.count(name) > 0; }
+  juce::String get(const juce::String& name, const juce::String& fallback) const
+  {
+    return has(name) ? values.at(name) : fallback;
+  }
+};
+
+struct Capture
+{
+  juce::File file;
+  double sampleRate;
+  int numChannels;
+  juce::int64 numSamples;
+};
+
+bool parseOptions(int argc, char* argv[], Options&);
+juce::Array<juce::File> findInputFiles(const Options&);
+int writeSweeps(const Options&);
+bool analyse(const Capture&, const LogSweep&, const Options&);
+bool write(const juce::File&, const Channels&, double, const Options&);
 
-void saveFile(const juce::AudioSampleBuffer&, std::string);
-void saveFile(const std::vector<float>&, std::string);
-juce::AudioSampleBuffer makeBufferFromVector(const std::vector<float>&);
+std::mutex logMutex;
+void log(const juce::String& message)
+{
+  const auto lock = std::lock_guard<std::mutex>(logMutex);
+  std::cout << message << std::endl;
+}
 
 // =============================================================================
 
-int main()
+int main(int argc, char* argv[])
 {
-  DBG(timestamp);
+  auto options = Options{};
+  if (!parseOptions(argc, argv, options))
+    return 1;
 
-  const auto sweepObject =
-    LogSweep(Frequency{ fs }, Duration{ sweepLength }, FreqRange{ 20, fs / 2 });
+  if (options.has("--sweeps"))
+    return writeSweeps(options);
 
-  const auto sweep = sweepObject.generateSignal();
-  const auto invSweep = sweepObject.generateInverse();
+  if (!options.has("--output") ||
+      !(options.has("--input") || options.has("--manifest"))) {
+    std::cerr << "Need --input or --manifest, and --output\n";
+    return 1;
+  }
+  const auto shard = juce::StringArray::fromTokens(
+    options.get("--shard", "0/1"), "/", "");
+  const auto shardIndex = shard[0].getIntValue();
+  const auto shardCount = shard[1].getIntValue();
+  const auto isIndex = [](const juce::String& token) {
+    return token.isNotEmpty() && token.containsOnly("0123456789");
+  };
+  if (shard.size() != 2 || !isIndex(shard[0]) || !isIndex(shard[1]) ||
+      shardCount <= 0 || shardIndex >= shardCount) {
+    std::cerr << "--shard needs i/n with n > 0 and 0 <= i < n\n";
+    return 1;
+  }
+  const auto output = juce::File::getCurrentWorkingDirectory().getChildFile(
+    options.get("--output", {}));
+  output.createDirectory();
 
-  saveFile(sweep, "sweep.wav");
-  saveFile(invSweep, "inv_sweep.wav");
+  // Sharding works on the sorted list, so every machine sees the same order:
+  auto files = findInputFiles(options);
+  files.sort();
 
-  return 0;
+  // Headers are read up front, so there is one sweep per sample rate whose
+  // inverse is computed before any worker uses it:
+  auto formats = juce::AudioFormatManager();
+  formats.registerBasicFormats();
+  auto captures = std::vector<Capture>();
+  for (int i = shardIndex; i < files.size(); i += shardCount) {
+    std::unique_ptr<juce::AudioFormatReader> reader(
+      formats.createReaderFor(files[i]));
+    if (reader == nullptr || reader->numChannels == 0 ||
+        reader->lengthInSamples == 0) {
+      log("Skipping unreadable file " + files[i].getFullPathName());
+      continue;
+    }
+    captures.push_back({ files[i],
+                         reader->sampleRate,
+                         int(reader->numChannels),
+                         reader->lengthInSamples });
+  }
+
+  const auto duration = options.get("--duration", "2").getDoubleValue();
+  const auto lower = options.get("--lower", "20").getDoubleValue();
+  const auto upper = options.get("--upper", "20000").getDoubleValue();
+  auto sweeps = std::map<double, std::unique_ptr<LogSweep>>();
+  for (const auto& capture : captures)
+    if (sweeps.count(capture.sampleRate) == 0) {
+      sweeps[capture.sampleRate] = std::make_unique<LogSweep>(
+        capture.sampleRate,
+        duration,
+        FreqRange{ lower, std::min(upper, capture.sampleRate / 2) });
+      sweeps[capture.sampleRate]->generateInverse();
+    }
+
+  const auto startTime = juce::Time::getMillisecondCounterHiRes();
+  auto failures = std::atomic<int>{ 0 };
+  {
+    auto budget = MemoryBudget(
+      size_t(options.get("--memory-mb", "2048").getLargeIntValue()) << 20);
+    auto pool =
+      WorkStealingPool(unsigned(options.get("--threads", "0").getIntValue()));
+
+    for (const auto& capture : captures)
+      pool.submit([&, capture] {
+        // Samples as float, plus the deconvolution's double-precision FFT
+        // buffers for one channel at a time:
+        const auto& sweep = *sweeps.at(capture.sampleRate);
+        const auto fftSize =
+          size_t(capture.numSamples) + sweep.generateInverse().size();
+        const auto bytes =
+          size_t(capture.numSamples) * size_t(capture.numChannels) * 4 +
+          fftSize * 48;
+
+        budget.acquire(bytes);
+        if (!analyse(capture, sweep, options))
+          ++failures;
+        budget.release(bytes);
+      });
+    pool.wait();
+  }
+
+  log(juce::String(captures.size()) + " file(s) analysed in " +
+      juce::String(juce::Time::getMillisecondCounterHiRes() - startTime, 0) +
+      " ms, " + juce::String(failures.load()) + " failed");
+  return failures > 0 ? 1 : 0;
 }
 
 // =============================================================================
 
-juce::AudioSampleBuffer makeBufferFromVector(const std::vector<float>& vector)
+bool analyse(const Capture& capture,
+             const LogSweep& sweep,
+             const Options& options)
+{
+  const auto output = juce::File::getCurrentWorkingDirectory().getChildFile(
+    options.get("--output", {}));
+  const auto stem = capture.file.getFileNameWithoutExtension();
+
+  auto formats = juce::AudioFormatManager();
+  formats.registerBasicFormats();
+  std::unique_ptr<juce::AudioFormatReader> reader(
+    formats.createReaderFor(capture.file));
+  if (reader == nullptr)
+    return false;
+
+  auto buffer =
+    juce::AudioSampleBuffer(capture.numChannels, int(capture.numSamples));
+  reader->read(&buffer, 0, buffer.getNumSamples(), 0, true, true);
+  reader.reset();
+
+  const auto fs = capture.sampleRate;
+  const auto irLength = size_t(
+    fs * options.get("--ir-length", "1").getDoubleValue());
+  auto irs = std::vector<std::vector<float>>();
+  for (int channel = 0; channel < buffer.getNumChannels(); ++channel) {
+    const auto* samples = buffer.getReadPointer(channel);
+    const auto ir = sweep.computeIR(
+      std::vector<float>(samples, samples + buffer.getNumSamples()));
+    const auto begin = ir.cbegin() + long(sweep.getIROffset());
+    const auto length = std::min(irLength, size_t(ir.cend() - begin));
+    irs.emplace_back(begin, begin + long(length));
+  }
+  buffer.setSize(0, 0);
+
+  // Evaluated before the truncation, which the per-band noise compensation
+  // replaces. The pool already runs one file per thread:
+  auto acousticsSettings = RoomAcousticsSettings{};
+  acousticsSettings.numThreads = 1;
+  const auto acoustics = room_acoustic_parameters(irs, fs, acousticsSettings);
+  auto acousticsHeader = std::vector<std::string>{ "freq" };
+  auto acousticsColumns = Channels(1);
+  for (const auto& band : acoustics.front())
+    acousticsColumns.front().push_back(float(band.frequency));
+  for (size_t channel = 0; channel < acoustics.size(); ++channel) {
+    const auto prefix = "ch" + std::to_string(channel + 1) + "_";
+    for (const auto* name : { "edt", "t20", "t30", "c50", "c80", "d50" })
+      acousticsHeader.push_back(prefix + name);
+    for (const auto member : { &RoomAcousticParameters::edt,
+                               &RoomAcousticParameters::t20,
+                               &RoomAcousticParameters::t30,
+                               &RoomAcousticParameters::c50,
+                               &RoomAcousticParameters::c80,
+                               &RoomAcousticParameters::d50 }) {
+      acousticsColumns.emplace_back();
+      for (const auto& band : acoustics[channel])
+        acousticsColumns.back().push_back(float(band.*member));
+    }
+  }
+
+  // One common length, so the channels still fit into one file:
+  auto kept = irs.front().size();
+  if (!options.has("--no-truncation")) {
+    kept = 0;
+    for (const auto& ir : irs)
+      kept = std::max(kept, find_truncation_point(ir, fs).point);
+    for (auto& ir : irs)
+      truncate_ir(ir, kept, kept / 10);
+  }
+
+  // Magnitude responses, 1/6 octave smoothed on a log grid:
+  const auto frequencies = dft_log_bins(512, 20, 20e3);
+  auto smoother = SpectrumSmoother(fs,
+                                   dft_size(irs.front().size()),
+                                   frequencies,
+                                   { SmoothingType::fractionalOctave, 6 });
+  auto header = std::vector<std::string>{ "freq" };
+  auto columns = Channels{ frequencies };
+  for (size_t channel = 0; channel < irs.size(); ++channel) {
+    header.push_back("ch" + std::to_string(channel + 1));
+    columns.push_back(smoother.magnitudeDb(dft_magnitude(irs[channel])));
+  }
+
+  auto settings = FilterDesignSettings{};
+  settings.fs = fs;
+  settings.numTaps = size_t(options.get("--taps", "8192").getIntValue());
+  settings.minimumPhase = options.has("--minimum-phase");
+  auto filters = std::vector<std::vector<float>>();
+  for (const auto& ir : irs)
+    filters.push_back(design_correction_filter(ir, settings).coefficients);
+
+  const auto csv = output.getChildFile(stem + "_magnitude.csv");
+  const auto acousticsCsv = output.getChildFile(stem + "_acoustics.csv");
+  if (!write(output.getChildFile(stem + "_ir"), irs, fs, options) ||
+      !write(output.getChildFile(stem + "_filter"), filters, fs, options) ||
+      !write_csv(csv.getFullPathName().toStdString(), header, columns) ||
+      !write_csv(acousticsCsv.getFullPathName().toStdString(),
+                 acousticsHeader,
+                 acousticsColumns,
+                 4)) {
+    log("Could not write the results for " + capture.file.getFileName());
+    return false;
+  }
+
+  log(capture.file.getFileName() + ": " + juce::String(irs.size()) +
+      " channel(s), " + juce::String(1000.0 * double(kept) / fs, 0) +
+      " ms IR");
+  return true;
+}
+
+bool write(const juce::File& stem,
+           const Channels& channels,
+           double fs,
+           const Options& options)
 {
-  juce::AudioSampleBuffer buffer(1, int(vector.size()));
-  for (size_t i = 0; i < vector.size(); ++i)
-    buffer.setSample(0, int(i), vector[i]);
-  return buffer;
+  const auto path = stem.getFullPathName().toStdString();
+  if (options.get("--format", "wav") == "npy")
+    return write_npy(path + ".npy", channels);
+  return write_wav(path + ".wav", channels, fs);
 }
 
-void saveFile(const juce::AudioSampleBuffer& buffer, std::string fileName)
+juce::Array<juce::File> findInputFiles(const Options& options)
 {
-  const auto filePath = basePath + timestamp + "_" + fileName;
+  const auto cwd = juce::File::getCurrentWorkingDirectory();
+  if (options.has("--input"))
+    return cwd.getChildFile(options.get("--input", {}))
+      .findChildFiles(juce::File::findFiles, false, "*.wav");
 
-  // The writer object takes ownership of the FileOutputStream, so we don't
-  // need to delete it:
-  std::unique_ptr<juce::AudioFormatWriter> writer(
-    juce::WavAudioFormat().createWriterFor(
-      new juce::FileOutputStream(juce::File(filePath)), fs, 1, 24, {}, 0));
+  const auto manifest = cwd.getChildFile(options.get("--manifest", {}));
+  auto lines = juce::StringArray();
+  manifest.readLines(lines);
+  auto files = juce::Array<juce::File>();
+  for (const auto& line : lines) {
+    const auto path = line.trim();
+    if (path.isNotEmpty() && !path.startsWith("#"))
+      files.add(manifest.getParentDirectory().getChildFile(path));
+  }
+  return files;
+}
 
-  writer->writeFromAudioSampleBuffer(buffer, 0, buffer.getNumSamples());
+int writeSweeps(const Options& options)
+{
+  const auto directory = juce::File::getCurrentWorkingDirectory().getChildFile(
+    options.get("--sweeps", {}));
+  directory.createDirectory();
+  const auto fs = options.get("--fs", "44100").getDoubleValue();
+  const auto sweepObject =
+    LogSweep(Frequency{ fs },
+             Duration{ options.get("--duration", "2").getDoubleValue() },
+             FreqRange{ 20, fs / 2 });
+
+  write(directory.getChildFile("sweep"),
+        { sweepObject.generateSignal() },
+        fs,
+        options);
+  write(directory.getChildFile("inv_sweep"),
+        { sweepObject.generateInverse() },
+        fs,
+        options);
+  return 0;
 }
 
-void saveFile(const std::vector<float>& vector, std::string fileName)
+bool parseOptions(int argc, char* argv[], Options& options)
 {
-  saveFile(makeBufferFromVector(vector), fileName);
+  for (int i = 1; i < argc; ++i) {
+    const auto name = juce::String(argv[i]);
+    if (!name.startsWith("--")) {
+      std::cerr << "Unexpected argument: " << argv[i] << "\n";
+      return false;
+    }
+    // Flags have no value, everything else takes the next argument:
+    const auto isFlag = name == "--minimum-phase" || name == "--no-truncation";
+    if (!isFlag && i + 1 >= argc) {
+      std::cerr << "Missing value for " << argv[i] << "\n";
+      return false;
+    }
+    options.values[name] = isFlag ? juce::String() : juce::String(argv[++i]);
+  }
+  return true;
 }
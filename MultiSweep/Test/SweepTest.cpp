@@ -1,14 +1,72 @@
 #define CATCH_CONFIG_MAIN
 
+#include "../Source/BackgroundWriter.h"
+#include "../Source/CorrectionChain.h"
+#include "../Source/Biquad.h"
+#include "../Source/DataFiles.h"
+#include "../Source/EqualizerFit.h"
+#include "../Source/FilterBank.h"
+#include "../Source/FilterDesign.h"
+#include "../Source/FractionalDelay.h"
+#include "../Source/Latency.h"
+#include "../Source/MinimumPhase.h"
+#include "../Source/PartitionedConvolver.h"
+#include "../Source/RoomAcoustics.h"
+#include "../Source/SessionStore.h"
+#include "../Source/Smoothing.h"
+#include "../Source/SpectralKernels.h"
+#include "../Source/SpectrumAnalyzer.h"
+#include "../Source/SpscRing.h"
+#include "../Source/TransferFunctionAnalyzer.h"
+#include "../Source/Truncation.h"
+#include "../Source/WorkStealingPool.h"
 #include "../Source/LogSweep.h"
 #include "../Source/fft.h"
 #include <algorithm>
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <chrono>
 #include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <functional>
+#include <new>
 #include <numeric>
+#include <random>
+#include <thread>
 #include <vector>
 
+// Heap operations of every thread, and of the calling one, to check that
+// real-time code neither allocates nor frees. Not inlined, so the compiler
+// doesn't take the malloc() and free() for a mismatch with new and delete:
+std::atomic<size_t> heapOperations{ 0 };
+thread_local size_t threadHeapOperations = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+  ++heapOperations;
+  ++threadHeapOperations;
+  if (auto* memory = std::malloc(size > 0 ? size : 1))
+    return memory;
+  throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept
+{
+  if (memory != nullptr) {
+    ++heapOperations;
+    ++threadHeapOperations;
+  }
+  std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+  operator delete(memory);
+}
+
 double meanSquaredError(const std::vector<float>& a,
                         const std::vector<float>& b)
 {
@@ -139,3 +197,1329 @@ TEST_CASE("Check mapping of log bins to lin bin indices")
   REQUIRE(indices[30] == 49);
   REQUIRE(indices[348] == 420);
 }
+
+// Band-limited impulse at a fractional position (windowed sinc):
+std::vector<float> fractionalImpulse(size_t length, double position)
+{
+  std::vector<float> ir(length, 0);
+  for (size_t i = 0; i < length; ++i) {
+    const auto x = double(i) - position;
+    const auto window = std::abs(x) < 32 ? 0.5 + 0.5 * std::cos(M_PI * x / 32)
+                                         : 0.0;
+    ir[i] = float(x == 0 ? 1.0 : window * std::sin(M_PI * x) / (M_PI * x));
+  }
+  return ir;
+}
+
+TEST_CASE("Check sub-sample peak estimation")
+{
+  for (const auto position : { 100.0, 100.25, 100.4, 257.8 }) {
+    const auto ir = fractionalImpulse(512, position);
+    CHECK(find_peak_index(ir) == size_t(std::round(position)));
+    // Parabolic interpolation is biased for sinc-shaped peaks:
+    CHECK(find_peak_parabolic(ir) == Approx(position).margin(0.25));
+    CHECK(find_peak_upsampled(ir, 16) == Approx(position).margin(0.02));
+  }
+}
+
+TEST_CASE("Check time of flight through LogSweep and loopback")
+{
+  const float fs = 48000;
+  const auto sweepObject =
+    LogSweep(Frequency{ fs }, Duration{ 1 }, FreqRange{ 20, fs / 2 });
+  const auto sweep = sweepObject.generateSignal();
+
+  const auto latency = 123.0;
+  const auto flight = 57.5;
+  const auto loopback =
+    sweepObject.computeIR(convolve(sweep, fractionalImpulse(512, latency)));
+  const auto measured = sweepObject.computeIR(
+    convolve(sweep, fractionalImpulse(512, latency + flight)));
+
+  const auto offset = double(sweepObject.getIROffset());
+  CHECK(estimate_arrival(loopback).peak - offset ==
+        Approx(latency).margin(0.05));
+  CHECK(estimate_time_of_flight(measured, loopback) ==
+        Approx(flight).margin(0.05));
+  CHECK(estimate_arrival(measured).onset < estimate_arrival(measured).peak);
+
+  const auto delays = delay_compensation({ 10.0, 12.5, 11.0 });
+  CHECK(delays == std::vector<double>{ 2.5, 0.0, 1.5 });
+
+  auto cache = RoundTripLatencyCache();
+  const auto key = RoundTripLatencyCache::makeKey("device", 48000, 256);
+  CHECK_FALSE(cache.lookup(key).has_value());
+  cache.store(key, latency);
+  CHECK(cache.lookup(key).value() == latency);
+}
+
+TEST_CASE("Check packed dft of two real signals")
+{
+  const auto a = RealVector{ 1, -2, 3, 0.5, 0, 7, -1 };
+  const auto b = RealVector{ 0, 4, -3, 2, 2, -0.25, 1 };
+  const auto [A, B] = dft_pair(a, b);
+  const auto A_reference = dft(a);
+  const auto B_reference = dft(b);
+
+  REQUIRE(A.size() == A_reference.size());
+  REQUIRE(B.size() == B_reference.size());
+  for (size_t k = 0; k < A.size(); ++k) {
+    CHECK(std::abs(A[k] - A_reference[k]) < 1e-9);
+    CHECK(std::abs(B[k] - B_reference[k]) < 1e-9);
+  }
+}
+
+TEST_CASE("Check transfer function against a loopback reference")
+{
+  float fs = 44100;
+  const auto sweep =
+    LogSweep(Frequency{ fs }, Duration{ 1 }, FreqRange{ 1, fs / 2 })
+      .generateSignal();
+
+  // The interface adds latency and some coloration to both channels:
+  auto interface = std::vector<float>(64, 0);
+  interface[40] = 0.8f;
+  interface[41] = 0.3f;
+  const auto reference = convolve(sweep, interface);
+
+  const auto testSystem = simulateImpulseResponse();
+  auto response = convolve(reference, testSystem);
+  response.resize(reference.size() + testSystem.size());
+
+  auto measuredSystem = transfer_function_ir(response, reference, 1e-6f);
+  measuredSystem.resize(testSystem.size());
+
+  CHECK(maxError(measuredSystem, testSystem) < 0.01);
+}
+
+TEST_CASE("Check correction filter design")
+{
+  // Comb filter caused by a single strong reflection:
+  auto ir = std::vector<float>(1000, 0);
+  ir[0] = 1.0f;
+  ir[20] = 0.5f;
+
+  auto settings = FilterDesignSettings{};
+  settings.fs = 48000;
+  settings.numTaps = 4096;
+  settings.target = { { 100, 0 }, { 10e3, -6 } };
+
+  const auto result = design_correction_filter(ir, settings);
+  REQUIRE(result.coefficients.size() == settings.numTaps);
+
+  // The corrected system should follow the target within the band:
+  const auto corrected = convolve(ir, result.coefficients);
+  const auto magnitude = dft_magnitude_db(corrected);
+  const auto bins = dft_lin_bins(48000, magnitude.size() * 2);
+  for (size_t k = 0; k < magnitude.size(); ++k)
+    if (bins[k] > 100 && bins[k] < 10e3)
+      CHECK(magnitude[k] ==
+            Approx(target_db(settings.target, bins[k])).margin(0.5));
+
+  const auto batch = design_correction_filters({ ir, ir, ir }, settings, 2);
+  REQUIRE(batch.size() == 3);
+  CHECK(batch[2].coefficients == result.coefficients);
+}
+
+TEST_CASE("Check minimum-phase conversion against a known filter")
+{
+  // Decaying resonance (poles inside the unit circle) followed by zeros at
+  // 0.9 and -0.5, which makes the filter minimum phase:
+  auto minimumPhaseFilter = std::vector<float>(256, 0);
+  auto y1 = 0.0, y2 = 0.0;
+  for (size_t n = 0; n < minimumPhaseFilter.size(); ++n) {
+    const auto x = (n == 0 ? 1.0 : 0.0) - (n == 1 ? 0.4 : 0.0) -
+                   (n == 2 ? 0.45 : 0.0);
+    const auto y = x + 1.2 * y1 - 0.72 * y2;
+    minimumPhaseFilter[n] = float(y);
+    y2 = y1;
+    y1 = y;
+  }
+
+  // Same magnitude, maximum phase (time-reversed):
+  auto reversed = minimumPhaseFilter;
+  std::reverse(reversed.begin(), reversed.end());
+
+  auto minimumPhase = MinimumPhase(4096);
+  const auto fromReversed = minimumPhase.fromImpulseResponse(reversed, 256);
+  const auto fromOriginal =
+    minimumPhase.fromImpulseResponse(minimumPhaseFilter, 256);
+
+  CHECK(maxError(fromReversed, minimumPhaseFilter) < 1e-3);
+  CHECK(maxError(fromOriginal, minimumPhaseFilter) < 1e-3);
+
+  const auto batch =
+    minimum_phase_filters({ reversed, minimumPhaseFilter }, 256, 4096, 2);
+  REQUIRE(batch.size() == 2);
+  CHECK(maxError(batch[0], minimumPhaseFilter) < 1e-3);
+  CHECK(maxError(batch[1], minimumPhaseFilter) < 1e-3);
+}
+
+TEST_CASE("Check minimum-phase correction filter design")
+{
+  auto ir = std::vector<float>(1000, 0);
+  ir[0] = 1.0f;
+  ir[20] = 0.5f;
+
+  auto settings = FilterDesignSettings{};
+  settings.fs = 48000;
+  settings.numTaps = 4096;
+  settings.minimumPhase = true;
+
+  const auto result = design_correction_filters({ ir }, settings).front();
+  REQUIRE(result.coefficients.size() == settings.numTaps);
+
+  // No modeling delay, so the energy is concentrated at the start:
+  CHECK(find_peak_index(result.coefficients) < 10);
+
+  const auto corrected = convolve(ir, result.coefficients);
+  const auto magnitude = dft_magnitude_db(corrected);
+  const auto bins = dft_lin_bins(48000, magnitude.size() * 2);
+  for (size_t k = 0; k < magnitude.size(); ++k)
+    if (bins[k] > 100 && bins[k] < 10e3)
+      CHECK(magnitude[k] == Approx(0).margin(0.5));
+}
+
+TEST_CASE("Check biquad designs")
+{
+  const auto fs = 48000.0;
+  const auto peak = make_biquad({ BiquadType::peak, 1000, 2, 6 }, fs);
+  CHECK(biquad_magnitude_db(peak, 1000, fs) == Approx(6).margin(1e-3));
+  CHECK(biquad_magnitude_db(peak, 20, fs) == Approx(0).margin(0.01));
+
+  const auto lowShelf =
+    make_biquad({ BiquadType::lowShelf, 200, 0.707, -4 }, fs);
+  CHECK(biquad_magnitude_db(lowShelf, 10, fs) == Approx(-4).margin(0.01));
+  CHECK(biquad_magnitude_db(lowShelf, 200, fs) == Approx(-2).margin(0.01));
+  CHECK(biquad_magnitude_db(lowShelf, 10e3, fs) == Approx(0).margin(0.01));
+
+  const auto highShelf =
+    make_biquad({ BiquadType::highShelf, 5000, 0.707, 3 }, fs);
+  CHECK(biquad_magnitude_db(highShelf, 20e3, fs) == Approx(3).margin(0.05));
+  CHECK(biquad_magnitude_db(highShelf, 50, fs) == Approx(0).margin(0.01));
+
+  CHECK(cascade_magnitude_db({ peak, lowShelf }, 1000, fs) ==
+        Approx(biquad_magnitude_db(peak, 1000, fs) +
+               biquad_magnitude_db(lowShelf, 1000, fs)));
+}
+
+TEST_CASE("Check biquad response gradient")
+{
+  const auto fs = 48000.0;
+  const auto frequencies = std::vector<double>{ 50, 700, 1000, 3000, 15e3 };
+  auto db = std::vector<double>();
+  auto gradient = std::vector<std::array<double, 3>>();
+  auto shiftedDb = std::vector<double>();
+  auto unused = std::vector<std::array<double, 3>>();
+
+  for (const auto type :
+       { BiquadType::peak, BiquadType::lowShelf, BiquadType::highShelf }) {
+    const auto params = BiquadParameters{ type, 1000, 1.5, -5 };
+    biquad_magnitude_db_with_gradient(params, frequencies, fs, db, gradient);
+
+    // Central differences in log2(frequency), log2(q) and gainDb:
+    const auto h = 1e-5;
+    for (size_t p = 0; p < 3; ++p) {
+      auto up = params;
+      auto down = params;
+      if (p == 0) {
+        up.frequency *= std::exp2(h);
+        down.frequency *= std::exp2(-h);
+      } else if (p == 1) {
+        up.q *= std::exp2(h);
+        down.q *= std::exp2(-h);
+      } else {
+        up.gainDb += h;
+        down.gainDb -= h;
+      }
+      auto upDb = std::vector<double>();
+      biquad_magnitude_db_with_gradient(up, frequencies, fs, upDb, unused);
+      biquad_magnitude_db_with_gradient(
+        down, frequencies, fs, shiftedDb, unused);
+      for (size_t n = 0; n < frequencies.size(); ++n)
+        CHECK(gradient[n][p] ==
+              Approx((upDb[n] - shiftedDb[n]) / (2 * h)).margin(1e-4));
+    }
+  }
+}
+
+TEST_CASE("Check parametric equalizer fit")
+{
+  const auto fs = 48000.0;
+  const auto frequencies = dft_log_bins(512, 20, 20e3);
+
+  // A room-like response: bass hump, a dip and a high-frequency roll-off.
+  const auto room = std::vector<Biquad>{
+    make_biquad({ BiquadType::peak, 60, 4, 9 }, fs),
+    make_biquad({ BiquadType::peak, 180, 3, -6 }, fs),
+    make_biquad({ BiquadType::peak, 2500, 1, 4 }, fs),
+    make_biquad({ BiquadType::highShelf, 8000, 0.707, -5 }, fs),
+  };
+  auto measuredDb = std::vector<float>();
+  for (const auto f : frequencies)
+    measuredDb.push_back(float(cascade_magnitude_db(room, f, fs)) + 3.0f);
+
+  auto settings = EqualizerFitSettings{};
+  settings.fs = fs;
+  settings.numBands = 8;
+  settings.maxBoostDb = 10;
+
+  const auto flat = std::vector<TargetPoint>{ { 1000, 0 } };
+  const auto results =
+    fit_equalizers({ measuredDb, measuredDb }, frequencies, flat, settings);
+  REQUIRE(results.size() == 2);
+
+  const auto& result = results.front();
+  REQUIRE(result.coefficients.size() == settings.numBands);
+  CHECK(result.rmsErrorDb < 0.5);
+  CHECK(results.back().rmsErrorDb == Approx(result.rmsErrorDb));
+
+  for (const auto& band : result.bands) {
+    CHECK(band.gainDb <= settings.maxBoostDb);
+    CHECK(band.gainDb >= -settings.maxCutDb);
+  }
+}
+
+TEST_CASE("Check fractional-octave and ERB smoothing")
+{
+  const auto fs = 48000.0;
+  const auto fftSize = size_t(8192);
+  const auto numBins = fftSize / 2 + 1;
+  const auto binWidth = fs / double(fftSize);
+  const auto frequencies = dft_log_bins(256, 20, 20e3);
+
+  const auto smoothings = { Smoothing{ SmoothingType::none },
+                            Smoothing{ SmoothingType::fractionalOctave, 1 },
+                            Smoothing{ SmoothingType::fractionalOctave, 48 },
+                            Smoothing{ SmoothingType::erb } };
+  for (const auto smoothing : smoothings) {
+    auto smoother = SpectrumSmoother(fs, fftSize, frequencies, smoothing);
+    CHECK(smoother.matches(fs, fftSize, frequencies, smoothing));
+    CHECK_FALSE(smoother.matches(fs, 2 * fftSize, frequencies, smoothing));
+
+    // A flat spectrum stays flat:
+    for (const auto db : smoother.magnitudeDb(std::vector<float>(numBins, 2)))
+      CHECK(db == Approx(20 * std::log10(2)).margin(1e-4));
+  }
+
+  // The mean of a linear ramp over a window is the ramp at the window's
+  // (linear) center, up to the bins being piecewise constant:
+  auto ramp = RealVector(numBins);
+  std::iota(ramp.begin(), ramp.end(), 0);
+  auto smoother = SpectrumSmoother(
+    fs, fftSize, frequencies, { SmoothingType::fractionalOctave, 3 });
+  const auto smoothed = smoother.power(ramp);
+  for (size_t i = 0; i < frequencies.size(); ++i) {
+    const auto halfWidth = std::exp2(1.0 / 6);
+    const auto center =
+      (frequencies[i] / halfWidth + frequencies[i] * halfWidth) / 2 / binWidth;
+    if (center * (halfWidth - 1 / halfWidth) > 1) // wider than one bin
+      CHECK(smoothed[i] == Approx(center).margin(0.125));
+    else
+      CHECK(smoothed[i] == Approx(frequencies[i] / binWidth).margin(1e-3));
+  }
+
+  // Odd lengths are padded by dft(), the smoothed response must follow:
+  auto impulse = std::vector<float>(1001, 0);
+  impulse[0] = 1;
+  CHECK(dft_size(impulse.size()) == 1002);
+  for (const auto smoothing : smoothings) {
+    const auto response =
+      smoothed_magnitude_with_log_bins(impulse, fs, 256, smoothing);
+    REQUIRE(response.size() == 256);
+    for (const auto db : response)
+      CHECK(db == Approx(0).margin(1e-4));
+  }
+  for (const auto db : dft_magnitude_with_log_bins(impulse, fs, 256))
+    CHECK(db == Approx(0).margin(1e-4));
+}
+
+TEST_CASE("Check spectral kernels against the standard library")
+{
+  // Odd length, so the scalar tail is covered too:
+  auto spectrum = ComplexVector(1001);
+  for (size_t k = 0; k < spectrum.size(); ++k)
+    spectrum[k] = std::polar(std::exp2(double(k % 97) - 60), 0.37 * k - 180);
+  spectrum[3] = 0;
+  spectrum[4] = { -1, 0 };
+  spectrum[5] = { -1, -0.0 };
+  spectrum[6] = { 0, -2 };
+
+  const auto n = spectrum.size();
+  auto output = RealVector(n);
+  auto db = RealVector(n);
+
+  spectral_magnitude(spectrum.data(), output.data(), n);
+  for (size_t k = 0; k < n; ++k)
+    CHECK(output[k] == Approx(std::abs(spectrum[k])));
+
+  spectral_power(spectrum.data(), output.data(), n);
+  for (size_t k = 0; k < n; ++k)
+    CHECK(output[k] == Approx(std::norm(spectrum[k])));
+
+  spectral_power_db(spectrum.data(), db.data(), n);
+  spectral_magnitude(spectrum.data(), output.data(), n);
+  spectral_db(output.data(), output.data(), n);
+  for (size_t k = 0; k < n; ++k)
+    if (k != 3) {
+      const auto expected = 20 * std::log10(std::abs(spectrum[k]));
+      CHECK(db[k] == Approx(expected).margin(1e-8));
+      CHECK(output[k] == Approx(expected).margin(1e-8));
+    }
+  CHECK(db[3] < -3000);
+
+  spectral_phase(spectrum.data(), output.data(), n);
+  for (size_t k = 0; k < n; ++k)
+    CHECK(output[k] == Approx(std::arg(spectrum[k])).margin(1e-10));
+
+  auto accumulator = ComplexVector(n, { 1, -1 });
+  complex_multiply_accumulate(
+    spectrum.data(), spectrum.data(), accumulator.data(), n);
+  auto product = spectrum;
+  complex_multiply_scaled(
+    product.data(), spectrum.data(), 0.5, product.data(), n);
+  for (size_t k = 0; k < n; ++k) {
+    const auto square = spectrum[k] * spectrum[k];
+    CHECK(accumulator[k].real() == Approx(1 + square.real()));
+    CHECK(accumulator[k].imag() == Approx(-1 + square.imag()));
+    CHECK(product[k].real() == Approx(0.5 * square.real()));
+    CHECK(product[k].imag() == Approx(0.5 * square.imag()));
+  }
+}
+
+TEST_CASE("Check partitioned convolution against direct convolution")
+{
+  const auto blockSize = size_t(64);
+  auto ir = std::vector<float>(300);
+  for (size_t i = 0; i < ir.size(); ++i)
+    ir[i] = float(std::sin(0.3 * double(i)) * std::exp(-0.01 * double(i)));
+
+  // Input with a long silent gap, so the silence shortcut is exercised:
+  auto input = std::vector<float>(40 * blockSize, 0);
+  for (size_t i = 0; i < 3 * blockSize + 5; ++i)
+    input[i] = float(std::cos(0.05 * double(i * i)));
+  for (size_t i = 30 * blockSize; i < 31 * blockSize; ++i)
+    input[i] = 0.5f;
+
+  auto convolver = PartitionedConvolver(ir, blockSize);
+  auto output = std::vector<float>(input.size(), 0);
+  for (size_t start = 0; start < input.size(); start += blockSize)
+    convolver.processAdding(&input[start], &output[start]);
+
+  auto expected = convolve(input, ir);
+  expected.resize(output.size());
+  CHECK(maxError(output, expected) < 1e-5);
+}
+
+TEST_CASE("Check work-stealing pool and memory budget")
+{
+  auto sum = std::atomic<int>{ 0 };
+  auto held = std::atomic<size_t>{ 0 };
+  auto maxHeld = std::atomic<size_t>{ 0 };
+  auto budget = MemoryBudget(100);
+
+  {
+    auto pool = WorkStealingPool(4);
+    for (int i = 1; i <= 100; ++i)
+      pool.submit([&, i] {
+        budget.acquire(30);
+        const auto now = held += 30;
+        auto previous = maxHeld.load();
+        while (now > previous && !maxHeld.compare_exchange_weak(previous, now))
+          ;
+        // Tasks may spawn more tasks:
+        pool.submit([&, i] { sum += i; });
+        held -= 30;
+        budget.release(30);
+      });
+    pool.wait();
+    CHECK(sum == 5050);
+
+    // A request larger than the budget still goes through on its own:
+    pool.submit([&] {
+      budget.acquire(1000);
+      budget.release(1000);
+      sum += 1;
+    });
+  }
+  CHECK(sum == 5051);
+  CHECK(maxHeld <= 90);
+}
+
+TEST_CASE("Check data file round trips")
+{
+  const auto channels = Channels{ { 0.5f, -0.25f, 1e-6f, 3 }, { 1, 2 } };
+  const auto padded = Channels{ channels[0], { 1, 2, 0, 0 } };
+  const auto base =
+    (std::filesystem::temp_directory_path() / "MultiSweepDataFiles").string();
+
+  // Files are written on the background thread (Catch2 assertions are not
+  // thread-safe, so results are checked afterwards):
+  auto written = std::vector<bool>(3);
+  {
+    auto writer = BackgroundWriter();
+    writer.enqueue(
+      [&] { written[0] = write_wav(base + ".wav", channels, 48000); });
+    writer.enqueue([&] { written[1] = write_npy(base + ".npy", channels); });
+    writer.flush();
+    writer.enqueue([&] {
+      written[2] = write_csv(base + ".csv", { "a", "b" }, channels, 4);
+    });
+  }
+  CHECK(written == std::vector<bool>{ true, true, true });
+
+  {
+    const auto file = MappedFile(base + ".wav");
+    auto wav = WavView{};
+    REQUIRE(read_wav(file, wav));
+    CHECK(wav.numChannels == 2);
+    CHECK(wav.numFrames == 4);
+    CHECK(wav.sampleRate == 48000);
+    for (size_t c = 0; c < 2; ++c) {
+      auto channel = std::vector<float>(wav.numFrames);
+      wav.copyChannel(c, channel.data());
+      CHECK(channel == padded[c]);
+    }
+  }
+
+  {
+    const auto file = MappedFile(base + ".npy");
+    auto npy = NpyView{};
+    REQUIRE(read_npy(file, npy));
+    CHECK(npy.shape == std::vector<size_t>{ 2, 4 });
+    CHECK(std::vector<float>(npy.data, npy.data + 4) == padded[0]);
+    CHECK(std::vector<float>(npy.data + 4, npy.data + 8) == padded[1]);
+  }
+
+  {
+    const auto file = MappedFile(base + ".csv");
+    CHECK(std::string(file.data(), file.size()) ==
+          "a,b\n0.5,1\n-0.25,2\n1e-06,\n3,\n");
+  }
+
+  for (const auto* extension : { ".wav", ".npy", ".csv" })
+    std::remove((base + extension).c_str());
+  CHECK_FALSE(MappedFile(base + ".wav").isOpen());
+
+  // The formatter agrees with printf("%g") where it takes the fast path:
+  char fast[32];
+  char reference[32];
+  for (const auto value : { 0.0f, -0.0f, 1.0f, -2.5f, 0.1f, 123.456f, 9.99999f,
+                            9999999.0f, 1.0e7f, 0.00012345f, 3.0e-5f, 1e20f }) {
+    for (const auto precision : { 3, 7 }) {
+      const auto length = format_float(fast, value, precision);
+      std::snprintf(reference, sizeof(reference), "%.*g", precision, value);
+      CHECK(std::string(fast, length) == reference);
+    }
+  }
+  auto rng = 1u;
+  for (int i = 0; i < 10000; ++i) {
+    rng = rng * 1664525u + 1013904223u;
+    const auto mantissa = float(int(rng >> 8) - (1 << 23));
+    const auto value = mantissa / float(1 << (rng % 24));
+    const auto length = format_float(fast, value, 7);
+    CHECK(std::strtof(std::string(fast, length).c_str(), nullptr) ==
+          Approx(value).epsilon(1e-6));
+  }
+}
+
+TEST_CASE("Check session store round trip")
+{
+  const auto path =
+    (std::filesystem::temp_directory_path() / "MultiSweepSession.mss")
+      .string();
+
+  const auto mic = std::vector<float>{ 1, 2, 3, 4, 5 };
+  const auto loopback = std::vector<float>{ -1, -2, -3, -4, -5 };
+  const auto ir = std::vector<float>{ 0.5f, 0.25f };
+
+  auto first = SessionChannel{};
+  first.channel = 3;
+  first.sweep = { 44100, 1.5, 30, 18e3 };
+  first.capture = { mic.data(), loopback.data() };
+  first.captureLength = mic.size();
+  first.ir = ir.data();
+  first.irLength = ir.size();
+  first.irOffset = 7;
+  first.referenceChannel = true;
+  first.regularization = 1e-3f;
+  first.truncation = { true, 0.2f };
+  first.truncationResult.found = true;
+  first.truncationResult.point = 2;
+  first.truncationResult.discardedEnergyDb = -40;
+  first.acoustics.resize(2);
+  first.acoustics[0].frequency = 500;
+  first.acoustics[0].t30 = 0.8;
+  first.acoustics[1].frequency = 1000;
+  first.acoustics[1].c80 = 3.5;
+
+  auto second = SessionChannel{};
+  second.channel = 0;
+  second.capture = { mic.data() };
+  second.captureLength = 3;
+
+  REQUIRE(write_session(path, { first, second }));
+
+  {
+    const auto session = SessionFile(path);
+    REQUIRE(session.isOpen());
+    REQUIRE(session.getChannels().size() == 2);
+    CHECK(session.find(1) == nullptr);
+
+    const auto* stored = session.find(3);
+    REQUIRE(stored != nullptr);
+    CHECK(stored->sweep.fs == 44100);
+    CHECK(stored->sweep.duration == 1.5);
+    CHECK(stored->sweep.lowerFreq == 30);
+    CHECK(stored->sweep.upperFreq == 18e3);
+    REQUIRE(stored->capture.size() == 2);
+    CHECK(std::vector<float>(stored->capture[1], stored->capture[1] + 5) ==
+          loopback);
+    CHECK(std::vector<float>(stored->ir, stored->ir + 2) == ir);
+    CHECK(stored->irOffset == 7);
+    CHECK(stored->referenceChannel);
+    CHECK(stored->regularization == 1e-3f);
+    CHECK(stored->truncation.enabled);
+    CHECK(stored->truncation.fadeLength == 0.2f);
+    CHECK(stored->truncationResult.found);
+    CHECK(stored->truncationResult.point == 2);
+    CHECK(stored->truncationResult.discardedEnergyDb == -40);
+    REQUIRE(stored->acoustics.size() == 2);
+    CHECK(stored->acoustics[0].frequency == 500);
+    CHECK(stored->acoustics[0].t30 == 0.8);
+    CHECK(std::isnan(stored->acoustics[0].c80));
+    CHECK(stored->acoustics[1].frequency == 1000);
+    CHECK(stored->acoustics[1].c80 == 3.5);
+
+    // Data is aligned inside the mapping:
+    CHECK(reinterpret_cast<uintptr_t>(stored->capture[0]) % 64 == 0);
+    CHECK(reinterpret_cast<uintptr_t>(stored->ir) % 64 == 0);
+
+    stored = session.find(0);
+    REQUIRE(stored != nullptr);
+    CHECK(std::vector<float>(stored->capture[0], stored->capture[0] + 3) ==
+          std::vector<float>{ 1, 2, 3 });
+    CHECK(stored->ir == nullptr);
+    CHECK(stored->acoustics.empty());
+  }
+
+  // A truncated file is rejected:
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 64);
+  CHECK_FALSE(SessionFile(path).isOpen());
+  std::filesystem::remove(path);
+  CHECK_FALSE(SessionFile(path).isOpen());
+}
+
+TEST_CASE("Check noise floor truncation")
+{
+  const auto fs = 48000.0;
+  auto generator = std::mt19937(1);
+  auto gaussian = std::normal_distribution<float>();
+
+  for (const auto t60 : { 0.3, 1.0 }) {
+    for (const auto noiseDb : { -40.0, -70.0 }) {
+      // Exponentially decaying noise, plus a constant noise floor:
+      auto ir = std::vector<float>(size_t(3 * fs));
+      for (size_t i = 0; i < ir.size(); ++i)
+        ir[i] = float(std::pow(10.0, -3 * double(i) / fs / t60) *
+                        gaussian(generator) +
+                      std::pow(10.0, noiseDb / 20) * gaussian(generator));
+
+      // The decay reaches the noise floor after t60 * noise / -60 dB:
+      const auto result = find_truncation_point(ir, fs);
+      REQUIRE(result.found);
+      CHECK(double(result.point) / fs ==
+            Approx(t60 * noiseDb / -60).epsilon(0.1));
+      CHECK(result.decayRateDbPerSecond ==
+            Approx(-60 / t60).epsilon(0.15));
+      CHECK(result.discardedEnergyDb < noiseDb / 3);
+
+      truncate_ir(ir, result.point, result.point / 10);
+      CHECK(ir.size() == result.point + result.point % 2);
+      CHECK(ir.size() % 2 == 0);
+      CHECK(std::abs(ir[result.point - 1]) < 1e-3f);
+      CHECK(std::abs(ir.back()) < 1e-3f);
+    }
+  }
+
+  // Pure noise has no decay to cut:
+  auto noise = std::vector<float>(size_t(fs));
+  for (auto& sample : noise)
+    sample = gaussian(generator);
+  const auto result = find_truncation_point(noise, fs);
+  CHECK_FALSE(result.found);
+  CHECK(result.point == noise.size());
+
+  // Odd points are padded to an even length, the padding is silent:
+  auto ramp = std::vector<float>(11, 1);
+  truncate_ir(ramp, 7, 0);
+  CHECK(ramp == std::vector<float>{ 1, 1, 1, 1, 1, 1, 1, 0 });
+
+  // Only the pre-roll of the lead-in is kept, its start is faded in:
+  auto leadIn = std::vector<float>(100, 1);
+  CHECK(trim_lead_in(leadIn, 90, 8) == 8);
+  REQUIRE(leadIn.size() == 18);
+  CHECK(leadIn[0] < 0.5f);
+  CHECK(leadIn[3] < 1);
+  CHECK(leadIn[4] == 1);
+  CHECK(trim_lead_in(leadIn, 4, 8) == 4);
+  CHECK(leadIn.size() == 18);
+}
+
+TEST_CASE("Check fractional octave filter bank")
+{
+  const auto fs = 48000.0;
+
+  // 31 third-octave bands from 20 Hz to 20 kHz:
+  const auto centers = band_center_frequencies({}, fs);
+  REQUIRE(centers.size() == 31);
+  CHECK(centers.front() == Approx(19.953).epsilon(1e-4));
+  CHECK(centers[17] == Approx(1000));
+  CHECK(band_center_frequencies({ BandResolution::octave }, fs).size() == 10);
+
+  // Unity gain at the center, -3 dB at the band edges:
+  for (const auto center : { 31.6228, 1000.0, 15848.9 }) {
+    const auto sections =
+      design_band_pass(center, BandResolution::thirdOctave, fs);
+    const auto gain = [&](double f) {
+      const auto z = std::polar(1.0, 2 * M_PI * f / fs);
+      auto response = std::complex<double>(1);
+      for (const auto& s : sections)
+        response *= s.gain * (1.0 - 1.0 / (z * z)) /
+                    (1.0 + s.a1 / z + s.a2 / (z * z));
+      return 20 * std::log10(std::abs(response));
+    };
+    const auto edge = std::pow(10.0, 0.3 / 6);
+    CHECK(gain(center) == Approx(0).margin(1e-6));
+    CHECK(gain(center * edge) == Approx(-3.01).margin(0.2));
+    CHECK(gain(center / edge) == Approx(-3.01).margin(0.2));
+    CHECK(gain(center * edge * edge) < -15);
+  }
+
+  // The bank matches a plain cascade of the same sections, band by band:
+  auto filterBank = FilterBank({}, fs);
+  REQUIRE(filterBank.getNumBands() == centers.size());
+  auto input = std::vector<float>(9600);
+  input[10] = 1;
+  auto outputs = std::vector<std::vector<float>>(centers.size(), input);
+  auto pointers = std::vector<float*>();
+  for (auto& output : outputs)
+    pointers.push_back(output.data());
+  filterBank.process(input.data(), pointers.data(), 1000);
+  for (auto& pointer : pointers)
+    pointer += 1000; // continues where the first call stopped
+  filterBank.process(input.data() + 1000, pointers.data(), 8600);
+  for (size_t band = 0; band < centers.size(); ++band) {
+    auto expected = std::vector<double>(input.cbegin(), input.cend());
+    for (const auto& section :
+         design_band_pass(centers[band], BandResolution::thirdOctave, fs)) {
+      auto z1 = 0.0, z2 = 0.0;
+      for (auto& sample : expected) {
+        const auto x = section.gain * sample;
+        const auto y = x + z1;
+        z1 = z2 - section.a1 * y;
+        z2 = -x - section.a2 * y;
+        sample = y;
+      }
+    }
+    for (size_t i = 0; i < input.size(); ++i)
+      REQUIRE(outputs[band][i] == Approx(expected[i]).margin(1e-6));
+  }
+
+  // Zero phase: the response to an impulse is symmetric around it (for the
+  // bands that have decayed within the signal):
+  std::fill(input.begin(), input.end(), 0.0f);
+  input[4800] = 1;
+  for (size_t band = 0; band < centers.size(); ++band)
+    pointers[band] = outputs[band].data();
+  filterBank.processZeroPhase(input.data(), pointers.data(), input.size());
+  for (size_t band = 0; band < centers.size(); ++band) {
+    if (centers[band] < 200)
+      continue;
+    const auto& output = outputs[band];
+    const auto peak = *std::max_element(output.cbegin(), output.cend());
+    CHECK(output[4800] == peak);
+    for (size_t i = 1; i < 4800; ++i)
+      REQUIRE(output[4800 - i] == Approx(output[4800 + i]).margin(1e-6));
+  }
+}
+
+TEST_CASE("Check room acoustic parameters")
+{
+  const auto fs = 48000.0;
+
+  const auto centers = band_center_frequencies({}, fs);
+
+  // Exponentially decaying noise with a T60 of 0.5 s above a -70 dB floor.
+  // Its energy falls by 6 dB in the first 50 ms and by 9.6 dB in 80 ms:
+  const auto t60 = 0.5;
+  auto generator = std::mt19937(1);
+  auto gaussian = std::normal_distribution<float>();
+  auto irs = std::vector<std::vector<float>>(64);
+  for (auto& ir : irs) {
+    ir.resize(size_t(1.5 * fs));
+    for (size_t i = 0; i < ir.size(); ++i)
+      ir[i] = float(std::pow(10.0, -3 * double(i) / fs / t60) *
+                      gaussian(generator) +
+                    std::pow(10.0, -70.0 / 20) * gaussian(generator));
+  }
+
+  const auto results = room_acoustic_parameters(irs, fs);
+
+  // Narrow bands of noise fluctuate a lot, so each band's mean over all
+  // channels is checked:
+  REQUIRE(results.size() == irs.size());
+  for (size_t band = 0; band < centers.size(); ++band) {
+    if (centers[band] < 500)
+      continue;
+    auto mean = RoomAcousticParameters{};
+    mean.edt = mean.t20 = mean.t30 = mean.c50 = mean.c80 = mean.d50 = 0;
+    for (const auto& channel : results) {
+      REQUIRE(channel.size() == centers.size());
+      const auto& result = channel[band];
+      CHECK(result.frequency == centers[band]);
+      CHECK(result.noiseFloorDb < -60);
+      mean.edt += result.edt / double(results.size());
+      mean.t20 += result.t20 / double(results.size());
+      mean.t30 += result.t30 / double(results.size());
+      mean.c50 += result.c50 / double(results.size());
+      mean.c80 += result.c80 / double(results.size());
+      mean.d50 += result.d50 / double(results.size());
+    }
+    CHECK(mean.edt == Approx(t60).epsilon(0.1));
+    CHECK(mean.t20 == Approx(t60).epsilon(0.05));
+    CHECK(mean.t30 == Approx(t60).epsilon(0.05));
+
+    // The longer impulse responses of the narrower low bands smear energy
+    // across the 50 and 80 ms limits:
+    if (centers[band] < 1000)
+      continue;
+    CHECK(mean.c50 == Approx(4.75).margin(1));
+    CHECK(mean.c80 == Approx(9.1).margin(1));
+    CHECK(mean.d50 == Approx(0.749).margin(0.05));
+  }
+}
+
+TEST_CASE("Check single-producer single-consumer ring")
+{
+  // Both sides move a running counter (offset per channel) in chunks of
+  // random size, alternating between in-place access and bulk copies, with a
+  // capacity small enough to make the ring wrap and fill up all the time:
+  constexpr size_t numChannels = 3;
+  constexpr size_t total = 1 << 20;
+  auto ring = SpscRing<uint32_t>(numChannels, 100);
+  CHECK(ring.getCapacity() == 128);
+
+  auto producer = std::thread([&] {
+    auto generator = std::mt19937(1);
+    auto chunk = std::vector<std::vector<uint32_t>>(
+      numChannels, std::vector<uint32_t>(200));
+    auto pointers = std::vector<const uint32_t*>();
+    for (const auto& samples : chunk)
+      pointers.push_back(samples.data());
+
+    for (size_t written = 0; written < total;) {
+      const auto n = std::min(size_t(generator() % 200), total - written);
+      if (generator() % 2 == 0) {
+        const auto region = ring.prepareWrite(n);
+        for (size_t c = 0; c < numChannels; ++c)
+          for (size_t i = 0; i < region.size(); ++i) {
+            const auto index = i < region.size1
+                                 ? region.start1 + i
+                                 : region.start2 + i - region.size1;
+            ring.channel(c)[index] = uint32_t(written + i + c * total);
+          }
+        ring.finishWrite(region.size());
+        written += region.size();
+      } else {
+        for (size_t c = 0; c < numChannels; ++c)
+          for (size_t i = 0; i < n; ++i)
+            chunk[c][i] = uint32_t(written + i + c * total);
+        written += ring.write(pointers.data(), n);
+      }
+    }
+  });
+
+  auto generator = std::mt19937(2);
+  auto chunk = std::vector<std::vector<uint32_t>>(numChannels,
+                                                  std::vector<uint32_t>(200));
+  auto pointers = std::vector<uint32_t*>();
+  for (auto& samples : chunk)
+    pointers.push_back(samples.data());
+
+  auto mismatches = size_t(0);
+  for (size_t read = 0; read < total;) {
+    const auto n = size_t(generator() % 200);
+    if (generator() % 2 == 0) {
+      const auto region = ring.prepareRead(n);
+      for (size_t c = 0; c < numChannels; ++c)
+        for (size_t i = 0; i < region.size(); ++i) {
+          const auto index = i < region.size1
+                               ? region.start1 + i
+                               : region.start2 + i - region.size1;
+          mismatches += ring.channel(c)[index] != read + i + c * total;
+        }
+      ring.finishRead(region.size());
+      read += region.size();
+    } else {
+      const auto numRead = ring.read(pointers.data(), n);
+      for (size_t c = 0; c < numChannels; ++c)
+        for (size_t i = 0; i < numRead; ++i)
+          mismatches += chunk[c][i] != read + i + c * total;
+      read += numRead;
+    }
+  }
+  producer.join();
+
+  CHECK(mismatches == 0);
+  CHECK(ring.getNumReady() == 0);
+  CHECK(ring.getFreeSpace() == ring.getCapacity());
+  CHECK(ring.read(pointers.data(), 1) == 0);
+}
+
+TEST_CASE("Check real-time analyzer levels, averaging and pink noise")
+{
+  const auto fs = 48000.0;
+  const auto pi = std::acos(-1.0);
+  const auto bands = std::vector<float>{ 125, 250, 500, 1000, 2000, 4000 };
+  const auto thirdOctave = Smoothing{ SmoothingType::fractionalOctave, 3 };
+
+  // A sine's band level doesn't depend on the FFT size (or its phase). Frames
+  // start every fftSize / 4 samples, regardless of how the input is chunked:
+  for (const auto fftSize : { size_t(2048), size_t(16384) }) {
+    auto settings = SpectrumAnalyzerSettings{};
+    settings.fftSize = fftSize;
+    auto analyzer = SpectrumAnalyzer(fs, settings);
+    auto sine = std::vector<float>(fftSize + 3 * analyzer.getHopSize());
+    for (size_t n = 0; n < sine.size(); ++n)
+      sine[n] = float(0.5 * std::sin(2 * pi * 1000 * double(n) / fs + 1));
+    for (size_t n = 0; n < sine.size(); n += 1000)
+      analyzer.push(sine.data() + n, std::min(size_t(1000), sine.size() - n));
+    CHECK(analyzer.getNumFrames() == 4);
+
+    auto smoother = SpectrumSmoother(fs, fftSize, bands, thirdOctave);
+    const auto levels = smoother.bandPower(analyzer.getPower());
+    CHECK(levels[3] == Approx(0.25).epsilon(0.01));
+    CHECK(levels[2] < 1e-6);
+    CHECK(levels[4] < 1e-6);
+  }
+
+  // Pink noise has the requested RMS level and the same level in every
+  // fractional-octave band:
+  auto noise = std::vector<float>(1 << 20);
+  PinkNoise().generate(noise.data(), noise.size(), 0.1f);
+  const auto energy =
+    std::inner_product(noise.cbegin(), noise.cend(), noise.cbegin(), 0.0);
+  CHECK(std::sqrt(energy / double(noise.size())) ==
+        Approx(0.1).epsilon(0.03));
+
+  for (const auto averaging :
+       { SpectrumAveraging::linear, SpectrumAveraging::exponential }) {
+    auto settings = SpectrumAnalyzerSettings{};
+    settings.averaging = averaging;
+    settings.numAverages = 0;
+    settings.timeConstant = 10;
+    auto analyzer = SpectrumAnalyzer(fs, settings);
+    analyzer.push(noise.data(), noise.size());
+
+    auto smoother = SpectrumSmoother(fs, settings.fftSize, bands, thirdOctave);
+    const auto levels = smoother.bandPower(analyzer.getPower());
+    for (const auto level : levels)
+      CHECK(10 * std::log10(level / levels.front()) == Approx(0).margin(1));
+  }
+
+  // Linear averaging over the last frames only:
+  auto settings = SpectrumAnalyzerSettings{};
+  settings.fftSize = 1024;
+  settings.averaging = SpectrumAveraging::linear;
+  settings.numAverages = 4;
+  auto analyzer = SpectrumAnalyzer(fs, settings);
+  analyzer.push(noise.data(), 1 << 14);
+  CHECK(analyzer.getNumFrames() == 4);
+  const auto silence = std::vector<float>(4 * analyzer.getHopSize());
+  analyzer.push(silence.data(), silence.size());
+  const auto& power = analyzer.getPower();
+  CHECK(std::accumulate(power.cbegin(), power.cend(), 0.0) > 0);
+  analyzer.push(silence.data(), silence.size());
+  CHECK(std::accumulate(power.cbegin(), power.cend(), 0.0) ==
+        Approx(0).margin(1e-12));
+}
+
+TEST_CASE("Check live transfer function with delay tracking")
+{
+  // The measurement is the reference at half the level, 1000 samples late
+  // and with uncorrelated noise 20 dB below it. After two seconds, the delay
+  // changes to 2000 samples:
+  const auto fs = 48000.0;
+  auto generator = std::mt19937(3);
+  auto distribution = std::normal_distribution<float>(0, 1);
+  auto reference = std::vector<float>(size_t(5 * fs));
+  for (auto& x : reference)
+    x = distribution(generator);
+  auto measurement = std::vector<float>(reference.size());
+  for (size_t n = 0; n < measurement.size(); ++n) {
+    const auto delay = n < size_t(2 * fs) ? size_t(1000) : size_t(2000);
+    const auto delayed = n >= delay ? reference[n - delay] : 0.0f;
+    measurement[n] = 0.5f * delayed + 0.05f * distribution(generator);
+  }
+
+  auto settings = TransferFunctionSettings{};
+  settings.analysis.fftSize = 4096;
+  settings.maxDelay = 0.1;
+  settings.delayInterval = 0.25;
+  auto analyzer = TransferFunctionAnalyzer(fs, settings);
+  const auto bands = std::vector<float>{ 100, 1000, 10000 };
+  auto smoother = SpectrumSmoother(
+    fs, 4096, bands, { SmoothingType::fractionalOctave, 3 });
+
+  const auto push = [&](size_t begin, size_t end) {
+    for (size_t n = begin; n < end; n += 512) {
+      const auto length = std::min(size_t(512), end - n);
+      analyzer.push(reference.data() + n, measurement.data() + n, length);
+    }
+  };
+  const auto check = [&](size_t delay) {
+    const auto estimate = analyzer.estimate(smoother);
+    REQUIRE(estimate.delay.has_value());
+    CHECK(*estimate.delay == delay);
+    CHECK(estimate.numFrames > 10);
+    for (size_t i = 0; i < bands.size(); ++i) {
+      CHECK(estimate.magnitudeDb[i] == Approx(-6.02).margin(0.3));
+      CHECK(estimate.phase[i] == Approx(0).margin(0.05));
+      // 0.25 / (0.25 + 0.0025):
+      CHECK(estimate.coherence[i] == Approx(0.99).margin(0.01));
+    }
+  };
+
+  push(0, size_t(2 * fs));
+  check(1000);
+  push(size_t(2 * fs), reference.size());
+  check(2000);
+
+  // Unrelated signals have no delay (and nothing is averaged):
+  auto unrelated = TransferFunctionAnalyzer(fs, settings);
+  unrelated.push(reference.data(), reference.data() + 100000, 100000);
+  CHECK(!unrelated.getDelay());
+  CHECK(unrelated.getNumFrames() == 0);
+}
+
+TEST_CASE("Check fused correction delay, gain and equalizer")
+{
+  // Every output must be the input, delayed, scaled and run through its
+  // biquads (in double precision here). With whole-sample delays, the
+  // Lagrange taps are exact:
+  const auto fs = 48000.0;
+  constexpr size_t numChannels = 7; // a full group of lanes and a partial one
+  constexpr size_t blockSize = 64;
+  auto settings = CorrectionChain::Settings(numChannels - 1);
+  for (size_t channel = 0; channel < settings.size(); ++channel) {
+    auto& setting = settings[channel].emplace();
+    setting.delay = float(3 * channel);
+    setting.gain = 1.0f / float(channel + 1);
+    for (size_t band = 0; band < channel % 3; ++band)
+      setting.equalizer.push_back(
+        make_biquad({ BiquadType::peak,
+                      250.0 * double((band + 1) * (channel + 1)),
+                      2,
+                      6.0 - 8.0 * double(band) },
+                    fs));
+  }
+  // Channels without settings are muted, like the last one:
+  settings[4].reset();
+
+  auto chain = CorrectionChain();
+  chain.setRampLength(0);
+  chain.setCrossfadeLength(0);
+  chain.prepare(int(numChannels), int(blockSize), 100);
+  chain.setSettings(settings);
+
+  auto generator = std::mt19937(1);
+  auto distribution = std::uniform_real_distribution<float>(-1, 1);
+  auto input = std::vector<float>(50 * blockSize);
+  for (auto& sample : input)
+    sample = distribution(generator);
+
+  auto outputs = std::vector<std::vector<float>>(
+    numChannels, std::vector<float>(input.size(), 1.0f));
+  for (size_t start = 0; start < input.size(); start += blockSize) {
+    float* pointers[numChannels];
+    for (size_t channel = 0; channel < numChannels; ++channel)
+      pointers[channel] = outputs[channel].data() + start;
+    chain.process(
+      input.data() + start, pointers, int(numChannels), int(blockSize));
+  }
+
+  for (size_t channel = 0; channel < numChannels; ++channel) {
+    auto expected = std::vector<float>(input.size(), 0.0f);
+    if (channel < settings.size() && settings[channel]) {
+      const auto& setting = *settings[channel];
+      const auto delay =
+        size_t(setting.delay) + size_t(CorrectionChain::getLatency());
+      auto signal = std::vector<double>(input.size(), 0.0);
+      for (size_t n = delay; n < input.size(); ++n)
+        signal[n] = setting.gain * input[n - delay];
+      for (const auto& section : setting.equalizer) {
+        auto z1 = 0.0, z2 = 0.0;
+        for (auto& x : signal) {
+          const auto y = section.b0 * x + z1;
+          z1 = section.b1 * x - section.a1 * y + z2;
+          z2 = section.b2 * x - section.a2 * y;
+          x = y;
+        }
+      }
+      std::copy(signal.cbegin(), signal.cend(), expected.begin());
+    }
+    CHECK(maxError(outputs[channel], expected) < 1e-4);
+  }
+}
+
+TEST_CASE("Check correction settings swaps while playing")
+{
+  // A sine through a boost that is swapped for a cut (and back) between
+  // blocks, with snapshots that are replaced before the audio thread picks
+  // them up in between:
+  const auto fs = 48000.0;
+  const auto pi = std::acos(-1.0);
+  constexpr int blockSize = 256;
+  constexpr int crossfadeLength = 1024;
+  const auto makeSettings = [&](double gainDb) {
+    auto settings = CorrectionChain::Settings(1);
+    settings[0].emplace().equalizer = {
+      make_biquad({ BiquadType::peak, 1000, 1, gainDb }, fs)
+    };
+    return settings;
+  };
+
+  auto input = std::vector<float>(200 * blockSize);
+  for (size_t n = 0; n < input.size(); ++n)
+    input[n] = float(0.5 * std::sin(2 * pi * 1000 * double(n) / fs));
+
+  const auto play = [&](CorrectionChain& chain,
+                        const std::vector<std::pair<int, double>>& swaps) {
+    auto output = std::vector<float>(input.size());
+    auto swap = swaps.cbegin();
+    auto audioThreadHeapOperations = size_t(0);
+    for (int start = 0; start < int(input.size()); start += blockSize) {
+      for (; swap != swaps.cend() && swap->first <= start; ++swap)
+        chain.setSettings(makeSettings(swap->second));
+      float* outputs[] = { output.data() + start };
+      const auto before = threadHeapOperations;
+      chain.process(input.data() + start, outputs, 1, blockSize);
+      audioThreadHeapOperations += threadHeapOperations - before;
+    }
+    CHECK(audioThreadHeapOperations == 0);
+    return output;
+  };
+
+  auto chain = CorrectionChain();
+  chain.setCrossfadeLength(crossfadeLength);
+  chain.prepare(1, blockSize, 0);
+  const auto heapOperationsElsewhere = [] {
+    return heapOperations - threadHeapOperations;
+  };
+  const auto elsewhereBefore = heapOperationsElsewhere();
+  const auto swapped = play(chain,
+                            { { 0, 12 },
+                              { 10 * blockSize, 0 },
+                              { 10 * blockSize, -12 },
+                              { 40 * blockSize, 12 },
+                              { 41 * blockSize, 6 },
+                              { 41 * blockSize, -12 } });
+
+  // The retired (and skipped) snapshots are freed on the background thread:
+  const auto deadline =
+    std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (heapOperationsElsewhere() == elsewhereBefore &&
+         std::chrono::steady_clock::now() < deadline)
+    std::this_thread::yield();
+  CHECK(heapOperationsElsewhere() > elsewhereBefore);
+
+  // No step between two samples is larger than those of the boosted sine
+  // (the largest amplitude), even while the filters are crossfaded:
+  auto boosted = CorrectionChain();
+  boosted.prepare(1, blockSize, 0);
+  const auto reference = play(boosted, { { 0, 12 } });
+  const auto largestStep = [](const std::vector<float>& signal,
+                              size_t begin,
+                              size_t end) {
+    auto step = 0.0f;
+    for (size_t n = begin + 1; n < end; ++n)
+      step = std::max(step, std::abs(signal[n] - signal[n - 1]));
+    return step;
+  };
+  const auto settled = size_t(5 * blockSize);
+  CHECK(largestStep(swapped, settled, swapped.size()) <=
+        1.01f * largestStep(reference, settled, reference.size()));
+
+  // After the last crossfade, the output is that of the final filters:
+  auto cut = CorrectionChain();
+  cut.prepare(1, blockSize, 0);
+  const auto expected = play(cut, { { 0, -12 } });
+  const auto tail = input.size() - 4096;
+  CHECK(maxError(std::vector<float>(swapped.cbegin() + long(tail),
+                                    swapped.cend()),
+                 std::vector<float>(expected.cbegin() + long(tail),
+                                    expected.cend())) < 1e-4);
+}
+
+TEST_CASE("Check per-channel correction updates")
+{
+  // 9 channels in three groups, played through the same EQ; the EQ of
+  // channel 5 (in the second group) is changed while playing:
+  const auto fs = 48000.0;
+  constexpr int blockSize = 128;
+  constexpr size_t numChannels = 9;
+  const auto equalizer = std::vector<Biquad>{
+    make_biquad({ BiquadType::peak, 300, 2, 6 }, fs),
+    make_biquad({ BiquadType::highShelf, 4000, 0.7, -3 }, fs)
+  };
+  auto settings = CorrectionChain::Settings(numChannels);
+  for (auto& setting : settings)
+    setting.emplace().equalizer = equalizer;
+
+  auto generator = std::mt19937(5);
+  auto uniform = std::uniform_real_distribution<float>(-0.5f, 0.5f);
+  auto input = std::vector<float>(40 * blockSize);
+  for (auto& x : input)
+    x = uniform(generator);
+
+  const auto play = [&](CorrectionChain& chain, bool update) {
+    auto output = std::vector<std::vector<float>>(
+      numChannels, std::vector<float>(input.size()));
+    for (int start = 0; start < int(input.size()); start += blockSize) {
+      if (update && start == 10 * blockSize) {
+        auto changed = *settings[5];
+        changed.equalizer[0] =
+          make_biquad({ BiquadType::peak, 300, 2, -6 }, fs);
+        chain.setChannel(5, changed);
+      }
+      auto outputs = std::vector<float*>();
+      for (auto& channel : output)
+        outputs.push_back(channel.data() + start);
+      chain.process(
+        input.data() + start, outputs.data(), int(numChannels), blockSize);
+    }
+    return output;
+  };
+
+  const auto prepare = [&](CorrectionChain& chain) {
+    chain.prepare(int(numChannels), blockSize, 0);
+    chain.setSettings(settings);
+  };
+  auto unchanged = CorrectionChain();
+  prepare(unchanged);
+  auto updated = CorrectionChain();
+  prepare(updated);
+  const auto reference = play(unchanged, false);
+  const auto output = play(updated, true);
+
+  // The other groups aren't touched at all:
+  for (size_t channel = 0; channel < numChannels; ++channel)
+    if (channel / CorrectionChain::lanes != 1)
+      CHECK(output[channel] == reference[channel]);
+
+  // The channels sharing the group only go through the crossfade of
+  // identical filters, and the changed one ends up with the new EQ:
+  for (const auto channel : { 4, 6, 7 })
+    CHECK(maxError(output[size_t(channel)], reference[size_t(channel)]) <
+          1e-6);
+  CHECK(maxError(output[5], reference[5]) > 0.01);
+
+  auto expected = settings;
+  expected[5] = updated.getSettings()[5];
+  auto fresh = CorrectionChain();
+  fresh.prepare(int(numChannels), blockSize, 0);
+  fresh.setSettings(expected);
+  const auto tail = input.size() - 2048;
+  const auto final = play(fresh, false);
+  CHECK(maxError(std::vector<float>(output[5].cbegin() + long(tail),
+                                    output[5].cend()),
+                 std::vector<float>(final[5].cbegin() + long(tail),
+                                    final[5].cend())) < 1e-4);
+}
+
+TEST_CASE("Check fractional delay against an analytic shift")
+{
+  // A sum of sines up to fs / 8, so the delayed signal is known at any
+  // (fractional) delay. An error of 0.01 samples would already deviate by up
+  // to 3.3e-3 (the largest slope is 0.33 per sample):
+  const auto fs = 48000.0;
+  const auto pi = std::acos(-1.0);
+  const auto signal = [&](double n) {
+    auto sum = 0.0;
+    for (const auto f : { 200.0, 1100.0, 2900.0, 6000.0 })
+      sum += 0.25 * std::sin(2 * pi * f * n / fs + f);
+    return sum;
+  };
+  constexpr int blockSize = 128;
+  constexpr int numBlocks = 100;
+  const auto latency = double(FractionalDelay::getLatency());
+
+  // Runs a block through the delay, and returns the largest deviation from
+  // the input shifted by the delay of every sample:
+  const auto run = [&](FractionalDelay& delay,
+                       int block,
+                       const std::vector<std::function<double(int)>>& delays) {
+    auto buffers = std::vector<std::vector<float>>(
+      delays.size(), std::vector<float>(blockSize));
+    auto pointers = std::vector<float*>();
+    for (auto& buffer : buffers) {
+      for (int i = 0; i < blockSize; ++i)
+        buffer[size_t(i)] = float(signal(block * blockSize + i));
+      pointers.push_back(buffer.data());
+    }
+    delay.process(pointers.data(), int(delays.size()), blockSize);
+
+    auto error = 0.0;
+    for (size_t channel = 0; channel < delays.size(); ++channel)
+      for (int i = 0; i < blockSize; ++i) {
+        const auto n = block * blockSize + i;
+        const auto expected = signal(n - delays[channel](n) - latency);
+        error =
+          std::max(error, std::abs(buffers[channel][size_t(i)] - expected));
+      }
+    return error;
+  };
+
+  // Fixed delays, including whole ones, in more channels than SIMD lanes:
+  const auto fixed = std::vector<float>{ 10.3f, 0.0f, 37.75f, 4.5f, 99.01f };
+  auto delay = FractionalDelay();
+  delay.prepare(int(fixed.size()), blockSize, 100);
+  delay.setRampLength(0);
+  auto delays = std::vector<std::function<double(int)>>();
+  for (size_t channel = 0; channel < fixed.size(); ++channel) {
+    delay.setDelay(int(channel), fixed[channel]);
+    delays.push_back([&, channel](int) { return double(fixed[channel]); });
+  }
+  auto error = 0.0;
+  for (int block = 0; block < numBlocks; ++block) {
+    const auto blockError = run(delay, block, delays);
+    if (block > 0) // once the history is filled
+      error = std::max(error, blockError);
+  }
+  CHECK(error < 3e-3);
+
+  // A linear ramp from 5 to 25.5 samples, starting with the block after the
+  // change:
+  constexpr int rampLength = 1000;
+  constexpr int rampStart = 10 * blockSize;
+  auto ramped = FractionalDelay();
+  ramped.prepare(1, blockSize, 100);
+  ramped.setRampLength(0);
+  ramped.setDelay(0, 5);
+  const auto ramp = [&](int n) {
+    const auto progress = std::clamp(n + 1 - rampStart, 0, rampLength);
+    return 5 + 20.5 * progress / rampLength;
+  };
+  error = 0.0;
+  for (int block = 0; block < numBlocks; ++block) {
+    if (block * blockSize == rampStart) {
+      ramped.setRampLength(rampLength);
+      ramped.setDelay(0, 25.5f);
+    }
+    const auto blockError = run(ramped, block, { ramp });
+    if (block > 0)
+      error = std::max(error, blockError);
+  }
+  CHECK(error < 3e-3);
+}
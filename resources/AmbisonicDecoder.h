@@ -87,7 +87,6 @@ public:
       newDecoder = nullptr;
 
       if (currentDecoder != nullptr) {
-        currentDecoder->removeAppliedWeights();
         const int cols = (int)currentDecoder->getMatrix().getNumColumns();
         buffer.setSize(cols, buffer.getNumSamples());
       }
@@ -98,13 +97,17 @@ public:
     return false;
   };
 
-  /** Giving the AmbisonicDecoder a new decoder for the audio processing. Note:
-   * The AmbisonicDecoder will call the removeAppliedWeights() of the
-   * ReferenceCountedDecoder before it processes audio! The matrix elements may
-   * change due to this method.
+  /** Giving the AmbisonicDecoder a new decoder for the audio processing. The
+   * decoder is left untouched, so its weights have to be removed where it is
+   * created (see ReferenceCountedDecoder::removeAppliedWeights(), which
+   * ConfigurationHelper calls when it parses one).
    */
   void setDecoder(ReferenceCountedDecoder::Ptr newDecoderToUse)
   {
+    jassert(newDecoderToUse == nullptr ||
+            !newDecoderToUse->getSettings().weightsAlreadyApplied ||
+            newDecoderToUse->getSettings().weights ==
+              ReferenceCountedDecoder::Weights::none);
     newDecoder = newDecoderToUse;
     newDecoderAvailable = true;
   }
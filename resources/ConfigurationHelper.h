@@ -147,11 +147,13 @@ public:
             return Result::fail(result.getErrorMessage());
 
         ReferenceCountedMatrix::Ptr newMatrix = new ReferenceCountedMatrix (name, description, rows, cols);
-        result = getMatrix(matrixData, rows, cols, newMatrix->getMatrix());
+        Matrix<float> elements (rows, cols);
+        result = getMatrix(matrixData, rows, cols, elements);
 
         if (! result.wasOk())
             return Result::fail (result.getErrorMessage());
 
+        newMatrix->setMatrix (elements);
         *matrix = newMatrix;
         return Result::ok();
     }
@@ -225,9 +227,11 @@ public:
 
         // create decoder and get matrix from 'Decoder' object
         ReferenceCountedDecoder::Ptr newDecoder = new ReferenceCountedDecoder (name, description, rows, cols);
-        result = getMatrix (matrixData, rows, cols, newDecoder->getMatrix());
+        Matrix<float> elements (rows, cols);
+        result = getMatrix (matrixData, rows, cols, elements);
         if (! result.wasOk())
             return Result::fail (result.getErrorMessage());
+        newDecoder->setMatrix (elements);
 
         if (decoderVar.hasProperty ("Routing"))
         {
@@ -293,6 +297,10 @@ public:
 
         newDecoder->setSettings(settings);
 
+        // decoders are always used (and written back) without their weights,
+        // so they can be applied for any order, see AmbisonicDecoder
+        newDecoder->removeAppliedWeights();
+
         *decoder = newDecoder;
         return Result::ok();
     }
@@ -306,7 +314,7 @@ public:
         if (routingData.size() != rows)
             return Result::fail("Length of 'Routing' attribute does not match number of matrix outputs (rows).");
 
-        Array<int>& routingArray = dest->getRoutingArrayReference();
+        Array<int> routingArray (dest->getRoutingArrayReference());
         for (int r = 0; r < rows; ++r)
         {
             var element = routingData.getArray()->getUnchecked(r);
@@ -318,6 +326,7 @@ public:
             else
                 return Result::fail("Datatype of 'Routing' element at position " + String(r+1) + " could not be interpreted (expected integer).");
         }
+        dest->setRoutingArray (routingArray);
         return Result::ok();
     }
 
@@ -533,7 +542,7 @@ public:
 
         // routing array
         var routing;
-        Array<int>& routingArray = decoder->getRoutingArrayReference();
+        const Array<int>& routingArray = decoder->getRoutingArrayReference();
         for (int i = 0; i < routingArray.size(); ++i)
             routing.append(routingArray[i] + 1); // one count
 
@@ -548,7 +557,7 @@ public:
     /**
      Converts a Matrix<float> object to a var object.
      */
-    static var convertMatrixToVar (Matrix<float>& mat)
+    static var convertMatrixToVar (const Matrix<float>& mat)
     {
         var matrixVar;
         for (int m = 0; m < mat.getSize()[0]; ++m)
@@ -21,12 +21,24 @@
  */
 
 #pragma once
-#include "WalshHadamard/fwht.h"
 #include <JuceHeader.h>
+#include <vector>
 using namespace dsp;
+
+/**
+ The network is processed in blocks no longer than its shortest delay, so all
+ samples read from the delay lines within a block were written before it. The
+ signals of one block are kept channel by channel in contiguous, SIMD-aligned
+ rows; the Walsh-Hadamard feedback matrix is then applied to whole rows at
+ once. The shelving filters run on groups of channels in SIMD lanes, with
+ their coefficients and states in structure-of-arrays form. The delay lines
+ of all channels share one buffer, with room for the longest delay length
+ each, so changing the delay length doesn't reallocate.
+ */
 class FeedbackDelayNetwork : private ProcessorBase
 {
   static constexpr int maxDelayLength = 30;
+  static constexpr int blockLength = 128; // samples, at most
 
 public:
   enum FdnSize
@@ -75,13 +87,12 @@ public:
     spec = newSpec;
 
     indices = indexGen(fdnSize, delayLength);
+    allocateDelayLines();
     updateParameterSettings();
 
-    for (int ch = 0; ch < fdnSize; ++ch) {
-      delayBufferVector[ch]->clear();
-      lowShelfFilters[ch]->reset();
-      highShelfFilters[ch]->reset();
-    }
+    for (auto& group : filterGroups)
+      for (int shelf = 0; shelf < 2; ++shelf)
+        group.z1[shelf] = group.z2[shelf] = SIMDType::expand(0.0f);
   }
 
   void process(const ProcessContextReplacing<float>& context) override
@@ -162,62 +173,10 @@ public:
     else
       dryGain = 1.0f - dryWet;
 
-    for (int i = 0; i < numSamples; ++i) {
-      // apply delay to each channel for one time sample
-      for (int channel = 0; channel < fdnSize; ++channel) {
-        const int idx = std::min(channel, nChannels - 1);
-        float* const channelData = buffer.getChannelPointer(idx);
-        float* const delayData = delayBufferVector[channel]->getWritePointer(0);
-
-        int delayPos = delayPositionVector[channel];
-
-        const float inSample = channelData[i];
-        if (!freeze) {
-          // data exchange between IO buffer and delay buffer
-
-          if (channel < nChannels)
-            delayData[delayPos] += inSample;
-        }
-
-        if (!freeze) {
-          // apply shelving filters
-          delayData[delayPos] =
-            highShelfFilters[channel]->processSingleSampleRaw(
-              delayData[delayPos]);
-          delayData[delayPos] =
-            lowShelfFilters[channel]->processSingleSampleRaw(
-              delayData[delayPos]);
-        }
-
-        if (channel < nChannels) {
-          channelData[i] = delayData[delayPos] * dryWet;
-          channelData[i] += inSample * dryGain;
-        }
-        if (!freeze)
-          transferVector.set(channel,
-                             delayData[delayPos] * feedbackGainVector[channel]);
-        else
-          transferVector.set(channel, delayData[delayPos]);
-      }
-
-      // perform fast walsh hadamard transform
-      fwht(transferVector.getRawDataPointer(), transferVector.size());
-
-      // write back into delay buffer
-      // increment the delay buffer pointer
-      for (int channel = 0; channel < fdnSize; ++channel) {
-        float* const delayData = delayBufferVector[channel]->getWritePointer(
-          0); // the buffer is single channel
-
-        int delayPos = delayPositionVector[channel];
-
-        delayData[delayPos] = transferVector[channel];
-
-        if (++delayPos >= delayBufferVector[channel]->getNumSamples())
-          delayPos = 0;
-
-        delayPositionVector.set(channel, delayPos);
-      }
+    for (int start = 0; start < numSamples;) {
+      const int n = jmin(numSamples - start, minDelayLength, blockLength);
+      processBlock(buffer, start, n, nChannels, dryGain);
+      start += n;
     }
     // if more channels than network order, mix pairs of high order channels
     // until order == number of channels
@@ -329,12 +288,36 @@ private:
   //==============================================================================
   ProcessSpec spec = { -1, 0, 0 };
 
-  OwnedArray<AudioBuffer<float>> delayBufferVector;
-  OwnedArray<IIRFilter> highShelfFilters;
-  OwnedArray<IIRFilter> lowShelfFilters;
-  Array<int> delayPositionVector;
+  using SIMDType = SIMDRegister<float>;
+  static constexpr int registersPerRow =
+    (blockLength + SIMDType::SIMDNumElements - 1) / SIMDType::SIMDNumElements;
+
+  std::vector<float> delayLines; // all channels, structure of arrays
+  std::vector<int> delayOffsets, delayLengths, delayPositions;
+  int minDelayLength = blockLength;
+  std::vector<SIMDType> rows; // one block of every channel
+
+  // high and low shelf of one group of channels (transposed direct form II)
+  struct ShelvingFilters
+  {
+    ShelvingFilters()
+    {
+      for (int shelf = 0; shelf < 2; ++shelf) {
+        b0[shelf] = SIMDType::expand(1.0f);
+        b1[shelf] = b2[shelf] = a1[shelf] = a2[shelf] = SIMDType::expand(0.0f);
+        z1[shelf] = z2[shelf] = SIMDType::expand(0.0f);
+      }
+    }
+
+    SIMDType b0[2], b1[2], b2[2], a1[2], a2[2];
+    SIMDType z1[2], z2[2];
+  };
+
+  static constexpr int lanes = static_cast<int>(SIMDType::SIMDNumElements);
+  static constexpr int groupsPerPass = 4;
+  std::vector<ShelvingFilters> filterGroups;
+  std::vector<SIMDType> interleaved; // one block of groupsPerPass groups
   Array<float> feedbackGainVector;
-  Array<float> transferVector;
 
   std::vector<int> primeNumbers;
   std::vector<int> indices;
@@ -371,11 +354,187 @@ private:
   UpdateStruct params;
 
   inline int delayLengthConversion(int channel)
+  {
+    return primeToSamples(indices[channel]);
+  }
+
+  inline int primeToSamples(int index)
   {
     // we divide by 10 to get better range for room size setting
-    float delayLenMillisec = primeNumbers[indices[channel]] / 10.f;
-    return int(delayLenMillisec / 1000.f *
-               spec.sampleRate); // convert to samples
+    float delayLenMillisec = primeNumbers[index] / 10.f;
+    return jmax(1,
+                int(delayLenMillisec / 1000.f *
+                    spec.sampleRate)); // convert to samples
+  }
+
+  //------------------------------------------------------------------------------
+  float* getRow(int channel)
+  {
+    return reinterpret_cast<float*>(&rows[size_t(channel) * registersPerRow]);
+  }
+
+  void processBlock(AudioBlock<float>& buffer,
+                    const int start,
+                    const int n,
+                    const int nChannels,
+                    const float dryGain)
+  {
+    // the normalization of the transform is applied with the feedback gains
+    const float norm = 1.0f / std::sqrt(static_cast<float>(fdnSize));
+
+    for (int channel = 0; channel < fdnSize; ++channel) {
+      float* const row = getRow(channel);
+      readDelayLine(channel, row, n);
+      if (!freeze && channel < nChannels)
+        FloatVectorOperations::add(
+          row, buffer.getChannelPointer(channel) + start, n);
+    }
+
+    if (!freeze)
+      applyShelvingFilters(n);
+
+    for (int channel = 0; channel < fdnSize; ++channel) {
+      float* const row = getRow(channel);
+      if (channel < nChannels) {
+        float* const channelData = buffer.getChannelPointer(channel) + start;
+        FloatVectorOperations::multiply(channelData, dryGain, n);
+        FloatVectorOperations::addWithMultiply(channelData, row, dryWet, n);
+      }
+
+      FloatVectorOperations::multiply(
+        row, freeze ? norm : feedbackGainVector[channel] * norm, n);
+    }
+
+    // fast Walsh-Hadamard transform across the channels, one butterfly for
+    // all samples of two rows at a time
+    const int numRegisters = (n + SIMDType::SIMDNumElements - 1) /
+                             static_cast<int>(SIMDType::SIMDNumElements);
+    for (int half = 1; half < fdnSize; half *= 2)
+      for (int first = 0; first < fdnSize; first += 2 * half)
+        for (int channel = first; channel < first + half; ++channel) {
+          SIMDType* a = &rows[size_t(channel) * registersPerRow];
+          SIMDType* b = &rows[size_t(channel + half) * registersPerRow];
+          for (int i = 0; i < numRegisters; ++i) {
+            const SIMDType sum = a[i] + b[i];
+            b[i] = a[i] - b[i];
+            a[i] = sum;
+          }
+        }
+
+    for (int channel = 0; channel < fdnSize; ++channel)
+      writeDelayLine(channel, getRow(channel), n);
+  }
+
+  // Several groups are filtered side by side, so their independent
+  // recursions can overlap in the pipeline.
+  void applyShelvingFilters(const int n)
+  {
+    float* const data = reinterpret_cast<float*>(interleaved.data());
+    const int numGroups = static_cast<int>(filterGroups.size());
+
+    for (int firstGroup = 0; firstGroup < numGroups;
+         firstGroup += groupsPerPass) {
+      const int firstChannel = firstGroup * lanes;
+      const int numLanes = jmin(lanes * groupsPerPass, fdnSize - firstChannel);
+
+      for (int lane = 0; lane < numLanes; ++lane) {
+        const float* row = getRow(firstChannel + lane);
+        for (int i = 0; i < n; ++i)
+          data[i * lanes * groupsPerPass + lane] = row[i];
+      }
+
+      // high shelf first, then low shelf
+      ShelvingFilters* filters = &filterGroups[size_t(firstGroup)];
+      const int passGroups = jmin(groupsPerPass, numGroups - firstGroup);
+      for (int shelf = 0; shelf < 2; ++shelf) {
+        if (passGroups == groupsPerPass)
+          filterPass<groupsPerPass>(filters, shelf, interleaved.data(), n);
+        else
+          for (int group = 0; group < passGroups; ++group)
+            filterPass<1>(
+              filters + group, shelf, interleaved.data() + group, n);
+      }
+
+      for (int lane = 0; lane < numLanes; ++lane) {
+        float* row = getRow(firstChannel + lane);
+        for (int i = 0; i < n; ++i)
+          row[i] = data[i * lanes * groupsPerPass + lane];
+      }
+    }
+  }
+
+  // everything the recursion needs is local, as SIMD stores may alias
+  template <int numGroups>
+  static void filterPass(ShelvingFilters* filters,
+                         const int shelf,
+                         SIMDType* const data,
+                         const int n)
+  {
+    SIMDType b0[numGroups], b1[numGroups], b2[numGroups], a1[numGroups],
+      a2[numGroups], z1[numGroups], z2[numGroups];
+    for (int g = 0; g < numGroups; ++g) {
+      b0[g] = filters[g].b0[shelf];
+      b1[g] = filters[g].b1[shelf];
+      b2[g] = filters[g].b2[shelf];
+      a1[g] = filters[g].a1[shelf];
+      a2[g] = filters[g].a2[shelf];
+      z1[g] = filters[g].z1[shelf];
+      z2[g] = filters[g].z2[shelf];
+    }
+
+    for (int i = 0; i < n; ++i) {
+      SIMDType* block = data + i * groupsPerPass;
+      for (int g = 0; g < numGroups; ++g) {
+        const SIMDType x = block[g];
+        const SIMDType y = b0[g] * x + z1[g];
+        z1[g] = b1[g] * x - a1[g] * y + z2[g];
+        z2[g] = b2[g] * x - a2[g] * y;
+        block[g] = y;
+      }
+    }
+
+    for (int g = 0; g < numGroups; ++g) {
+      filters[g].z1[shelf] = z1[g];
+      filters[g].z2[shelf] = z2[g];
+    }
+  }
+
+  void readDelayLine(int channel, float* destination, int n)
+  {
+    const float* line = &delayLines[size_t(delayOffsets[size_t(channel)])];
+    const int pos = delayPositions[size_t(channel)];
+    const int first = jmin(n, delayLengths[size_t(channel)] - pos);
+    FloatVectorOperations::copy(destination, line + pos, first);
+    FloatVectorOperations::copy(destination + first, line, n - first);
+  }
+
+  // writes to the samples just read and moves on
+  void writeDelayLine(int channel, const float* source, int n)
+  {
+    float* line = &delayLines[size_t(delayOffsets[size_t(channel)])];
+    const int length = delayLengths[size_t(channel)];
+    int& pos = delayPositions[size_t(channel)];
+    const int first = jmin(n, length - pos);
+    FloatVectorOperations::copy(line + pos, source, first);
+    FloatVectorOperations::copy(line, source + first, n - first);
+    pos = (pos + n) % length;
+  }
+
+  // every channel gets room for its delay at the maximum delay length
+  void allocateDelayLines()
+  {
+    if (spec.sampleRate <= 0)
+      return;
+
+    const std::vector<int> longest = indexGen(fdnSize, maxDelayLength);
+    int total = 0;
+    for (int channel = 0; channel < fdnSize; ++channel) {
+      delayOffsets[size_t(channel)] = total;
+      total += primeToSamples(longest[size_t(channel)]);
+    }
+    delayLines.assign(size_t(total), 0.0f);
+    std::fill(delayLengths.begin(), delayLengths.end(), 0);
+    std::fill(delayPositions.begin(), delayPositions.end(), 0);
   }
 
   inline float channelGainConversion(int channel, float gain)
@@ -441,13 +600,19 @@ private:
   {
     indices = indexGen(fdnSize, delayLength);
 
-    for (int channel = 0; channel < fdnSize; ++channel) {
-      // update multichannel delay parameters
-      int delayLenSamples = delayLengthConversion(channel);
-      delayBufferVector[channel]->setSize(1, delayLenSamples, true, true, true);
-      if (delayPositionVector[channel] >=
-          delayBufferVector[channel]->getNumSamples())
-        delayPositionVector.set(channel, 0);
+    minDelayLength = blockLength;
+    for (int channel = 0; channel < fdnSize && !delayLines.empty(); ++channel) {
+      // update multichannel delay parameters, samples that come into use
+      // again are cleared
+      const int delayLenSamples = delayLengthConversion(channel);
+      int& length = delayLengths[size_t(channel)];
+      float* line = &delayLines[size_t(delayOffsets[size_t(channel)])];
+      if (delayLenSamples > length)
+        FloatVectorOperations::clear(line + length, delayLenSamples - length);
+      length = delayLenSamples;
+      if (delayPositions[size_t(channel)] >= length)
+        delayPositions[size_t(channel)] = 0;
+      minDelayLength = jmin(minDelayLength, length);
     }
     updateFeedBackGainVector();
     updateFilterCoefficients();
@@ -466,44 +631,49 @@ private:
     if (spec.sampleRate > 0) {
       // update shelving filter parameters
       for (int channel = 0; channel < fdnSize; ++channel) {
-        lowShelfFilters[channel]->setCoefficients(IIRCoefficients::makeLowShelf(
-          spec.sampleRate,
-          jmin(0.5 * spec.sampleRate,
-               static_cast<double>(lowShelfParameters.frequency)),
-          lowShelfParameters.q,
-          channelGainConversion(channel, lowShelfParameters.linearGain)));
-
-        highShelfFilters[channel]->setCoefficients(
+        const IIRCoefficients shelves[2] = {
           IIRCoefficients::makeHighShelf(
             spec.sampleRate,
             jmin(0.5 * spec.sampleRate,
                  static_cast<double>(highShelfParameters.frequency)),
             highShelfParameters.q,
-            channelGainConversion(channel, highShelfParameters.linearGain)));
+            channelGainConversion(channel, highShelfParameters.linearGain)),
+          IIRCoefficients::makeLowShelf(
+            spec.sampleRate,
+            jmin(0.5 * spec.sampleRate,
+                 static_cast<double>(lowShelfParameters.frequency)),
+            lowShelfParameters.q,
+            channelGainConversion(channel, lowShelfParameters.linearGain))
+        };
+
+        ShelvingFilters& filters = filterGroups[size_t(channel / lanes)];
+        const size_t lane = size_t(channel % lanes);
+        for (int shelf = 0; shelf < 2; ++shelf) {
+          const float* c = shelves[shelf].coefficients;
+          filters.b0[shelf].set(lane, c[0]);
+          filters.b1[shelf].set(lane, c[1]);
+          filters.b2[shelf].set(lane, c[2]);
+          filters.a1[shelf].set(lane, c[3]);
+          filters.a2[shelf].set(lane, c[4]);
+        }
       }
     }
   }
 
   void updateFdnSize(FdnSize newSize)
   {
-    if (fdnSize != newSize) {
-      const int diff = newSize - delayBufferVector.size();
-      if (fdnSize < newSize) {
-        for (int i = 0; i < diff; i++) {
-          delayBufferVector.add(new AudioBuffer<float>());
-          highShelfFilters.add(new IIRFilter());
-          lowShelfFilters.add(new IIRFilter());
-        }
-      } else {
-        // TODO: what happens if newSize == 0?;
-        delayBufferVector.removeLast(diff);
-        highShelfFilters.removeLast(diff);
-        lowShelfFilters.removeLast(diff);
-      }
-    }
-    delayPositionVector.resize(newSize);
+    filterGroups.resize(size_t((newSize + lanes - 1) / lanes));
+    interleaved.assign(size_t(blockLength * groupsPerPass),
+                       SIMDType::expand(0.0f));
+    delayOffsets.resize(size_t(newSize));
+    delayLengths.resize(size_t(newSize));
+    delayPositions.resize(size_t(newSize));
     feedbackGainVector.resize(newSize);
-    transferVector.resize(newSize);
+    rows.assign(size_t(newSize) * registersPerRow, SIMDType::expand(0.0f));
     fdnSize = newSize;
+
+    // the lengths are set again with the next parameter update
+    indices = indexGen(fdnSize, delayLength);
+    allocateDelayLines();
   }
 };
@@ -23,7 +23,11 @@
 #pragma once
 #include "ReferenceCountedDecoder.h"
 #include "ReferenceCountedMatrix.h"
+#include <Eigen/Dense>
 #include <JuceHeader.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 using namespace dsp;
 class MatrixMultiplication
@@ -96,45 +100,25 @@ public:
       return;
     }
 
-    auto& T = retainedCurrentMatrix->getMatrix();
-
+    // the plan is part of the matrix, so it is retained along with it
+    const auto& routing = retainedCurrentMatrix->getRoutingPlan();
     const int nInputChannels =
-      jmin(static_cast<int>(inputBlock.getNumChannels()),
-           static_cast<int>(T.getNumColumns()));
+      jmin(static_cast<int>(inputBlock.getNumChannels()), routing.numColumns);
+    const int nOutputChannels = static_cast<int>(outputBlock.getNumChannels());
     const int nSamples = static_cast<int>(inputBlock.getNumSamples());
 
-    for (int row = 0; row < T.getNumRows(); ++row) {
-      const int destCh =
-        retainedCurrentMatrix->getRoutingArrayReference().getUnchecked(row);
-      if (destCh < outputBlock.getNumChannels()) {
-        float* dest = outputBlock.getChannelPointer(destCh);
-        FloatVectorOperations::multiply(dest,
-                                        inputBlock.getChannelPointer(0),
-                                        T(row, 0),
-                                        nSamples); // first channel
-        for (int i = 1; i < nInputChannels; ++i)   // remaining channels
-          FloatVectorOperations::addWithMultiply(
-            dest, inputBlock.getChannelPointer(i), T(row, i), nSamples);
-      }
-    }
-
-    Array<int> routingCopy(retainedCurrentMatrix->getRoutingArrayReference());
-    routingCopy.sort();
-    int lastDest = -1;
-    const int nElements = routingCopy.size();
-    for (int i = 0; i < nElements; ++i) {
-      const int destCh = routingCopy[i];
-      for (; ++lastDest < destCh;)
-        if (lastDest < outputBlock.getNumChannels())
-          FloatVectorOperations::clear(outputBlock.getChannelPointer(lastDest),
-                                       (int)outputBlock.getNumSamples());
-      lastDest = destCh;
-    }
-
-    for (int ch = routingCopy.getLast() + 1; ch < outputBlock.getNumChannels();
-         ++ch)
-      FloatVectorOperations::clear(outputBlock.getChannelPointer(ch),
-                                   (int)outputBlock.getNumSamples());
+    if (routing.dense)
+      processDense(routing, inputBlock, outputBlock, nInputChannels);
+    else
+      processSparse(routing, inputBlock, outputBlock, nInputChannels);
+
+    // output channels no row is routed to
+    for (const int ch : routing.unroutedChannels)
+      if (ch < nOutputChannels)
+        FloatVectorOperations::clear(outputBlock.getChannelPointer(ch),
+                                     nSamples);
+    for (int ch = routing.numRoutedChannels; ch < nOutputChannels; ++ch)
+      FloatVectorOperations::clear(outputBlock.getChannelPointer(ch), nSamples);
   }
 
   const bool checkIfNewMatrixAvailable()
@@ -158,6 +142,11 @@ public:
     return false;
   };
 
+  /** Sets the matrix to be used from the next processed block on. It is
+   * multiplied according to its routing plan, which its setters keep up to
+   * date. Nothing is planned or allocated here, so this can be called from the
+   * audio thread.
+   */
   void setMatrix(ReferenceCountedMatrix::Ptr newMatrixToUse, bool force = false)
   {
     newMatrix = newMatrixToUse;
@@ -169,11 +158,94 @@ public:
   ReferenceCountedMatrix::Ptr getMatrix() { return currentMatrix; }
 
 private:
+  using RoutingPlan = ReferenceCountedMatrix::RoutingPlan;
+  static constexpr int tileSize = 64; // samples per dense matrix product
+
+  void processSparse(const RoutingPlan& routing,
+                     const AudioBlock<float>& inputBlock,
+                     AudioBlock<float>& outputBlock,
+                     const int nInputChannels)
+  {
+    const int nSamples = static_cast<int>(inputBlock.getNumSamples());
+
+    for (int row = 0; row < routing.numRows; ++row) {
+      const int destCh = routing.destinations[size_t(row)];
+      if (destCh >= static_cast<int>(outputBlock.getNumChannels()))
+        continue;
+
+      float* dest = outputBlock.getChannelPointer(destCh);
+      bool written = false;
+      for (int k = routing.rowStarts[size_t(row)];
+           k < routing.rowStarts[size_t(row) + 1];
+           ++k) {
+        const int col = routing.columns[size_t(k)];
+        if (col >= nInputChannels)
+          break; // columns are sorted
+        const float* source = inputBlock.getChannelPointer(col);
+        const float gain = routing.coefficients[size_t(k)];
+        if (written)
+          FloatVectorOperations::addWithMultiply(dest, source, gain, nSamples);
+        else
+          FloatVectorOperations::multiply(dest, source, gain, nSamples);
+        written = true;
+      }
+
+      if (!written)
+        FloatVectorOperations::clear(dest, nSamples);
+    }
+  }
+
+  // Multiplies tiles of tileSize samples, so inputs and outputs of a tile stay
+  // in cache.
+  void processDense(const RoutingPlan& routing,
+                    const AudioBlock<float>& inputBlock,
+                    AudioBlock<float>& outputBlock,
+                    const int nInputChannels)
+  {
+    const int nSamples = static_cast<int>(inputBlock.getNumSamples());
+    const int nOutputChannels = static_cast<int>(outputBlock.getNumChannels());
+
+    // the tiles have fixed storage, so resizing them doesn't allocate; the
+    // input rows of missing channels stay zero
+    inputTile.resize(routing.numColumns, tileSize);
+    outputTile.resize(routing.numRows, tileSize);
+    inputTile.bottomRows(routing.numColumns - nInputChannels).setZero();
+
+    for (int start = 0; start < nSamples; start += tileSize) {
+      const int n = jmin(tileSize, nSamples - start);
+      for (int col = 0; col < nInputChannels; ++col)
+        FloatVectorOperations::copy(inputTile.row(col).data(),
+                                    inputBlock.getChannelPointer(col) + start,
+                                    n);
+
+      // small enough for Eigen to keep its blocking workspace on the stack
+      outputTile.leftCols(n).noalias() =
+        routing.gains * inputTile.leftCols(n);
+
+      for (int row = 0; row < routing.numRows; ++row) {
+        const int destCh = routing.destinations[size_t(row)];
+        if (destCh < nOutputChannels) {
+          float* dest = outputBlock.getChannelPointer(destCh) + start;
+          FloatVectorOperations::copy(
+            dest, outputTile.row(row).data(), n);
+        }
+      }
+    }
+  }
+
   //==============================================================================
   ProcessSpec spec = { -1, 0, 0 };
   ReferenceCountedMatrix::Ptr currentMatrix{ nullptr };
   ReferenceCountedMatrix::Ptr newMatrix{ nullptr };
 
+  using Tile = Eigen::Matrix<float,
+                             Eigen::Dynamic,
+                             Eigen::Dynamic,
+                             Eigen::RowMajor,
+                             RoutingPlan::maxDenseChannels,
+                             tileSize>;
+  Tile inputTile, outputTile;
+
   AudioBuffer<float> buffer;
   bool bufferPrepared{ false };
 
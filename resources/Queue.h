@@ -22,6 +22,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+
 
 // A simple queue of arbitrary sample type (SampleType) with fixed numbers of samples (BufferSize).
 // A good thing to transfer data between processor and editoras it should be lock-free.
@@ -44,12 +47,8 @@ public:
         int start1, size1, start2, size2;
         abstractFifo.prepareToWrite (numSamples, start1, size1, start2, size2);
 
-        if (size1 > 0)
-            for (int i = 0; i < size1; ++i)
-                buffer[start1 + i] = samples[i];
-        if (size2 > 0)
-            for (int i = 0; i < size2; ++i)
-                buffer[i] = samples[size1 + i];
+        std::copy_n (samples, size1, buffer.begin() + start1);
+        std::copy_n (samples + size1, size2, buffer.begin());
         abstractFifo.finishedWrite (size1 + size2);
 
         return size1 + size2;
@@ -61,12 +60,8 @@ public:
         int start1, size1, start2, size2;
         abstractFifo.prepareToRead (numItems, start1, size1, start2, size2);
 
-        if (size1 > 0)
-            for (int i = 0; i < size1; ++i)
-                outputBuffer[i] = buffer[start1 + i];
-        if (size2 > 0)
-            for (int i = 0; i < size2; ++i)
-                outputBuffer[start1 + i] = buffer[i];
+        std::copy_n (buffer.begin() + start1, size1, outputBuffer);
+        std::copy_n (buffer.begin(), size2, outputBuffer + size1);
 
         abstractFifo.finishedRead (size1 + size2);
 
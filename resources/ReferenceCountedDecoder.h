@@ -115,6 +115,7 @@ public:
                     for (int j = 0; j < matrix.getNumRows(); ++j)
                         matrix(j,i) = matrix(j,i) / getInPhaseLUT(order)[i];
             settings.weightsAlreadyApplied = false;
+            updateRoutingPlan();
         }
     }
 
@@ -21,6 +21,10 @@
  */
 
 #pragma once
+#include <Eigen/Dense>
+#include <algorithm>
+#include <vector>
+
 using namespace dsp;
 class ReferenceCountedMatrix : public ReferenceCountedObject
 {
@@ -34,6 +38,8 @@ public:
         for (int i = 0; i < rows; ++i)
             routingArray.add(i);
 
+        updateRoutingPlan();
+
         DBG (getConstructorMessage());
     }
 
@@ -52,10 +58,22 @@ public:
         return "Matrix named '" + name + "' destroyed.";
     }
 
-    Matrix<float>& getMatrix()
+    const Matrix<float>& getMatrix() const
     {
         return matrix;
     }
+
+    /** Replaces the matrix elements (the size is fixed at construction) and
+        replans the routing, which allocates: don't call it on the audio thread.
+     */
+    void setMatrix (const Matrix<float>& newMatrix)
+    {
+        jassert (newMatrix.getNumRows() == matrix.getNumRows()
+                 && newMatrix.getNumColumns() == matrix.getNumColumns());
+        matrix = newMatrix;
+        updateRoutingPlan();
+    }
+
     const String getName()
     {
         return name;
@@ -83,16 +101,107 @@ public:
         return (int) matrix.getNumColumns();
     }
 
-    Array<int>& getRoutingArrayReference()
+    const Array<int>& getRoutingArrayReference() const
     {
         return routingArray;
     }
 
+    /** Sets the output channel of every row and replans the routing, like
+        setMatrix().
+     */
+    void setRoutingArray (const Array<int>& newRoutingArray)
+    {
+        jassert (newRoutingArray.size() == routingArray.size());
+        routingArray = newRoutingArray;
+        updateRoutingPlan();
+    }
+
+    /** How MatrixMultiplication applies the matrix: the output channel of every
+        row, the non-zero coefficients in compressed sparse row format, and all
+        coefficients for matrices dense enough to be multiplied as a whole.
+     */
+    struct RoutingPlan
+    {
+        // Matrices with at least this share of non-zero coefficients and at
+        // least minDenseSize coefficients (and not more than maxDenseChannels
+        // rows and columns) are multiplied as dense matrices.
+        static constexpr float denseThreshold = 0.5f;
+        static constexpr int minDenseSize = 256;
+        static constexpr int maxDenseChannels = 64;
+
+        int numRows = 0;
+        int numColumns = 0;
+        std::vector<int> destinations;
+
+        std::vector<int> rowStarts;
+        std::vector<int> columns;
+        std::vector<float> coefficients;
+
+        // channels below numRoutedChannels that no row is routed to
+        std::vector<int> unroutedChannels;
+        int numRoutedChannels = 0;
+
+        bool dense = false;
+        Eigen::MatrixXf gains;
+    };
+
+    const RoutingPlan& getRoutingPlan() const
+    {
+        return routingPlan;
+    }
+
 
 protected:
+    /** Plans the routing from the current matrix elements and routing array.
+        This allocates, so it is done by the setters (and by subclasses that
+        change either of them), before the matrix is handed to the audio
+        thread.
+     */
+    void updateRoutingPlan()
+    {
+        RoutingPlan p;
+        p.numRows = static_cast<int> (matrix.getNumRows());
+        p.numColumns = static_cast<int> (matrix.getNumColumns());
+
+        p.rowStarts.push_back (0);
+        for (int row = 0; row < p.numRows; ++row)
+        {
+            p.destinations.push_back (routingArray[row]);
+            for (int col = 0; col < p.numColumns; ++col)
+                if (matrix (row, col) != 0.0f)
+                {
+                    p.columns.push_back (col);
+                    p.coefficients.push_back (matrix (row, col));
+                }
+            p.rowStarts.push_back (static_cast<int> (p.columns.size()));
+        }
+
+        for (const int destCh : p.destinations)
+            p.numRoutedChannels = jmax (p.numRoutedChannels, destCh + 1);
+        for (int ch = 0; ch < p.numRoutedChannels; ++ch)
+            if (std::find (p.destinations.begin(), p.destinations.end(), ch) == p.destinations.end())
+                p.unroutedChannels.push_back (ch);
+
+        const int size = p.numRows * p.numColumns;
+        p.dense = size >= RoutingPlan::minDenseSize
+                    && p.numRows <= RoutingPlan::maxDenseChannels
+                    && p.numColumns <= RoutingPlan::maxDenseChannels
+                    && static_cast<float> (p.columns.size()) >= RoutingPlan::denseThreshold * size;
+        if (p.dense)
+        {
+            p.gains.resize (p.numRows, p.numColumns);
+            for (int row = 0; row < p.numRows; ++row)
+                for (int col = 0; col < p.numColumns; ++col)
+                    p.gains (row, col) = matrix (row, col);
+        }
+
+        routingPlan = std::move (p);
+    }
+
     String name;
     String description;
     Matrix<float> matrix;
     Array<int> routingArray;
+    RoutingPlan routingPlan;
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReferenceCountedMatrix)
 };
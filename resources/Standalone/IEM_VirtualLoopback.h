@@ -0,0 +1,347 @@
+/*
+ ==============================================================================
+ This file is part of the IEM plug-in suite.
+ Authors: Fabian Hummel, David Neussl
+ Copyright (c) 2020 - Institute of Electronic Music and Acoustics (IEM)
+ https://iem.at
+
+ The IEM plug-in suite is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ The IEM plug-in suite is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this software.  If not, see <https://www.gnu.org/licenses/>.
+ ==============================================================================
+ */
+
+#pragma once
+
+namespace iem
+{
+
+/**
+    A virtual audio device that routes all outputs back to the inputs, for
+    profiling and testing the standalone without audio hardware.
+
+    Every output channel is convolved with an impulse response, summed, delayed
+    by the round-trip latency and mixed with noise, like a microphone in a room.
+    The result is fed to all input channels. The device either runs clocked at
+    real time (counting an xrun whenever a callback misses its deadline) or as
+    fast as the callback allows.
+
+    It is configured through environment variables, read when it is opened, so
+    headless jobs don't need any UI:
+        IEM_LOOPBACK_IR         audio file with one IR per output (channels are
+                                reused cyclically), default: unit impulse
+        IEM_LOOPBACK_LATENCY    round trip in samples, default: 1024
+        IEM_LOOPBACK_NOISE_DB   noise RMS in dBFS, default: -90
+*/
+class VirtualLoopbackAudioIODevice  : public AudioIODevice,
+                                      private Thread
+{
+public:
+    static constexpr int numChannels = 64;
+
+    VirtualLoopbackAudioIODevice (const String& deviceName, const String& typeName, bool clockedAtRealTime)
+        : AudioIODevice (deviceName, typeName),
+          Thread ("Virtual Loopback"),
+          realTime (clockedAtRealTime)
+    {
+    }
+
+    ~VirtualLoopbackAudioIODevice() override
+    {
+        close();
+    }
+
+    StringArray getOutputChannelNames() override        { return getChannelNames ("Output "); }
+    StringArray getInputChannelNames() override         { return getChannelNames ("Input "); }
+    Array<double> getAvailableSampleRates() override    { return { 44100.0, 48000.0, 88200.0, 96000.0 }; }
+    Array<int> getAvailableBufferSizes() override       { return { 32, 64, 128, 256, 512, 1024, 2048 }; }
+    int getDefaultBufferSize() override                 { return 512; }
+
+    String open (const BigInteger& inputChannels, const BigInteger& outputChannels,
+                 double newSampleRate, int newBufferSize) override
+    {
+        close();
+
+        sampleRate = newSampleRate > 0 ? newSampleRate : 48000.0;
+        bufferSize = newBufferSize > 0 ? newBufferSize : getDefaultBufferSize();
+        activeInputChannels = inputChannels.getBitRange (0, numChannels);
+        activeOutputChannels = outputChannels.getBitRange (0, numChannels);
+
+        lastError = prepareRoom();
+        if (lastError.isNotEmpty())
+            return lastError;
+
+        inputBuffer.setSize (activeInputChannels.countNumberOfSetBits(), bufferSize);
+        outputBuffer.setSize (activeOutputChannels.countNumberOfSetBits(), bufferSize);
+        microphone.setSize (1, bufferSize);
+        xruns = 0;
+        deviceIsOpen = true;
+        return {};
+    }
+
+    void close() override
+    {
+        stop();
+        deviceIsOpen = false;
+        convolutions.clear();
+    }
+
+    void start (AudioIODeviceCallback* newCallback) override
+    {
+        if (! deviceIsOpen || newCallback == nullptr || newCallback == callback)
+            return;
+
+        stop();
+        newCallback->audioDeviceAboutToStart (this);
+        {
+            const ScopedLock sl (callbackLock);
+            callback = newCallback;
+        }
+        startThread();
+    }
+
+    void stop() override
+    {
+        stopThread (2000);
+
+        AudioIODeviceCallback* oldCallback;
+        {
+            const ScopedLock sl (callbackLock);
+            oldCallback = callback;
+            callback = nullptr;
+        }
+        if (oldCallback != nullptr)
+            oldCallback->audioDeviceStopped();
+    }
+
+    bool isOpen() override                              { return deviceIsOpen; }
+    bool isPlaying() override                           { return callback != nullptr; }
+    String getLastError() override                      { return lastError; }
+    int getCurrentBufferSizeSamples() override          { return bufferSize; }
+    double getCurrentSampleRate() override              { return sampleRate; }
+    int getCurrentBitDepth() override                   { return 32; }
+    BigInteger getActiveOutputChannels() const override { return activeOutputChannels; }
+    BigInteger getActiveInputChannels() const override  { return activeInputChannels; }
+    int getOutputLatencyInSamples() override            { return latency; }
+    int getInputLatencyInSamples() override            { return 0; }
+    int getXRunCount() const noexcept override          { return xruns; }
+
+private:
+    static StringArray getChannelNames (const String& prefix)
+    {
+        StringArray names;
+        for (int i = 1; i <= numChannels; ++i)
+            names.add (prefix + String (i));
+        return names;
+    }
+
+    String prepareRoom()
+    {
+        const auto environment = [] (const char* name) { return SystemStats::getEnvironmentVariable (name, {}); };
+
+        const auto latencyText = environment ("IEM_LOOPBACK_LATENCY");
+        latency = jmax (bufferSize, latencyText.isNotEmpty() ? latencyText.getIntValue() : 1024);
+        const auto noiseText = environment ("IEM_LOOPBACK_NOISE_DB");
+        noiseGain = Decibels::decibelsToGain (noiseText.isNotEmpty() ? noiseText.getFloatValue() : -90.0f, -200.0f);
+
+        // Unit impulse unless a file is given:
+        AudioBuffer<float> responses (1, 1);
+        responses.setSample (0, 0, 1.0f);
+        auto responseSampleRate = sampleRate;
+
+        const auto path = environment ("IEM_LOOPBACK_IR");
+        if (path.isNotEmpty())
+        {
+            AudioFormatManager formats;
+            formats.registerBasicFormats();
+            std::unique_ptr<AudioFormatReader> reader (formats.createReaderFor (File (path)));
+            if (reader == nullptr)
+                return "Could not read loopback IR " + path;
+
+            responses.setSize ((int) reader->numChannels, (int) reader->lengthInSamples);
+            reader->read (&responses, 0, (int) reader->lengthInSamples, 0, true, true);
+            responseSampleRate = reader->sampleRate;
+        }
+
+        // The first block of latency comes from feeding the outputs back as the next
+        // input block, the rest is a delay line:
+        delayLine.setSize (1, latency);
+        delayLine.clear();
+        delayPosition = 0;
+
+        const dsp::ProcessSpec spec { sampleRate, (uint32) bufferSize, 1 };
+        for (int output = 0; output < activeOutputChannels.countNumberOfSetBits(); ++output)
+        {
+            AudioBuffer<float> response (1, responses.getNumSamples());
+            response.copyFrom (0, 0, responses, output % responses.getNumChannels(), 0, responses.getNumSamples());
+
+            auto convolution = std::make_unique<dsp::Convolution>();
+            convolution->prepare (spec);
+            convolution->loadImpulseResponse (std::move (response), responseSampleRate,
+                                              dsp::Convolution::Stereo::no,
+                                              dsp::Convolution::Trim::no,
+                                              dsp::Convolution::Normalise::no);
+            convolutions.push_back (std::move (convolution));
+        }
+        return waitForImpulseResponses() ? String() : "Timeout while loading the loopback IR";
+    }
+
+    // IRs are loaded in the background. Processing silence until all of them have
+    // arrived keeps the first measurement deterministic:
+    bool waitForImpulseResponses()
+    {
+        AudioBuffer<float> silence (1, bufferSize);
+        const auto timeout = Time::getMillisecondCounter() + 10000;
+
+        for (auto& convolution : convolutions)
+        {
+            while (convolution->getCurrentIRSize() == 0)
+            {
+                if (Time::getMillisecondCounter() > timeout)
+                    return false;
+
+                silence.clear();
+                dsp::AudioBlock<float> block (silence);
+                convolution->process (dsp::ProcessContextReplacing<float> (block));
+                Thread::sleep (1);
+            }
+            convolution->reset();
+        }
+        return true;
+    }
+
+    void run() override
+    {
+        const auto blockDurationMs = 1000.0 * bufferSize / sampleRate;
+        auto deadline = Time::getMillisecondCounterHiRes() + blockDurationMs;
+
+        while (! threadShouldExit())
+        {
+            processBlock();
+
+            if (! realTime)
+                continue;
+
+            const auto now = Time::getMillisecondCounterHiRes();
+            if (now > deadline)
+            {
+                // The callback took longer than a block:
+                ++xruns;
+                deadline = now;
+            }
+            else
+            {
+                while (deadline - Time::getMillisecondCounterHiRes() > 2.0 && ! threadShouldExit())
+                    Thread::sleep (1);
+                while (Time::getMillisecondCounterHiRes() < deadline)
+                    Thread::yield();
+            }
+            deadline += blockDurationMs;
+        }
+    }
+
+    void processBlock()
+    {
+        // The microphone signal computed in the last round goes to all inputs:
+        for (int channel = 0; channel < inputBuffer.getNumChannels(); ++channel)
+            inputBuffer.copyFrom (channel, 0, microphone, 0, 0, bufferSize);
+        outputBuffer.clear();
+
+        {
+            const ScopedLock sl (callbackLock);
+            if (callback == nullptr)
+                return;
+
+            callback->audioDeviceIOCallback (const_cast<const float**> (inputBuffer.getArrayOfReadPointers()), inputBuffer.getNumChannels(),
+                                             const_cast<float**> (outputBuffer.getArrayOfWritePointers()), outputBuffer.getNumChannels(),
+                                             bufferSize);
+        }
+
+        // Room: convolve and sum all outputs, in place in the output buffer:
+        microphone.clear();
+        for (int output = 0; output < outputBuffer.getNumChannels(); ++output)
+        {
+            auto block = dsp::AudioBlock<float> (outputBuffer).getSingleChannelBlock ((size_t) output);
+            convolutions[(size_t) output]->process (dsp::ProcessContextReplacing<float> (block));
+            microphone.addFrom (0, 0, outputBuffer, output, 0, bufferSize);
+        }
+
+        // Latency beyond the first block, then noise:
+        const auto delay = latency - bufferSize;
+        auto* mic = microphone.getWritePointer (0);
+        auto* line = delayLine.getWritePointer (0);
+        for (int i = 0; i < bufferSize; ++i)
+        {
+            if (delay > 0)
+            {
+                const auto delayed = line[delayPosition];
+                line[delayPosition] = mic[i];
+                delayPosition = (delayPosition + 1) % delay;
+                mic[i] = delayed;
+            }
+            mic[i] += noiseGain * 1.7320508f * (2.0f * random.nextFloat() - 1.0f); // uniform with the given RMS
+        }
+    }
+
+    const bool realTime;
+    bool deviceIsOpen = false;
+    String lastError;
+    double sampleRate = 48000.0;
+    int bufferSize = 512;
+    int latency = 1024;
+    float noiseGain = 0.0f;
+    BigInteger activeInputChannels, activeOutputChannels;
+
+    CriticalSection callbackLock;
+    AudioIODeviceCallback* callback = nullptr;
+    std::atomic<int> xruns { 0 };
+
+    AudioBuffer<float> inputBuffer, outputBuffer, microphone, delayLine;
+    int delayPosition = 0;
+    std::vector<std::unique_ptr<dsp::Convolution>> convolutions;
+    Random random { 1 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VirtualLoopbackAudioIODevice)
+};
+
+//==============================================================================
+class VirtualLoopbackAudioIODeviceType  : public AudioIODeviceType
+{
+public:
+    VirtualLoopbackAudioIODeviceType() : AudioIODeviceType ("Virtual Loopback") {}
+
+    void scanForDevices() override {}
+    StringArray getDeviceNames (bool /* wantInputNames */) const override   { return { realTimeName, fastName }; }
+    int getDefaultDeviceIndex (bool /* forInput */) const override          { return 0; }
+    bool hasSeparateInputsAndOutputs() const override                       { return false; }
+
+    int getIndexOfDevice (AudioIODevice* device, bool /* asInput */) const override
+    {
+        return device != nullptr ? getDeviceNames (false).indexOf (device->getName()) : -1;
+    }
+
+    AudioIODevice* createDevice (const String& outputDeviceName, const String& inputDeviceName) override
+    {
+        const auto name = outputDeviceName.isNotEmpty() ? outputDeviceName : inputDeviceName;
+        if (name == realTimeName || name == fastName)
+            return new VirtualLoopbackAudioIODevice (name, getTypeName(), name == realTimeName);
+        return nullptr;
+    }
+
+private:
+    static constexpr const char* realTimeName = "Loopback (real time)";
+    static constexpr const char* fastName = "Loopback (as fast as possible)";
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (VirtualLoopbackAudioIODeviceType)
+};
+
+} // namespace iem
@@ -68,6 +68,10 @@
     #include "IEM_JackAudio.h"
 #endif
 
+#if JUCE_MODULE_AVAILABLE_juce_dsp
+    #include "IEM_VirtualLoopback.h"
+#endif
+
 #if JUCE_MODULE_AVAILABLE_juce_audio_plugin_client
 extern juce::AudioProcessor* JUCE_API JUCE_CALLTYPE createPluginFilterOfType (juce::AudioProcessor::WrapperType type);
 #endif
@@ -136,6 +140,9 @@ public:
 
         deviceManager.addAudioDeviceType (std::make_unique<iem::JackAudioIODeviceType> ());
 #endif
+#if JUCE_MODULE_AVAILABLE_juce_dsp
+        deviceManager.addAudioDeviceType (std::make_unique<iem::VirtualLoopbackAudioIODeviceType> ());
+#endif
 
         auto inChannels = (channelConfiguration.size() > 0 ? channelConfiguration[0].numIns
                                                            : processor->getMainBusNumInputChannels());